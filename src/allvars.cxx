@@ -7,6 +7,17 @@
 //-- Structures and external variables
 ///external pointer to keep track of structure levels and parent
 StrucLevelData *psldata;
+///potentials read from the input sorted by particle id, empty unless \ref UnbindInfo.iinputpotential is set
+vector<input_potential> inputpotentials;
+
+///\name OpenMP and potential calculation thresholds, see \ref OMPLIMS and \ref SetOpenMPThresholds
+//@{
+Int_t ompsplitsubsearchnum=OMPDEFAULTSPLITSUBSEARCHNUM, ompsubsearchnum=OMPDEFAULTSUBSEARCHNUM;
+Int_t ompsearchnum=OMPDEFAULTSEARCHNUM, ompunbindnum=OMPDEFAULTUNBINDNUM;
+Int_t ompperiodnum=OMPDEFAULTPERIODNUM, omppropnum=OMPDEFAULTPROPNUM;
+Int_t ompfofsearchnum=OMPDEFAULTFOFSEARCHNUM, ompsortsize=OMPDEFAULTSORTSIZE;
+Int_t potppcalcnum=POTDEFAULTPPCALCNUM, potompcalcnum=POTDEFAULTOMPCALCNUM;
+//@}
 
 
 ///\name define routines for the HeaderUnitInfo
@@ -18,6 +18,7 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstddef>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
@@ -30,6 +31,8 @@
 #include <map>
 #include <unordered_map>
 #include <bitset>
+#include <atomic>
+#include <functional>
 #include <getopt.h>
 #include <sys/stat.h>
 #include <sys/timeb.h>
@@ -62,6 +65,7 @@
 #include <omp.h>
 #endif
 #include "ompvar.h"
+#include "fixedmatrix.h"
 
 ///if using HDF API
 #ifdef USEHDF
@@ -189,6 +193,16 @@ using namespace NBody;
 
 //@}
 
+///\defgroup SFCTYPES Space filling curve used to order particles after loading
+//@{
+///keep input order
+#define SFCNONE 0
+///Morton (Z-order) curve
+#define SFCMORTON 1
+///Hilbert curve
+#define SFCHILBERT 2
+//@}
+
 ///\defgroup INPUTTYPES defining types of input
 //@{
 #define  NUMINPUTS 5
@@ -239,11 +253,35 @@ typedef double (*ExtraPropFunc)(double, double, double&);
 ///number below which just use PP calculation for potential, which occurs roughly at when n~2*log(n) (from scaling of n^2 vs n ln(n) for PP vs tree and factor of 2 is
 ///for extra overhead in producing tree. For reasonable values of n (>100) this occurs at ~100. Here to account for extra memory need for tree, we use n=3*log(n) or 150
 #define UNBINDNUM 150
-#define POTPPCALCNUM 150
-#define POTOMPCALCNUM 1000
+///default number below which the PP potential calculation is used and above which the potential calculation is run with OpenMP,
+///the values used being \ref potppcalcnum and \ref potompcalcnum, set at start up (see \ref SetOpenMPThresholds)
+#define POTDEFAULTPPCALCNUM 150
+#define POTDEFAULTOMPCALCNUM 1000
+extern Int_t potppcalcnum, potompcalcnum;
+///number of unbound particles above which their contribution is removed from the potential of a group using a tree of the unbound particles
+#define UNBINDSOURCETREENUM 2048
+///number of source particles per tile in direct potential summation, so that a tile of packed positions and masses stays in L1 cache
+#define POTPPTILE 256
+///size of the fixed traversal stack of single point FMM tree walks, deeper (unbalanced) trees spill onto the heap
+#define FMMWALKSTACKSIZE 128
 ///diferent methods for calculating approximate potential
 #define POTAPPROXMETHODTREE 0
 #define POTAPPROXMETHODRAND 1
+///different methods for calculating the potential with a tree, a Barnes-Hut monopole tree walk per particle, a dual tree fast multipole method
+///or a Barnes-Hut tree walk per leaf shared by the particles in the leaf
+#define POTMETHODTREE 0
+#define POTMETHODFMM 1
+#define POTMETHODTREEGROUP 2
+///corrections applied to potentials read from the input to recover the self-potential of a group, none, subtracting a constant
+///external potential or subtracting an external potential with a constant gradient, either fit at a sample of the group members
+#define POTINPUTCORRNONE 0
+#define POTINPUTCORRCONST 1
+#define POTINPUTCORRLINEAR 2
+///working precision of the direct sums in the potential calculation, double precision, single precision with positions
+///relative to the group and sums accumulated in double precision, or single precision validated against double precision
+#define POTPRECDOUBLE 0
+#define POTPRECMIXED 1
+#define POTPRECVALIDATE 2
 
 ///when unbinding check to see if system is bound and least bound particle is also bound
 #define USYSANDPART 0
@@ -358,6 +396,26 @@ struct UnbindInfo
     Double_t approxpotminnum;
     ///method of subsampling to calculate potential
     int approxpotmethod;
+    ///if >0, the subsample of each group is refined until the rms relative error of the potential of probe particles is below this value
+    Double_t approxpotrelerr;
+    ///number of probe particles at which the exact potential is calculated to estimate the error of the approximate potential
+    int approxpotnumprobe;
+    ///method of calculating the potential of large groups, see \ref POTMETHODTREE
+    int potmethod;
+    ///order of the fast multipole expansion, 1 for monopole and 2 for quadrupole
+    int fmmorder;
+    ///opening angle of the fast multipole method, cells are well separated if the sum of their sizes < angle times their separation
+    Double_t FMMThetaOpen;
+    ///working precision of the potential calculation, see \ref POTPRECDOUBLE
+    int potprecision;
+    ///whether to use the potentials stored in the input rather than calculating them
+    int iinputpotential;
+    ///correction used to remove the external potential from input potentials, see \ref POTINPUTCORRNONE
+    int inputpotcorrection;
+    ///number of group members at which the self-potential is directly calculated to fit the external potential
+    Int_t inputpotnumsample;
+    ///factor converting the specific potential in the input to velocity units squared
+    Double_t inputpotconversion;
     //@}
     UnbindInfo(){
         icalculatepotential=true;
@@ -380,6 +438,16 @@ struct UnbindInfo
         approxpotnumfrac = 0.1;
         approxpotminnum = 5000;
         approxpotmethod = POTAPPROXMETHODTREE;
+        approxpotrelerr = 0;
+        approxpotnumprobe = 64;
+        potmethod = POTMETHODTREE;
+        fmmorder = 2;
+        FMMThetaOpen = 0.35;
+        potprecision = POTPRECDOUBLE;
+        iinputpotential = 0;
+        inputpotcorrection = POTINPUTCORRLINEAR;
+        inputpotnumsample = 32;
+        inputpotconversion = 1.0;
     }
 };
 
@@ -469,10 +537,17 @@ struct Options
     /// is this to ^3
     int mpinumtoplevelcells;
 
-    /// run FOF using OpenMP
+    /// run FOF using OpenMP, see \ref OMPFOFTYPES
     int iopenmpfof;
     /// size of openmp FOF region
     int openmpfofsize;
+    /// OpenMP thresholds (see \ref OMPLIMS) set in the config, a value < 0 uses the default or calibrated value
+    Int_t ompsplitsubsearchnumset, ompsubsearchnumset, ompsearchnumset, ompunbindnumset;
+    Int_t ompperiodnumset, omppropnumset, ompfofsearchnumset, ompsortsizeset, potompcalcnumset;
+    /// maximum number of particles for which the potential is calculated with a PP calculation, < 0 uses the default value
+    Int_t potppcalcnumset;
+    /// calibrate the OpenMP thresholds not set in the config with short benchmarks at start up
+    int iompcalibrate;
 
     ///\name length,m,v,grav conversion units
     //@{
@@ -504,6 +579,10 @@ struct Options
     int Nvel, Nsearch, Bsize;
     Int_t Ncell;
     Double_t Ncellfac;
+    ///derive the background grid of a substructure from the grid cells of its parent when it is well resolved by them
+    int iincrementalbg;
+    ///minimum number of parent cells with at least \ref MINCELLSIZE particles of a substructure for the parent grid to be used
+    int incrementalbgmincells;
     //@}
     ///minimum group size
     int MinSize;
@@ -516,6 +595,14 @@ struct Options
     int iSubSearch;
     ///type of search
     int foftype,fofbgtype;
+    ///use cell-linked-list 3D FOF search of the full particle list rather than tree based search
+    int iFOFgrid;
+    ///use inlined versions of the stream and 6d FOF criteria in substructure searches rather than calling them through function pointers
+    int iFOFspecialised;
+    ///space filling curve along which particles are ordered after loading, see \ref SFCTYPES
+    int iSFCorder;
+    ///base name of the group array file (see \ref WriteFOF) of a previous snapshot used to warm start the 3D FOF search
+    char *warmstartname;
     ///grid type, physical, physical+entropy splitting criterion, phase+entropy splitting criterion. Note that this parameter should not be changed from the default value
     int gridtype;
     ///flag indicating search all particle types or just dark matter
@@ -947,6 +1034,8 @@ struct Options
     unsigned long long memuse_ave;
     int memuse_nsamples;
     bool memuse_log;
+    ///peak memory used by the arenas holding the per sublevel bookkeeping of the substructure search
+    unsigned long long memuse_arenapeak;
     //@}
 
     //silly flag to store whether input has little h's in it.
@@ -995,6 +1084,8 @@ struct Options
         Nvel=32;
         Nsearch=256;
         Ncellfac=0.01;
+        iincrementalbg=0;
+        incrementalbgmincells=32;
 
         iSubSearch=1;
         partsearchtype=PSTALL;
@@ -1002,6 +1093,10 @@ struct Options
         foftype=FOFSTPROB;
         gridtype=PHYSENGRID;
         fofbgtype=FOF6D;
+        iFOFgrid=0;
+        iFOFspecialised=0;
+        iSFCorder=SFCNONE;
+        warmstartname=NULL;
         idenvflag=0;
         iBaryonSearch=0;
         icmrefadjust=1;
@@ -1149,9 +1244,15 @@ struct Options
         profilenbins=0;
         profileminsize = profileminFOFsize = 0;
 #ifdef USEOPENMP
-        iopenmpfof = 1;
-        openmpfofsize = ompfofsearchnum;
+        iopenmpfof = OMPFOFDOMAIN;
+#else
+        iopenmpfof = OMPFOFNONE;
 #endif
+        openmpfofsize = OMPDEFAULTFOFSEARCHNUM;
+        ompsplitsubsearchnumset = ompsubsearchnumset = ompsearchnumset = ompunbindnumset = -1;
+        ompperiodnumset = omppropnumset = ompfofsearchnumset = ompsortsizeset = potompcalcnumset = -1;
+        potppcalcnumset = -1;
+        iompcalibrate = 0;
 
         iontheflyfinding = false;
 
@@ -1159,6 +1260,7 @@ struct Options
         memuse_ave = 0;
         memuse_nsamples = 0;
         memuse_log = false;
+        memuse_arenapeak = 0;
 
         inputcontainslittleh = true;
 
@@ -3152,6 +3254,163 @@ struct leaf_node_info{
 #endif
 };
 
+///Key of a particle and its index, used to select or sort particles by some property without moving the particles themselves
+struct particle_key_index{
+    Double_t key;
+    Int_t index;
+};
+
+///Simulation id of a particle and its specific potential read from the input, sorted by id to look up the potentials of group members (see \ref StoreInputPotentials)
+struct input_potential{
+    long long pid;
+    Double_t pot;
+};
+
+/*!
+    Cell of the tree used by the fast multipole potential calculation (see \ref PotentialFMM).
+    Stores the multipole moments about the centre of mass and the local expansion of the potential
+    about the same point, with symmetric tensors stored as xx,xy,xz,yy,yz,zz.
+*/
+struct FMMCell{
+    ///particles in the cell, in tree order
+    Int_t start, end;
+    ///index of child cells, -1 if a leaf
+    Int_t left, right;
+    ///mass and maximum distance of a particle from the centre of mass
+    Double_t mass, rmax;
+    Double_t cm[3];
+    ///second moment of the mass distribution about cm
+    Double_t quad[6];
+    ///local expansion, potential, its gradient and its hessian at cm
+    Double_t L0, L1[3], L2[6];
+};
+
+/*!
+    Disjoint set (union-find) over indices that can be updated concurrently by several threads.
+    Roots are joined with compare and swap, always linking the root with the larger index to the root
+    with the smaller index so no cycles can form, and paths are compressed by halving.
+*/
+struct DisjointSet{
+    vector<atomic<Int_t>> parent;
+
+    DisjointSet(Int_t n=0) : parent(n) {
+        for (Int_t i=0;i<n;i++) parent[i].store(i, memory_order_relaxed);
+    }
+    ///find root of index
+    inline Int_t Root(Int_t i) {
+        Int_t p, gp;
+        while (true) {
+            p = parent[i].load(memory_order_relaxed);
+            if (p == i) return i;
+            gp = parent[p].load(memory_order_relaxed);
+            if (p != gp) parent[i].compare_exchange_weak(p, gp, memory_order_relaxed);
+            i = gp;
+        }
+    }
+    ///join the sets containing the two indices
+    inline void Link(Int_t i, Int_t j) {
+        Int_t expected;
+        while (true) {
+            i = Root(i);
+            j = Root(j);
+            if (i == j) return;
+            if (i < j) swap(i, j);
+            expected = i;
+            if (parent[i].compare_exchange_strong(expected, j, memory_order_relaxed)) return;
+        }
+    }
+    ///attach an index that has not been linked to anything to the set containing j, only the first attachment succeeds.
+    ///As nothing is ever linked to i, this cannot join sets through i
+    inline void Attach(Int_t i, Int_t j) {
+        Int_t expected = i;
+        parent[i].compare_exchange_strong(expected, j, memory_order_relaxed);
+    }
+};
+
+/*!
+    Bump (arena) allocator for short lived bookkeeping arrays of plain data.
+    Memory is handed out from large blocks by advancing an offset and is only returned all at once with \ref Reset,
+    which keeps the blocks for reuse, or \ref Free. The peak number of bytes in use is kept in highwater.
+    An arena is not thread safe, each thread should allocate from its own arena.
+*/
+struct MemoryArena{
+    vector<char *> blocks;
+    vector<size_t> blocksizes;
+    ///minimum size of a block, current block and offset within it
+    size_t minblocksize, iblock, offset;
+    ///bytes currently handed out and peak since construction
+    size_t used, highwater;
+
+    MemoryArena(size_t blocksize=1048576){
+        minblocksize = blocksize;
+        iblock = offset = used = highwater = 0;
+    }
+    MemoryArena(const MemoryArena &)=delete;
+    MemoryArena &operator=(const MemoryArena &)=delete;
+    ~MemoryArena(){Free();}
+
+    ///return uninitialised memory for n elements of type T, aligned for any fundamental type
+    template<typename T> T *Allocate(size_t n){
+        const size_t align = alignof(max_align_t);
+        size_t nbytes = (n*sizeof(T) + align - 1) & ~(align - 1);
+        char *p;
+        if (nbytes == 0) nbytes = align;
+        while (iblock < blocks.size() && offset + nbytes > blocksizes[iblock]) {iblock++; offset = 0;}
+        if (iblock == blocks.size()) {
+            size_t blocksize = max(minblocksize, nbytes);
+            blocks.push_back(new char[blocksize]);
+            blocksizes.push_back(blocksize);
+            offset = 0;
+        }
+        p = blocks[iblock] + offset;
+        offset += nbytes;
+        used += nbytes;
+        if (used > highwater) highwater = used;
+        return reinterpret_cast<T *>(p);
+    }
+    ///release everything allocated in one step, keeping the blocks for subsequent allocations
+    void Reset(){
+        iblock = offset = used = 0;
+    }
+    ///release everything and free the blocks
+    void Free(){
+        for (auto &b:blocks) delete[] b;
+        vector<char *>().swap(blocks);
+        vector<size_t>().swap(blocksizes);
+        Reset();
+    }
+};
+
+///Uniform grid used by the cell-linked-list FOF search (see \ref fofgrid.cxx). Only occupied cells are stored, sorted by key
+struct FOFGrid{
+    ///number of cells in each dimension
+    unsigned long long ncells[3];
+    ///cell size and lower boundary of the grid in each dimension
+    Double_t cellsize[3], xmin[3];
+    ///period of the grid, 0 if not periodic
+    Double_t period;
+    ///whether the cell diagonal is within the linking length so that all particles in a cell are linked
+    bool iautolink;
+    ///keys of occupied cells along with the offset into and number of particles in the index array
+    vector<unsigned long long> cellkey;
+    vector<Int_t> celloffset, cellcount;
+    ///particle indices ordered by cell
+    vector<Int_t> index;
+
+    FOFGrid(){
+        period = 0;
+        iautolink = false;
+        for (int k=0;k<3;k++) {ncells[k] = 0; cellsize[k] = xmin[k] = 0;}
+    }
+    ///free memory
+    void Clear(){
+        vector<unsigned long long>().swap(cellkey);
+        vector<Int_t>().swap(celloffset);
+        vector<Int_t>().swap(cellcount);
+        vector<Int_t>().swap(index);
+    }
+};
+
 ///if using MPI API
 #ifdef USEMPI
 #include <mpi.h>
@@ -3160,5 +3419,6 @@ struct leaf_node_info{
 #endif
 
 extern StrucLevelData *psldata;
+extern vector<input_potential> inputpotentials;
 
 #endif
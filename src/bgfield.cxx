@@ -139,6 +139,59 @@ void FillTreeGrid(Options &opt, const Int_t nbodies, const Int_t ngrid, KDTree *
     if (opt.iverbose>=2) cout<<"Done."<<endl;
 }
 
+/*!
+    Fills the GridCell struct of a substructure using the cells of its parent structure.
+    parentcell stores the index of the parent cell containing each particle (-1 if none). The particles of a parent cell
+    form a cell if there are at least \ref MINCELLSIZE of them, ensuring the same Poisson noise as the cells built with \ref InitializeTreeGrid.
+    The remaining particles are not in any cell, their background being interpolated from the nearest cells as for any other particle.
+    If fewer than \ref Options.incrementalbgmincells cells can be formed, the substructure is not well resolved by the parent's cells,
+    no grid is allocated and 0 is returned.
+*/
+Int_t FillTreeGridFromParent(Options &opt, const Int_t nbodies, Particle *Part, Int_t *parentcell, GridCell* &grid)
+{
+    Int_t ngrid=0, maxcell=-1, icell;
+    vector<Int_t> count, cellindex;
+    for (Int_t i=0;i<nbodies;i++) if (parentcell[i]>maxcell) maxcell=parentcell[i];
+    if (maxcell<0) return 0;
+    count.resize(maxcell+1,0);
+    cellindex.resize(maxcell+1,-1);
+    for (Int_t i=0;i<nbodies;i++) if (parentcell[i]>=0) count[parentcell[i]]++;
+    for (Int_t i=0;i<=maxcell;i++) if (count[i]>=MINCELLSIZE) cellindex[i]=ngrid++;
+    if (ngrid<opt.incrementalbgmincells) return 0;
+
+    if (opt.iverbose>=2) cout<<"Filling grid from "<<ngrid<<" parent cells"<<endl;
+    grid=new GridCell[ngrid];
+    for (Int_t i=0;i<=maxcell;i++) {
+        if (cellindex[i]<0) continue;
+        icell=cellindex[i];
+        grid[icell].ndim=3;
+        grid[icell].gid=i;
+        grid[icell].nparts=count[i];
+        grid[icell].nindex=new Int_t[count[i]];
+        grid[icell].mass=0;
+        for (int j=0;j<3;j++) {
+            grid[icell].xm[j]=0.;
+            grid[icell].xbl[j]=MAXVALUE;
+            grid[icell].xbu[j]=-MAXVALUE;
+        }
+        count[i]=0;
+    }
+    for (Int_t i=0;i<nbodies;i++) {
+        if (parentcell[i]<0 || cellindex[parentcell[i]]<0) continue;
+        GridCell &g=grid[cellindex[parentcell[i]]];
+        g.nindex[count[parentcell[i]]++]=i;
+        for (int j=0;j<3;j++) {
+            g.xm[j]+=Part[i].GetPosition(j)*Part[i].GetMass();
+            if (Part[i].GetPosition(j)<g.xbl[j]) g.xbl[j]=Part[i].GetPosition(j);
+            if (Part[i].GetPosition(j)>g.xbu[j]) g.xbu[j]=Part[i].GetPosition(j);
+        }
+        g.mass+=Part[i].GetMass();
+    }
+    for (Int_t i=0;i<ngrid;i++) for (int j=0;j<3;j++) grid[i].xm[j]/=grid[i].mass;
+    if (opt.iverbose>=2) cout<<"Done."<<endl;
+    return ngrid;
+}
+
 //@}
 
 ///\name Calculate mean velocity distribution quantities
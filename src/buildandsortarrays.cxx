@@ -4,99 +4,188 @@
 
 #include "stf.h"
 
+/// \name Parallel group membership kernels
+/*!
+    The group size and group list arrays are built with a histogram, prefix sum and scatter. Each thread counts the members of
+    each group in a contiguous block of particles. For the lists, the counts are turned into the position of the thread's first member in each
+    group's list by a prefix sum ordered by thread, so that the scatter keeps particles in each list in index order, as in the serial build.
+    Threads are used only if there are enough particles, and the per thread counts are kept smaller than the particle arrays.
+*/
+//@{
+
+///number of threads used to build group arrays
+inline int GroupArrayNumThreads(const Int_t nbodies, const Int_t numgroups)
+{
+#ifdef USEOPENMP
+    if (nbodies > omppropnum && (Int_t)omp_get_max_threads()*(numgroups+1) < nbodies) return omp_get_max_threads();
+#endif
+    return 1;
+}
+
+///block of particles processed by a thread
+inline void GroupArrayThreadBlock(const Int_t nbodies, const int nthreads, const int tid, Int_t &istart, Int_t &iend)
+{
+    istart = (nbodies/nthreads)*tid + min((Int_t)tid, nbodies%nthreads);
+    iend = istart + nbodies/nthreads + (tid < nbodies%nthreads);
+}
+
+///count the members of each group, groupid(i) returning the group of particle i and 0 if not in a group
+template<typename GroupIDFunc> void CountGroupMembers(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, GroupIDFunc groupid)
+{
+    int nthreads = GroupArrayNumThreads(nbodies, numgroups);
+    Int_t gid;
+    for (Int_t i=0;i<=numgroups;i++) numingroup[i]=0;
+    if (nthreads == 1) {
+        for (Int_t i=0;i<nbodies;i++) if ((gid = groupid(i)) > 0) numingroup[gid]++;
+        return;
+    }
+#ifdef USEOPENMP
+    vector<Int_t> count;
+#pragma omp parallel default(shared) num_threads(nthreads)
+{
+    //the team can be smaller than requested, so the blocks are set by the number of threads actually running
+    int tid = omp_get_thread_num(), nteam = omp_get_num_threads();
+#pragma omp single
+    count.assign((numgroups+1)*nteam, 0);
+    Int_t istart, iend, g, *tcount = &count[tid*(numgroups+1)];
+    GroupArrayThreadBlock(nbodies, nteam, tid, istart, iend);
+    for (Int_t i=istart;i<iend;i++) if ((g = groupid(i)) > 0) tcount[g]++;
+#pragma omp barrier
+#pragma omp for schedule(static)
+    for (Int_t j=1;j<=numgroups;j++) {
+        Int_t n = 0;
+        for (auto t=0;t<nteam;t++) n += count[t*(numgroups+1)+j];
+        numingroup[j] = n;
+    }
+}
+#endif
+}
+
+/*!
+    Scatter particles into the lists of their groups, groupid(i) returning the group of particle i, 0 if not in a group,
+    and value(i) the value stored in the list. The lists must be allocated with the sizes in numingroup.
+    Groups with numingroup<0 are skipped.
+*/
+template<typename GroupIDFunc, typename ValueFunc> void ScatterGroupMembers(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, Int_t **pglist,
+    GroupIDFunc groupid, ValueFunc value)
+{
+    int nthreads = GroupArrayNumThreads(nbodies, numgroups);
+    Int_t gid;
+    if (nthreads == 1) {
+        for (Int_t i=1;i<=numgroups;i++) if (numingroup[i]>0) numingroup[i]=0;
+        for (Int_t i=0;i<nbodies;i++) {
+            gid = groupid(i);
+            if (gid == 0) continue;
+            if (numingroup[gid]<0) continue;
+            pglist[gid][numingroup[gid]++]=value(i);
+        }
+        return;
+    }
+#ifdef USEOPENMP
+    vector<Int_t> offset;
+#pragma omp parallel default(shared) num_threads(nthreads)
+{
+    //the team can be smaller than requested, so the blocks are set by the number of threads actually running
+    int tid = omp_get_thread_num(), nteam = omp_get_num_threads();
+#pragma omp single
+    offset.assign((numgroups+1)*nteam, 0);
+    Int_t istart, iend, g, *toffset = &offset[tid*(numgroups+1)];
+    GroupArrayThreadBlock(nbodies, nteam, tid, istart, iend);
+    for (Int_t i=istart;i<iend;i++) if ((g = groupid(i)) > 0) toffset[g]++;
+#pragma omp barrier
+#pragma omp for schedule(static)
+    for (Int_t j=1;j<=numgroups;j++) {
+        Int_t n = 0, ncount;
+        for (auto t=0;t<nteam;t++) {
+            ncount = offset[t*(numgroups+1)+j];
+            offset[t*(numgroups+1)+j] = n;
+            n += ncount;
+        }
+    }
+    for (Int_t i=istart;i<iend;i++) {
+        g = groupid(i);
+        if (g == 0) continue;
+        if (numingroup[g]<0) continue;
+        pglist[g][toffset[g]++]=value(i);
+    }
+}
+#endif
+}
+
+///allocate group lists of the sizes given by numingroup
+inline Int_t **AllocatePGList(const Int_t numgroups, Int_t *numingroup)
+{
+    Int_t **pglist=new Int_t*[numgroups+1];
+    pglist[0]=NULL;
+    for (Int_t i=1;i<=numgroups;i++) {
+        pglist[i] = NULL;
+        if (numingroup[i]<=0) continue;
+        pglist[i]=new Int_t[numingroup[i]];
+    }
+    return pglist;
+}
+//@}
+
 /// \name Simple group id based array building and group id reordering routines
 //@{
 
 ///build group size array
 Int_t *BuildNumInGroup(const Int_t nbodies, const Int_t numgroups, Int_t *pfof){
     Int_t *numingroup=new Int_t[numgroups+1];
-    for (Int_t i=0;i<=numgroups;i++) numingroup[i]=0;
-    for (Int_t i=0;i<nbodies;i++) if (pfof[i]>0) numingroup[pfof[i]]++;
+    CountGroupMembers(nbodies, numgroups, numingroup, [pfof](Int_t i){return pfof[i];});
+    return numingroup;
+}
+///build group size array using memory from an arena
+Int_t *BuildNumInGroup(const Int_t nbodies, const Int_t numgroups, Int_t *pfof, MemoryArena &arena){
+    Int_t *numingroup=arena.Allocate<Int_t>(numgroups+1);
+    CountGroupMembers(nbodies, numgroups, numingroup, [pfof](Int_t i){return pfof[i];});
     return numingroup;
 }
 ///build group size array for specific type
 Int_t *BuildNumInGroupTyped(const Int_t nbodies, const Int_t numgroups, Int_t *pfof, Particle *P, int type){
     Int_t *numingroup=new Int_t[numgroups+1];
-    for (Int_t i=0;i<=numgroups;i++) numingroup[i]=0;
-    for (Int_t i=0;i<nbodies;i++) if (pfof[i]>0 && P[i].GetType()==type) numingroup[pfof[i]]++;
+    CountGroupMembers(nbodies, numgroups, numingroup, [pfof,P,type](Int_t i){return (P[i].GetType()==type)?pfof[i]:(Int_t)0;});
     return numingroup;
 }
 
 ///build the group particle index list (assumes particles are in ID order)
 Int_t **BuildPGList(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, Int_t *pfof){
-    Int_t **pglist=new Int_t*[numgroups+1];
-    Int_t pid;
+    Int_t **pglist=AllocatePGList(numgroups, numingroup);
+    ScatterGroupMembers(nbodies, numgroups, numingroup, pglist, [pfof](Int_t i){return pfof[i];}, [](Int_t i){return i;});
+    return pglist;
+}
+///build the group particle index list using memory from an arena, with the lists of all groups stored contiguously (assumes particles are in ID order)
+Int_t **BuildPGList(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, Int_t *pfof, MemoryArena &arena){
+    Int_t **pglist=arena.Allocate<Int_t*>(numgroups+1);
+    Int_t ntotal=0, *pglistdata;
+    for (Int_t i=1;i<=numgroups;i++) if (numingroup[i]>0) ntotal+=numingroup[i];
+    pglistdata=arena.Allocate<Int_t>(ntotal);
     pglist[0]=NULL;
     for (Int_t i=1;i<=numgroups;i++) {
         pglist[i] = NULL;
         if (numingroup[i]<=0) continue;
-        pglist[i]=new Int_t[numingroup[i]];
-        numingroup[i]=0;
-    }
-    for (Int_t i=0;i<nbodies;i++) {
-        pid = pfof[i];
-        if (pid == 0) continue;
-        if (numingroup[pid]<0) continue;
-        pglist[pid][numingroup[pid]++]=i;
+        pglist[i]=pglistdata;
+        pglistdata+=numingroup[i];
     }
+    ScatterGroupMembers(nbodies, numgroups, numingroup, pglist, [pfof](Int_t i){return pfof[i];}, [](Int_t i){return i;});
     return pglist;
 }
 ///build the group particle index list for particles of a specific type (assumes particles are in ID order)
 Int_t **BuildPGListTyped(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, Int_t *pfof, Particle *P, int type){
-    Int_t **pglist=new Int_t*[numgroups+1];
-    Int_t pid;
-    pglist[0]=NULL;
-    for (Int_t i=1;i<=numgroups;i++) {
-        pglist[i] = NULL;
-        if (numingroup[i]<=0) continue;
-        pglist[i]=new Int_t[numingroup[i]];
-        numingroup[i]=0;
-    }
-    for (Int_t i=0;i<nbodies;i++) {
-        pid = pfof[i];
-        if (pid == 0 || P[i].GetType() != type) continue;
-        if (numingroup[pid]<0) continue;
-        pglist[pid][numingroup[pid]++]=i;
-    }
+    Int_t **pglist=AllocatePGList(numgroups, numingroup);
+    ScatterGroupMembers(nbodies, numgroups, numingroup, pglist, [pfof,P,type](Int_t i){return (P[i].GetType()==type)?pfof[i]:(Int_t)0;}, [](Int_t i){return i;});
     return pglist;
 }
 ///build the group particle index list (doesn't assume particles are in ID order and stores index of particle)
 Int_t **BuildPGList(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, Int_t *pfof, Particle *Part){
-    Int_t **pglist=new Int_t*[numgroups+1];
-    Int_t pid, index;
-    pglist[0]=NULL;
-    for (Int_t i=1;i<=numgroups;i++) {
-        pglist[i] = NULL;
-        if (numingroup[i]<=0) continue;
-        pglist[i]=new Int_t[numingroup[i]];
-        numingroup[i]=0;
-    }
-    for (Int_t i=0;i<nbodies;i++) {
-        index = Part[i].GetID();
-        pid = pfof[index];
-        if (pid == 0) continue;
-        if (numingroup[pid]<0) continue;
-        pglist[pid][numingroup[pid]++]=i;
-    }
+    Int_t **pglist=AllocatePGList(numgroups, numingroup);
+    ScatterGroupMembers(nbodies, numgroups, numingroup, pglist, [pfof,Part](Int_t i){return pfof[Part[i].GetID()];}, [](Int_t i){return i;});
     return pglist;
 }
 ///build the group particle index list (doesn't assumes particles are in ID order)
 Int_t **BuildPGList(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, Int_t *pfof, Int_t *ids){
-    Int_t **pglist=new Int_t*[numgroups+1];
-    Int_t pid;
-    pglist[0]=NULL;
-    for (Int_t i=1;i<=numgroups;i++) {
-        pglist[i] = NULL;
-        if (numingroup[i]<=0) continue;
-        pglist[i]=new Int_t[numingroup[i]];
-        numingroup[i]=0;
-    }
-    for (Int_t i=0;i<nbodies;i++) {
-        pid = pfof[i];
-        if (pid == 0) continue;
-        if (numingroup[pid]<0) continue;
-        pglist[pid][numingroup[pid]++]=ids[i];
-    }
+    Int_t **pglist=AllocatePGList(numgroups, numingroup);
+    ScatterGroupMembers(nbodies, numgroups, numingroup, pglist, [pfof](Int_t i){return pfof[i];}, [ids](Int_t i){return ids[i];});
     return pglist;
 }
 ///build the Head array which points to the head of the group a particle belongs to
@@ -134,6 +223,22 @@ Int_tree_t *BuildGroupTailArray(const Int_t nbodies, const Int_t numgroups, Int_
     }
     return GTail;
 }
+///build group ids from a disjoint set, with groups ordered by decreasing size (ties by lowest index) and groups smaller than minsize set to 0
+Int_t BuildGroupIDsFromDisjointSet(DisjointSet &ds, const Int_t nbodies, const Int_t minsize, Int_t *gid){
+    Int_t numgroups;
+    vector<Int_t> numingroup(nbodies,0), roots;
+    for (Int_t i=0;i<nbodies;i++) numingroup[ds.Root(i)]++;
+    for (Int_t i=0;i<nbodies;i++) if (numingroup[i]>=minsize && numingroup[i]>1) roots.push_back(i);
+    sort(roots.begin(), roots.end(), [&numingroup](Int_t a, Int_t b){
+        if (numingroup[a] != numingroup[b]) return numingroup[a] > numingroup[b];
+        return a < b;
+    });
+    numgroups=roots.size();
+    for (Int_t i=0;i<nbodies;i++) numingroup[i]=0;
+    for (Int_t i=0;i<numgroups;i++) numingroup[roots[i]]=i+1;
+    for (Int_t i=0;i<nbodies;i++) gid[i]=numingroup[ds.Root(i)];
+    return numgroups;
+}
 ///build the group particle arrays need for unbinding procedure
 Particle **BuildPartList(Int_t numgroups, Int_t *numingroup, Int_t **pglist, Particle* Part,
     bool ikeepextrainfo)
@@ -165,6 +270,37 @@ Particle **BuildPartList(Int_t numgroups, Int_t *numingroup, Int_t **pglist, Par
     }
     return gPart;
 }
+/*!
+    Gather the particles of all groups into one packed array, ordered by group and within each group as in pglist, without their
+    hydro, star, black hole and extra dark matter properties (see \ref CopyParticleCoreData). On return gPart[i] points to group i
+    in the packed array. Part is only read. The packed array is returned and, like gPart, is freed with delete[].
+    Large groups are gathered with all threads and the remaining groups are shared between threads.
+*/
+Particle *BuildPackedPartList(const Int_t numgroups, Int_t *numingroup, Int_t **pglist, Particle *Part, Particle **&gPart)
+{
+    Int_t ntotal=0;
+    Particle *packedPart;
+    gPart=new Particle*[numgroups+1];
+    gPart[0]=NULL;
+    for (Int_t i=1;i<=numgroups;i++) if (numingroup[i]>0) ntotal+=numingroup[i];
+    packedPart=new Particle[ntotal];
+    ntotal=0;
+    for (Int_t i=1;i<=numgroups;i++) {
+        gPart[i]=NULL;
+        if (numingroup[i]<=0) continue;
+        gPart[i]=&packedPart[ntotal];
+        ntotal+=numingroup[i];
+    }
+    for (Int_t i=1;i<=numgroups;i++) if (numingroup[i]>omppropnum) GatherParticlesCoreData(numingroup[i], gPart[i], Part, pglist[i]);
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(dynamic) if (ntotal > omppropnum)
+#endif
+    for (Int_t i=1;i<=numgroups;i++) {
+        if (numingroup[i]<=0 || numingroup[i]>omppropnum) continue;
+        for (Int_t j=0;j<numingroup[i];j++) CopyParticleCoreData(gPart[i][j], Part[pglist[i][j]]);
+    }
+    return packedPart;
+}
 ///build a particle list subset using array of indices
 Particle *BuildPart(Int_t numingroup, Int_t *pglist, Particle* Part,
     bool ikeepextrainfo)
@@ -212,27 +348,42 @@ Int_t *BuildNoffset(const Int_t nbodies, Particle *Part, Int_t numgroups,Int_t *
 ///reorder groups from largest to smallest
 ///\todo must alter so that after pfof is reorderd, so is numingroup array and pglist so that do not have to reconstruct this list
 ///after reordering if numgroups==newnumgroups (ie, list has not shrunk)
+///the new group ids are found from the queue and the group lists then relabelled in parallel if they contain enough particles
 void ReorderGroupIDs(const Int_t numgroups, const Int_t newnumgroups, Int_t *numingroup, Int_t *pfof, Int_t **pglist)
 {
     PriorityQueue *pq=new PriorityQueue(newnumgroups);
-    Int_t groupid,size;
-    for (Int_t i = 1; i <=numgroups; i++) if (numingroup[i]>0) pq->Push(i, numingroup[i]);
+    vector<Int_t> oldgroupid(newnumgroups+1);
+    Int_t ntotal=0;
+    for (Int_t i = 1; i <=numgroups; i++) if (numingroup[i]>0) {pq->Push(i, numingroup[i]);ntotal+=numingroup[i];}
     for (Int_t i = 1; i<=newnumgroups; i++) {
-        groupid=pq->TopQueue();size=pq->TopPriority();pq->Pop();
-        for (Int_t j=0;j<size;j++) pfof[pglist[groupid][j]]=i;
+        oldgroupid[i]=pq->TopQueue();pq->Pop();
     }
     delete pq;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(dynamic) if (ntotal > omppropnum)
+#endif
+    for (Int_t i = 1; i<=newnumgroups; i++) {
+        Int_t groupid=oldgroupid[i];
+        for (Int_t j=0;j<numingroup[groupid];j++) pfof[pglist[groupid][j]]=i;
+    }
 }
 void ReorderGroupIDs(const Int_t numgroups, const Int_t newnumgroups, Int_t *numingroup, Int_t *pfof, Int_t **pglist, Particle *Partsubset)
 {
     PriorityQueue *pq=new PriorityQueue(newnumgroups);
-    Int_t groupid,size;
-    for (Int_t i = 1; i <=numgroups; i++) if (numingroup[i]>0) pq->Push(i, numingroup[i]);
+    vector<Int_t> oldgroupid(newnumgroups+1);
+    Int_t ntotal=0;
+    for (Int_t i = 1; i <=numgroups; i++) if (numingroup[i]>0) {pq->Push(i, numingroup[i]);ntotal+=numingroup[i];}
     for (Int_t i = 1; i<=newnumgroups; i++) {
-        groupid=pq->TopQueue();size=pq->TopPriority();pq->Pop();
-        for (Int_t j=0;j<size;j++) pfof[Partsubset[pglist[groupid][j]].GetID()]=i;
+        oldgroupid[i]=pq->TopQueue();pq->Pop();
     }
     delete pq;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(dynamic) if (ntotal > omppropnum)
+#endif
+    for (Int_t i = 1; i<=newnumgroups; i++) {
+        Int_t groupid=oldgroupid[i];
+        for (Int_t j=0;j<numingroup[groupid];j++) pfof[Partsubset[pglist[groupid][j]].GetID()]=i;
+    }
 }
 
 ///similar to \ref ReorderGroupIDs but weight by value
@@ -0,0 +1,249 @@
+/*! \file fixedmatrix.h
+ *  \brief this file contains fixed size matrices and vectors for the small tensors used in phase-space calculations
+
+    Elements are stored in place, unlike GMatrix which allocates them, so these can be created and copied freely
+    in loops over particles, cells and groups. The 3x3 and 6x6 sizes are used for tensors, see \ref Matrix3 and \ref PhaseMatrix, and 4x4 for linear least squares fits.
+ */
+
+#ifndef FIXEDMATRIX_H
+#define FIXEDMATRIX_H
+
+/// \name Fixed size matrices
+//@{
+
+///vector of N elements
+template<int N> struct FixedVector{
+    Double_t v[N];
+
+    FixedVector(){}
+    explicit FixedVector(Double_t val){
+        for (int i=0;i<N;i++) v[i]=val;
+    }
+    inline Double_t &operator[](int i){return v[i];}
+    inline const Double_t &operator[](int i) const {return v[i];}
+    inline FixedVector operator+(const FixedVector &b) const {
+        FixedVector c;
+        for (int i=0;i<N;i++) c.v[i]=v[i]+b.v[i];
+        return c;
+    }
+    inline FixedVector operator-(const FixedVector &b) const {
+        FixedVector c;
+        for (int i=0;i<N;i++) c.v[i]=v[i]-b.v[i];
+        return c;
+    }
+    inline FixedVector operator*(Double_t a) const {
+        FixedVector c;
+        for (int i=0;i<N;i++) c.v[i]=v[i]*a;
+        return c;
+    }
+    inline FixedVector &operator+=(const FixedVector &b){
+        for (int i=0;i<N;i++) v[i]+=b.v[i];
+        return *this;
+    }
+    inline FixedVector &operator*=(Double_t a){
+        for (int i=0;i<N;i++) v[i]*=a;
+        return *this;
+    }
+    inline Double_t Dot(const FixedVector &b) const {
+        Double_t sum=0;
+        for (int i=0;i<N;i++) sum+=v[i]*b.v[i];
+        return sum;
+    }
+};
+
+///N x N matrix stored in row major order
+template<int N> struct FixedMatrix{
+    Double_t m[N*N];
+
+    FixedMatrix(){}
+    explicit FixedMatrix(Double_t val){
+        for (int i=0;i<N*N;i++) m[i]=val;
+    }
+    static FixedMatrix Identity(){
+        FixedMatrix a(0.);
+        for (int i=0;i<N;i++) a.m[i*N+i]=1.0;
+        return a;
+    }
+    inline Double_t &operator()(int i, int j){return m[i*N+j];}
+    inline const Double_t &operator()(int i, int j) const {return m[i*N+j];}
+    inline FixedMatrix operator+(const FixedMatrix &b) const {
+        FixedMatrix c;
+        for (int i=0;i<N*N;i++) c.m[i]=m[i]+b.m[i];
+        return c;
+    }
+    inline FixedMatrix operator-(const FixedMatrix &b) const {
+        FixedMatrix c;
+        for (int i=0;i<N*N;i++) c.m[i]=m[i]-b.m[i];
+        return c;
+    }
+    inline FixedMatrix operator*(Double_t a) const {
+        FixedMatrix c;
+        for (int i=0;i<N*N;i++) c.m[i]=m[i]*a;
+        return c;
+    }
+    inline FixedMatrix &operator+=(const FixedMatrix &b){
+        for (int i=0;i<N*N;i++) m[i]+=b.m[i];
+        return *this;
+    }
+    inline FixedMatrix &operator*=(Double_t a){
+        for (int i=0;i<N*N;i++) m[i]*=a;
+        return *this;
+    }
+    inline FixedMatrix operator*(const FixedMatrix &b) const {
+        FixedMatrix c(0.);
+        for (int i=0;i<N;i++) for (int k=0;k<N;k++) for (int j=0;j<N;j++) c.m[i*N+j]+=m[i*N+k]*b.m[k*N+j];
+        return c;
+    }
+    inline FixedVector<N> operator*(const FixedVector<N> &x) const {
+        FixedVector<N> y(0.);
+        for (int i=0;i<N;i++) for (int j=0;j<N;j++) y.v[i]+=m[i*N+j]*x.v[j];
+        return y;
+    }
+    inline FixedMatrix Transpose() const {
+        FixedMatrix c;
+        for (int i=0;i<N;i++) for (int j=0;j<N;j++) c.m[j*N+i]=m[i*N+j];
+        return c;
+    }
+    ///x^T M x
+    inline Double_t QuadraticForm(const FixedVector<N> &x) const {
+        Double_t sum=0, t;
+        for (int i=0;i<N;i++) {
+            t=0;
+            for (int j=0;j<N;j++) t+=m[i*N+j]*x.v[j];
+            sum+=x.v[i]*t;
+        }
+        return sum;
+    }
+    ///add w x x^T
+    inline void AddOuter(const FixedVector<N> &x, Double_t w){
+        for (int i=0;i<N;i++) for (int j=0;j<N;j++) m[i*N+j]+=w*x.v[i]*x.v[j];
+    }
+    ///determinant from an LU decomposition with partial pivoting
+    Double_t Det() const {
+        FixedMatrix a(*this);
+        Double_t det=1.0, t;
+        int p;
+        for (int k=0;k<N;k++) {
+            p=k;
+            for (int i=k+1;i<N;i++) if (fabs(a.m[i*N+k])>fabs(a.m[p*N+k])) p=i;
+            if (a.m[p*N+k]==0) return 0;
+            if (p!=k) {
+                for (int j=0;j<N;j++) {t=a.m[k*N+j];a.m[k*N+j]=a.m[p*N+j];a.m[p*N+j]=t;}
+                det=-det;
+            }
+            det*=a.m[k*N+k];
+            for (int i=k+1;i<N;i++) {
+                t=a.m[i*N+k]/a.m[k*N+k];
+                for (int j=k+1;j<N;j++) a.m[i*N+j]-=t*a.m[k*N+j];
+            }
+        }
+        return det;
+    }
+    ///inverse by Gauss-Jordan elimination with partial pivoting, all elements are zero if the matrix is singular
+    FixedMatrix Inverse() const {
+        FixedMatrix a(*this), b=Identity();
+        Double_t t;
+        int p;
+        for (int k=0;k<N;k++) {
+            p=k;
+            for (int i=k+1;i<N;i++) if (fabs(a.m[i*N+k])>fabs(a.m[p*N+k])) p=i;
+            if (a.m[p*N+k]==0) return FixedMatrix(0.);
+            if (p!=k) {
+                for (int j=0;j<N;j++) {
+                    t=a.m[k*N+j];a.m[k*N+j]=a.m[p*N+j];a.m[p*N+j]=t;
+                    t=b.m[k*N+j];b.m[k*N+j]=b.m[p*N+j];b.m[p*N+j]=t;
+                }
+            }
+            t=1.0/a.m[k*N+k];
+            for (int j=0;j<N;j++) {a.m[k*N+j]*=t;b.m[k*N+j]*=t;}
+            for (int i=0;i<N;i++) {
+                if (i==k || a.m[i*N+k]==0) continue;
+                t=a.m[i*N+k];
+                for (int j=0;j<N;j++) {a.m[i*N+j]-=t*a.m[k*N+j];b.m[i*N+j]-=t*b.m[k*N+j];}
+            }
+        }
+        return b;
+    }
+    /*!
+        Eigenvalues and eigenvectors of a symmetric matrix using cyclic Jacobi rotations.
+        Eigenvalues are sorted in decreasing order and eigenvector i is stored in column i of eigvec.
+    */
+    void SymEigen(FixedVector<N> &eigval, FixedMatrix &eigvec) const {
+        FixedMatrix a(*this);
+        Double_t off, scale, theta, t, c, s, tau, aip, aiq, vip, viq;
+        eigvec=Identity();
+        for (int sweep=0;sweep<50;sweep++) {
+            off=scale=0;
+            for (int p=0;p<N;p++) {
+                scale+=a.m[p*N+p]*a.m[p*N+p];
+                for (int q=p+1;q<N;q++) off+=a.m[p*N+q]*a.m[p*N+q];
+            }
+            if (off<=1e-30*scale || off==0) break;
+            for (int p=0;p<N-1;p++) for (int q=p+1;q<N;q++) {
+                if (a.m[p*N+q]==0) continue;
+                theta=(a.m[q*N+q]-a.m[p*N+p])/(2.0*a.m[p*N+q]);
+                t=(theta>=0?1.0:-1.0)/(fabs(theta)+sqrt(theta*theta+1.0));
+                c=1.0/sqrt(t*t+1.0);
+                s=t*c;
+                tau=s/(1.0+c);
+                a.m[p*N+p]-=t*a.m[p*N+q];
+                a.m[q*N+q]+=t*a.m[p*N+q];
+                a.m[p*N+q]=a.m[q*N+p]=0;
+                for (int i=0;i<N;i++) {
+                    if (i!=p && i!=q) {
+                        aip=a.m[i*N+p];
+                        aiq=a.m[i*N+q];
+                        a.m[i*N+p]=a.m[p*N+i]=aip-s*(aiq+tau*aip);
+                        a.m[i*N+q]=a.m[q*N+i]=aiq+s*(aip-tau*aiq);
+                    }
+                    vip=eigvec.m[i*N+p];
+                    viq=eigvec.m[i*N+q];
+                    eigvec.m[i*N+p]=vip-s*(viq+tau*vip);
+                    eigvec.m[i*N+q]=viq+s*(vip-tau*viq);
+                }
+            }
+        }
+        for (int i=0;i<N;i++) eigval.v[i]=a.m[i*N+i];
+        //sort by decreasing eigenvalue
+        for (int i=0;i<N-1;i++) {
+            int k=i;
+            for (int j=i+1;j<N;j++) if (eigval.v[j]>eigval.v[k]) k=j;
+            if (k==i) continue;
+            t=eigval.v[i];eigval.v[i]=eigval.v[k];eigval.v[k]=t;
+            for (int j=0;j<N;j++) {t=eigvec.m[j*N+i];eigvec.m[j*N+i]=eigvec.m[j*N+k];eigvec.m[j*N+k]=t;}
+        }
+    }
+};
+
+///determinant of a 3x3 matrix by cofactors
+template<> inline Double_t FixedMatrix<3>::Det() const {
+    return m[0]*(m[4]*m[8]-m[5]*m[7])-m[1]*(m[3]*m[8]-m[5]*m[6])+m[2]*(m[3]*m[7]-m[4]*m[6]);
+}
+///inverse of a 3x3 matrix by cofactors, all elements are zero if the matrix is singular
+template<> inline FixedMatrix<3> FixedMatrix<3>::Inverse() const {
+    FixedMatrix<3> b;
+    Double_t det=Det(), idet;
+    if (det==0) return FixedMatrix<3>(0.);
+    idet=1.0/det;
+    b.m[0]=(m[4]*m[8]-m[5]*m[7])*idet;
+    b.m[1]=(m[2]*m[7]-m[1]*m[8])*idet;
+    b.m[2]=(m[1]*m[5]-m[2]*m[4])*idet;
+    b.m[3]=(m[5]*m[6]-m[3]*m[8])*idet;
+    b.m[4]=(m[0]*m[8]-m[2]*m[6])*idet;
+    b.m[5]=(m[2]*m[3]-m[0]*m[5])*idet;
+    b.m[6]=(m[3]*m[7]-m[4]*m[6])*idet;
+    b.m[7]=(m[1]*m[6]-m[0]*m[7])*idet;
+    b.m[8]=(m[0]*m[4]-m[1]*m[3])*idet;
+    return b;
+}
+
+///3x3 matrix, such as a velocity dispersion tensor
+typedef FixedMatrix<3> Matrix3;
+///6x6 matrix, such as a phase-space dispersion tensor
+typedef FixedMatrix<6> PhaseMatrix;
+///6 dimensional phase-space coordinate
+typedef FixedVector<6> PhaseVector;
+
+//@}
+
+#endif
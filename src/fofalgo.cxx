@@ -216,3 +216,223 @@ int FOFcheckpositivetype(Particle &a, Double_t *params){
 }
 
 //@}
+
+/// \name Tree walk helpers for FOF searches using a disjoint set
+//@{
+void FOFGetLeafNodes(Node *np, const Int_t bsize, vector<Node*> &leaves)
+{
+    if (np->GetCount()>bsize) {
+        FOFGetLeafNodes(((SplitNode*)np)->GetLeft(), bsize, leaves);
+        FOFGetLeafNodes(((SplitNode*)np)->GetRight(), bsize, leaves);
+    }
+    else leaves.push_back(np);
+}
+//@}
+
+/// \name Specialised FOF criteria
+//@{
+
+///link all active particle pairs of two leaves that satisfy the criterion.
+///The criterion is first evaluated for all pairs of a row into linkflag so the inner loop is free of branches and can be vectorised
+template<class FOFCriterionType> inline void FOFSpecialisedLinkLeafPair(Node *leaf1, Node *leaf2,
+    const FOFPhaseData &d, const vector<char> &iactive, DisjointSet &ds,
+    const typename FOFCriterionType::ParamType &p, vector<int> &linkflag)
+{
+    Int_t jstart, jend=leaf2->GetEnd();
+    bool isame=(leaf1==leaf2);
+    for (Int_t i=leaf1->GetStart();i<leaf1->GetEnd();i++) {
+        if (!iactive[i]) continue;
+        if (isame) jstart=i+1;
+        else jstart=leaf2->GetStart();
+        for (Int_t j=jstart;j<jend;j++) linkflag[j-jstart]=FOFCriterionType::Link(d,i,j,p);
+        for (Int_t j=jstart;j<jend;j++) if (linkflag[j-jstart] && iactive[j]) ds.Link(i,j);
+    }
+}
+
+///walk the tree from a node, linking the leaf to all leaves at or after it in index order whose bounding boxes lie within the linking length
+template<class FOFCriterionType> void FOFSpecialisedLinkLeaf(Node *np, Node *leaf, const Int_t bsize,
+    const FOFPhaseData &d, const vector<char> &iactive, DisjointSet &ds,
+    const typename FOFCriterionType::ParamType &p, vector<int> &linkflag)
+{
+    if (np->GetEnd()<=leaf->GetStart()) return;
+    if (FOFNodeDist2(np,leaf)>=p.ell2) return;
+    if (np->GetCount()>bsize) {
+        FOFSpecialisedLinkLeaf<FOFCriterionType>(((SplitNode*)np)->GetLeft(), leaf, bsize, d, iactive, ds, p, linkflag);
+        FOFSpecialisedLinkLeaf<FOFCriterionType>(((SplitNode*)np)->GetRight(), leaf, bsize, d, iactive, ds, p, linkflag);
+    }
+    else FOFSpecialisedLinkLeafPair<FOFCriterionType>(leaf, np, d, iactive, ds, p, linkflag);
+}
+
+///FOF search over all leaf pairs of the tree using the criterion FOFCriterionType, returning group ids indexed by particle id.
+///Groups are always ordered by decreasing size, as KDTree::FOFCriterion does with iorder=1
+template<class FOFCriterionType> Int_t *FOFSpecialisedSearch(KDTree *tree, Particle *Part, const Int_t nbodies, const Int_t bsize,
+    Double_t *params, Int_t &numgroups, const Int_t minsize, FOFcheckfunc check)
+{
+    typename FOFCriterionType::ParamType p(params);
+    FOFPhaseData d(nbodies, Part);
+    vector<char> iactive(nbodies);
+    vector<Node*> leaves;
+    vector<Int_t> gid(nbodies);
+    DisjointSet ds(nbodies);
+    Int_t *pfof=new Int_t[nbodies];
+
+    for (Int_t i=0;i<nbodies;i++) iactive[i]=(check==NULL||check(Part[i],params)==0);
+    FOFGetLeafNodes(tree->GetRoot(), bsize, leaves);
+#ifdef USEOPENMP
+#pragma omp parallel default(shared) if (nbodies>ompsearchnum)
+{
+#endif
+    vector<int> linkflag(bsize+1);
+#ifdef USEOPENMP
+#pragma omp for schedule(dynamic,64)
+#endif
+    for (Int_t l=0;l<(Int_t)leaves.size();l++)
+        FOFSpecialisedLinkLeaf<FOFCriterionType>(tree->GetRoot(), leaves[l], bsize, d, iactive, ds, p, linkflag);
+#ifdef USEOPENMP
+}
+#endif
+    numgroups=BuildGroupIDsFromDisjointSet(ds, nbodies, minsize, gid.data());
+    for (Int_t i=0;i<nbodies;i++) pfof[Part[i].GetID()]=gid[i];
+    return pfof;
+}
+
+Int_t *FOFCriterionSpecialised(KDTree *tree, Particle *Part, const Int_t nbodies, const Int_t bsize,
+    FOFcompfunc fofcmp, Double_t *params, Int_t &numgroups, const Int_t minsize, FOFcheckfunc check)
+{
+    if (check!=NULL && check!=&FOFchecksub && check!=&FOFcheckbg) return NULL;
+    if (fofcmp==&FOFStreamwithprob)
+        return FOFSpecialisedSearch<FOFStreamwithprobCriterion>(tree, Part, nbodies, bsize, params, numgroups, minsize, check);
+    else if (fofcmp==&FOF6d)
+        return FOFSpecialisedSearch<FOF6dCriterion>(tree, Part, nbodies, bsize, params, numgroups, minsize, check);
+    else if (fofcmp==&FOF6dbgup)
+        return FOFSpecialisedSearch<FOF6dbgupCriterion>(tree, Part, nbodies, bsize, params, numgroups, minsize, check);
+    else if (fofcmp==&FOF6dbg)
+        return FOFSpecialisedSearch<FOF6dbgCriterion>(tree, Part, nbodies, bsize, params, numgroups, minsize, check);
+    return NULL;
+}
+
+Int_t *FOFCriterionSearch(Options &opt, KDTree *tree, Particle *Part, const Int_t nbodies,
+    FOFcompfunc fofcmp, Double_t *params, Int_t &numgroups, const Int_t minsize,
+    int iorder, int icheck, FOFcheckfunc check)
+{
+    Int_t *pfof=NULL;
+    //the specialised search always orders groups by size so unordered group ids use the generic search
+    if (opt.iFOFspecialised && iorder) {
+        pfof=FOFCriterionSpecialised(tree, Part, nbodies, opt.Bsize, fofcmp, params, numgroups, minsize, (icheck?check:NULL));
+        if (pfof==NULL && opt.iverbose>=2) cout<<"No specialised FOF criterion available, using generic FOF search"<<endl;
+    }
+    if (pfof==NULL) pfof=tree->FOFCriterion(fofcmp,params,numgroups,minsize,iorder,icheck,check);
+    return pfof;
+}
+//@}
+
+/// \name Warm started 3D FOF search
+//@{
+
+///for each index, the end of the run of consecutive indices sharing the same value
+void FOFWarmStartRuns(const Int_t nbodies, const Int_t *value, vector<Int_t> &runend)
+{
+    runend.resize(nbodies);
+    if (nbodies==0) return;
+    runend[nbodies-1]=nbodies;
+    for (Int_t i=nbodies-2;i>=0;i--) runend[i]=(value[i]==value[i+1])?runend[i+1]:i+1;
+}
+
+///distance squared between two particles, accounting for periodicity
+inline Double_t FOFWarmStartDist2(Particle *Part, const Int_t i, const Int_t j, const Double_t period)
+{
+    Double_t d2=0, dx;
+    for (auto k=0;k<3;k++) {
+        dx=Part[i].GetPosition(k)-Part[j].GetPosition(k);
+        if (period>0) {
+            if (dx>0.5*period) dx-=period;
+            else if (dx<-0.5*period) dx+=period;
+        }
+        d2+=dx*dx;
+    }
+    return d2;
+}
+
+/*!
+    Walk the tree from a node, linking the leaf to all leaves at or after it in index order within the linking length.
+    If iseed, only pairs belonging to the same seed group are tested, otherwise all pairs are tested.
+    Node pairs that each lie entirely within a single seed group (given by the runs of seed values) are skipped
+    if the groups differ (or are not groups) when verifying seeds, or if the groups are already joined when the seeds
+    are verified groups. Particle pairs already joined are never tested.
+*/
+void FOFWarmStartLinkLeaf(Node *np, Node *leaf, const Int_t bsize, Particle *Part,
+    DisjointSet &ds, const Int_t *seed, const vector<Int_t> &runend,
+    const Double_t ell2, const Double_t period, const bool iseed)
+{
+    Int_t lstart=leaf->GetStart(), nstart=np->GetStart();
+    if (np->GetEnd()<=lstart) return;
+    if (runend[lstart]>=leaf->GetEnd() && runend[nstart]>=np->GetEnd()) {
+        if (iseed && (seed[lstart]!=seed[nstart] || seed[lstart]==0)) return;
+        if (!iseed && ds.Root(lstart)==ds.Root(nstart)) return;
+    }
+    if (FOFNodeDist2(np, leaf, period)>=ell2) return;
+    if (np->GetCount()>bsize) {
+        FOFWarmStartLinkLeaf(((SplitNode*)np)->GetLeft(), leaf, bsize, Part, ds, seed, runend, ell2, period, iseed);
+        FOFWarmStartLinkLeaf(((SplitNode*)np)->GetRight(), leaf, bsize, Part, ds, seed, runend, ell2, period, iseed);
+        return;
+    }
+    Int_t jstart;
+    bool isame=(leaf==np);
+    for (auto i=lstart;i<leaf->GetEnd();i++) {
+        if (iseed && seed[i]==0) continue;
+        jstart=isame?i+1:nstart;
+        for (auto j=jstart;j<np->GetEnd();j++) {
+            if (iseed && seed[i]!=seed[j]) continue;
+            if (ds.Root(i)==ds.Root(j)) continue;
+            if (FOFWarmStartDist2(Part, i, j, period)<ell2) ds.Link(i,j);
+        }
+    }
+}
+
+/*!
+    3D FOF search seeded by the group membership of a previous snapshot.
+    Assumes the tree has been built on Part with the input order overwritten and that pfofprev is in tree order.
+    First the links within each previous group are verified, with node pairs lying in different previous groups skipped
+    in bulk. The groups found are then used as the seed of a full search in which node pairs lying entirely within the
+    same group are skipped, so only particles at group boundaries and particles not in a group are searched in full.
+    Since every pair of particles that could join two distinct sets is still tested, the groups are identical to those of
+    a search from scratch, the previous groups only determining how much of the search can be skipped.
+    Returns the group id array ordered by decreasing group size with groups below minsize set to 0.
+*/
+Int_t *FOFWarmStartSearch(Options &opt, const Int_t nbodies, Particle *Part, KDTree *tree, Int_t *pfofprev,
+    const Double_t rdist, const Double_t period, Int_t &numgroups, const Int_t minsize)
+{
+    double time1=MyGetTime();
+    Double_t ell2=rdist*rdist;
+    Int_t *pfof=new Int_t[nbodies];
+    vector<Int_t> runend, seed(nbodies);
+    vector<Node*> leaves;
+    DisjointSet ds(nbodies);
+#ifndef USEMPI
+    int ThisTask=0,NProcs=1;
+#endif
+
+    FOFGetLeafNodes(tree->GetRoot(), opt.Bsize, leaves);
+    //verify the links within previous groups
+    FOFWarmStartRuns(nbodies, pfofprev, runend);
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(dynamic,64) if (nbodies>ompsearchnum)
+#endif
+    for (Int_t l=0;l<(Int_t)leaves.size();l++)
+        FOFWarmStartLinkLeaf(tree->GetRoot(), leaves[l], opt.Bsize, Part, ds, pfofprev, runend, ell2, period, true);
+    if (opt.iverbose) cout<<ThisTask<<": verified links of previous groups "<<MyGetTime()-time1<<endl;
+
+    //then search for links between the verified groups and of particles not in groups
+    for (Int_t i=0;i<nbodies;i++) seed[i]=ds.Root(i);
+    FOFWarmStartRuns(nbodies, seed.data(), runend);
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(dynamic,64) if (nbodies>ompsearchnum)
+#endif
+    for (Int_t l=0;l<(Int_t)leaves.size();l++)
+        FOFWarmStartLinkLeaf(tree->GetRoot(), leaves[l], opt.Bsize, Part, ds, seed.data(), runend, ell2, period, false);
+
+    numgroups=BuildGroupIDsFromDisjointSet(ds, nbodies, minsize, pfof);
+    if (opt.iverbose) cout<<ThisTask<<": finished warm started FOF search "<<MyGetTime()-time1<<endl;
+    return pfof;
+}
+//@}
@@ -53,4 +53,115 @@ int FOFchecktype(Particle &a, Double_t *params);
 int FOFcheckpositivetype(Particle &a, Double_t *params);
 //@}
 
+/// \name Tree walk helpers for FOF searches using a disjoint set
+//@{
+///minimum distance squared between the bounding boxes of two nodes, accounting for periodicity
+inline Double_t FOFNodeDist2(Node *a, Node *b, Double_t period=0)
+{
+    Double_t d2 = 0, dx, dxp;
+    for (auto k=0;k<3;k++) {
+        dx = max((Double_t)0.0, max(b->GetBoundary(k,0)-a->GetBoundary(k,1), a->GetBoundary(k,0)-b->GetBoundary(k,1)));
+        if (period > 0) {
+            dxp = max((Double_t)0.0, max(b->GetBoundary(k,0)-period-a->GetBoundary(k,1), a->GetBoundary(k,0)-b->GetBoundary(k,1)+period));
+            if (dxp < dx) dx = dxp;
+            dxp = max((Double_t)0.0, max(b->GetBoundary(k,0)+period-a->GetBoundary(k,1), a->GetBoundary(k,0)-b->GetBoundary(k,1)-period));
+            if (dxp < dx) dx = dxp;
+        }
+        d2 += dx*dx;
+    }
+    return d2;
+}
+///store all leaf nodes of the tree in index order
+void FOFGetLeafNodes(Node *np, const Int_t bsize, vector<Node*> &leaves);
+///3D FOF search seeded by group ids of a previous snapshot, giving groups identical to a search from scratch
+Int_t *FOFWarmStartSearch(Options &opt, const Int_t nbodies, Particle *Part, KDTree *tree, Int_t *pfofprev,
+    const Double_t rdist, const Double_t period, Int_t &numgroups, const Int_t minsize);
+//@}
+
+/// \name Specialised FOF criteria
+/// Typed parameters and inline criteria used by \ref FOFCriterionSpecialised, which mirror
+/// \ref FOFStreamwithprob, \ref FOF6d, \ref FOF6dbgup and \ref FOF6dbg but operate on packed phase-space data
+/// so that the pair tests can be inlined and vectorised in the leaf-leaf loops rather than called through a function pointer.
+//@{
+///packed phase-space data of the particles in tree order
+struct FOFPhaseData {
+    vector<Double_t> x[3], v[3], vmag, pot;
+    FOFPhaseData(const Int_t nbodies, Particle *Part) {
+        for (auto k=0;k<3;k++) {x[k].resize(nbodies); v[k].resize(nbodies);}
+        vmag.resize(nbodies); pot.resize(nbodies);
+        for (Int_t i=0;i<nbodies;i++) {
+            for (auto k=0;k<3;k++) {x[k][i]=Part[i].GetPosition(k); v[k][i]=Part[i].GetVelocity(k);}
+            vmag[i]=sqrt(v[0][i]*v[0][i]+v[1][i]*v[1][i]+v[2][i]*v[2][i]);
+            pot[i]=Part[i].GetPotential();
+        }
+    }
+};
+///parameters of the stream criterion: param 6 is physical linking length squared, 7 is speed ratio, 8 is min cosine and 9 is outlier threshold
+struct FOFStreamParams {
+    Double_t ell2, vratio, costheta, threshold;
+    FOFStreamParams(Double_t *params) : ell2(params[6]), vratio(params[7]), costheta(params[8]), threshold(params[9]) {}
+};
+///parameters of the 6d criteria: param 6 is physical linking length squared, 7 is velocity linking length squared and 9 is outlier threshold
+struct FOF6dParams {
+    Double_t ell2, vel2, ell2vel2, threshold;
+    FOF6dParams(Double_t *params) : ell2(params[6]), vel2(params[7]), ell2vel2(params[6]*params[7]), threshold(params[9]) {}
+};
+///inline version of \ref FOFStreamwithprob
+struct FOFStreamwithprobCriterion {
+    typedef FOFStreamParams ParamType;
+    static inline int Link(const FOFPhaseData &d, const Int_t i, const Int_t j, const ParamType &p) {
+        Double_t dx, dist2=0, vdot=0;
+        for (auto k=0;k<3;k++) {
+            dx=d.x[k][i]-d.x[k][j];
+            dist2+=dx*dx;
+            vdot+=d.v[k][i]*d.v[k][j];
+        }
+        return (d.pot[i]>=p.threshold) & (d.pot[j]>=p.threshold) & (dist2<p.ell2)
+            & (vdot>p.costheta*d.vmag[i]*d.vmag[j]) & (d.vmag[i]<p.vratio*d.vmag[j]) & (d.vmag[i]*p.vratio>d.vmag[j]);
+    }
+};
+///inline 6d linking test, dist2/ell2+vdist2/vel2<1 without divisions
+inline int FOF6dLinkTest(const FOFPhaseData &d, const Int_t i, const Int_t j, const FOF6dParams &p) {
+    Double_t dx, dv, dist2=0, vdist2=0;
+    for (auto k=0;k<3;k++) {
+        dx=d.x[k][i]-d.x[k][j];
+        dv=d.v[k][i]-d.v[k][j];
+        dist2+=dx*dx;
+        vdist2+=dv*dv;
+    }
+    return (dist2*p.vel2+vdist2*p.ell2<p.ell2vel2);
+}
+///inline version of FOF6d
+struct FOF6dCriterion {
+    typedef FOF6dParams ParamType;
+    static inline int Link(const FOFPhaseData &d, const Int_t i, const Int_t j, const ParamType &p) {
+        return FOF6dLinkTest(d,i,j,p);
+    }
+};
+///inline version of \ref FOF6dbgup
+struct FOF6dbgupCriterion {
+    typedef FOF6dParams ParamType;
+    static inline int Link(const FOFPhaseData &d, const Int_t i, const Int_t j, const ParamType &p) {
+        return (d.pot[i]>=p.threshold) & (d.pot[j]>=p.threshold) & FOF6dLinkTest(d,i,j,p);
+    }
+};
+///inline version of \ref FOF6dbg
+struct FOF6dbgCriterion {
+    typedef FOF6dParams ParamType;
+    static inline int Link(const FOFPhaseData &d, const Int_t i, const Int_t j, const ParamType &p) {
+        return (d.pot[i]<p.threshold) & (d.pot[j]<p.threshold) & FOF6dLinkTest(d,i,j,p);
+    }
+};
+///FOF search of a tree using the specialised criterion matching fofcmp and check. Returns NULL if no specialised version exists,
+///which is the case for criteria other than \ref FOFStreamwithprob, \ref FOF6d, \ref FOF6dbgup and \ref FOF6dbg and for checks
+///other than \ref FOFchecksub and \ref FOFcheckbg
+Int_t *FOFCriterionSpecialised(KDTree *tree, Particle *Part, const Int_t nbodies, const Int_t bsize,
+    FOFcompfunc fofcmp, Double_t *params, Int_t &numgroups, const Int_t minsize, FOFcheckfunc check=NULL);
+///FOF search of a tree that uses \ref FOFCriterionSpecialised if enabled and available and otherwise KDTree::FOFCriterion.
+///Groups from the specialised search are ordered by size, so it is only used with iorder=1
+Int_t *FOFCriterionSearch(Options &opt, KDTree *tree, Particle *Part, const Int_t nbodies,
+    FOFcompfunc fofcmp, Double_t *params, Int_t &numgroups, const Int_t minsize,
+    int iorder=1, int icheck=0, FOFcheckfunc check=NULL);
+//@}
+
 #endif
@@ -0,0 +1,320 @@
+/*! \file fofgrid.cxx
+ *  \brief this file contains routines for a cell-linked-list 3D FOF search
+
+    Particles are binned into a uniform grid, storing only occupied cells sorted by their key, with a cell size
+    no larger than the linking length/sqrt(3). Since the diagonal of a cell is then no larger than the linking
+    length, all particles within a cell are linked immediately and pairs of neighbouring cells only need a single
+    link to be joined. Neighbouring cells that are too distant or already part of the same group are skipped.
+ */
+
+#include "stf.h"
+
+/// \name Cell-linked-list FOF routines
+//@{
+
+///wrap a cell coordinate if periodic, returning false if the cell lies outside the grid
+inline bool FOFGridWrapCell(FOFGrid &grid, long long &ix, const int k)
+{
+    long long n = grid.ncells[k];
+    if (grid.period > 0) {
+        ix = ((ix % n) + n) % n;
+        return true;
+    }
+    return (ix >= 0 && ix < n);
+}
+
+///cell coordinate of a position along dimension k
+inline long long FOFGridCellCoord(FOFGrid &grid, Double_t x, const int k)
+{
+    long long ix;
+    if (grid.period > 0) x -= grid.period*floor(x/grid.period);
+    ix = (long long)((x-grid.xmin[k])/grid.cellsize[k]);
+    if (ix < 0) ix = 0;
+    else if (ix >= (long long)grid.ncells[k]) ix = grid.ncells[k]-1;
+    return ix;
+}
+
+///return index of occupied cell with the key, -1 if cell is empty
+inline Int_t FOFGridFindCell(FOFGrid &grid, unsigned long long key)
+{
+    auto it = lower_bound(grid.cellkey.begin(), grid.cellkey.end(), key);
+    if (it == grid.cellkey.end() || *it != key) return -1;
+    return it - grid.cellkey.begin();
+}
+
+///periodic distance squared between two positions
+inline Double_t FOFGridDist2(const Double_t *x1, const Double_t *x2, const Double_t period)
+{
+    Double_t d2 = 0, dx;
+    for (auto k=0;k<3;k++) {
+        dx = x1[k]-x2[k];
+        if (period > 0) {
+            if (dx > 0.5*period) dx -= period;
+            else if (dx < -0.5*period) dx += period;
+        }
+        d2 += dx*dx;
+    }
+    return d2;
+}
+
+/*!
+    Build grid used by the cell-linked-list FOF search. The cell size is set to be no larger than rdist/sqrt(3) if
+    possible so that all particles in a cell are within the linking length of each other. Only occupied cells are stored.
+*/
+void FOFGridBuild(FOFGrid &grid, const Int_t nbodies, Particle *Part, const Double_t rdist, const Double_t period)
+{
+    //limit number of cells per dimension so that cell keys fit in 63 bits
+    const unsigned long long maxcells = 1ULL<<21;
+    Double_t xmin[3], xmax[3], cellsize = rdist/sqrt(3.0), diag2 = 0;
+    vector<pair<unsigned long long, Int_t>> keyindex(nbodies);
+
+    grid.period = period;
+    if (period > 0) {
+        for (auto k=0;k<3;k++) {xmin[k] = 0; xmax[k] = period;}
+    }
+    else {
+        for (auto k=0;k<3;k++) {xmin[k] = MAXVALUE; xmax[k] = -MAXVALUE;}
+        for (auto i=0;i<nbodies;i++) {
+            for (auto k=0;k<3;k++) {
+                if (Part[i].GetPosition(k) < xmin[k]) xmin[k] = Part[i].GetPosition(k);
+                if (Part[i].GetPosition(k) > xmax[k]) xmax[k] = Part[i].GetPosition(k);
+            }
+        }
+    }
+    for (auto k=0;k<3;k++) {
+        grid.xmin[k] = xmin[k];
+        if (period > 0) {
+            grid.ncells[k] = max(1.0, ceil(period/cellsize));
+            if (grid.ncells[k] > maxcells) grid.ncells[k] = maxcells;
+            grid.cellsize[k] = period/(Double_t)grid.ncells[k];
+        }
+        else {
+            grid.ncells[k] = (unsigned long long)((xmax[k]-xmin[k])/cellsize)+1;
+            grid.cellsize[k] = cellsize;
+            if (grid.ncells[k] > maxcells) {
+                grid.ncells[k] = maxcells;
+                grid.cellsize[k] = (xmax[k]-xmin[k])/(Double_t)(maxcells-1);
+            }
+        }
+        diag2 += grid.cellsize[k]*grid.cellsize[k];
+    }
+    //cells can only be linked internally if diagonal is within linking length
+    grid.iautolink = (diag2 < rdist*rdist);
+
+#ifdef USEOPENMP
+#pragma omp parallel for \
+default(shared) schedule(static) if (nbodies > ompsearchnum)
+#endif
+    for (auto i=0;i<nbodies;i++) {
+        unsigned long long ix[3];
+        for (auto k=0;k<3;k++) ix[k] = FOFGridCellCoord(grid, Part[i].GetPosition(k), k);
+        keyindex[i].first = (ix[0]*grid.ncells[1]+ix[1])*grid.ncells[2]+ix[2];
+        keyindex[i].second = i;
+    }
+    sort(keyindex.begin(), keyindex.end());
+
+    grid.index.resize(nbodies);
+    grid.cellkey.clear();
+    grid.celloffset.clear();
+    grid.cellcount.clear();
+    for (auto i=0;i<nbodies;i++) {
+        grid.index[i] = keyindex[i].second;
+        if (i == 0 || keyindex[i].first != keyindex[i-1].first) {
+            grid.cellkey.push_back(keyindex[i].first);
+            grid.celloffset.push_back(i);
+            grid.cellcount.push_back(0);
+        }
+        grid.cellcount.back()++;
+    }
+}
+
+/*!
+    Returns whether any pair of particles in the two cells is within the linking length.
+    Positions are packed in cell order so the inner loop is a simple batch of distance calculations
+*/
+inline bool FOFGridCellsLinked(const Int_t off1, const Int_t n1, const Int_t off2, const Int_t n2,
+    const Double_t *xp, const Double_t *yp, const Double_t *zp, const Double_t ell2, const Double_t period)
+{
+    Double_t dx, dy, dz;
+    int ilink;
+    for (auto i=off1;i<off1+n1;i++) {
+        ilink = 0;
+        for (auto j=off2;j<off2+n2;j++) {
+            dx = xp[i]-xp[j]; dy = yp[i]-yp[j]; dz = zp[i]-zp[j];
+            if (period > 0) {
+                dx = (dx > 0.5*period) ? dx-period : ((dx < -0.5*period) ? dx+period : dx);
+                dy = (dy > 0.5*period) ? dy-period : ((dy < -0.5*period) ? dy+period : dy);
+                dz = (dz > 0.5*period) ? dz-period : ((dz < -0.5*period) ? dz+period : dz);
+            }
+            ilink |= (dx*dx+dy*dy+dz*dz < ell2);
+        }
+        if (ilink) return true;
+    }
+    return false;
+}
+
+/*!
+    Cell-linked-list 3D FOF search with linking length rdist. Particles within a cell are linked immediately
+    when the cell diagonal is within the linking length and neighbouring cells are joined by the first link found.
+    Neighbouring cells whose bounding boxes are further apart than the linking length, or that already belong to
+    the same group, are skipped. The grid is returned so that it can be used for subsequent searches
+    (see \ref FOFGridSearchBallPos).
+
+    Returns group ids indexed by particle index ordered by decreasing group size with groups below minsize set to 0.
+    If Head and Next are not NULL, these are updated to contain the group linked lists.
+*/
+Int_t *FOFGridSearch(Options &opt, const Int_t nbodies, Particle *Part, FOFGrid &grid,
+    const Double_t rdist, const Double_t period, Int_t &numgroups, const Int_t minsize,
+    Int_tree_t *Head, Int_tree_t *Next)
+{
+#ifndef USEMPI
+    int ThisTask=0,NProcs=1;
+#endif
+    Int_t *pfof = new Int_t[nbodies];
+    Int_t ncell, nrange[3];
+    Double_t ell2 = rdist*rdist;
+    vector<Double_t> xp(nbodies), yp(nbodies), zp(nbodies);
+    vector<Int_t> newgid, groupfirst, grouplast;
+    double time1 = MyGetTime();
+
+    FOFGridBuild(grid, nbodies, Part, rdist, period);
+    ncell = grid.cellkey.size();
+    for (auto k=0;k<3;k++) nrange[k] = ceil(rdist/grid.cellsize[k]);
+    if (opt.iverbose) cout<<ThisTask<<": cell-linked-list FOF using "<<ncell<<" occupied cells with cell size "<<grid.cellsize[0]<<endl;
+
+    //pack positions in cell order
+    for (auto i=0;i<nbodies;i++) {
+        xp[i] = Part[grid.index[i]].GetPosition(0);
+        yp[i] = Part[grid.index[i]].GetPosition(1);
+        zp[i] = Part[grid.index[i]].GetPosition(2);
+    }
+
+    //disjoint set is over the cell ordered index
+    DisjointSet ds(nbodies);
+    if (grid.iautolink) {
+        for (auto c=0;c<ncell;c++)
+            for (auto j=grid.celloffset[c]+1;j<grid.celloffset[c]+grid.cellcount[c];j++) ds.parent[j].store(grid.celloffset[c], memory_order_relaxed);
+    }
+
+#ifdef USEOPENMP
+#pragma omp parallel for \
+default(shared) schedule(dynamic,256) if (nbodies > ompsearchnum)
+#endif
+    for (auto c=0;c<ncell;c++) {
+        long long ix[3], jx[3];
+        unsigned long long key;
+        Int_t d, off1 = grid.celloffset[c], n1 = grid.cellcount[c], off2, n2;
+        Double_t gap, gap2;
+        Double_t x1[3], x2[3];
+        key = grid.cellkey[c];
+        ix[2] = key % grid.ncells[2]; key /= grid.ncells[2];
+        ix[1] = key % grid.ncells[1]; key /= grid.ncells[1];
+        ix[0] = key;
+
+        //if cell cannot be linked internally, check all pairs
+        if (!grid.iautolink) {
+            for (auto i=off1;i<off1+n1;i++) {
+                x1[0] = xp[i]; x1[1] = yp[i]; x1[2] = zp[i];
+                for (auto j=i+1;j<off1+n1;j++) {
+                    x2[0] = xp[j]; x2[1] = yp[j]; x2[2] = zp[j];
+                    if (FOFGridDist2(x1, x2, period) < ell2) ds.Link(i, j);
+                }
+            }
+        }
+
+        //search half of the neighbouring cells so that each cell pair is processed once
+        for (long long dx=-nrange[0];dx<=nrange[0];dx++) {
+        for (long long dy=-nrange[1];dy<=nrange[1];dy++) {
+        for (long long dz=-nrange[2];dz<=nrange[2];dz++) {
+            if (dx < 0 || (dx == 0 && dy < 0) || (dx == 0 && dy == 0 && dz <= 0)) continue;
+            //skip cells whose bounding boxes are further apart than the linking length
+            gap2 = 0;
+            gap = max(0LL, abs(dx)-1)*grid.cellsize[0]; gap2 += gap*gap;
+            gap = max(0LL, abs(dy)-1)*grid.cellsize[1]; gap2 += gap*gap;
+            gap = max(0LL, abs(dz)-1)*grid.cellsize[2]; gap2 += gap*gap;
+            if (gap2 >= ell2) continue;
+            jx[0] = ix[0]+dx; jx[1] = ix[1]+dy; jx[2] = ix[2]+dz;
+            if (!FOFGridWrapCell(grid, jx[0], 0) || !FOFGridWrapCell(grid, jx[1], 1) || !FOFGridWrapCell(grid, jx[2], 2)) continue;
+            d = FOFGridFindCell(grid, (jx[0]*grid.ncells[1]+jx[1])*grid.ncells[2]+jx[2]);
+            if (d < 0 || d == c) continue;
+            off2 = grid.celloffset[d];
+            n2 = grid.cellcount[d];
+            if (grid.iautolink) {
+                //cells already in the same group need not be checked
+                if (ds.Root(off1) == ds.Root(off2)) continue;
+                if (FOFGridCellsLinked(off1, n1, off2, n2, xp.data(), yp.data(), zp.data(), ell2, period)) ds.Link(off1, off2);
+            }
+            else {
+                for (auto i=off1;i<off1+n1;i++) {
+                    x1[0] = xp[i]; x1[1] = yp[i]; x1[2] = zp[i];
+                    for (auto j=off2;j<off2+n2;j++) {
+                        x2[0] = xp[j]; x2[1] = yp[j]; x2[2] = zp[j];
+                        if (FOFGridDist2(x1, x2, period) < ell2) ds.Link(i, j);
+                    }
+                }
+            }
+        }
+        }
+        }
+    }
+    vector<Double_t>().swap(xp);
+    vector<Double_t>().swap(yp);
+    vector<Double_t>().swap(zp);
+
+    //determine group sizes, remove small groups and order ids by decreasing size
+    newgid.resize(nbodies);
+    numgroups = BuildGroupIDsFromDisjointSet(ds, nbodies, minsize, newgid.data());
+    for (auto i=0;i<nbodies;i++) pfof[grid.index[i]] = newgid[i];
+
+    //update head and next, ordered by particle index
+    if (Head != NULL && Next != NULL) {
+        groupfirst.resize(numgroups+1, -1);
+        grouplast.resize(numgroups+1, -1);
+        for (auto i=0;i<nbodies;i++) {
+            Head[i] = i;
+            Next[i] = -1;
+            if (pfof[i] == 0) continue;
+            if (groupfirst[pfof[i]] == -1) groupfirst[pfof[i]] = i;
+            else Next[grouplast[pfof[i]]] = i;
+            grouplast[pfof[i]] = i;
+            Head[i] = groupfirst[pfof[i]];
+        }
+    }
+    if (opt.iverbose) cout<<ThisTask<<": found "<<numgroups<<" groups with cell-linked-list FOF in "<<MyGetTime()-time1<<endl;
+    return pfof;
+}
+
+/*!
+    Find all particles within sqrt(rdist2) of position x using a grid built by \ref FOFGridBuild,
+    storing their indices in nn and returning the number found.
+*/
+Int_t FOFGridSearchBallPos(FOFGrid &grid, Particle *Part, Coordinate &x, const Double_t rdist2, Int_t *nn)
+{
+    Int_t nt = 0, c, p;
+    long long ilo[3], ihi[3], jx[3];
+    Double_t rdist = sqrt(rdist2), xpos[3], ppos[3];
+    for (auto k=0;k<3;k++) {
+        xpos[k] = x[k];
+        ilo[k] = (long long)floor((x[k]-rdist-grid.xmin[k])/grid.cellsize[k]);
+        ihi[k] = (long long)floor((x[k]+rdist-grid.xmin[k])/grid.cellsize[k]);
+        //if periodic do not search the same cell twice
+        if (grid.period > 0 && ihi[k]-ilo[k] >= (long long)grid.ncells[k]) ihi[k] = ilo[k]+grid.ncells[k]-1;
+    }
+    for (auto ix=ilo[0];ix<=ihi[0];ix++) {
+    for (auto iy=ilo[1];iy<=ihi[1];iy++) {
+    for (auto iz=ilo[2];iz<=ihi[2];iz++) {
+        jx[0] = ix; jx[1] = iy; jx[2] = iz;
+        if (!FOFGridWrapCell(grid, jx[0], 0) || !FOFGridWrapCell(grid, jx[1], 1) || !FOFGridWrapCell(grid, jx[2], 2)) continue;
+        c = FOFGridFindCell(grid, (jx[0]*grid.ncells[1]+jx[1])*grid.ncells[2]+jx[2]);
+        if (c < 0) continue;
+        for (auto j=grid.celloffset[c];j<grid.celloffset[c]+grid.cellcount[c];j++) {
+            p = grid.index[j];
+            for (auto k=0;k<3;k++) ppos[k] = Part[p].GetPosition(k);
+            if (FOFGridDist2(xpos, ppos, grid.period) < rdist2) nn[nt++] = p;
+        }
+    }
+    }
+    }
+    return nt;
+}
+//@}
@@ -724,6 +724,8 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     string extrafield, extrafield2;
     int iextraoffset;
     double *extrafieldbuff = NULL;
+    //name of the optional potential data set
+    string potname;
 
     SetUniqueInputNames(opt);
 
@@ -791,12 +793,15 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     vector<hid_t> partsdataspaceall;
     vector<hid_t> partsdatasetall_extra;
     vector<hid_t> partsdataspaceall_extra;
+    vector<hid_t> partsdatasetall_pot;
+    vector<hid_t> partsdataspaceall_pot;
 
     //extra blocks to store info
     float *velfloatbuff=new float[chunksize*3];
     double *veldoublebuff=new double[chunksize*3];
     float *massfloatbuff=new float[chunksize];
     double *massdoublebuff=new double[chunksize];
+    double *potdoublebuff=NULL;
 #ifdef GASON
     float *ufloatbuff=new float[chunksize];
     double *udoublebuff=new double[chunksize];
@@ -919,6 +924,14 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
         for (auto &x:partsdataspaceall_extra) x=-1;
         extrafieldbuff = new double[numextrafields*chunksize];
     }
+    if (opt.uinfo.iinputpotential) {
+        partsdatasetall_pot.resize(opt.num_files*NHDFTYPE);
+        partsdataspaceall_pot.resize(opt.num_files*NHDFTYPE);
+        for (auto &x:partsdatasetall_pot) x=-1;
+        for (auto &x:partsdataspaceall_pot) x=-1;
+        potdoublebuff = new double[chunksize];
+        potname = HDFPotentialName(opt.ihdfnameconvention);
+    }
 #endif
     for(i=0; i<opt.num_files; i++) if(ireadfile[i]) {
         if(opt.num_files>1) sprintf(buf,"%s.%d.hdf5",opt.fname,(int)i);
@@ -1321,6 +1334,62 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
             for (auto &hidval:partsdataspace) HDF5CloseDataSpace(hidval);
             for (auto &hidval:partsdataset) HDF5CloseDataSet(hidval);
 
+            //get potentials if they are to be used when unbinding, types without the data set are flagged with NaN
+            if (opt.uinfo.iinputpotential) {
+              potname=HDFPotentialName(opt.ihdfnameconvention);
+              for (j=0;j<nusetypes;j++) {
+                k=usetypes[j];
+                if (HDF5DataSetExists(partsgroup[i*NHDFTYPE+k],potname)) {
+                  if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<potname<<endl;
+                  partsdataset[i*NHDFTYPE+k]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],potname);
+                  partsdataspace[i*NHDFTYPE+k]=HDF5OpenDataSpace(partsdataset[i*NHDFTYPE+k]);
+                }
+              }
+              if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
+                k=usetypes[j];
+                if (HDF5DataSetExists(partsgroup[i*NHDFTYPE+k],potname)) {
+                  partsdataset[i*NHDFTYPE+k]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],potname);
+                  partsdataspace[i*NHDFTYPE+k]=HDF5OpenDataSpace(partsdataset[i*NHDFTYPE+k]);
+                }
+              }
+              count=count2;
+              bcount=bcount2;
+              for (j=0;j<nusetypes;j++) {
+                k=usetypes[j];
+                if (partsdataset[i*NHDFTYPE+k]<0) {
+                  for (n=0;n<hdf_header_info[i].npart[k];n++) Part[count++].SetPotential(NAN);
+                  continue;
+                }
+                if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
+                else nchunk=chunksize;
+                for(n=0;n<hdf_header_info[i].npart[k];n+=nchunk)
+                {
+                  if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
+                  HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 1, nchunk, n);
+                  for (int nn=0;nn<nchunk;nn++) Part[count++].SetPotential(doublebuff[nn]);
+                }
+              }
+              if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
+                for (j=1;j<=nbusetypes;j++) {
+                  k=usetypes[j];
+                  if (partsdataset[i*NHDFTYPE+k]<0) {
+                    for (n=0;n<hdf_header_info[i].npart[k];n++) Pbaryons[bcount++].SetPotential(NAN);
+                    continue;
+                  }
+                  if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
+                  else nchunk=chunksize;
+                  for(n=0;n<hdf_header_info[i].npart[k];n+=nchunk)
+                  {
+                    if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
+                    HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 1, nchunk, n);
+                    for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetPotential(doublebuff[nn]);
+                  }
+                }
+              }
+              for (auto &hidval:partsdataspace) HDF5CloseDataSpace(hidval);
+              for (auto &hidval:partsdataset) HDF5CloseDataSet(hidval);
+            }
+
             //get masses, note that DM do not contain a mass field
             itemp++;
             for (j=0;j<nusetypes;j++) {
@@ -2342,6 +2411,25 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
 #endif
                 } //end of baryon read if not running search dm then baryons
 
+                //optional potentials, types without the data set are flagged with NaN
+                if (opt.uinfo.iinputpotential) {
+                  for (j=0;j<nusetypes;j++) {
+                    k=usetypes[j];
+                    if (HDF5DataSetExists(partsgroup[i*NHDFTYPE+k],potname)) {
+                      if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<potname<<endl;
+                      partsdatasetall_pot[i*NHDFTYPE+k]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],potname);
+                      partsdataspaceall_pot[i*NHDFTYPE+k]=HDF5OpenDataSpace(partsdatasetall_pot[i*NHDFTYPE+k]);
+                    }
+                  }
+                  if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
+                    k=usetypes[j];
+                    if (HDF5DataSetExists(partsgroup[i*NHDFTYPE+k],potname)) {
+                      partsdatasetall_pot[i*NHDFTYPE+k]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],potname);
+                      partsdataspaceall_pot[i*NHDFTYPE+k]=HDF5OpenDataSpace(partsdatasetall_pot[i*NHDFTYPE+k]);
+                    }
+                  }
+                }
+
                 if (numextrafields>0)
                 {
                     iextraoffset = 0;
@@ -2527,6 +2615,10 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                         if (hdf_header_info[i].mass[k]==0) {
                             HDF5ReadHyperSlabReal(massdoublebuff,partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp], partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp], 1, 1, nchunk, n, plist_id);
                         }
+                        //potentials
+                        if (opt.uinfo.iinputpotential && partsdatasetall_pot[i*NHDFTYPE+k]>=0) {
+                            HDF5ReadHyperSlabReal(potdoublebuff,partsdatasetall_pot[i*NHDFTYPE+k], partsdataspaceall_pot[i*NHDFTYPE+k], 1, 1, nchunk, n, plist_id);
+                        }
 #ifdef GASON
                         //self-energy
                         itemp++;
@@ -2702,6 +2794,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                         else Pbuf[ibufindex].SetMass(hdf_header_info[i].mass[k]);
                         Pbuf[ibufindex].SetPID(longbuff[nn]);
                         Pbuf[ibufindex].SetID(nn);
+                        if (opt.uinfo.iinputpotential) Pbuf[ibufindex].SetPotential(partsdatasetall_pot[i*NHDFTYPE+k]>=0 ? potdoublebuff[nn] : NAN);
                         if (k==HDFGASTYPE) Pbuf[ibufindex].SetType(GASTYPE);
                         else if (k==HDFDMTYPE) Pbuf[ibufindex].SetType(DARKTYPE);
 #ifdef HIGHRES
@@ -2913,6 +3006,10 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                       if (hdf_header_info[i].mass[k]==0) {
                           HDF5ReadHyperSlabReal(massdoublebuff,partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp], partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp], 1, 1, nchunk, n, plist_id);
                       }
+                      //potentials
+                      if (opt.uinfo.iinputpotential && partsdatasetall_pot[i*NHDFTYPE+k]>=0) {
+                          HDF5ReadHyperSlabReal(potdoublebuff,partsdatasetall_pot[i*NHDFTYPE+k], partsdataspaceall_pot[i*NHDFTYPE+k], 1, 1, nchunk, n, plist_id);
+                      }
 #ifdef GASON
                       //self-energy
                       itemp++;
@@ -2964,6 +3061,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                         else Pbuf[ibufindex].SetMass(hdf_header_info[i].mass[k]);
                         Pbuf[ibufindex].SetPID(longbuff[nn]);
                         Pbuf[ibufindex].SetID(nn);
+                        if (opt.uinfo.iinputpotential) Pbuf[ibufindex].SetPotential(partsdatasetall_pot[i*NHDFTYPE+k]>=0 ? potdoublebuff[nn] : NAN);
                         if (k==HDFGASTYPE) Pbuf[ibufindex].SetType(GASTYPE);
                         else if (k==HDFDMTYPE) Pbuf[ibufindex].SetType(DARKTYPE);
 #ifdef HIGHRES
@@ -3014,6 +3112,8 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                 for (auto &hidval:partsdatasetall) HDF5CloseDataSet(hidval);
                 for (auto &hidval:partsdataspaceall_extra) HDF5CloseDataSpace(hidval);
                 for (auto &hidval:partsdatasetall_extra) HDF5CloseDataSet(hidval);
+                for (auto &hidval:partsdataspaceall_pot) HDF5CloseDataSpace(hidval);
+                for (auto &hidval:partsdatasetall_pot) HDF5CloseDataSet(hidval);
                 for (auto &hidval:partsgroup) HDF5CloseGroup(hidval);
             }//end of try block
             /*
@@ -3256,6 +3356,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     delete[] veldoublebuff;
     delete[] massfloatbuff;
     delete[] massdoublebuff;
+    delete[] potdoublebuff;
 #ifdef GASON
     delete[] ufloatbuff;
     delete[] udoublebuff;
@@ -315,6 +315,11 @@ static inline hid_t HDF5OpenDataSpace(const hid_t &id){
     hid_t idval=H5Dget_space(id);
     return idval;
 }
+///check whether a data set is present in a group, used for optional fields such as the potential
+static inline bool HDF5DataSetExists(const hid_t &id, string name){
+    if (id<0) return false;
+    return (H5Lexists(id,name.c_str(),H5P_DEFAULT)>0);
+}
 
 
 static inline int whatisopen(hid_t fid) {
@@ -1269,6 +1274,13 @@ struct HDF_Header {
     }
 };
 
+///name of the gravitational potential data set of a particle group, which is optional in all naming conventions
+static inline string HDFPotentialName(int hdfnametype)
+{
+    if (hdfnametype==HDFSWIFTEAGLENAMES) return string("Potentials");
+    return string("Potential");
+}
+
 struct HDF_Part_Info {
     string names[HDFMAXPINFO];
     int ptype;
@@ -203,9 +203,10 @@ void AdjustBHQuantities(Options &opt, vector<Particle> &Part, const Int_t nbodie
 //@{
 
 ///Read local velocity density
-void ReadLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particle> &Part){
+void ReadLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particle> &Part, Int_t *inputorder){
     Int_t tempi;
     Double_t tempd;
+    vector<Double_t> density(nbodies);
     fstream Fin;
     char fname[1000];
     //set filename appropriate to mpi thread if necessary
@@ -223,7 +224,7 @@ void ReadLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particle
             cerr<<"File "<<fname<<" contains incorrect number of particles. Exiting\n";
             exit(9);
         }
-        for(Int_t i=0;i<nbodies;i++) {Fin.read((char*)&tempd,sizeof(Double_t));Part[i].SetDensity(tempd);}
+        for(Int_t i=0;i<nbodies;i++) {Fin.read((char*)&tempd,sizeof(Double_t));density[i]=tempd;}
     }
     else {
         Fin.open(fname,ios::in);
@@ -232,8 +233,11 @@ void ReadLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particle
             cerr<<"File "<<fname<<" contains incorrect number of particles. Exiting\n";
             exit(9);
         }
-        for(Int_t i=0;i<nbodies;i++) {Fin>>tempd;Part[i].SetDensity(tempd);}
+        for(Int_t i=0;i<nbodies;i++) {Fin>>tempd;density[i]=tempd;}
     }
+    //data is stored in input order
+    if (inputorder!=NULL) for(Int_t i=0;i<nbodies;i++) Part[i].SetDensity(density[inputorder[i]]);
+    else for(Int_t i=0;i<nbodies;i++) Part[i].SetDensity(density[i]);
     cout<<"Done"<<endl;
     Fin.close();
 }
@@ -244,9 +248,13 @@ void ReadLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particle
 //@{
 
 ///Writes local velocity density of each particle to a file
-void WriteLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particle> &Part){
+void WriteLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particle> &Part, Int_t *inputorder){
     fstream Fout;
     char fname[1000];
+    vector<Double_t> density(nbodies);
+    //data is stored in input order
+    if (inputorder!=NULL) for(Int_t i=0;i<nbodies;i++) density[inputorder[i]]=Part[i].GetDensity();
+    else for(Int_t i=0;i<nbodies;i++) density[i]=Part[i].GetDensity();
 #ifdef USEMPI
     if(opt.smname==NULL) sprintf(fname,"%s.smdata.%d",opt.outname,ThisTask);
     else sprintf(fname,"%s.%d",opt.smname,ThisTask);
@@ -258,13 +266,13 @@ void WriteLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particl
         Fout.open(fname,ios::out|ios::binary);
         Fout.write((char*)&nbodies,sizeof(Int_t));
         Double_t tempd;
-        for(Int_t i=0;i<nbodies;i++) {tempd=Part[i].GetDensity();Fout.write((char*)&tempd,sizeof(Double_t));}
+        for(Int_t i=0;i<nbodies;i++) {tempd=density[i];Fout.write((char*)&tempd,sizeof(Double_t));}
     }
     if (opt.ibinaryout==OUTBINARY) {
         Fout.open(fname,ios::out);
         Fout<<nbodies<<endl;
         Fout<<scientific<<setprecision(10);
-        for(Int_t i=0;i<nbodies;i++)Fout<<Part[i].GetDensity()<<endl;
+        for(Int_t i=0;i<nbodies;i++)Fout<<density[i]<<endl;
     }
     Fout.close();
 }
@@ -277,22 +285,28 @@ void WriteLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particl
 /*! Writes a tipsy formatted fof.grp array file that contains the number of particles first then for each particle the group id of that particle
     group zero is untagged particles. \n
 */
-void WriteFOF(Options &opt, const Int_t nbodies, Int_t *pfof){
+void WriteFOF(Options &opt, const Int_t nbodies, Int_t *pfof, Int_t *inputorder){
     fstream Fout;
     char fname[1000];
     sprintf(fname,"%s.fof.grp",opt.outname);
     cout<<"saving fof data to "<<fname<<endl;
     Fout.open(fname,ios::out);
+    //group ids are written in input order
+    Int_t *pfofout=pfof;
+    if (inputorder!=NULL) {
+        pfofout=new Int_t[nbodies];
+        for (Int_t i=0;i<nbodies;i++) pfofout[inputorder[i]]=pfof[i];
+    }
     if (opt.partsearchtype==PSTALL) {
         Fout<<nbodies<<endl;
-        for (Int_t i=0;i<nbodies;i++) Fout<<pfof[i]<<endl;
+        for (Int_t i=0;i<nbodies;i++) Fout<<pfofout[i]<<endl;
     }
     else if (opt.partsearchtype==PSTDARK) {
         Int_t nt=0;
         for (int i=0;i<NPARTTYPES;i++) nt+=opt.numpart[i];
         Fout<<nt<<endl;
         for (Int_t i=0;i<opt.numpart[GASTYPE];i++) Fout<<0<<endl;
-        for (Int_t i=0;i<nbodies;i++) Fout<<pfof[i]<<endl;
+        for (Int_t i=0;i<nbodies;i++) Fout<<pfofout[i]<<endl;
         for (Int_t i=0;i<opt.numpart[STARTYPE];i++) Fout<<0<<endl;
     }
     else if (opt.partsearchtype==PSTSTAR) {
@@ -301,16 +315,17 @@ void WriteFOF(Options &opt, const Int_t nbodies, Int_t *pfof){
         Fout<<nt<<endl;
         for (Int_t i=0;i<opt.numpart[GASTYPE];i++) Fout<<0<<endl;
         for (Int_t i=0;i<opt.numpart[DARKTYPE];i++) Fout<<0<<endl;
-        for (Int_t i=0;i<nbodies;i++) Fout<<pfof[i]<<endl;
+        for (Int_t i=0;i<nbodies;i++) Fout<<pfofout[i]<<endl;
     }
     else if (opt.partsearchtype==PSTGAS) {
         Int_t nt=0;
         for (int i=0;i<NPARTTYPES;i++) nt+=opt.numpart[i];
         Fout<<nt<<endl;
-        for (Int_t i=0;i<nbodies;i++) Fout<<pfof[i]<<endl;
+        for (Int_t i=0;i<nbodies;i++) Fout<<pfofout[i]<<endl;
         for (Int_t i=0;i<opt.numpart[DARKTYPE];i++) Fout<<0<<endl;
         for (Int_t i=0;i<opt.numpart[STARTYPE];i++) Fout<<0<<endl;
     }
+    if (inputorder!=NULL) delete[] pfofout;
     Fout.close();
     cout<<"Done"<<endl;
 }
@@ -3515,17 +3530,34 @@ void WriteCellValues(Options &opt, const Int_t nbodies, const Int_t ngrid, GridC
 
 /// \name Read group ids which can be useful if {\em Halo} have already been found
 //@{
-Int_t ReadPFOF(Options &opt, Int_t nbodies, Int_t *pfof){
+///Reads a group array file (see \ref WriteFOF), by default that of this run, returning the number of groups or -1 if the file does not match the particles
+Int_t ReadPFOF(Options &opt, Int_t nbodies, Int_t *pfof, char *inname){
     fstream Fin;
-    Int_t temp;
-    char fname[400];
+    Int_t temp, nt, noffset=0, nexpected=nbodies;
+    char fname[1400];
     Int_t ngroup=0;
-    sprintf(fname,"%s.fof.grp",opt.outname);
+    if (inname==NULL) inname=opt.outname;
+    sprintf(fname,"%s.fof.grp",inname);
     cout<<"reading fof data "<<fname<<endl;
+    if (!FileExists(fname)) {
+        cerr<<"File "<<fname<<" does not exist"<<endl;
+        return -1;
+    }
+    //the file lists all particles, with particles not searched written with group 0 in the type order of WriteFOF
+    if (opt.partsearchtype!=PSTALL) {
+        nexpected=0;
+        for (int i=0;i<NPARTTYPES;i++) nexpected+=opt.numpart[i];
+        if (opt.partsearchtype==PSTDARK) noffset=opt.numpart[GASTYPE];
+        else if (opt.partsearchtype==PSTSTAR) noffset=opt.numpart[GASTYPE]+opt.numpart[DARKTYPE];
+    }
     Fin.open(fname,ios::in);
-    Fin>>nbodies;
-    //nbodies=opt.numpart[DARKTYPE];
-    //for (Int_t i=0;i<opt.numpart[GASTYPE];i++) Fin>>temp;
+    Fin>>nt;
+    if (nt!=nexpected) {
+        cerr<<"File "<<fname<<" contains incorrect number of particles "<<nt<<" rather than "<<nexpected<<endl;
+        Fin.close();
+        return -1;
+    }
+    for (Int_t i=0;i<noffset;i++) Fin>>temp;
     for (Int_t i=0;i<nbodies;i++) {Fin>>pfof[i];if (pfof[i]>ngroup) ngroup=pfof[i];}
     Fin.close();
     cout<<"Done"<<endl;
@@ -23,8 +23,10 @@ void GetDenVRatio(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngrid
     Int_t **nn;
 
     Double_t w,wsum,maxdist,sv,vsv,fbg,tempdenv;
-    Coordinate vp,vmweighted;
-    Matrix isvweighted;
+    Coordinate vmweighted;
+    FixedVector<3> vp;
+    Matrix3 isvweighted;
+    vector<Matrix3> ginvdisp;
     Particle *ptemp;
     KDTree *tree;
 
@@ -60,6 +62,9 @@ private(i) if (nbodies > ompsubsearchnum)
     gveldisp=mpi_gveldisp;
     }
 #endif
+    //store the inverse dispersions as fixed size matrices for the interpolation
+    ginvdisp.resize(ngrid);
+    for (i=0;i<ngrid;i++) for (int j=0;j<3;j++) for (int k=0;k<3;k++) ginvdisp[i](j,k)=gveldisp[i](j,k);
     ptemp=new Particle[ngrid];
     for (i=0;i<ngrid;i++) ptemp[i]=Particle(1.0,grid[i].xm[0],grid[i].xm[1],grid[i].xm[2],0.0,0.0,0.0,i);
     tree=new KDTree(ptemp,ngrid,1,tree->TPHYS, tree->KEPAN,100,0,0,0,NULL,NULL,false);
@@ -98,7 +103,7 @@ if (nbodies > ompsubsearchnum)
         wsum=0.;
         maxdist=0.;
         vmweighted[0]=vmweighted[1]=vmweighted[2]=0.;
-        for (int j=0;j<3;j++) for (int k=0;k<3;k++) isvweighted(j,k)=0.0;
+        isvweighted=Matrix3(0.);
         Coordinate xpos(Part[i].GetPosition());
         tree->FindNearestPos(xpos,nn[tid],dist[tid],MAXNGRID+1);
         for (int j=0;j<=MAXNGRID;j++) {
@@ -110,13 +115,13 @@ if (nbodies > ompsubsearchnum)
             //w=1.0/dist[tid][j];
             wsum+=w;
             vmweighted=vmweighted+gvel[ptemp[nn[tid][j]].GetID()]*w;
-            isvweighted=isvweighted+gveldisp[ptemp[nn[tid][j]].GetID()]*w;
+            for (int m=0;m<9;m++) isvweighted.m[m]+=ginvdisp[ptemp[nn[tid][j]].GetID()].m[m]*w;
         }
         vmweighted=vmweighted*(1.0/wsum);
-        isvweighted=isvweighted*(1.0/wsum);
+        isvweighted*=(1.0/wsum);
         sv=sqrt(abs(isvweighted.Det()));
         for (int m=0;m<3;m++) vp[m]=Part[i].GetVelocity(m)-vmweighted[m];
-        vsv=0.;for (int m=0;m<3;m++) for (int n=0;n<3;n++) vsv+=vp[m]*vp[n]*isvweighted(m,n);
+        vsv=isvweighted.QuadraticForm(vp);
         fbg=log(sv)-0.5*vsv;
         Part[i].SetPotential(log(tempdenv)-log(norm)-fbg);
     }
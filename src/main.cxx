@@ -97,6 +97,9 @@ int main(int argc,char **argv)
     //to store (point to) particle data
     Int_t nbodies,nbaryons,ndark;
     vector<Particle> Part;
+    //input index of particles if they have been reordered after loading
+    vector<Int_t> sfcinputorder;
+    Int_t *inputorder=NULL;
     Particle *Pbaryons;
     KDTree *tree;
 
@@ -252,6 +255,13 @@ int main(int argc,char **argv)
     cout<<"TIME::"<<ThisTask<<" took "<<time1<<" to load "<<nbodies<<endl;
 #endif
 
+    //reorder particles along a space filling curve so that spatially close particles are close in memory,
+    //keeping the input index of each particle for outputs that are in input order
+    SFCReorderParticles(opt, nbodies, Part.data(), sfcinputorder);
+    if (sfcinputorder.size()>0) inputorder=sfcinputorder.data();
+    //keep any potentials read from the input, as the potential of particles is overwritten during the search
+    StoreInputPotentials(opt, nbodies, Part.data(), nbaryons, Pbaryons);
+
     //write out the configuration used by velociraptor having read in the data (as input data can contain cosmological information)
     WriteVELOCIraptorConfig(opt);
     WriteSimulationInfo(opt);
@@ -271,10 +281,10 @@ int main(int argc,char **argv)
 #else
     if (opt.iSubSearch==1) {
         time1=MyGetTime();
-        if(FileExists(fname4)) ReadLocalVelocityDensity(opt, nbodies,Part);
+        if(FileExists(fname4)) ReadLocalVelocityDensity(opt, nbodies,Part,inputorder);
         else  {
             GetVelocityDensity(opt, nbodies, Part.data());
-            WriteLocalVelocityDensity(opt, nbodies,Part);
+            WriteLocalVelocityDensity(opt, nbodies,Part,inputorder);
         }
         time1=MyGetTime()-time1;
         cout<<"TIME::"<<ThisTask<<" took "<<time1<<" to analyze/read local velocity density for "<<Nlocal<<" with "<<nthreads<<endl;
@@ -288,7 +298,24 @@ int main(int argc,char **argv)
     if (!opt.iSingleHalo) {
 #ifndef USEMPI
         time1=MyGetTime();
-        pfof=SearchFullSet(opt,nbodies,Part,ngroup);
+        //if requested, seed the search with the groups of a previous snapshot, stored in input order
+        Int_t *pfofprev=NULL;
+        if (opt.warmstartname!=NULL) {
+            pfofprev=new Int_t[nbodies];
+            if (ReadPFOF(opt,nbodies,pfofprev,opt.warmstartname)<0) {
+                cout<<"Unable to warm start FOF search, searching from scratch"<<endl;
+                delete[] pfofprev;
+                pfofprev=NULL;
+            }
+            else if (inputorder!=NULL) {
+                Int_t *pfofinput=pfofprev;
+                pfofprev=new Int_t[nbodies];
+                for (Int_t i=0;i<nbodies;i++) pfofprev[i]=pfofinput[inputorder[i]];
+                delete[] pfofinput;
+            }
+        }
+        pfof=SearchFullSet(opt,nbodies,Part,ngroup,pfofprev);
+        if (pfofprev!=NULL) delete[] pfofprev;
         nhalos=ngroup;
         cout<<"TIME:: took "<<time1<<" to search "<<nbodies<<" with "<<nthreads<<endl;
 #else
@@ -469,7 +496,7 @@ int main(int argc,char **argv)
         MPICollectFOF(Ntotal, pfof);
         if (ThisTask==0) WriteFOF(opt,Ntotal,mpi_pfof);
 #else
-        WriteFOF(opt,nbodies,pfof);
+        WriteFOF(opt,nbodies,pfof,inputorder);
 #endif
     }
     numingroup=BuildNumInGroup(Nlocal, ngroup, pfof);
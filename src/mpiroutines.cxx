@@ -4616,7 +4616,7 @@ void MPIUpdateExportList(const Int_t nbodies, Particle *Part, Int_t *&pfof, Int_
     the number of links found between the local particles and all other exported particles from all other mpi domains.
     \todo need to update lengths if strucden flag used to limit particles for which real velocity density calculated
 */
-Int_t MPILinkAcross(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Int_tree_t *&Len, Int_tree_t *&Head, Int_tree_t *&Next, Double_t rdist2){
+Int_t MPILinkAcross(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Int_tree_t *&Len, Int_tree_t *&Head, Int_tree_t *&Next, Double_t rdist2, FOFGrid *grid){
     Int_t i,j,k;
     Int_t links=0;
     Int_t nbuffer[NProcs];
@@ -4626,7 +4626,8 @@ Int_t MPILinkAcross(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&
     for (i=0;i<NImport;i++) {
         for (j=0;j<3;j++) x[j]=PartDataGet[i].GetPosition(j);
         //find all particles within a search radius of the imported particle
-        nt=tree->SearchBallPosTagged(x, rdist2, nn);
+        if (grid!=NULL) nt=FOFGridSearchBallPos(*grid, Part, x, rdist2, nn);
+        else nt=tree->SearchBallPosTagged(x, rdist2, nn);
         for (Int_t ii=0;ii<nt;ii++) {
             k=nn[ii];
             //if the imported particle does not belong to a group
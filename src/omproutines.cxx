@@ -112,17 +112,22 @@ Int_t OpenMPLocalSearch(Options &opt,
 {
     Int_t i, orgIndex, ng = 0, ngtot=0;
     Int_t *p3dfofomp;
+    FOFGrid localgrid;
 #ifndef USEMPI
     int ThisTask=0,NProcs=1;
 #endif
     double time1=MyGetTime();
     cout<<ThisTask<<": Starting local openmp searches "<<endl;
     #pragma omp parallel default(shared) \
-    private(i,p3dfofomp,orgIndex, ng)
+    private(i,p3dfofomp,orgIndex, ng, localgrid)
     {
     #pragma omp for schedule(dynamic) nowait reduction(+:ngtot)
     for (i=0;i<numompregions;i++) {
         if (opt.partsearchtype==PSTALL && opt.iBaryonSearch>1) p3dfofomp=tree3dfofomp[i]->FOFCriterionSetBasisForLinks(fofcmp,param,ng,ompminsize,0,0,FOFchecktype, &Head[ompdomain[i].noffset], &Next[ompdomain[i].noffset]);
+        else if (opt.iFOFgrid) {
+            p3dfofomp=FOFGridSearch(opt, ompdomain[i].ncount, &Part.data()[ompdomain[i].noffset], localgrid, rdist, opt.p, ng, ompminsize, &Head[ompdomain[i].noffset], &Next[ompdomain[i].noffset]);
+            localgrid.Clear();
+        }
         else p3dfofomp=tree3dfofomp[i]->FOF(rdist,ng,ompminsize,0, &Head[ompdomain[i].noffset], &Next[ompdomain[i].noffset]);
         if (ng > 0) {
             for (int j=ompdomain[i].noffset;j<ompdomain[i].noffset+ompdomain[i].ncount;j++)
@@ -360,4 +365,237 @@ void OpenMPHeadNextUpdate(const Int_t nbodies, vector<Particle> &Part, const Int
 
 //@}
 
+/// \name Single tree parallel FOF using a concurrent disjoint set
+//@{
+
+///link all particle pairs of two leaves that are within the linking length. Only pairs of basis particles are linked,
+///a non-basis particle is attached to the set of the first basis particle found within the linking length
+inline void OpenMPUnionFindLinkLeafPair(Node *leaf1, Node *leaf2, vector<Particle> &Part,
+    DisjointSet &ds, vector<char> &isbasis,
+    const Double_t ell2, const Double_t period)
+{
+    Int_t jstart;
+    Double_t d2, dx, x1[3];
+    bool isame = (leaf1 == leaf2);
+    for (Int_t i=leaf1->GetStart();i<leaf1->GetEnd();i++) {
+        for (auto k=0;k<3;k++) x1[k] = Part[i].GetPosition(k);
+        if (isame) jstart = i+1;
+        else jstart = leaf2->GetStart();
+        for (Int_t j=jstart;j<leaf2->GetEnd();j++) {
+            if (!isbasis[i] && !isbasis[j]) continue;
+            d2 = 0;
+            for (auto k=0;k<3;k++) {
+                dx = x1[k]-Part[j].GetPosition(k);
+                if (period > 0) {
+                    if (dx > 0.5*period) dx -= period;
+                    else if (dx < -0.5*period) dx += period;
+                }
+                d2 += dx*dx;
+            }
+            if (d2 >= ell2) continue;
+            if (isbasis[i] && isbasis[j]) ds.Link(i, j);
+            else if (isbasis[i]) ds.Attach(j, i);
+            else ds.Attach(i, j);
+        }
+    }
+}
+
+///walk the tree from a node, linking the leaf to all leaves at or after it in index order that lie within the linking length
+void OpenMPUnionFindLinkLeaf(Node *np, Node *leaf, const Int_t bsize, vector<Particle> &Part,
+    DisjointSet &ds, vector<char> &isbasis,
+    const Double_t ell2, const Double_t period)
+{
+    //pairs with leaves earlier in the index order are processed by those leaves
+    if (np->GetEnd() <= leaf->GetStart()) return;
+    if (FOFNodeDist2(np, leaf, period) >= ell2) return;
+    if (np->GetCount()>bsize) {
+        OpenMPUnionFindLinkLeaf(((SplitNode*)np)->GetLeft(), leaf, bsize, Part, ds, isbasis, ell2, period);
+        OpenMPUnionFindLinkLeaf(((SplitNode*)np)->GetRight(), leaf, bsize, Part, ds, isbasis, ell2, period);
+    }
+    else OpenMPUnionFindLinkLeafPair(leaf, np, Part, ds, isbasis, ell2, period);
+}
+
+/*!
+    3D FOF search of the full particle list using a single tree and a concurrent disjoint set.
+    Threads process leaf-leaf pairs of the tree directly, joining sets with compare and swap operations,
+    so no domain decomposition, particle import, linking across domains or resorting of particles is required.
+    Assumes the tree has been built on Part and the input order overwritten so that particle ids are array indices.
+    If basischeck is not NULL, only particles passing the check (returning 0) can generate links, as in
+    FOFCriterionSetBasisForLinks. Other particles join the group of one basis particle within the linking length
+    and so never bridge two groups.
+    Returns the group id array ordered by decreasing group size with groups below minsize set to 0.
+*/
+Int_t *OpenMPUnionFindFOF(Options &opt, const Int_t nbodies, vector<Particle> &Part, KDTree *&tree,
+    Double_t *param, FOFcheckfunc basischeck, Int_t &numgroups, const Int_t minsize)
+{
+#ifndef USEMPI
+    int ThisTask=0,NProcs=1;
+#endif
+    Int_t *pfof = new Int_t[nbodies];
+    DisjointSet ds(nbodies);
+    vector<char> isbasis(nbodies);
+    vector<Node*> leaves;
+    Double_t ell2 = param[1], period = opt.p;
+    double time1 = MyGetTime();
+
+    #pragma omp parallel for default(shared) schedule(static)
+    for (Int_t i=0;i<nbodies;i++) {
+        if (basischeck == NULL) isbasis[i] = 1;
+        else isbasis[i] = (basischeck(Part[i], param) == 0);
+    }
+    FOFGetLeafNodes(tree->GetRoot(), opt.Bsize, leaves);
+    if (opt.iverbose) cout<<ThisTask<<": starting union-find FOF over "<<leaves.size()<<" leaves "<<endl;
+
+    #pragma omp parallel for default(shared) schedule(dynamic,64)
+    for (Int_t i=0;i<(Int_t)leaves.size();i++) {
+        OpenMPUnionFindLinkLeaf(tree->GetRoot(), leaves[i], opt.Bsize, Part, ds, isbasis, ell2, period);
+    }
+
+    //set group id to the root index, offset by one so that 0 remains unassigned
+    #pragma omp parallel for default(shared) schedule(static)
+    for (Int_t i=0;i<nbodies;i++) pfof[i] = ds.Root(i)+1;
+    if (opt.iverbose) cout<<ThisTask<<": finished union-find linking in "<<MyGetTime()-time1<<endl;
+
+    //remove small groups and order by size
+    numgroups = OpenMPResortParticleandGroups(nbodies, Part, pfof, minsize);
+    if (opt.iverbose) cout<<ThisTask<<": found "<<numgroups<<" groups with union-find FOF in "<<MyGetTime()-time1<<endl;
+    return pfof;
+}
+//@}
+
+/// \name OpenMP threshold calibration
+//@{
+
+///minimum wall time of a few repeats of a kernel acting on n particles with nthreads
+double OpenMPCalibrationTime(const function<void(Int_t,int)> &kernel, Int_t n, int nthreads)
+{
+    double tmin=0, t;
+    for (auto r=0;r<3;r++) {
+        t=MyGetTime();
+        kernel(n,nthreads);
+        t=MyGetTime()-t;
+        if (r==0 || t<tmin) tmin=t;
+    }
+    return tmin;
+}
+
+///smallest of the sizes nmin*factor^i <= nmax at which running a kernel with all threads is faster than a single thread.
+///If no size benefits, returns twice the largest size tried
+Int_t OpenMPCalibrationCutOver(const function<void(Int_t,int)> &kernel, Int_t nmin, Int_t nmax, Int_t factor, int nthreads)
+{
+    Int_t n;
+    for (n=nmin;n<=nmax;n*=factor) {
+        if (OpenMPCalibrationTime(kernel,n,nthreads)<0.9*OpenMPCalibrationTime(kernel,n,1)) return n;
+    }
+    return n/factor*2;
+}
+
+/*!
+    Calibrate the OpenMP thresholds (see \ref OMPLIMS) for this machine and number of threads by timing the typical kernels
+    on synthetic particle distributions of increasing size and choosing the size at which the parallel version becomes faster.
+    The kernels are
+    - the direct PP potential calculation used in unbinding, setting ompunbindnum and potompcalcnum
+    - the reductions used in calculating properties, setting omppropnum
+    - simple per particle updates (such as periodic wrapping), setting ompperiodnum and ompsortsize
+    - tree ball searches used in FOF searches, setting ompsearchnum and ompsubsearchnum
+
+    Thresholds set explicitly in the config are not calibrated. ompsplitsubsearchnum and ompfofsearchnum select how a search is decomposed
+    rather than whether a loop is threaded, and potppcalcnum changes the potential calculated, so these are not calibrated.
+*/
+void CalibrateOpenMPThresholds(Options &opt)
+{
+    int nthreads = omp_get_max_threads();
+    if (nthreads==1) return;
+    double time1=MyGetTime();
+    const Int_t nmax=262144;
+    vector<Particle> Part(nmax);
+    Double_t *phi = new Double_t[nmax];
+    Double_t period[3]={1.0,1.0,1.0};
+    unsigned long long seed=88172645463325252ULL;
+    //simple xorshift generator so that the calibration does not depend on the state of any other generator
+    auto uniform=[&seed]() {
+        seed^=seed<<13;seed^=seed>>7;seed^=seed<<17;
+        return (Double_t)(seed>>11)*(1.0/9007199254740992.0);
+    };
+    for (auto i=0;i<nmax;i++) {
+        Part[i].SetMass(1.0);
+        for (auto k=0;k<3;k++) Part[i].SetPosition(k,uniform());
+        Part[i].SetVelocity(uniform()-0.5,uniform()-0.5,uniform()-0.5);
+        Part[i].SetID(i);
+    }
+
+    //direct PP potential
+    auto potkernel=[&](Int_t n, int nt) {
+        #pragma omp parallel for default(shared) schedule(dynamic,16) num_threads(nt)
+        for (auto i=0;i<n;i++) {
+            Double_t pot=0, r2;
+            for (auto j=0;j<n;j++) {
+                if (j==i) continue;
+                r2=0;
+                for (auto k=0;k<3;k++) r2+=(Part[i].GetPosition(k)-Part[j].GetPosition(k))*(Part[i].GetPosition(k)-Part[j].GetPosition(k));
+                pot-=Part[j].GetMass()/sqrt(r2+1e-6);
+            }
+            phi[i]=pot;
+        }
+    };
+    //reduction of centre of mass and velocity dispersion
+    auto propkernel=[&](Int_t n, int nt) {
+        Double_t cmx=0, cmy=0, cmz=0, sigv=0, mtot=0;
+        #pragma omp parallel for default(shared) schedule(static) num_threads(nt) reduction(+:mtot,sigv,cmx,cmy,cmz)
+        for (auto i=0;i<n;i++) {
+            mtot+=Part[i].GetMass();
+            cmx+=Part[i].GetMass()*Part[i].GetPosition(0);
+            cmy+=Part[i].GetMass()*Part[i].GetPosition(1);
+            cmz+=Part[i].GetMass()*Part[i].GetPosition(2);
+            for (auto k=0;k<3;k++) sigv+=Part[i].GetMass()*Part[i].GetVelocity(k)*Part[i].GetVelocity(k);
+        }
+        phi[0]=cmx+cmy+cmz+sigv/mtot;
+    };
+    //periodic wrapping
+    auto periodkernel=[&](Int_t n, int nt) {
+        #pragma omp parallel for default(shared) schedule(static) num_threads(nt)
+        for (auto i=0;i<n;i++) {
+            for (auto k=0;k<3;k++) phi[i]=Part[i].GetPosition(k)-floor(Part[i].GetPosition(k));
+        }
+    };
+
+    if (opt.ompunbindnumset<0 || opt.potompcalcnumset<0) {
+        Int_t ncut=OpenMPCalibrationCutOver(potkernel,64,4096,2,nthreads);
+        if (opt.ompunbindnumset<0) ompunbindnum=ncut;
+        if (opt.potompcalcnumset<0) potompcalcnum=ncut;
+    }
+    if (opt.omppropnumset<0) omppropnum=OpenMPCalibrationCutOver(propkernel,1000,nmax,4,nthreads);
+    if (opt.ompperiodnumset<0 || opt.ompsortsizeset<0) {
+        Int_t ncut=OpenMPCalibrationCutOver(periodkernel,1000,nmax,4,nthreads);
+        if (opt.ompperiodnumset<0) ompperiodnum=ncut;
+        if (opt.ompsortsizeset<0) ompsortsize=ncut;
+    }
+    if (opt.ompsearchnumset<0 || opt.ompsubsearchnumset<0) {
+        KDTree *tree;
+        tree=new KDTree(Part.data(),nmax,opt.Bsize,tree->TPHYS,tree->KEPAN,100,0,0,0,period);
+        //linking length giving of order 10 neighbours per particle
+        Double_t rdist2=pow(10.0/(4.0/3.0*M_PI*nmax),2.0/3.0);
+        auto searchkernel=[&](Int_t n, int nt) {
+            #pragma omp parallel default(shared) num_threads(nt)
+            {
+            Int_t *nn=new Int_t[nmax];
+            Double_t x[3];
+            #pragma omp for schedule(dynamic,1000)
+            for (auto i=0;i<n;i++) {
+                for (auto k=0;k<3;k++) x[k]=Part[i].GetPosition(k);
+                phi[i]=tree->SearchBallPosTagged(x,rdist2,nn);
+            }
+            delete[] nn;
+            }
+        };
+        Int_t ncut=OpenMPCalibrationCutOver(searchkernel,1000,nmax/4,4,nthreads);
+        if (opt.ompsearchnumset<0) ompsearchnum=ncut;
+        if (opt.ompsubsearchnumset<0) ompsubsearchnum=ncut;
+        delete tree;
+    }
+    delete[] phi;
+    if (opt.iverbose) cout<<"Calibrated OpenMP thresholds for "<<nthreads<<" threads in "<<MyGetTime()-time1<<endl;
+}
+//@}
+
 #endif
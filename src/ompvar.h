@@ -24,15 +24,29 @@ using namespace Math;
 using namespace NBody;
 
 /// \defgroup OMPLIMS For determining whether loop contains enough for openm to be worthwhile.
+/// The limits are variables, set at start up from the OMP_*_min_num config options or by calibration
+/// (see \ref SetOpenMPThresholds), otherwise taking the default values given here.
 //@{
-#define ompsplitsubsearchnum 10000000
-#define ompsubsearchnum 10000
-#define ompsearchnum 50000
-#define ompunbindnum 1000
-#define ompperiodnum 1000000
-#define omppropnum 50000
-#define ompfofsearchnum 2000000
-#define ompsortsize 1000000
+#define OMPDEFAULTSPLITSUBSEARCHNUM 10000000
+#define OMPDEFAULTSUBSEARCHNUM 10000
+#define OMPDEFAULTSEARCHNUM 50000
+#define OMPDEFAULTUNBINDNUM 1000
+#define OMPDEFAULTPERIODNUM 1000000
+#define OMPDEFAULTPROPNUM 50000
+#define OMPDEFAULTFOFSEARCHNUM 2000000
+#define OMPDEFAULTSORTSIZE 1000000
+extern Int_t ompsplitsubsearchnum, ompsubsearchnum, ompsearchnum, ompunbindnum;
+extern Int_t ompperiodnum, omppropnum, ompfofsearchnum, ompsortsize;
+//@}
+
+/// \defgroup OMPFOFTYPES Type of OpenMP FOF search of the full particle list
+//@{
+///no OpenMP specific FOF search
+#define OMPFOFNONE 0
+///decompose into domains, search each and link across domains
+#define OMPFOFDOMAIN 1
+///single tree search using a concurrent disjoint set
+#define OMPFOFUNIONFIND 2
 //@}
 
 #ifdef USEOPENMP 
@@ -22,6 +22,8 @@ void usage(void);
 void GetArgs(const int argc, char *argv[], Options &opt);
 void GetParamFile(Options &opt);
 void ConfigCheck(Options &opt);
+///set OpenMP thresholds from config, calibrating them if requested
+void SetOpenMPThresholds(Options &opt);
 void NOMASSCheck(Options &opt);
 
 //@}
@@ -58,14 +60,14 @@ void AdjustStarQuantities(Options &opt, vector<Particle> &Part, const Int_t nbod
 ///Adjust BH particles/quantities to appropriate units
 void AdjustBHQuantities(Options &opt, vector<Particle> &Part, const Int_t nbodies);
 
-///Read local velocity density
-void ReadLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particle> &Part);
-///Writes local velocity density of each particle to a file
-void WriteLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particle> &Part);
+///Read local velocity density, stored in input order (inputorder maps particle index to input index if particles have been reordered)
+void ReadLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particle> &Part, Int_t *inputorder=NULL);
+///Writes local velocity density of each particle to a file in input order
+void WriteLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particle> &Part, Int_t *inputorder=NULL);
 
 
-///Writes a tipsy formatted fof.grpfile
-void WriteFOF(Options &opt, const Int_t nbodies, Int_t *pfof);
+///Writes a tipsy formatted fof.grpfile in input order
+void WriteFOF(Options &opt, const Int_t nbodies, Int_t *pfof, Int_t *inputorder=NULL);
 ///Writes a pg list file (first in effective index order of input file(s), second is particle ids
 void WritePGList(Options &opt, const Int_t ngroups, const Int_t ng, Int_t *numingroup, Int_t **pglist, Int_t *ids);
 ///Write catalog information (number of groups, number in groups, number of particles in groups, particle pids)
@@ -113,7 +115,7 @@ void WriteAHFProperties(Options &opt, const Int_t ngroups, PropData *pdata);
 ///read a group file which can be useful if a halo search has already been run and one only wishes to
 ///identify substructures
 //@{
-Int_t ReadPFOF(Options &opt, Int_t nbodies, Int_t *pfof);
+Int_t ReadPFOF(Options &opt, Int_t nbodies, Int_t *pfof, char *inname=NULL);
 Int_t ReadFOFGroupBinary(Options &opt, Int_t nbodies, Int_t *pfof, Int_t *idtoindex, Int_t minid, Particle *p);
 //@}
 
@@ -143,6 +145,8 @@ void WriteExtendedOutput (Options &opt, Int_t numgroups, Int_t nbodies, PropData
 KDTree* InitializeTreeGrid(Options &opt, const Int_t nbodies, Particle *Part);
 ///Fill cells of grid from tree
 void FillTreeGrid(Options &opt, const Int_t nbodies, const Int_t ngrid, KDTree *&tree, Particle *Part, GridCell* &grid);
+///Fill cells of grid from the cells of a parent structure, returning the number of cells or 0 if the parent cells do not resolve the structure
+Int_t FillTreeGridFromParent(Options &opt, const Int_t nbodies, Particle *Part, Int_t *parentcell, GridCell* &grid);
 
 //@}
 
@@ -201,8 +205,8 @@ Int_t GetOutliersValues(Options &opt, const Int_t nbodies, Particle *Part, int s
 */
 //@{
 
-///Search full system without finding outliers first
-Int_t *SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part, Int_t &numgroups);
+///Search full system without finding outliers first, optionally seeding the 3D FOF search with the group ids of a previous snapshot
+Int_t *SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part, Int_t &numgroups, Int_t *pfofprev=NULL);
 ///Search the outliers
 Int_t *SearchSubset(Options &opt, const Int_t nbodies, const Int_t nsubset, Particle *Partsubset, Int_t &numgroups, Int_t sublevel=0, Int_t *pnumcores=NULL);
 ///Search for subsubstructures
@@ -230,6 +234,32 @@ void AdjustStructureForPeriod(Options &opt, const Int_t nbodies, vector<Particle
 void AdjustHaloPositionForPeriod(Options &opt, Int_t ngroup, Int_t *&numingroup, PropData *&pdata);
 //@}
 
+/// \name Cell-linked-list FOF routines
+/// see \ref fofgrid.cxx for implementation
+//@{
+///build the grid of occupied cells used by the cell-linked-list FOF search
+void FOFGridBuild(FOFGrid &grid, const Int_t nbodies, Particle *Part, const Double_t rdist, const Double_t period);
+///3D FOF search using a cell-linked-list
+Int_t *FOFGridSearch(Options &opt, const Int_t nbodies, Particle *Part, FOFGrid &grid,
+    const Double_t rdist, const Double_t period, Int_t &numgroups, const Int_t minsize,
+    Int_tree_t *Head=NULL, Int_tree_t *Next=NULL);
+///find all particles within a search radius using the grid
+Int_t FOFGridSearchBallPos(FOFGrid &grid, Particle *Part, Coordinate &x, const Double_t rdist2, Int_t *nn);
+//@}
+
+/// \name Space filling curve routines
+/// see \ref spacefillingcurve.cxx for implementation
+//@{
+///Morton key of a cell with 21 bit coordinates
+unsigned long long SFCMortonKey(unsigned int ix, unsigned int iy, unsigned int iz);
+///Hilbert key of a cell with 21 bit coordinates
+unsigned long long SFCHilbertKey(unsigned int ix, unsigned int iy, unsigned int iz);
+///parallel radix sort of keys, permuting index alongside
+void SFCRadixSort(vector<unsigned long long> &key, vector<Int_t> &index);
+///reorder particles along a space filling curve, storing the input index of each particle in inputorder
+void SFCReorderParticles(Options &opt, const Int_t nbodies, Particle *Part, vector<Int_t> &inputorder);
+//@}
+
 /// \name Extra routines used in iterative search
 //@{
 
@@ -248,9 +278,15 @@ inline void DetermineGroupMergerConnections(Particle *Partsubset, Int_t numgroup
 ///used to search particle list using tree to tag particles based on a comparison function (here distance information is used)
 inline void SearchForNewLinks(Int_t nsubset, KDTree *tree, Particle *Partsubset, Int_t *pfof, FOFcompfunc &fofcmp, Double_t *param,
     Int_t newlinks, Int_t *newlinksIndex, Int_t **nnID, Double_t **dist2, int nthreads);
-///used to search particle list using tree to tag particles based on a comparison function (here distance information is NOT used)
+///build a compressed neighbour list of outlier particles so that repeated searches do not need to walk the tree
+void BuildOutlierNeighbourList(const Int_t nsubset, KDTree *tree, Particle *Partsubset, Double_t ellthreshold, Double_t rmax2,
+    vector<Int_t> &nnoffset, vector<Int_t> &nnlist);
+///used to tag the neighbours in a neighbour list based on a comparison function
+inline void SearchCriterionNeighbourList(Int_t target, FOFcompfunc &fofcmp, Double_t *param, Int_t iGroup, Particle *Partsubset, Int_t *nnID,
+    Int_t *nnoffset, Int_t *nnlist);
+///used to search particle list using tree, or a neighbour list if provided, to tag particles based on a comparison function (here distance information is NOT used)
 inline void SearchForNewLinks(Int_t nsubset, KDTree *tree, Particle *Partsubset, Int_t *pfof, FOFcompfunc &fofcmp, Double_t *param,
-    Int_t newlinks, Int_t *newlinksIndex, Int_t **nnID, int nthreads);
+    Int_t newlinks, Int_t *newlinksIndex, Int_t **nnID, int nthreads, Int_t *nnoffset=NULL, Int_t *nnlist=NULL);
 ///used to link new tag particles1
 inline void LinkUntagged(Particle *Partsubset, Int_t numgroups, Int_t *pfof, Int_t *numingroup, Int_t **pglist,
     Int_t newlinks, Int_t *numgrouplinksIndex, Int_t **newIndex,
@@ -272,19 +308,76 @@ inline Int_t MergeHaloGroups(Options &opt, Particle *Partsubset, Int_t numgroups
 void GetNodeList(Node *np, Int_t &ncell, Node **nodelist, const Int_t bsize);
 ///used for tree walk in potential calculation
 inline void MarkCell(Node *np, Int_t *marktreecell, Int_t *markleafcell, Int_t &ntreecell, Int_t &nleafcell, const Int_t bsize, Double_t *cR2max, Coordinate *cm, Double_t *cmtot, Coordinate xpos, Double_t eps2);
-
+///direct summation of the potential of all pairs of packed particles, in working precision T (float or double)
+template<typename T> void PotentialPPKernel(const Int_t n, const T *x, const T *y, const T *z, const T *m,
+    Double_t *phi, const Double_t eps2);
+///direct summation of the potential of packed source particles at packed target particles, in working precision T (float or double)
+template<typename T> void PotentialPPSourceKernel(const Int_t nt, const T *tx, const T *ty, const T *tz, const Int_t tstart,
+    const Int_t ns, const T *sx, const T *sy, const T *sz, const T *sm, const Int_t *sindex,
+    Double_t *phi, const Double_t eps2);
+///origin of packed positions in the potential calculation
+Coordinate PotentialReferencePosition(const Int_t n, Particle *P);
+///used for tree walk shared by the particles of a leaf in potential calculation
+inline void MarkCellGroup(Node *np, Int_t *marktreecell, Int_t *markleafcell, Int_t &ntreecell, Int_t &nleafcell, const Int_t bsize, Double_t *cR2max, Coordinate *cm, Coordinate &xleaf, Double_t rleaf);
+
+///estimated cost of the potential calculation of a group
+double GroupPotentialCost(Int_t n);
+///estimated cost of unbinding a group
+double GroupUnbindCost(Int_t n);
+///process groups in order of decreasing estimated cost
+void GroupTasksByCost(Int_t numgroups, Int_t *numingroup, Int_t minompnum,
+    const function<double(Int_t)> &groupcost, const function<void(Int_t)> &groupwork);
+///store the potentials read from the input by particle id
+void StoreInputPotentials(Options &opt, const Int_t nbodies, Particle *Part, const Int_t nbaryons, Particle *Pbaryons);
+///set the potentials of particles to those read from the input
+bool GetInputPotentials(Options &opt, const Int_t n, Particle *P);
+///potential energy of a group from input potentials, removing the external potential
+void GroupPotentialFromInput(Options &opt, const Int_t n, Particle *P);
+///fraction of the particles of a group that are bound in its centre of mass frame
+Double_t GroupBoundFraction(Options &opt, Int_t n, Particle *P);
+///potential of a group in mixed precision, compared to double precision
+void ValidateGroupPotential(Options &opt, Int_t n, Particle *P, Double_t &dpot, Double_t &dfrac);
+///report the largest differences found when validating mixed precision potentials
+void ReportPotentialValidation(Int_t numgroups, vector<Double_t> &dpot, vector<Double_t> &dfrac);
+///centre of mass velocity of the particles closest to a centre
+Coordinate CentralCMVel(Int_t n, Particle *P, const Coordinate &centre, Int_t npot);
+///iteratively unbind a single group
+int UnbindGroup(Options &opt, Int_t i, Int_t &ning, Particle *groupPart, Int_t *&pglist, Int_t *&pfof,
+    Double_t &gmass, Coordinate &cmvel);
 ///Interface for unbinding proceedure
 int CheckUnboundGroups(Options opt, const Int_t nbodies, Particle *Part, Int_t &ngroup, Int_t *&pfof, Int_t *numingroup=NULL, Int_t **pglist=NULL,int ireorder=1, Int_t *groupflag=NULL);
 ///check if group self-bound
-int Unbind(Options &opt, Particle **gPartList, Int_t &numgroups, Int_t *numingroup, Int_t *pfof, Int_t **pglist, int ireorder=1);
+int Unbind(Options &opt, Particle **gPartList, Int_t &numgroups, Int_t *numingroup, Int_t *pfof, Int_t **pglist, int ireorder=1, int *inputpotflag=NULL);
 int Unbind(Options &opt, Particle *Part, Int_t &numgroups, Int_t *&numingroup, Int_t *&noffset, Int_t *&pfof);
 ///calculate the potential of an array of particles
 void Potential(Options &opt, Int_t nbodies, Particle *Part, Double_t *potV);
 void Potential(Options &opt, Int_t nbodies, Particle *Part);
+///subsample particles for the approximate potential, see \ref ParticleSubSample
 void ParticleSubSample(Options &opt, const Int_t nbodies, Particle *&Part,
-    Int_t &newnbodies, Particle *&newpart, double &mr);
+    Int_t &newnbodies, Particle *&newpart, double &mr, Int_t nsub=0, KDTree **leaftree=NULL, vector<leaf_node_info> *leafnodes=NULL);
 void PotentialTree(Options &opt, Int_t nbodies, Particle *&Part, KDTree* &tree);
+///dual tree fast multipole potential calculation, see \ref PotentialFMM
+void PotentialFMM(Options &opt, Int_t nbodies, Particle *&Part, KDTree* &tree);
+void FMMInteract(FMMCell *cells, const Int_t a, const Int_t b,
+    const Double_t *px, const Double_t *py, const Double_t *pz, const Double_t *pm, Double_t *pot,
+    const Double_t theta2, const Double_t eps2, const int order);
+void FMMEvaluateLocal(FMMCell *cells, const Int_t a,
+    const Double_t *px, const Double_t *py, const Double_t *pz, Double_t *pot);
+void FMMSinkCells(FMMCell *cells, const Int_t a, const Int_t nmax, vector<Int_t> &sinks);
+FMMCell *FMMBuildCells(KDTree *tree, const int bsize, const Double_t *px, const Double_t *py, const Double_t *pz, const Double_t *pm,
+    Int_t &ncell, bool runomp);
+Double_t FMMPotentialAt(const FMMCell *cells, const Int_t a, const Double_t *x, const Int_t index,
+    const Double_t *sx, const Double_t *sy, const Double_t *sz, const Double_t *sm, const Int_t *sindex,
+    const Double_t theta2, const Double_t eps2, const int order);
+Double_t FMMPotentialGradAt(const FMMCell *cells, const Int_t a, const Double_t *x, const Int_t index,
+    const Double_t *sx, const Double_t *sy, const Double_t *sz, const Double_t *sm, const Int_t *sindex,
+    const Double_t theta2, const Double_t eps2, Double_t *grad);
 void PotentialInterpolate(Options &opt, const Int_t nbodies, Particle *&Part, Particle *&interolateparts, KDTree *&tree, double massratio, int nsearch);
+///assign potentials to particles from the leaves used to subsample them, see \ref PotentialLeafInterpolate
+void PotentialLeafInterpolate(Options &opt, const Int_t nbodies, Particle *Part, const Int_t nleaf, Particle *leafpart,
+    vector<leaf_node_info> &leafnodes);
+///error of an approximate potential estimated at probe particles, see \ref ApproxPotentialError
+Double_t ApproxPotentialError(Options &opt, const Int_t nbodies, Particle *Part, Int_t nprobe);
 
 void PotentialPP(Options &opt, Int_t nbodies, Particle *Part);
 //@}
@@ -354,9 +447,9 @@ void CalcPosSigmaTensor(const Int_t n, Particle *p, Double_t &a, Double_t &b, Do
 ///Calculate velocity dispersion tensor and eigvector
 void CalcVelSigmaTensor(const Int_t n, Particle *p, Double_t &a, Double_t &b, Double_t &c, Matrix& eigenvec, Matrix &I, int itype=-1);
 ///Calculate phase-space dispersion tensor and eigvector
-void CalcPhaseSigmaTensor(const Int_t n, Particle *p, GMatrix &eigenvalues, GMatrix& eigenvec, GMatrix &I, int itype=-1);
+void CalcPhaseSigmaTensor(const Int_t n, Particle *p, PhaseVector &eigenvalues, PhaseMatrix &eigenvec, PhaseMatrix &I, int itype=-1);
 ///Calculate phase-space dispersion tensor
-void CalcPhaseSigmaTensor(const Int_t n, Particle *p, GMatrix &I, int itype=-1);
+void CalcPhaseSigmaTensor(const Int_t n, Particle *p, PhaseMatrix &I, int itype=-1);
 ///Calculate the reduced weighted inertia tensor used to determine the spatial morphology
 void CalcMTensor(Matrix& M, const Double_t q, const Double_t s, const Int_t n, Particle *p, int itype);
 ///Same as \ref CalcMTensor but include mass
@@ -364,7 +457,7 @@ void CalcMTensorWithMass(Matrix& M, const Double_t q, const Double_t s, const In
 ///Rotate particles to some coordinate frame
 void RotParticles(const Int_t n, Particle *p, Matrix &R);
 ///get phase-space center-of-mass
-GMatrix CalcPhaseCM(const Int_t n, Particle *p, int itype=-1);
+PhaseVector CalcPhaseCM(const Int_t n, Particle *p, int itype=-1);
 
 ///get concentration routines associted with finding concentrations via root finding
 void CalcConcentration(PropData &p);
@@ -484,9 +577,15 @@ void OpenMPLinkAcross(Options &opt,
 
 ///resorts particles and group id values after OpenMP search
 Int_t OpenMPResortParticleandGroups(Int_t nbodies, vector<Particle> &Part, Int_t *&pfof, Int_t minsize);
+///calibrate the OpenMP thresholds for this machine and number of threads
+void CalibrateOpenMPThresholds(Options &opt);
 
 ///sets the head/next arrays based on the current particle order and the current pfof array
 void OpenMPHeadNextUpdate(const Int_t nbodies, vector<Particle> &Part, const Int_t numgroups, Int_t *&pfof, Int_tree_t *&Head, Int_tree_t *&Next);
+
+///3D FOF search of all particles using a single tree and a concurrent disjoint set, processing leaf-leaf pairs in parallel
+Int_t *OpenMPUnionFindFOF(Options &opt, const Int_t nbodies, vector<Particle> &Part, KDTree *&tree,
+    Double_t *param, FOFcheckfunc basischeck, Int_t &numgroups, const Int_t minsize);
 #endif
 
 #ifdef USEMPI
@@ -715,8 +814,8 @@ void MPIGetExportNumUsingMesh(Options &opt, const Int_t nbodies, Particle *Part,
 void MPIBuildParticleExportList(Options &opt, const Int_t nbodies, Particle *Part, Int_t *&pfof, Int_tree_t *&Len, Double_t rdist);
 ///Determine and send particles that need to be exported to another mpi thread from local mpi thread based on rdist using the SWIFT mesh
 void MPIBuildParticleExportListUsingMesh(Options &opt, const Int_t nbodies, Particle *Part, Int_t *&pfof, Int_tree_t *&Len, Double_t rdist);
-///Link groups across MPI threads using a physical search
-Int_t MPILinkAcross(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Int_tree_t *&Len, Int_tree_t *&Head, Int_tree_t *&Next, Double_t rdist2);
+///Link groups across MPI threads using a physical search, using the grid of the cell-linked-list FOF search if provided
+Int_t MPILinkAcross(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Int_tree_t *&Len, Int_tree_t *&Head, Int_tree_t *&Next, Double_t rdist2, FOFGrid *grid=NULL);
 ///Link groups across MPI threads using criterion
 Int_t MPILinkAcross(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Int_tree_t *&Len, Int_tree_t *&Head, Int_tree_t *&Next, Double_t rdist2, FOFcompfunc &cmp, Double_t *params);
 ///Link groups across MPI threads checking particle types
@@ -791,10 +890,14 @@ void MPISwiftExchange(vector<Particle> &Part);
 
 ///build group size array
 Int_t *BuildNumInGroup(const Int_t nbodies, const Int_t numgroups, Int_t *pfof);
+///build group size array using memory from an arena
+Int_t *BuildNumInGroup(const Int_t nbodies, const Int_t numgroups, Int_t *pfof, MemoryArena &arena);
 ///build group size array of particles of a specific type
 Int_t *BuildNumInGroupTyped(const Int_t nbodies, const Int_t numgroups, Int_t *pfof, Particle *Part, int type);
 ///build array such that array is pglist[group][]={particle list}
 Int_t **BuildPGList(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, Int_t *pfof);
+///build pglist using memory from an arena, storing the lists of all groups in one contiguous block
+Int_t **BuildPGList(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, Int_t *pfof, MemoryArena &arena);
 ///build array such that array is pglist[group][]={particle list} but only for particles of a specific type
 ///should be matched with \ref BuildNumInGroupTyped
 Int_t **BuildPGListTyped(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, Int_t *pfof, Particle *Part, int type);
@@ -804,6 +907,8 @@ Int_t **BuildPGList(const Int_t nbodies, const Int_t numgroups, Int_t *numingrou
 Int_t **BuildPGList(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, Int_t *pfof, Int_t *ids);
 ///build the group particle arrays need for unbinding procedure
 Particle **BuildPartList(const Int_t numgroups, Int_t *numingroup, Int_t **pglist, Particle* Part, bool ikeepextrainfo = false);
+///gather the particles of groups into one packed array, see \ref BuildPackedPartList
+Particle *BuildPackedPartList(const Int_t numgroups, Int_t *numingroup, Int_t **pglist, Particle *Part, Particle **&gPart);
 ///build a particle list subset using array of indices
 Particle *BuildPart(Int_t numingroup, Int_t *pglist, Particle* Part, bool ikeepextrainfo = false);
 ///build the Head array which points to the head of the group a particle belongs to
@@ -814,6 +919,8 @@ Int_tree_t *BuildNextArray(const Int_t nbodies, const Int_t numgroups, Int_t *nu
 Int_tree_t *BuildLenArray(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, Int_t **pglist);
 ///build the GroupTail array which stores the Tail of a group
 Int_tree_t *BuildGroupTailArray(const Int_t nbodies, const Int_t numgroups, Int_t *numingroup, Int_t **pglist);
+///build group ids from a disjoint set ordered by decreasing group size, returning the number of groups
+Int_t BuildGroupIDsFromDisjointSet(DisjointSet &ds, const Int_t nbodies, const Int_t minsize, Int_t *gid);
 ///sort particles according to the group value (or technically any integer array) unique to each group and return an array of offsets to access the particle array via their group
 Int_t *BuildNoffset(const Int_t nbodies, Particle *Part, Int_t numgroups,Int_t *numingroup, Int_t *sortval, Int_t ioffset=0);
 ///reorder groups from largest to smallest
@@ -852,6 +959,18 @@ void GetMemUsage(string callingfunction, bool printreport);
 void InitMemUsageLog(Options &opt);
 ///get a time
 double MyGetTime();
+///copy a particle without its hydro, star, black hole and extra dark matter properties
+void CopyParticleCoreData(Particle &dst, Particle &src);
+///gather particles by index without their hydro, star, black hole and extra dark matter properties
+void GatherParticlesCoreData(const Int_t n, Particle *dst, Particle *src, const Int_t *index);
+///squared distance of particles from a centre with their index
+void ParticleRadialKeys(const Int_t n, Particle *P, const Coordinate &centre, vector<particle_key_index> &keys);
+///select the smallest keys with nth_element
+void SelectSmallestKeys(vector<particle_key_index> &keys, Int_t nsel);
+///sort keys and permute particles into the same order, moving each particle once
+void SortParticlesByKeys(const Int_t n, Particle *P, vector<particle_key_index> &keys);
+///sort particles by radius without swapping particles during the sort
+void SortParticlesByRadius(const Int_t n, Particle *P);
 //@}
 
 /// \name Compilation functions
@@ -21,7 +21,7 @@
     \todo 3DFOF envelop kept as separate structures is NOT fully tested nor truly implemented just yet.
     \todo OpenMP parallel finding likely has other opmisations that can be implemented to reduce compute time.
 */
-Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part, Int_t &numgroups)
+Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part, Int_t &numgroups, Int_t *pfofprev)
 {
     Int_t i, *pfof = NULL, *pfoftemp = NULL, minsize;
     FOFcompfunc fofcmp;
@@ -43,7 +43,10 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
     Double_t time1,time2, time3;
     KDTree *tree = NULL;
     KDTree **tree3dfofomp = NULL;
+    FOFGrid fofgrid;
     Int_t *p3dfofomp = NULL;
+    //group ids of a previous snapshot in tree order used to warm start the search
+    Int_t *pfofwarm = NULL;
     int iorder = 1;
 #ifndef USEMPI
     int ThisTask=0,NProcs=1;
@@ -57,7 +60,11 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
     }
     OMP_Domain *ompdomain;
     int numompregions = ceil(nbodies/(float)opt.openmpfofsize);
-    bool runompfof = (numompregions>=2 && nthreads > 1 && opt.iopenmpfof == 1);
+    bool runompfof = (numompregions>=2 && nthreads > 1 && opt.iopenmpfof == OMPFOFDOMAIN);
+    //single tree search with concurrent disjoint set does not require any domain decomposition
+    bool runompunionfof = (nbodies > ompsearchnum && nthreads > 1 && opt.iopenmpfof == OMPFOFUNIONFIND);
+    //warm started search is itself a single tree search that uses OpenMP
+    if (pfofprev != NULL) runompfof = runompunionfof = false;
 #endif
     if (opt.p>0) {
         period=new Double_t[3];
@@ -104,12 +111,22 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
     else {
         time3=MyGetTime();
         tree = new KDTree(Part.data(),nbodies,opt.Bsize,tree->TPHYS,tree->KEPAN,1000,0,0,0,period);
+        //store previous group ids in tree order before the input order is overwritten
+        if (pfofprev != NULL) {
+            pfofwarm = new Int_t[nbodies];
+            for (i=0;i<nbodies;i++) pfofwarm[i]=pfofprev[Part[i].GetID()];
+        }
         tree->OverWriteInputOrder();
         if (opt.iverbose) cout<<ThisTask<<": finished building single tree with single OpenMP "<<MyGetTime()-time3<<endl;
     }
 
 #else
     tree=new KDTree(Part.data(),nbodies,opt.Bsize,tree->TPHYS,tree->KEPAN,1000,0,0,0,period);
+    //store previous group ids in tree order before the input order is overwritten
+    if (pfofprev != NULL) {
+        pfofwarm = new Int_t[nbodies];
+        for (i=0;i<nbodies;i++) pfofwarm[i]=pfofprev[Part[i].GetID()];
+    }
     tree->OverWriteInputOrder();
 #endif
     cout<<"Done"<<endl;
@@ -209,12 +226,31 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
 #endif
 
     }
+    else if (runompunionfof) {
+        time3=MyGetTime();
+        //only dark matter particles generate links if all particles searched but baryons treated separately
+        if (opt.partsearchtype==PSTALL && opt.iBaryonSearch>1) fofcheck=FOFchecktype;
+        else fofcheck=NULL;
+        pfof=OpenMPUnionFindFOF(opt, nbodies, Part, tree, param, fofcheck, numgroups, minsize);
+        //if running MPI then need to update the head, next info
+#ifdef USEMPI
+        OpenMPHeadNextUpdate(nbodies, Part, numgroups, pfof, Head, Next);
+#endif
+        if (opt.iverbose) cout<<ThisTask<<": finished union-find FOF search "<<MyGetTime()-time3<<endl;
+    }
     else {
         //posible alteration for all particle search
         if (opt.partsearchtype==PSTALL && opt.iBaryonSearch>1) {
             pfof=tree->FOFCriterionSetBasisForLinks(fofcmp,param,numgroups,minsize,
                 iorder,0,FOFchecktype,Head,Next);
         }
+        else if (pfofwarm != NULL) {
+            pfof=FOFWarmStartSearch(opt, nbodies, Part.data(), tree, pfofwarm, sqrt(param[1]), opt.p, numgroups, minsize);
+            delete[] pfofwarm;
+        }
+        else if (opt.iFOFgrid) {
+            pfof=FOFGridSearch(opt, nbodies, Part.data(), fofgrid, sqrt(param[1]), opt.p, numgroups, minsize, Head, Next);
+        }
         else {
             pfof=tree->FOF(sqrt(param[1]),numgroups,minsize,iorder,Head,Next);
         }
@@ -225,6 +261,13 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
         pfof=tree->FOFCriterionSetBasisForLinks(fofcmp,param,numgroups,minsize,
             iorder,0,FOFchecktype,Head,Next);
     }
+    else if (pfofwarm != NULL) {
+        pfof=FOFWarmStartSearch(opt, nbodies, Part.data(), tree, pfofwarm, sqrt(param[1]), opt.p, numgroups, minsize);
+        delete[] pfofwarm;
+    }
+    else if (opt.iFOFgrid) {
+        pfof=FOFGridSearch(opt, nbodies, Part.data(), fofgrid, sqrt(param[1]), opt.p, numgroups, minsize, Head, Next);
+    }
     else {
         pfof=tree->FOF(sqrt(param[1]),numgroups,minsize,iorder,Head,Next);
     }
@@ -354,7 +397,9 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
             links_across=MPILinkAcross(nbodies, tree, Part.data(), pfof, Len, Head, Next, param[1], fofcheck, param);
         }
         else {
-            links_across=MPILinkAcross(nbodies, tree, Part.data(), pfof, Len, Head, Next, param[1]);
+            //use grid from cell-linked-list search if available
+            if (fofgrid.cellkey.size()>0) links_across=MPILinkAcross(nbodies, tree, Part.data(), pfof, Len, Head, Next, param[1], &fofgrid);
+            else links_across=MPILinkAcross(nbodies, tree, Part.data(), pfof, Len, Head, Next, param[1]);
         }
         if (opt.iverbose>=2) {
             cout<<ThisTask<<" has found "<<links_across<<" links to particles on other mpi domains "<<endl;
@@ -371,6 +416,7 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
 
     //reorder local particle array and delete memory associated with Head arrays, only need to keep Particles, pfof and some id and idexing information
     delete tree;
+    fofgrid.Clear();
     delete[] Head;
     delete[] Next;
     delete[] Len;
@@ -1151,7 +1197,7 @@ Int_t* SearchSubset(Options &opt, const Int_t nbodies, const Int_t nsubset, Part
         //if large enough for statistically significant structures to be found then search. This is a robust search
         if (nsubset>=MINSUBSIZE) {
             if (opt.iverbose>=2) cout<<"Now search ... "<<endl;
-            pfof=tree->FOFCriterion(fofcmp,param,numgroups,minsize,1,1,FOFchecksub);
+            pfof=FOFCriterionSearch(opt,tree,Partsubset,nsubset,fofcmp,param,numgroups,minsize,1,1,FOFchecksub);
         }
         else {
             numgroups=0;
@@ -1208,6 +1254,7 @@ private(i,tid)
         Int_t newlinks, intergrouplinks,*newlinksIndex,*intergrouplinksIndex;
         Int_t pid,ppid, ss,tail,startpoint;
         Int_t numgrouplinks,*numgrouplinksIndex,**newIndex,*oldnumingroup,**newintergroupIndex,**intergroupgidIndex;
+        vector<Int_t> nnoffset, nnlist;
 
         //to slowly expand search, must declare several arrays making it easier to move along a group.
         numingroup=BuildNumInGroup(nsubset, numgroups, pfof);
@@ -1283,6 +1330,12 @@ private(i,tid)
 
         for (i=0;i<nsubset;i++) if (Partsubset[i].GetPotential()<param[9]&&nnID[0][Partsubset[i].GetID()]==0) nnID[0][Partsubset[i].GetID()]=-1;
 
+        //the remaining passes only link outliers above the same threshold within at most the largest linking length,
+        //so find the neighbours of the outliers once rather than walking the tree for every search
+        BuildOutlierNeighbourList(nsubset, tree, Partsubset, opt.ellthreshold*opt.ellfac,
+            (opt.ellxscale*opt.ellxscale)*(opt.ellphys*opt.ellphys)*max((Double_t)1.0,opt.ellxfac*opt.ellxfac), nnoffset, nnlist);
+        if (opt.iverbose>=2) cout<<ThisTask<<" "<<"Outlier neighbour list has "<<nnlist.size()<<" entries"<<endl;
+
         fofcmp=&FOFStreamwithprob;
         param[1]=(opt.ellxscale*opt.ellxscale)*(opt.ellphys*opt.ellphys);// *opt.ellxfac*opt.ellxfac;//increase physical linking length slightly
         param[6]=(opt.ellxscale*opt.ellxscale)*(opt.ellphys*opt.ellphys);// *opt.ellxfac*opt.ellxfac;
@@ -1307,7 +1360,7 @@ private(i,tid)
         //now continue to search all new links till there are no more links found
         tid=0;
         do {
-            SearchForNewLinks(nsubset, tree, Partsubset, pfof, fofcmp, param, newlinks, newlinksIndex, nnID, nthreads);
+            SearchForNewLinks(nsubset, tree, Partsubset, pfof, fofcmp, param, newlinks, newlinksIndex, nnID, nthreads, nnoffset.data(), nnlist.data());
             DetermineNewLinks(nsubset, Partsubset, pfof, numgroups, newlinks, newlinksIndex, numgrouplinksIndex, nnID[tid],&newIndex);
             LinkUntagged(Partsubset, numgroups, pfof, numingroup, pglist, newlinks, numgrouplinksIndex, newIndex, Head, Next, GroupTail,nnID[tid]);
             for (Int_t j=1;j<=numgroups;j++) delete[] newIndex[j];
@@ -1332,7 +1385,7 @@ private(i,tid)
             //first search list and find any new links, not that here if a particle has a pfof value > that the pfofvalue of the reference particle, its nnID value is set to the reference
             //particle's group id, otherwise, its left alone (unless its untagged)
             //if number of searches is large, run search in parallel
-            SearchForNewLinks(nsubset, tree, Partsubset, pfof, fofcmp, param, newlinks, newlinksIndex, nnID, nthreads);
+            SearchForNewLinks(nsubset, tree, Partsubset, pfof, fofcmp, param, newlinks, newlinksIndex, nnID, nthreads, nnoffset.data(), nnlist.data());
             DetermineGroupLinks(nsubset, Partsubset, pfof, numgroups, newlinks, newlinksIndex, numgrouplinksIndex, nnID[tid], &newIndex);
             DetermineGroupMergerConnections(Partsubset, numgroups, pfof, ilflag, numgrouplinksIndex, intergrouplinksIndex, nnID[tid], &newIndex, &newintergroupIndex, &intergroupgidIndex);
             newlinks=0;
@@ -1361,7 +1414,7 @@ private(i,tid)
         //now continue to search all new links till there are no more links found
         tid=0;
         do {
-            SearchForNewLinks(nsubset, tree, Partsubset, pfof, fofcmp, param, newlinks, newlinksIndex, nnID, nthreads);
+            SearchForNewLinks(nsubset, tree, Partsubset, pfof, fofcmp, param, newlinks, newlinksIndex, nnID, nthreads, nnoffset.data(), nnlist.data());
             DetermineNewLinks(nsubset, Partsubset, pfof, numgroups, newlinks, newlinksIndex, numgrouplinksIndex, nnID[tid],&newIndex);
             LinkUntagged(Partsubset, numgroups, pfof, numingroup, pglist, newlinks, numgrouplinksIndex, newIndex, Head, Next, GroupTail,nnID[tid]);
             for (Int_t j=1;j<=numgroups;j++) delete[] newIndex[j];
@@ -1478,7 +1531,7 @@ private(i,tid)
             fofcmp=&FOF6dbgup;
             //here this ensures that particles belong to a 6dfof substructure that is composed of particles
             //which are considered dynamical outliers using a very large grid
-            pfofbg=tree->FOFCriterion(fofcmp,param,numgroupsbg,minsize,1,1,FOFchecksub);
+            pfofbg=FOFCriterionSearch(opt,tree,Partsubset,nsubset,fofcmp,param,numgroupsbg,minsize,1,1,FOFchecksub);
 
             //now combine results such that if particle already belongs to a substructure ignore
             //otherwise leave tagged. Then check if these new background substructures share enough links with the
@@ -1716,7 +1769,7 @@ private(i,tid)
         for (i=0;i<nsubset;i++) Partsubset[i].SetPotential(pfof[Partsubset[i].GetID()]);
         for (i=0;i<nsubset;i++) Partsubset[i].SetType(-1);
         param[9]=0.5;
-        pfofbg=tree->FOFCriterion(fofcmp,param,numgroupsbg,minsize,iorder,icheck,FOFcheckbg);
+        pfofbg=FOFCriterionSearch(opt,tree,Partsubset,nsubset,fofcmp,param,numgroupsbg,minsize,iorder,icheck,FOFcheckbg);
 
         for (i=0;i<nsubset;i++) if (pfofbg[Partsubset[i].GetID()]<=1 && pfof[Partsubset[i].GetID()]==0) Partsubset[i].SetType(numactiveloops);
 
@@ -1763,7 +1816,7 @@ private(i,tid)
                 //we adjust the particles potentials so as to ignore already tagged particles using FOFcheckbg
                 //here since loop just iterates to search the largest core, we just set all previously tagged particles not belonging to main core as 1
                 for (i=0;i<nsubset;i++) Partsubset[i].SetPotential((pfofbgnew[Partsubset[i].GetID()]!=1)+(pfof[Partsubset[i].GetID()]>0));
-                pfofbg=tree->FOFCriterion(fofcmp,param,numgroupsbg,minsize,iorder,icheck,FOFcheckbg);
+                pfofbg=FOFCriterionSearch(opt,tree,Partsubset,nsubset,fofcmp,param,numgroupsbg,minsize,iorder,icheck,FOFcheckbg);
                 //now if numgroupsbg is greater than one, need to update the pfofbgnew array
                 if (numgroupsbg>1) {
                     numactiveloops++;
@@ -1942,6 +1995,126 @@ private(i,tid)
     return pfof;
 }
 
+/// \name Phase-space core growth helpers, see \ref HaloCoreGrowth
+//@{
+
+///number of particles whose distances to the cores are evaluated together
+#define COREGROWTHTILE 64
+
+///phase-space centre and inverse dispersion tensor of a core
+struct CorePhaseMetric{
+    PhaseVector cm;
+    PhaseMatrix invdisp;
+};
+
+///mass weighted moments of the particles of a core about a reference point, updated as particles are assigned to the core
+struct CorePhaseMoments{
+    PhaseVector ref, m1;
+    PhaseMatrix m2;
+    Double_t mass;
+
+    CorePhaseMoments() : ref(0.) {
+        Clear();
+    }
+    ///reset the moments, keeping the reference point
+    void Clear(){
+        mass=0;
+        m1=PhaseVector(0.);
+        m2=PhaseMatrix(0.);
+    }
+    inline void Add(Particle &p){
+        PhaseVector d;
+        Double_t w=p.GetMass();
+        for (int k=0;k<6;k++) d[k]=p.GetPhase(k)-ref[k];
+        mass+=w;
+        m1+=d*w;
+        m2.AddOuter(d,w);
+    }
+    ///add moments about the same reference point
+    inline void Add(const CorePhaseMoments &m){
+        mass+=m.mass;
+        m1+=m.m1;
+        m2+=m.m2;
+    }
+    ///centre of mass and inverse of the dispersion tensor about it, as \ref CalcPhaseCM and \ref CalcPhaseSigmaTensor
+    void GetMetric(CorePhaseMetric &metric){
+        PhaseVector d=m1*(1.0/mass);
+        PhaseMatrix disp=m2*(1.0/mass);
+        metric.cm=ref+d;
+        disp.AddOuter(d,-1.0);
+        metric.invdisp=disp.Inverse();
+    }
+};
+
+///phase-space distance squared of a point from a core in units of the core's dispersion
+inline Double_t CorePhaseDistance2(const CorePhaseMetric &metric, const PhaseVector &x)
+{
+    return metric.invdisp.QuadraticForm(x-metric.cm);
+}
+
+///phase-space distances squared of a tile of n particles from a core, with coordinate k of particle i stored in phase[k*COREGROWTHTILE+i]
+inline void CorePhaseDistance2Tile(const CorePhaseMetric &metric, const int n, const Double_t *phase, Double_t *D2)
+{
+    Double_t d[6*COREGROWTHTILE];
+    for (int k=0;k<6;k++) {
+#ifdef USEOPENMP
+#pragma omp simd
+#endif
+        for (int i=0;i<n;i++) d[k*COREGROWTHTILE+i]=phase[k*COREGROWTHTILE+i]-metric.cm[k];
+    }
+#ifdef USEOPENMP
+#pragma omp simd
+#endif
+    for (int i=0;i<n;i++) {
+        Double_t sum=0, t;
+        for (int k=0;k<6;k++) {
+            t=0;
+            for (int l=0;l<6;l++) t+=metric.invdisp.m[k*6+l]*d[l*COREGROWTHTILE+i];
+            sum+=d[k*COREGROWTHTILE+i]*t;
+        }
+        D2[i]=sum;
+    }
+}
+
+///moments of the particles of each core about the core's centre of mass
+void CorePhaseMomentsFromCores(const Int_t nsubset, Particle *Partsubset, Int_t *pfofbg, const Int_t numgroupsbg, vector<CorePhaseMoments> &moments)
+{
+    Int_t i, pid;
+    vector<Double_t> mass(numgroupsbg+1,0);
+    for (i=1;i<=numgroupsbg;i++) {moments[i].ref=PhaseVector(0.); moments[i].Clear();}
+    for (i=0;i<nsubset;i++) {
+        pid=pfofbg[Partsubset[i].GetID()];
+        if (pid==0) continue;
+        mass[pid]+=Partsubset[i].GetMass();
+        for (int k=0;k<6;k++) moments[pid].ref[k]+=Partsubset[i].GetPhase(k)*Partsubset[i].GetMass();
+    }
+    for (i=1;i<=numgroupsbg;i++) for (int k=0;k<6;k++) moments[i].ref[k]/=mass[i];
+#ifdef USEOPENMP
+#pragma omp parallel default(shared) private(i,pid) if (nsubset > ompperiodnum)
+{
+#endif
+    vector<CorePhaseMoments> tmoments(moments);
+    for (auto &m:tmoments) m.Clear();
+#ifdef USEOPENMP
+    #pragma omp for schedule(static) nowait
+#endif
+    for (i=0;i<nsubset;i++) {
+        pid=pfofbg[Partsubset[i].GetID()];
+        if (pid>0) tmoments[pid].Add(Partsubset[i]);
+    }
+#ifdef USEOPENMP
+    #pragma omp critical (corephasemoments)
+#endif
+    {
+    for (i=1;i<=numgroupsbg;i++) moments[i].Add(tmoments[i]);
+    }
+#ifdef USEOPENMP
+}
+#endif
+}
+
+//@}
+
 //search for unassigned background particles if cores have been found.
 void HaloCoreGrowth(Options &opt, const Int_t nsubset, Particle *&Partsubset, Int_t *&pfof, Int_t *&pfofbg, Int_t &numgroupsbg, Double_t param[], vector<Double_t> &dispfac,
     int numactiveloops, vector<int> &corelevel,
@@ -1963,7 +2136,6 @@ void HaloCoreGrowth(Options &opt, const Int_t nsubset, Particle *&Partsubset, In
     Double_t **dist2;
     PriorityQueue *pq;
     Int_t nactivepart=nsubset;
-    vector<Int_t> noffset(numgroupsbg+1,0);
 
     //determine the weights for the cores dispersions factors
     for (i=0;i<nsubset;i++) {
@@ -1984,43 +2156,25 @@ void HaloCoreGrowth(Options &opt, const Int_t nsubset, Particle *&Partsubset, In
         //about their centres and use this to determine distances
         if (opt.iPhaseCoreGrowth) {
             if (opt.iverbose>=2) cout<<"Searching untagged particles to assign to cores using full phase-space metrics"<<endl;
-            vector<GMatrix> dist(nthreads,GMatrix(6,1));
-            vector<GMatrix> cmphase(numgroupsbg+1,GMatrix(6,1));
-            vector<GMatrix> invdisp(numgroupsbg+1,GMatrix(6,6));
-            GMatrix coredist(6,1);
+            vector<CorePhaseMetric> metric(numgroupsbg+1);
+            vector<CorePhaseMoments> moments(numgroupsbg+1);
+            vector<Int_t> activelist;
+            vector<int> activecores;
             Int_t nactive=0;
 
-            //store particles
-            Pcore=new Particle[nincore];
-            nincore=0;
-            for (i=0;i<nsubset;i++) if (pfofbg[Partsubset[i].GetID()]>0) {
-                Pcore[nincore]=Partsubset[i];
-                Pcore[nincore].SetType(pfofbg[Partsubset[i].GetID()]);
-                nincore++;
-            }
-            qsort(Pcore,nincore,sizeof(Particle),TypeCompare);
-            noffset[0]=noffset[1]=0;
-            for (i=2;i<=numgroupsbg;i++) noffset[i]=noffset[i-1]+ncore[i-1];
-            //now get centre of masses and dispersions
-            for (i=1;i<=numgroupsbg;i++) {
-                cmphase[i]=CalcPhaseCM(ncore[i], &Pcore[noffset[i]]);
-                for (int j=0;j<ncore[i];j++) {
-                    for (int k=0;k<6;k++) Pcore[noffset[i]+j].SetPhase(k,Pcore[noffset[i]+j].GetPhase(k)-cmphase[i](k,0));
-                }
-                CalcPhaseSigmaTensor(ncore[i], &Pcore[noffset[i]], invdisp[i]);
-                ///\todo must be issue with either phase-space tensor or number of particles assigned as
-                ///it is possible to get haloes of size 0
-                invdisp[i]=invdisp[i].Inverse();
-            }
-            delete[] Pcore;
+            //get centre of masses and dispersions from the moments of the core particles, kept so that
+            //dispersions can be updated with the particles assigned at each loop rather than recalculated
+            CorePhaseMomentsFromCores(nsubset, Partsubset, pfofbg, numgroupsbg, moments);
+            ///\todo must be issue with either phase-space tensor or number of particles assigned as
+            ///it is possible to get haloes of size 0
+            for (i=1;i<=numgroupsbg;i++) moments[i].GetMetric(metric[i]);
 
             //once phase-space centers and dispersions are calculated, check to see
             //if distance is significant. Here idea is get distance in dispersion of
             //candidate core and this must be by ND*halocoredistsig, where ND is number of dimensions, ie. 6
             //if core is not significant set its mcore to 0
             for (i=2;i<=numgroupsbg;i++) {
-                for (int k=0;k<6;k++) coredist(k,0)=(cmphase[i](k,0)-cmphase[1](k,0));
-                D2=(coredist.Transpose()*invdisp[i]*coredist)(0,0);
+                D2=CorePhaseDistance2(metric[i], metric[1].cm);
                 if (D2<opt.halocorephasedistsig*opt.halocorephasedistsig*6.0) mcore[i]=0;
                 else nactive++;
             }
@@ -2035,106 +2189,90 @@ void HaloCoreGrowth(Options &opt, const Int_t nsubset, Particle *&Partsubset, In
             //otherwise recalculating dispersions at every level
             else if (opt.iPhaseCoreGrowth>=2) for (i=1;i<=numgroupsbg;i++) dispfac[i]=1.0;
 
+            //list of untagged particles, from which particles are removed once assigned
+            for (i=0;i<nsubset;i++) {
+                pid=Partsubset[i].GetID();
+                if (pfofbg[pid]==0 && pfof[pid]==0) activelist.push_back(i);
+            }
+
             for (Int_t iloop=numactiveloops;iloop>=0;iloop--) {
+            Int_t nlist=activelist.size(), ntiles=(nlist+COREGROWTHTILE-1)/COREGROWTHTILE, nreduce=0;
+            activecores.clear();
+            for (int j=2;j<=numgroupsbg;j++) if (mcore[j]>0 && corelevel[j]>=iloop) activecores.push_back(j);
+            int nactivecores=activecores.size();
+
+            //distances of a tile of particles to all active cores are calculated at once, then each particle is assigned to the core
+            //that is closest once distances are weighted by the core's mass and dispersion factor relative to the closest core so far
 #ifdef USEOPENMP
-            //if particle number large enough to warrant parallel search
-            if (nactivepart>ompperiodnum) {
-            int nreduce=0;
 #pragma omp parallel default(shared) \
-private(i,tid,Pval,D2,dval,mval,pid,weight)
+private(i,D2,dval,mval,pid,weight) if (nlist > ompperiodnum)
 {
-#pragma omp for reduction(+:nreduce)
-            for (i=0;i<nsubset;i++)
+#endif
+            vector<Double_t> phase(6*COREGROWTHTILE), D2tile((nactivecores+1)*COREGROWTHTILE);
+            vector<Int_t> tileindex(COREGROWTHTILE);
+            vector<CorePhaseMoments> tmoments;
+            if (opt.iPhaseCoreGrowth>=2) {
+                tmoments=moments;
+                for (auto &m:tmoments) m.Clear();
+            }
+#ifdef USEOPENMP
+#pragma omp for schedule(static) reduction(+:nreduce)
+#endif
+            for (Int_t itile=0;itile<ntiles;itile++)
             {
-                tid=omp_get_thread_num();
-                Pval=&Partsubset[i];
-                if (Pval->GetType()<iloop) continue;
-                pid=Pval->GetID();
-                if (pfofbg[pid]==0 && pfof[pid]==0) {
+                Int_t iend=min((itile+1)*COREGROWTHTILE,nlist);
+                int n=0, icore;
+                for (Int_t l=itile*COREGROWTHTILE;l<iend;l++) {
+                    i=activelist[l];
+                    if (Partsubset[i].GetType()<iloop) continue;
+                    tileindex[n]=i;
+                    for (int k=0;k<6;k++) phase[k*COREGROWTHTILE+n]=Partsubset[i].GetPhase(k);
+                    n++;
+                }
+                if (n==0) continue;
+                CorePhaseDistance2Tile(metric[1], n, phase.data(), D2tile.data());
+                for (int j=0;j<nactivecores;j++)
+                    CorePhaseDistance2Tile(metric[activecores[j]], n, phase.data(), &D2tile[(j+1)*COREGROWTHTILE]);
+                for (int m=0;m<n;m++) {
+                    dval=D2tile[m];
                     mval=mcore[1];
-                    for (int k=0;k<6;k++) dist[tid](k,0)=Pval->GetPhase(k)-cmphase[1](k,0);
-                    dval=(dist[tid].Transpose()*invdisp[1]*dist[tid])(0,0);
-                    pfofbg[pid]=1;
-                    for (int j=2;j<=numgroupsbg;j++) {
-                        if (mcore[j]>0 && corelevel[j]>=iloop){
-                            weight = 1.0/sqrt(mcore[j]/mval);
-                            for (int k=0;k<6;k++) dist[tid](k,0)=Pval->GetPhase(k)-cmphase[j](k,0);
-                            D2=(dist[tid].Transpose()*invdisp[j]*dist[tid])(0,0) * weight;
-                            if (dval*dispfac[pfofbg[pid]]>D2*dispfac[j]) {
-                                dval=D2;
-                                mval=mcore[j];
-                                pfofbg[pid]=j;
-                            }
+                    icore=1;
+                    for (int j=0;j<nactivecores;j++) {
+                        weight = 1.0/sqrt(mcore[activecores[j]]/mval);
+                        D2=D2tile[(j+1)*COREGROWTHTILE+m]*weight;
+                        if (dval*dispfac[icore]>D2*dispfac[activecores[j]]) {
+                            dval=D2;
+                            mval=mcore[activecores[j]];
+                            icore=activecores[j];
                         }
                     }
+                    pid=Partsubset[tileindex[m]].GetID();
+                    pfofbg[pid]=icore;
+                    if (opt.iPhaseCoreGrowth>=2) tmoments[icore].Add(Partsubset[tileindex[m]]);
                     //if particle assigned to a core remove from search
-                    Pval->SetType(-1);
+                    Partsubset[tileindex[m]].SetType(-1);
                     nreduce++;
                 }
             }
-}
-            nactivepart-=nreduce;
-            }
-            else {
+            if (opt.iPhaseCoreGrowth>=2) {
+#ifdef USEOPENMP
+#pragma omp critical (corephasegrowth)
 #endif
-            for (i=0;i<nsubset;i++)
             {
-                tid=0;
-                Pval=&Partsubset[i];
-                if (Pval->GetType()<iloop) continue;
-                pid=Pval->GetID();
-                if (pfofbg[pid]==0 && pfof[pid]==0) {
-                    mval=mcore[1];
-                    for (int k=0;k<6;k++) dist[tid](k,0)=Pval->GetPhase(k)-cmphase[1](k,0);
-                    dval=(dist[tid].Transpose()*invdisp[1]*dist[tid])(0,0);
-                    pfofbg[pid]=1;
-                    for (int j=2;j<=numgroupsbg;j++) {
-                        if (mcore[j]>0 && corelevel[j]>=iloop){
-                            weight = 1.0/sqrt(mcore[j]/mval);
-                            for (int k=0;k<6;k++) dist[tid](k,0)=Pval->GetPhase(k)-cmphase[j](k,0);
-                            D2=(dist[tid].Transpose()*invdisp[j]*dist[tid])(0,0) * weight;
-                            if (dval*dispfac[pfofbg[pid]]>D2*dispfac[j]) {
-                                dval=D2;
-                                mval=mcore[j];
-                                pfofbg[pid]=j;
-                            }
-                        }
-                    }
-                    Pval->SetType(-1);
-                    nactivepart--;
-                }
+            for (i=1;i<=numgroupsbg;i++) moments[i].Add(tmoments[i]);
             }
-#ifdef USEOPENMP
             }
+#ifdef USEOPENMP
+}
 #endif
-            //otherwise, recalculate dispersions
+            nactivepart-=nreduce;
+            //remove assigned particles from the list
+            Int_t nleft=0;
+            for (Int_t l=0;l<nlist;l++) if (Partsubset[activelist[l]].GetType()!=-1) activelist[nleft++]=activelist[l];
+            activelist.resize(nleft);
+            //otherwise, update dispersions
             if (opt.iPhaseCoreGrowth>=2) {
-                nincore=0;
-                for (i=0;i<nsubset;i++)
-                    if (pfofbg[i]>0)
-                        nincore++;
-                Pcore=new Particle[nincore];
-                for (i=1;i<=numgroupsbg;i++) ncore[i]=0;
-                nincore=0;
-                for (i=0;i<nsubset;i++) if (pfofbg[Partsubset[i].GetID()]>0) {
-                    Pcore[nincore]=Partsubset[i];
-                    Pcore[nincore].SetType(pfofbg[Partsubset[i].GetID()]);
-                    nincore++;
-                    ncore[pfofbg[Partsubset[i].GetID()]]++;
-                }
-                qsort(Pcore,nincore,sizeof(Particle),TypeCompare);
-                noffset[0]=noffset[1]=0;
-                for (i=2;i<=numgroupsbg;i++) noffset[i]=noffset[i-1]+ncore[i-1];
-                //now get centre of masses and dispersions
-                for (i=1;i<=numgroupsbg;i++) if (corelevel[i]>=iloop) {
-                    cmphase[i]=CalcPhaseCM(ncore[i], &Pcore[noffset[i]]);
-                    for (int j=0;j<ncore[i];j++) {
-                        for (int k=0;k<6;k++) Pcore[noffset[i]+j].SetPhase(k,Pcore[noffset[i]+j].GetPhase(k)-cmphase[i](k,0));
-                    }
-                    CalcPhaseSigmaTensor(ncore[i], &Pcore[noffset[i]], invdisp[i]);
-                    invdisp[i]=invdisp[i].Inverse();
-                }
-                delete[] Pcore;
+                for (i=1;i<=numgroupsbg;i++) if (corelevel[i]>=iloop) moments[i].GetMetric(metric[i]);
             }
         }//
         }//end of phase core growth
@@ -2147,7 +2285,7 @@ private(i,tid,Pval,D2,dval,mval,pid,weight)
             Pcore=new Particle[nincore];
             nincore=0;
             for (i=0;i<nsubset;i++) if (pfofbg[Partsubset[i].GetID()]>0) {
-                Pcore[nincore]=Partsubset[i];
+                CopyParticleCoreData(Pcore[nincore],Partsubset[i]);
                 Pcore[nincore].SetType(pfofbg[Partsubset[i].GetID()]);
                 nincore++;
             }
@@ -2282,9 +2420,8 @@ void MergeSubstructuresCoresPhase(Options &opt, const Int_t nsubset, Particle *&
 {
     //get the phase centres of objects and see if they overlap
     Int_t pfofval, imerge, numlargesubs=0, newnumcores=numcores;
-    Double_t disp, dist2, mindist2, fdist2=pow(opt.coresubmergemindist,2.0);
-    Coordinate pos;
-    vector<Int_t> numingroup, noffset, taggedsubs;
+    Double_t disp, fdist2=pow(opt.coresubmergemindist,2.0);
+    vector<Int_t> numingroup, noffset;
     vector<Particle> subs, cores;
     KDTree *tree;
     //vector<GMatrix> phasetensorsubs(numsubs,GMatrix(6,6)), phasetensorcores(numcores,GMatrix(6,6));
@@ -2371,29 +2508,34 @@ void MergeSubstructuresCoresPhase(Options &opt, const Int_t nsubset, Particle *&
     //now built tree on substructures
     tree = new KDTree(subs.data(),numsubs,1,tree->TPHYS,tree->KEPAN,100,0,0,0);
     //tree = new KDTree(subs.data(),numlargesubs,1,tree->TPHYS,tree->KEPAN,100,0,0,0);
-    //check all cores to see if they overlap significantly with substructures
-    newnumcores=0;
+    //check all cores to see if they overlap significantly with substructures, finding the substructure
+    //each core merges with in one pass before updating any group ids as cores only merge with substructures
+    vector<Int_t> coremerge(numcores,-1);
+#ifdef USEOPENMP
+#pragma omp parallel for \
+default(shared) schedule(dynamic) if (numcores > ompsubsearchnum)
+#endif
     for (auto i=0;i<numcores;i++) {
+        Coordinate pos;
+        vector<Int_t> tagged;
+        Double_t disp, dist2, mindist2=MAXVALUE;
         for (auto k=0;k<3;k++) pos[k]=cores[i].GetPosition(k);
-        taggedsubs = tree->SearchBallPosTagged(pos, sigXcores[i]*fdist2);
-        if (taggedsubs.size()==0) {
-            newnumcores++;
-            cores[i].SetID(newnumcores+numsubs);
-            continue;
-        }
+        tagged = tree->SearchBallPosTagged(pos, sigXcores[i]*fdist2);
         //if objects are within search window of core, get min phase distance
-        imerge=-1;
-        mindist2=MAXVALUE;
-        for (auto j=0;j<taggedsubs.size();j++) {
-            disp = 0; for (auto k=0;k<3;k++) disp+=pow(subs[taggedsubs[j]].GetPosition(k)-cores[i].GetPosition(k),2.0);
+        for (auto j=0;j<tagged.size();j++) {
+            disp = 0; for (auto k=0;k<3;k++) disp+=pow(subs[tagged[j]].GetPosition(k)-cores[i].GetPosition(k),2.0);
             dist2 = disp/sigXcores[i];
-            disp = 0; for (auto k=0;k<3;k++) disp+=pow(subs[taggedsubs[j]].GetVelocity(k)-cores[i].GetVelocity(k),2.0);
+            disp = 0; for (auto k=0;k<3;k++) disp+=pow(subs[tagged[j]].GetVelocity(k)-cores[i].GetVelocity(k),2.0);
             dist2 += disp/sigVcores[i];
             if (dist2<fdist2 && dist2<mindist2){
-                imerge=subs[taggedsubs[j]].GetPID();
+                coremerge[i]=subs[tagged[j]].GetPID();
                 mindist2=dist2;
             }
         }
+    }
+    newnumcores=0;
+    for (auto i=0;i<numcores;i++) {
+        imerge=coremerge[i];
         //merging core with sub if one is found
         if (imerge!=-1) {
             pfofval=i+numsubs+1;
@@ -2422,7 +2564,12 @@ void MergeSubstructuresCoresPhase(Options &opt, const Int_t nsubset, Particle *&
     }
     numcores=newnumcores;
 }
-///Testing a merge of all substructures
+/*!
+    Merge all substructures (and the background if opt.icoresubmergewithbg) that overlap significantly in phase-space.
+    Candidate pairs are found for all objects in a single pass over the tree of phase centres. Merges are then
+    applied with a union-find in one sweep in the order objects are searched, so that an object already merged cannot
+    absorb others and objects merged into a subsequently merged object follow it.
+*/
 void MergeSubstructuresPhase(Options &opt, const Int_t nsubset, Particle *&Partsubset, Int_t *&pfof, Int_t &numgroups, Int_t &numsubs, Int_t &numcores)
 {
 #ifndef USEMPI
@@ -2436,46 +2583,30 @@ void MergeSubstructuresPhase(Options &opt, const Int_t nsubset, Particle *&Parts
     else if (opt.icoresubmergewithbg == 0 && (numcores == 0 || numsubs == 0)) return;
 
     //get the phase centres of objects and see if they overlap
-    Int_t pfofval, newpfofval, imerge, newnumgroups, newnumcores, nummerged=0, index1, index2;
-    Double_t disp, dist2, dist2sub1,dist2sub2, mindist2, fdist2=pow(opt.coresubmergemindist,2.0);
-    Double_t xsub1, xsub2, vsub1, vsub2;
-    Coordinate pos;
-    vector<Int_t> numingroup, noffset, taggedsubs;
+    Int_t pfofval, newnumgroups, newnumcores, nummerged=0, index1, index2, nobjects=numgroups+1;
+    Double_t disp, fdist2=pow(opt.coresubmergemindist,2.0);
+    vector<Int_t> numingroup, mergeroot, newpfof;
     struct mergeinfo {
         Int_t originalpfofval;
         Int_t pfofval;
         Int_t numingroup;
         int type;
-        int nummerged;
         bool ismerged;
-        int mergeindex;
-        vector<Int_t> mergedlist;
+        Int_t mergeindex;
         mergeinfo(){
-            nummerged = 0;
             ismerged = false;
             mergeindex = -1;
         };
     };
     vector<Particle> subs;
     vector<mergeinfo> minfo;
+    vector<vector<Int_t>> objectcandidates;
     KDTree *tree;
-    //vector<GMatrix> phasetensorsubs(numgroups+1,GMatrix(6,6));
-    vector<Double_t> sigXsubs(numgroups+1), sigVsubs(numgroups+1);
-    Double_t searchdist;
-    struct indexfof {
-        Int_t fofval;
-        Int_t index;
-    };
-    vector<indexfof> indexing;
-    int idoffset, idtagged;
-
-    subs.resize(numgroups+1);
-    minfo.resize(numgroups+1);
-    idoffset = 0;
-    idtagged = -1;
-    numingroup.resize(numgroups+1);
-    noffset.resize(numgroups+1);
-    indexing.resize(nsubset);
+    vector<Double_t> sigXsubs(nobjects), sigVsubs(nobjects);
+
+    subs.resize(nobjects);
+    minfo.resize(nobjects);
+    numingroup.resize(nobjects);
 
     for (auto &x:sigXsubs) x=0;
     for (auto &x:sigVsubs) x=0;
@@ -2484,18 +2615,14 @@ void MergeSubstructuresPhase(Options &opt, const Int_t nsubset, Particle *&Parts
     //get center of mass in phase-space
     for (auto i=0;i<nsubset;i++) {
         pfofval = pfof[Partsubset[i].GetID()];
-        indexing[i].fofval = pfofval;
-        indexing[i].index = i;
         numingroup[pfofval]++;
-        //if (opt.icoresubmergewithbg == 0 && pfofval==0) continue;
         //store total mass in potential (to ensure compatability with NOMASS option)
         subs[pfofval].SetPotential(subs[pfofval].GetPotential()+Partsubset[i].GetMass());
         for (auto k=0;k<6;k++) subs[pfofval].SetPhase(k,subs[pfofval].GetPhase(k)+Partsubset[i].GetPhase(k)*Partsubset[i].GetMass());
     }
-    noffset[0]=0; for (auto i=1;i<=numgroups;i++) noffset[i]=numingroup[i-1]+noffset[i-1];
 
     //set sub properties.
-    for (auto i=0;i<subs.size();i++)
+    for (auto i=0;i<nobjects;i++)
     {
         if (i == 0) subs[i].SetType(-1);
         else subs[i].SetType((i>numsubs));
@@ -2508,11 +2635,6 @@ void MergeSubstructuresPhase(Options &opt, const Int_t nsubset, Particle *&Parts
         for (auto k=0;k<6;k++) subs[i].SetPhase(k,subs[i].GetPhase(k)/subs[i].GetPotential());
     }
 
-    //sort indices by original fof value
-    sort(indexing.begin(), indexing.end(), [](indexfof &a, indexfof &b){
-    return a.fofval < b.fofval;
-    });
-
     //get the dispersions
     for (auto i=0;i<nsubset;i++) {
         pfofval = pfof[Partsubset[i].GetID()];
@@ -2526,81 +2648,94 @@ void MergeSubstructuresPhase(Options &opt, const Int_t nsubset, Particle *&Parts
 
     if (opt.icoresubmergewithbg == 0) index1 = 1;
     else index1 = 0;
-    for (auto i=index1;i<subs.size();i++) {
+    for (auto i=index1;i<nobjects;i++) {
         sigXsubs[i]*=1.0/subs[i].GetPotential();
         sigVsubs[i]*=1.0/subs[i].GetPotential();
     }
 
     //now built tree on substructures
-    tree = new KDTree(subs.data(),subs.size(),1,tree->TPHYS,tree->KEPAN,100,0,0,0);
+    tree = new KDTree(subs.data(),nobjects,1,tree->TPHYS,tree->KEPAN,100,0,0,0);
 
-    //first check all cores to see if they overlap significantly with dynamically distince
-    //substructures. Since cores are after subs in id value, this removes a core
-    //and adds particles to a substructure
-    for (auto i=0;i<numgroups;i++) {
+    //find all candidate mergers in a single pass. An object searches for dynamically distinct objects
+    //within its search window that overlap significantly in phase-space. Since cores are after subs in id value,
+    //merging removes a core and adds particles to a substructure. Candidates are stored by the tree
+    //index of the searching object, in the order returned by the search
+    objectcandidates.resize(nobjects);
+#ifdef USEOPENMP
+#pragma omp parallel for \
+default(shared) schedule(dynamic) if (nobjects > ompsubsearchnum)
+#endif
+    for (auto i=0;i<nobjects;i++) {
+        Int_t i1, i2;
+        Double_t d2, xsub1, xsub2, vsub1, vsub2, dist2sub1, dist2sub2;
+        vector<Int_t> tagged;
         //if only looking at core
         if (opt.icoresubmergewithbg == 2 && subs[i].GetType() != -1) continue;
-        //ignore if already merged
-        if (subs[i].GetPID()==idtagged) continue;
         //don't search cores, which have type 1, to see if objects should merge with them
         if (subs[i].GetType()==1) continue;
         //if not searching background, ignore;
         if (opt.icoresubmergewithbg == 0 && subs[i].GetType() == -1) continue;
-        index1 = subs[i].GetID();
-        searchdist = sigXsubs[index1]*fdist2;
-        ////if object is background halo of type -1, decrease search distance^2 by 1/2^2
-        //if (subs[i].GetType() == -1) searchdist *= 0.25;
-        taggedsubs = tree->SearchBallPosTagged(i, searchdist);
-        if (taggedsubs.size()<=1) continue;
-        //if objects are within search window of core, get min phase distance
-        imerge=-1;
-        mindist2=MAXVALUE;
-        for (auto j=0;j<taggedsubs.size();j++)
+        i1 = subs[i].GetID();
+        tagged = tree->SearchBallPosTagged(i, sigXsubs[i1]*fdist2);
+        if (tagged.size()<=1) continue;
+        for (auto j=0;j<tagged.size();j++)
         {
             //object skips itself
-            if (i==taggedsubs[j]) continue;
-            //object skips any tagged substructure objects
-            if (subs[taggedsubs[j]].GetPID() == idtagged) continue;
+            if (i==tagged[j]) continue;
             //skip background
-            if (subs[taggedsubs[j]].GetType() == -1) continue;
-            index2=subs[taggedsubs[j]].GetID();
-            disp = 0; for (auto k=0;k<3;k++) disp+=pow(subs[taggedsubs[j]].GetPosition(k)-subs[i].GetPosition(k),2.0);
-            xsub1=disp/sigXsubs[index1];
-            xsub2=disp/sigXsubs[index2];
+            if (subs[tagged[j]].GetType() == -1) continue;
+            i2=subs[tagged[j]].GetID();
+            d2 = 0; for (auto k=0;k<3;k++) d2+=pow(subs[tagged[j]].GetPosition(k)-subs[i].GetPosition(k),2.0);
+            xsub1=d2/sigXsubs[i1];
+            xsub2=d2/sigXsubs[i2];
             dist2sub1 = xsub1;
             dist2sub2 = xsub2;
-
-            disp = 0; for (auto k=0;k<3;k++) disp+=pow(subs[taggedsubs[j]].GetVelocity(k)-subs[i].GetVelocity(k),2.0);
-            vsub1=disp/sigVsubs[index1];
-            vsub2=disp/sigVsubs[index2];
+            d2 = 0; for (auto k=0;k<3;k++) d2+=pow(subs[tagged[j]].GetVelocity(k)-subs[i].GetVelocity(k),2.0);
+            vsub1=d2/sigVsubs[i1];
+            vsub2=d2/sigVsubs[i2];
             dist2sub1 += vsub1;
             dist2sub2 += vsub2;
-            dist2 = 0.5*(dist2sub1+dist2sub2);
-
-            if ((dist2sub1<fdist2 && dist2sub2<fdist2) || (xsub1<0.05 && vsub1<0.1 && vsub2<0.1 && index1 ==0)){
-                imerge=taggedsubs[j];
-                mindist2=dist2;
-                nummerged++;
-                minfo[index2].ismerged = true;
-                minfo[index2].mergeindex = index1;
-                subs[imerge].SetPID(idtagged);
-                minfo[index1].numingroup += minfo[index2].numingroup;
-                minfo[index1].nummerged = minfo[index2].nummerged+1;
-                minfo[index1].mergedlist.push_back(index2);
-                for (auto j=0;j<minfo[index2].nummerged;j++) {
-                    minfo[index1].mergedlist.push_back(minfo[index2].mergedlist[j]);
-                    minfo[minfo[index2].mergedlist[j]].ismerged = true;
-                    minfo[minfo[index2].mergedlist[j]].mergeindex = index1;
-                }
+            if ((dist2sub1<fdist2 && dist2sub2<fdist2) || (xsub1<0.05 && vsub1<0.1 && vsub2<0.1 && i1 ==0)){
+                objectcandidates[i].push_back(i2);
             }
         }
     }
+
+    //apply mergers in the order objects are searched. An object that has been merged is skipped as is any
+    //candidate that has already been merged, otherwise the candidate (and all objects merged with it) joins the object
+    mergeroot.resize(nobjects);
+    for (auto i=0;i<nobjects;i++) mergeroot[i]=i;
+    for (auto i=0;i<nobjects;i++) {
+        index1 = subs[i].GetID();
+        if (minfo[index1].ismerged) continue;
+        for (auto &index2:objectcandidates[i]) {
+            if (minfo[index2].ismerged) continue;
+            minfo[index2].ismerged = true;
+            mergeroot[index2] = index1;
+            nummerged++;
+        }
+    }
     delete tree;
+    vector<vector<Int_t>>().swap(objectcandidates);
 
     //if nothing has changed, do nothing
     if (nummerged==0) return;
     //otherwise start merging groups
     if (opt.iverbose>=2) cout<<ThisTask<<": merging phase-space structures which overlap significantly. Number of mergers "<<nummerged<<" of " <<numgroups<<endl;
+    //find the object each merged object ends up in, compressing the path as we go
+    for (auto i=0;i<nobjects;i++) {
+        if (minfo[i].ismerged == false) continue;
+        index1 = i;
+        while (mergeroot[index1] != index1) index1 = mergeroot[index1];
+        index2 = i;
+        while (mergeroot[index2] != index1) {
+            pfofval = mergeroot[index2];
+            mergeroot[index2] = index1;
+            index2 = pfofval;
+        }
+        minfo[i].mergeindex = index1;
+        minfo[index1].numingroup += numingroup[i];
+    }
     //sort merger info by type, which would be (background if present), subs, cores, individually arranged by size, keeping original order if possible
     sort(minfo.begin(), minfo.end(), [](mergeinfo &a, mergeinfo &b){
         if (a.type<b.type) return true;
@@ -2613,17 +2748,11 @@ void MergeSubstructuresPhase(Options &opt, const Int_t nsubset, Particle *&Parts
         }
         else return false;
     });
-    //store old to new pfof values
-    map<Int_t, Int_t> oldtonewindex;
-    for (auto i=0;i<minfo.size();i++)
-    {
-        oldtonewindex[minfo[i].originalpfofval] = i;
-    }
 
     newnumgroups=0;
     newnumcores=0;
     //having sorted groups based on type and size, update the pfof values;
-    for (auto i=0;i<minfo.size();i++)
+    for (auto i=0;i<nobjects;i++)
     {
         //if object has mergered, leave its pfofval unchanged.
         if (minfo[i].ismerged == true) continue;
@@ -2631,40 +2760,15 @@ void MergeSubstructuresPhase(Options &opt, const Int_t nsubset, Particle *&Parts
         minfo[i].pfofval = newnumgroups;
         if (minfo[i].type == 1) newnumcores++;
     }
-    //update the values to new pfof values
-    for (auto i=0;i<minfo.size();i++)
-    {
-        if (minfo[i].ismerged == true) {
-            minfo[i].mergeindex = oldtonewindex[minfo[i].mergeindex];
-        }
-        else if (minfo[i].nummerged > 0) {
-            for (auto &mergedgroup:minfo[i].mergedlist) mergedgroup = oldtonewindex[mergedgroup];
-        }
-    }
+    //store old to new pfof values, with merged objects taking the value of the object they merged with
+    newpfof.resize(nobjects);
+    for (auto &x:minfo) if (x.ismerged == false) newpfof[x.originalpfofval] = x.pfofval;
+    for (auto &x:minfo) if (x.ismerged == true) newpfof[x.originalpfofval] = newpfof[x.mergeindex];
 
-    //now update the pfof array as necessary
-    for (auto i=0;i<minfo.size();i++) {
-        //if object is still in same order and has not mergered with anything, do nothing
-        if (minfo[i].ismerged == true) continue;
-        //if object is in order and has no mergers, nothing to update
-        if (minfo[i].pfofval == minfo[i].originalpfofval && minfo[i].nummerged==0) continue;
-        //if object has things that merged with it, update the list
-        if (minfo[i].nummerged>0) {
-            pfofval = minfo[i].pfofval;
-            for (auto &mergedgroup:minfo[i].mergedlist) {
-                index1 = minfo[mergedgroup].originalpfofval;
-                for (auto j=noffset[index1];j<noffset[index1]+numingroup[index1];j++) {
-                    pfof[Partsubset[indexing[j].index].GetID()] = pfofval;
-                }
-            }
-        }
-        if (minfo[i].pfofval != minfo[i].originalpfofval) {
-            index1 = minfo[i].originalpfofval;
-            pfofval = minfo[i].pfofval;
-            for (auto j=noffset[index1];j<noffset[index1]+numingroup[index1];j++) {
-                pfof[Partsubset[indexing[j].index].GetID()]=pfofval;
-            }
-        }
+    //now update the pfof array
+    for (auto i=0;i<nsubset;i++) {
+        index1 = Partsubset[i].GetID();
+        pfof[index1] = newpfof[pfof[index1]];
     }
 
     numcores=newnumcores;
@@ -2680,6 +2784,9 @@ void RemoveSpuriousDynamicalSubstructures(Options &opt, const Int_t nsubset, Int
 #endif
     if (numgroups == 0 || numsubs==0) return;
     Int_t numinsub=0, numinlargest=0;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) reduction(+:numinsub,numinlargest) if (nsubset > omppropnum)
+#endif
     for (auto i=0;i<nsubset;i++) {
         if (pfof[i]==0) continue;
         numinlargest+=(pfof[i]==1);
@@ -2690,6 +2797,9 @@ void RemoveSpuriousDynamicalSubstructures(Options &opt, const Int_t nsubset, Int
         if (opt.iverbose>=2) cout<<ThisTask<<": removing a large substructure "<<nsubset<<" "<<numgroups<<" "<<numsubs<<" "<<numcores<<" and size is "<<numinsub<<" "<<numinlargest<<endl;
         numgroups--;
         numsubs--;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nsubset > omppropnum)
+#endif
         for (auto i=0;i<nsubset;i++) if (pfof[i]>0) pfof[i]--;
     }
 }
@@ -2699,7 +2809,7 @@ int setNthreads(){
 }
 
 ///adjust to phase centre
-inline void AdjustSubPartToPhaseCM(Int_t num, Particle *subPart, GMatrix &cmphase)
+inline void AdjustSubPartToPhaseCM(Int_t num, Particle *subPart, PhaseVector &cmphase)
 {
     int nthreads = 1;
 #ifdef USEOPENMP
@@ -2709,12 +2819,19 @@ num_threads(nthreads) if (num > ompperiodnum)
 #endif
     for (auto j=0;j<num;j++)
     {
-        for (int k=0;k<6;k++) subPart[j].SetPhase(k,subPart[j].GetPhase(k)-cmphase(k,0));
+        for (int k=0;k<6;k++) subPart[j].SetPhase(k,subPart[j].GetPhase(k)-cmphase[k]);
     }
 }
 
 ///Pre-calcualtions for searching for substructure
-inline void PreCalcSearchSubSet(Options &opt, Int_t subnumingroup,  Particle *&subPart, Int_t sublevel)
+/*!
+    If bgcellid is passed, it stores for each particle of the subset the index of the grid cell containing the particle in the
+    background grid of the (sub)structure that was last searched, -1 if none. The grid cells of a structure are then derived
+    from those of its parent if it is well resolved by them (see \ref FillTreeGridFromParent) and the cells of this structure stored
+    for its own substructures.
+*/
+inline void PreCalcSearchSubSet(Options &opt, Int_t subnumingroup,  Particle *&subPart, Int_t sublevel,
+    Int_t *subpglist=NULL, Int_t *bgcellid=NULL)
 {
     #ifndef USEMPI
     int ThisTask = 0;
@@ -2732,10 +2849,25 @@ inline void PreCalcSearchSubSet(Options &opt, Int_t subnumingroup,  Particle *&s
         opt.Ncell=opt.Ncellfac*subnumingroup;
         //if ncell is such that uncertainty would be greater than 0.5% based on Poisson noise, increase ncell till above unless cell would contain >25%
         while (opt.Ncell<MINCELLSIZE && subnumingroup/4.0>opt.Ncell) opt.Ncell*=2;
-        tree=InitializeTreeGrid(opt,subnumingroup,subPart);
-        ngrid=tree->GetNumLeafNodes();
-        grid=new GridCell[ngrid];
-        FillTreeGrid(opt, subnumingroup, ngrid, tree, subPart, grid);
+        ngrid=0;
+        if (bgcellid!=NULL) {
+            vector<Int_t> parentcell(subnumingroup);
+            for (auto j=0;j<subnumingroup;j++) parentcell[j]=bgcellid[subpglist[j]];
+            ngrid=FillTreeGridFromParent(opt, subnumingroup, subPart, parentcell.data(), grid);
+            if (opt.iverbose && ngrid>0) cout<<ThisTask<<" Using "<<ngrid<<" cells of parent structure to characterize the background"<<endl;
+        }
+        if (ngrid==0) {
+            tree=InitializeTreeGrid(opt,subnumingroup,subPart);
+            ngrid=tree->GetNumLeafNodes();
+            grid=new GridCell[ngrid];
+            FillTreeGrid(opt, subnumingroup, ngrid, tree, subPart, grid);
+        }
+        //store cells for the substructures of this structure before they are freed
+        if (bgcellid!=NULL) {
+            for (auto j=0;j<subnumingroup;j++) bgcellid[subpglist[j]]=-1;
+            for (auto j=0;j<ngrid;j++)
+                for (auto k=0;k<grid[j].nparts;k++) bgcellid[subpglist[grid[j].nindex[k]]]=j;
+        }
         gvel=GetCellVel(opt,subnumingroup,subPart,ngrid,grid);
         gveldisp=GetCellVelDisp(opt,subnumingroup,subPart,ngrid,grid,gvel);
         
@@ -2761,28 +2893,29 @@ inline void PreCalcSearchSubSet(Options &opt, Int_t subnumingroup,  Particle *&s
         Double_t sigma2x,sigma2y,sigma2z;
         CalcVelSigmaTensor(subnumingroup, subPart, sigma2x, sigma2y, sigma2z, eigvec, I);
         opt.HaloLocalSigmaV=opt.HaloSigmaV=pow(sigma2x*sigma2y*sigma2z,1.0/3.0);
+        if (bgcellid!=NULL) for (auto j=0;j<subnumingroup;j++) bgcellid[subpglist[j]]=-1;
     }
 }
 
+///update group ids with the substructures found in a (sub)structure, storing the substructure lists in the sublevel's arena
 inline void CleanAndUpdateGroupsFromSubSearch(Options &opt,
     Int_t &subnumingroup, Particle *subPart, Int_t *&subpfof,
     Int_t &subngroup, Int_t *&subsubnumingroup,
     Int_t **&subsubpglist, Int_t &numcores,
     Int_t *&subpglist,
-    Int_t *&pfof, Int_t &ngroup, Int_t &ngroupidoffset)
+    Int_t *&pfof, Int_t &ngroup, Int_t &ngroupidoffset, MemoryArena &arena)
 {
     bool iunbindflag;
-    Int_t ng=subngroup;
     Int_t *coreflag;
     if (subngroup == 0) return;
 
-    subsubnumingroup = BuildNumInGroup(subnumingroup, subngroup, subpfof);
-    subsubpglist = BuildPGList(subnumingroup, subngroup, subsubnumingroup, subpfof);
+    subsubnumingroup = BuildNumInGroup(subnumingroup, subngroup, subpfof, arena);
+    subsubpglist = BuildPGList(subnumingroup, subngroup, subsubnumingroup, subpfof, arena);
 
     if (opt.uinfo.unbindflag&&subngroup>0) {
         //if also keeping track of cores then must allocate coreflag
         if (numcores>0 && opt.iHaloCoreSearch>=1) {
-            coreflag=new Int_t[subngroup+1];
+            coreflag=arena.Allocate<Int_t>(subngroup+1);
             for (auto icore=1;icore<=subngroup;icore++) coreflag[icore]=1+(icore>subngroup-numcores);
         }
         else {
@@ -2790,29 +2923,32 @@ inline void CleanAndUpdateGroupsFromSubSearch(Options &opt,
         }
         iunbindflag = CheckUnboundGroups(opt, subnumingroup, subPart,
             subngroup, subpfof, subsubnumingroup, subsubpglist, 1, coreflag);
+        //old lists are simply left in the arena and released at the end of the sublevel
         if (iunbindflag) {
-            for (auto j=1;j<=ng;j++) delete[] subsubpglist[j];
-            delete[] subsubnumingroup;
-            delete[] subsubpglist;
             if (subngroup>0) {
-                subsubnumingroup = BuildNumInGroup(subnumingroup, subngroup, subpfof);
-                subsubpglist = BuildPGList(subnumingroup, subngroup, subsubnumingroup, subpfof);
+                subsubnumingroup = BuildNumInGroup(subnumingroup, subngroup, subpfof, arena);
+                subsubpglist = BuildPGList(subnumingroup, subngroup, subsubnumingroup, subpfof, arena);
             }
             //if need to update number of cores,
             if (numcores>0 && opt.iHaloCoreSearch>=1) {
                 numcores=0;
                 for (auto icore=1;icore<=subngroup;icore++) numcores += (coreflag[icore]==2);
-                delete[] coreflag;
             }
         }
     }
 
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (subnumingroup > omppropnum)
+#endif
     for (auto j=0;j<subnumingroup;j++)
     {
         if (subpfof[j]>0) pfof[subpglist[j]]=ngroup+ngroupidoffset+subpfof[j];
     }
     //ngroupidoffset+=subngroup;
     //now alter subsubpglist so that index pointed is global subset index as global subset is used to get the particles to be searched for subsubstructure
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(dynamic) if (subnumingroup > omppropnum)
+#endif
     for (auto j=1;j<=subngroup;j++)
     {
         for (auto k=0;k<subsubnumingroup[j];k++)
@@ -2844,6 +2980,122 @@ void UpdateGroupIDsFromSubstructure(Int_t activenumgroups, Int_t oldnumgroups,
     }
 }
 
+///search a single (sub)structure for substructures using a local copy of its particles, used by \ref SearchSubSub
+///the lists of substructures found are allocated from the arena
+inline void SearchSubSubStructure(Options &opt, const Int_t sublevel, vector<Particle> &Partsubset,
+    Int_t &subnumingroup, Int_t *&subpglist, Int_t &subngroup,
+    Int_t *&subsubnumingroup, Int_t **&subsubpglist, Int_t &numcores, Int_t &subpfofold,
+    Int_t *&pfof, Int_t &ngroup, Int_t &ngroupidoffset, MemoryArena &arena, Int_t *bgcellid)
+{
+    Particle *subPart;
+    Int_t *subpfof;
+    subpfofold=pfof[subpglist[0]];
+    //the search only needs the phase-space data so the particle properties are not copied
+    subPart=new Particle[subnumingroup];
+    GatherParticlesCoreData(subnumingroup, subPart, Partsubset.data(), subpglist);
+    //move to cm if desired
+    if (opt.icmrefadjust) {
+        //this routine is in substructureproperties.cxx. Has internal parallelisation
+        PhaseVector cmphase = CalcPhaseCM(subnumingroup, subPart);
+        //this routine is within this file, also has internal parallelisation
+        AdjustSubPartToPhaseCM(subnumingroup, subPart, cmphase);
+    }
+    PreCalcSearchSubSet(opt, subnumingroup, subPart, sublevel, subpglist, bgcellid);
+    subpfof = SearchSubset(opt, subnumingroup, subnumingroup, subPart,
+        subngroup, sublevel, &numcores);
+    CleanAndUpdateGroupsFromSubSearch(opt, subnumingroup, subPart, subpfof,
+        subngroup, subsubnumingroup, subsubpglist, numcores,
+        subpglist, pfof, ngroup, ngroupidoffset, arena);
+    delete[] subpfof;
+    delete[] subPart;
+}
+
+#ifdef USEOPENMP
+/*!
+    Search all (sub)structures of a sublevel for substructures as OpenMP tasks, returning the number of substructures found.
+    Tasks are created in order of decreasing expected cost, ~n log n, so the most expensive searches start first and
+    idle threads pick up the remaining tasks as they finish. Structures with at least \ref ompsplitsubsearchnum particles
+    run the parallel regions within their search with a number of threads proportional to their share of the cost of
+    the level, rather than being searched one at a time with all threads before the smaller structures are started.
+    The nested threads come from a pool of spare threads that the outer team leaves free, sized for the largest search but at
+    most half the threads, so the total number of threads never exceeds omp_get_max_threads() and small searches keep at least half
+    of the threads when one structure dominates the level. A large search takes what is left of the pool when it starts.
+    Each task searches with its own copy of the options. The per-structure fields, Ncell, HaloSigmaV and HaloLocalSigmaV, are set
+    for each structure by \ref PreCalcSearchSubSet before they are used, so as before only the velocity dispersion scale of
+    the large structures, the maximum over structures, is kept in the global options.
+    Substructure lists are allocated from the arena of the thread running the task,
+    arenas[thread+1], as tasks are tied to the thread that starts them.
+*/
+Int_t SearchSubSubLevelTasks(Options &opt, const Int_t sublevel, const Int_t nsubsearch, vector<Particle> &Partsubset,
+    Int_t *subnumingroup, Int_t **subpglist, Int_t *subngroup,
+    Int_t **subsubnumingroup, Int_t ***subsubpglist, Int_t *numcores, Int_t *subpfofold,
+    Int_t *&pfof, Int_t &ngroup, vector<Int_t> &ngroupidoffset, vector<MemoryArena> &arenas, Int_t *bgcellid)
+{
+    Int_t ns = 0;
+    int nthreads = omp_get_max_threads(), maxactivelevels = omp_get_max_active_levels();
+    int nspare = 0, nsparefree;
+    double totalcost = 0;
+    vector<double> cost(nsubsearch+1);
+    vector<int> ntaskthreads(nsubsearch+1, 1);
+    vector<Int_t> taskorder(nsubsearch);
+
+    for (Int_t i=1;i<=nsubsearch;i++) {
+        cost[i] = subnumingroup[i]*log((double)subnumingroup[i]+1.0);
+        totalcost += cost[i];
+        taskorder[i-1] = i;
+    }
+    sort(taskorder.begin(), taskorder.end(), [&cost](Int_t a, Int_t b){return cost[a] > cost[b];});
+    //threads wanted by large searches, the extra threads coming from a pool the outer team leaves free
+    for (Int_t i=1;i<=nsubsearch;i++) {
+        if (subnumingroup[i] < ompsplitsubsearchnum) continue;
+        ntaskthreads[i] = max(1, (int)round(nthreads*cost[i]/totalcost));
+        nspare = max(nspare, ntaskthreads[i]-1);
+    }
+    //at most half the threads are held back, so that a dominant structure does not leave the many small ones to a few threads
+    nspare = min(nspare, nthreads/2);
+    nsparefree = nspare;
+    //allow the parallel regions of large searches to use more than one thread
+    omp_set_max_active_levels(max(maxactivelevels, 2));
+    #pragma omp parallel default(shared) num_threads(nthreads-nspare)
+    #pragma omp single
+    {
+        for (Int_t itask=0;itask<nsubsearch;itask++) {
+            Int_t i = taskorder[itask];
+            #pragma omp task default(shared) firstprivate(i)
+            {
+                Options opt2 = opt;
+                MemoryArena &arena = arenas[omp_get_thread_num()+1];
+                int nextra = 0;
+                if (ntaskthreads[i] > 1) {
+                    #pragma omp critical (searchsubsubthreads)
+                    {
+                    nextra = min(ntaskthreads[i]-1, nsparefree);
+                    nsparefree -= nextra;
+                    }
+                }
+                omp_set_num_threads(1+nextra);
+                SearchSubSubStructure(opt2, sublevel, Partsubset, subnumingroup[i], subpglist[i],
+                    subngroup[i], subsubnumingroup[i], subsubpglist[i], numcores[i], subpfofold[i],
+                    pfof, ngroup, ngroupidoffset[i], arena, bgcellid);
+                if (subnumingroup[i] >= ompsplitsubsearchnum) {
+                    #pragma omp critical (searchsubsublarge)
+                    {
+                    if (opt2.HaloVelDispScale > opt.HaloVelDispScale) opt.HaloVelDispScale = opt2.HaloVelDispScale;
+                    }
+                }
+                if (nextra > 0) {
+                    #pragma omp critical (searchsubsubthreads)
+                    nsparefree += nextra;
+                }
+            }
+        }
+    }
+    omp_set_max_active_levels(maxactivelevels);
+    for (Int_t i=1;i<=nsubsearch;i++) ns += subngroup[i];
+    return ns;
+}
+#endif
+
 /*!
     Given a initial ordered candidate list of substructures, find all substructures that are large enough to be searched.
     These substructures are used as a mean background velocity field and a new outlier list is found and searched.
@@ -2859,12 +3111,16 @@ void UpdateGroupIDsFromSubstructure(Int_t activenumgroups, Int_t oldnumgroups,
     NOTE: if the code is altered and generalized to outliers in say the entropy distribution when searching for gas shocks,
     it might be possible to lower the cuts imposed.
 
-    \todo ADACS optimisation request. Here the function could be altered to employ better parallelisation. Specifically, the loop over
-    substructures at a given level could be parallelized (see for loop commented with ENCAPSULATE-01). Currently, at a given level in the substructure hierarchy
-    each object is searched sequentially but this does not need to be the case. It would require restructureing the loop and some of calls within
-    the loop so that the available pool of threads over which to run in parallel for the callled subroutines is adaptive. (Or it might be
-    simply more useful to not have the functions called within this loop parallelised. This loop invokes a few routines that have OpenMP
-    parallelisation: InitializeTreeGrid, GetCellVel, GetCellVelDisp, CalcVelSigmaTensor, etc.
+    With OpenMP, the (sub)structures of a sublevel are searched as tasks ordered by cost (see \ref SearchSubSubLevelTasks).
+    Sublevels are still searched one after another as the group ids and structure level data are updated once a sublevel is complete.
+
+    The bookkeeping of a sublevel (the number and list of particles in each substructure found, the number of substructures
+    and cores of each searched structure and their old ids) is allocated from a \ref MemoryArena for the level and one per thread,
+    all released in one step once the structures to be searched at the next sublevel have been stored.
+    The peak memory held by the arenas is kept in \ref Options.memuse_arenapeak and reported with the memory usage.
+
+    If \ref Options.iincrementalbg is set, the background grid cell of each particle is kept from one sublevel to the next so that
+    the background of well resolved substructures can be derived from the cells of their parent (see \ref PreCalcSearchSubSet).
 */
 void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubset, Int_t *&pfof, Int_t &ngroup, Int_t &nhalos, PropData *pdata)
 {
@@ -2880,7 +3136,20 @@ void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubse
     Int_t *numcores,*coreflag;
     Int_t *subpfofold;
     vector<Int_t> ngroupidoffset_old, ngroupidoffset_new;
-    vector<Int_t> ompactivesubgroups;
+    //arena for per level arrays followed by one per thread for the per structure lists
+    int nthreads=1;
+    size_t arenaused;
+#ifdef USEOPENMP
+    nthreads=omp_get_max_threads();
+#endif
+    vector<MemoryArena> arenas(nthreads+1);
+    //background grid cell of each particle in the last structure searched, used to derive the background of its substructures
+    vector<Int_t> bgcellidvec;
+    Int_t *bgcellid=NULL;
+    if (opt.iincrementalbg) {
+        bgcellidvec.assign(nsubset,-1);
+        bgcellid=bgcellidvec.data();
+    }
     //variables to keep track of structure level, pfof values (ie group ids) and their parent structure
     //use to point to current level
     StrucLevelData *pcsld;
@@ -2948,11 +3217,11 @@ void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubse
     while (iflag) {
         if (opt.iverbose) cout<<ThisTask<<" There are "<<nsubsearch<<" substructures large enough to search for other substructures at sub level "<<sublevel<<endl;
         oldnsubsearch=nsubsearch;
-        subsubnumingroup=new Int_t*[nsubsearch+1];
-        subsubpglist=new Int_t**[nsubsearch+1];
-        subngroup=new Int_t[nsubsearch+1];
-        numcores=new Int_t[nsubsearch+1];
-        subpfofold=new Int_t[nsubsearch+1];
+        subsubnumingroup=arenas[0].Allocate<Int_t*>(nsubsearch+1);
+        subsubpglist=arenas[0].Allocate<Int_t**>(nsubsearch+1);
+        subngroup=arenas[0].Allocate<Int_t>(nsubsearch+1);
+        numcores=arenas[0].Allocate<Int_t>(nsubsearch+1);
+        subpfofold=arenas[0].Allocate<Int_t>(nsubsearch+1);
         ns=0;
 
         ngroupidoffset_old.resize(oldnsubsearch+1);
@@ -2960,105 +3229,19 @@ void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubse
         ngroupidoffset_new[1] = ngroupidoffset;
         ngroupidoffset_old[1] = ngroupidoffset;
         for (auto i=2;i<=oldnsubsearch;i++) ngroupidoffset_old[i] = ngroupidoffset_old[i-1]+ceil(subnumingroup[i-1]/opt.MinSize)+1;
-#ifdef USEOPENMP
-        //vector that will store the subgroups that are small
-        //enough to be searched fully in parallel.
-        ompactivesubgroups.resize(0);
-#endif
         GetMemUsage(opt, __func__+string("--line--")+to_string(__LINE__)+string("--subelvel--")+to_string(sublevel), (opt.iverbose>=1));
 
-        for (Int_t i=1;i<=oldnsubsearch;i++) {
-            // try running loop over largest objects in serial with parallel inside calls
-            // so skip of group is small enough and running with openmp
 #ifdef USEOPENMP
-            if (subnumingroup[i] < ompsplitsubsearchnum) {
-                ompactivesubgroups.push_back(i);
-                continue;
-            }
-#endif
-            subpfofold[i]=pfof[subpglist[i][0]];
-            subPart=new Particle[subnumingroup[i]];
-            for (Int_t j=0;j<subnumingroup[i];j++) {
-                subPart[j]=Partsubset[subpglist[i][j]];
-#ifdef GASON
-                if (subPart[j].HasHydroProperties()) subPart[j].SetHydroProperties();
-#endif
-#ifdef STARON
-                if (subPart[j].HasStarProperties()) subPart[j].SetStarProperties();
-#endif
-#ifdef BHON
-                if (subPart[j].HasBHProperties()) subPart[j].SetBHProperties();
-#endif
-#ifdef EXTRADMON
-                if (subPart[j].HasExtraDMProperties()) subPart[j].SetExtraDMProperties();
-#endif
-            }
-            //move to cm if desired
-            if (opt.icmrefadjust) {
-                //this routine is in substructureproperties.cxx. Has internal parallelisation
-                GMatrix cmphase = CalcPhaseCM(subnumingroup[i], subPart);
-                //this routine is within this file, also has internal parallelisation
-                AdjustSubPartToPhaseCM(subnumingroup[i], subPart, cmphase);
-            }
-            PreCalcSearchSubSet(opt, subnumingroup[i], subPart, sublevel);
-            subpfof = SearchSubset(opt, subnumingroup[i], subnumingroup[i], subPart,
-                subngroup[i], sublevel, &numcores[i]);
-            CleanAndUpdateGroupsFromSubSearch(opt, subnumingroup[i], subPart, subpfof,
-                    subngroup[i], subsubnumingroup[i], subsubpglist[i], numcores[i],
-                    subpglist[i], pfof, ngroup, ngroupidoffset_old[i]);
-            delete[] subpfof;
-            delete[] subPart;
+        ns = SearchSubSubLevelTasks(opt, sublevel, oldnsubsearch, Partsubset,
+            subnumingroup, subpglist, subngroup, subsubnumingroup, subsubpglist,
+            numcores, subpfofold, pfof, ngroup, ngroupidoffset_old, arenas, bgcellid);
+#else
+        for (Int_t i=1;i<=oldnsubsearch;i++) {
+            SearchSubSubStructure(opt, sublevel, Partsubset, subnumingroup[i], subpglist[i],
+                subngroup[i], subsubnumingroup[i], subsubpglist[i], numcores[i], subpfofold[i],
+                pfof, ngroup, ngroupidoffset_old[i], arenas[1], bgcellid);
             ns+=subngroup[i];
         }
-
-
-#ifdef USEOPENMP
-        if (ompactivesubgroups.size()>0) {
-            Int_t oldns = ns;
-            ns = 0;
-            Options opt2;
-            #pragma omp parallel for \
-            default(shared) private(subPart, subpfof, opt2) schedule(dynamic) \
-            reduction(+:ns)
-            for (auto iomp=0;iomp<ompactivesubgroups.size();iomp++) {
-                Int_t i=ompactivesubgroups[iomp];
-                opt2 = opt;
-                subpfofold[i] = pfof[subpglist[i][0]];
-                subPart = new Particle[subnumingroup[i]];
-                for (Int_t j=0;j<subnumingroup[i];j++) {
-                    subPart[j] = Partsubset[subpglist[i][j]];
-#ifdef GASON
-                    if (subPart[j].HasHydroProperties()) subPart[j].SetHydroProperties();
-#endif
-#ifdef STARON
-                    if (subPart[j].HasStarProperties()) subPart[j].SetStarProperties();
-#endif
-#ifdef BHON
-                    if (subPart[j].HasBHProperties()) subPart[j].SetBHProperties();
-#endif
-#ifdef EXTRADMON
-                    if (subPart[j].HasExtraDMProperties()) subPart[j].SetExtraDMProperties();
-#endif
-                }
-
-                if (opt.icmrefadjust) {
-                    //this routine is in substructureproperties.cxx. Has internal parallelisation
-                    GMatrix cmphase = CalcPhaseCM(subnumingroup[i], subPart);
-                    //this routine is within this file, also has internal parallelisation
-                    AdjustSubPartToPhaseCM(subnumingroup[i], subPart, cmphase);
-                }
-                PreCalcSearchSubSet(opt2, subnumingroup[i], subPart, sublevel);
-                subpfof = SearchSubset(opt2, subnumingroup[i], subnumingroup[i], subPart,
-                    subngroup[i], sublevel, &numcores[i]);
-                CleanAndUpdateGroupsFromSubSearch(opt2, subnumingroup[i], subPart, subpfof,
-                        subngroup[i], subsubnumingroup[i], subsubpglist[i], numcores[i],
-                        subpglist[i], pfof, ngroup, ngroupidoffset_old[i]);
-                delete[] subpfof;
-                delete[] subPart;
-                ns += subngroup[i];
-            }
-            ns += oldns;
-        }
 #endif
         UpdateGroupIDsFromSubstructure(oldnsubsearch, ngroup,
             pfof, subngroup, subnumingroup, subpglist,
@@ -3183,19 +3366,11 @@ void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubse
             nsubsearch--;
         }
         else iflag=false;
-        //free memory
-        for (Int_t i=1;i<=oldnsubsearch;i++) {
-            if (subngroup[i]>0) {
-                for (Int_t j=1;j<=subngroup[i];j++) delete[] subsubpglist[i][j];
-                delete[] subsubnumingroup[i];
-                delete[] subsubpglist[i];
-            }
-        }
-        delete[] subsubnumingroup;
-        delete[] subsubpglist;
-        delete[] subngroup;
-        delete[] numcores;
-        delete[] subpfofold;
+        //free memory of the level, nothing is freed during a level so the memory in use is the level's peak
+        arenaused=0;
+        for (auto &arena:arenas) {arenaused+=arena.used; arena.Reset();}
+        if (opt.memuse_arenapeak<arenaused) opt.memuse_arenapeak=arenaused;
+        if (opt.iverbose>=2) cout<<ThisTask<<" Sublevel bookkeeping used "<<arenaused/1024.0/1024.0<<" MB, peak "<<opt.memuse_arenapeak/1024.0/1024.0<<" MB"<<endl;
         if (opt.iverbose) cout<<ThisTask<<"Finished storing next level of substructures to be searched for subsubstructure"<<endl;
     }
 
@@ -3337,15 +3512,19 @@ int CheckSignificance(Options &opt, const Int_t nsubset, Particle *Partsubset, I
     if (opt.iverbose) {
         cout<<"Checking that groups have a significance level of "<<opt.siglevel<<" and contain more than "<<opt.MinSize<<" members"<<endl;
     }
-    for (i=0;i<=numgroups;i++) {aveell[i]=0.;maxell[i]=-MAXVALUE;minell[i]=MAXVALUE;//numingroup[i]=0;
-    }
-    for (i=0;i<nsubset;i++)
-    {
-        Int_t gid=pfof[Partsubset[i].GetID()];
-        Double_t ellvalue=Partsubset[i].GetPotential();
-        aveell[gid]+=ellvalue;
-        if(maxell[gid]<ellvalue)maxell[gid]=ellvalue;
-        if(minell[gid]>ellvalue)minell[gid]=ellvalue;
+    //get the ell statistics of each group from its list of members
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(dynamic) if (nsubset > omppropnum)
+#endif
+    for (i=1;i<=numgroups;i++) {
+        Double_t ellvalue;
+        aveell[i]=0.;maxell[i]=-MAXVALUE;minell[i]=MAXVALUE;
+        for (Int_t j=0;j<numingroup[i];j++) {
+            ellvalue=Partsubset[pglist[i][j]].GetPotential();
+            aveell[i]+=ellvalue;
+            if(maxell[i]<ellvalue)maxell[i]=ellvalue;
+            if(minell[i]>ellvalue)minell[i]=ellvalue;
+        }
     }
     for (i=1;i<=numgroups;i++) {
         aveell[i]/=(Double_t)numingroup[i];
@@ -3356,41 +3535,43 @@ int CheckSignificance(Options &opt, const Int_t nsubset, Particle *Partsubset, I
     if (opt.iverbose) cout<<"Done"<<endl;
     if (iflag){
         if (opt.iverbose) cout<<"Remove groups below significance level"<<endl;
+        //particles are removed in order of increasing ell, one for each distinct ell value, until the group is significant.
+        //Rather than searching the group for the next lowest value after each removal, the members are sorted once by ell
 #ifdef USEOPENMP
-#pragma omp parallel default(shared) \
-private(i)
-{
-#pragma omp for
+#pragma omp parallel for default(shared) schedule(dynamic) if (nsubset > omppropnum)
 #endif
         for (i=1;i<=numgroups;i++) {
             if(betaave[i]<opt.siglevel) {
-                do {
-                    if ((numingroup[i])<opt.MinSize) {
-                        for (Int_t j=0;j<numingroup[i];j++) pfof[Partsubset[pglist[i][j]].GetID()]=0;
-                        numingroup[i]=-1;
-                        break;
-                    }
-                    Int_t iminell;
-                    Double_t vminell=minell[i];
-                    aveell[i]=(aveell[i]*(Double_t)numingroup[i]-minell[i])/(Double_t)(numingroup[i]-1.0);
-                    minell[i]=maxell[i];
-                    for (Int_t j=0;j<numingroup[i];j++)
-                        if(Partsubset[pglist[i][j]].GetPotential()>vminell&&Partsubset[pglist[i][j]].GetPotential()<minell[i])minell[i]=Partsubset[pglist[i][j]].GetPotential();
-                        else if (Partsubset[pglist[i][j]].GetPotential()==vminell) iminell=j;
-                    pfof[Partsubset[pglist[i][iminell]].GetID()]=0;
-                    if (iminell!=numingroup[i]-1)pglist[i][iminell]=pglist[i][numingroup[i]-1];
-                    numingroup[i]--;
-                    betaave[i]=(aveell[i]/ellaveexp-1.0)*sqrt((Double_t)numingroup[i]);
-                } while(betaave[i]<opt.siglevel);
+                Int_t *glist=pglist[i], nremove=0, nkeep=0;
+                Double_t ellsum=aveell[i]*(Double_t)numingroup[i], vminell=-MAXVALUE;
+                sort(glist, glist+numingroup[i], [Partsubset](Int_t a, Int_t b){
+                    return Partsubset[a].GetPotential() < Partsubset[b].GetPotential();
+                });
+                for (Int_t j=0;j<numingroup[i];j++) {
+                    if (Partsubset[glist[j]].GetPotential()==vminell) continue;
+                    if (numingroup[i]-nremove<opt.MinSize) break;
+                    vminell=Partsubset[glist[j]].GetPotential();
+                    ellsum-=vminell;
+                    pfof[Partsubset[glist[j]].GetID()]=0;
+                    nremove++;
+                    betaave[i]=(ellsum/(Double_t)(numingroup[i]-nremove)/ellaveexp-1.0)*sqrt((Double_t)(numingroup[i]-nremove));
+                    if (betaave[i]>=opt.siglevel) break;
+                }
+                //keep the remaining members at the start of the list
+                for (Int_t j=0;j<numingroup[i];j++) if (pfof[Partsubset[glist[j]].GetID()]>0) glist[nkeep++]=glist[j];
+                numingroup[i]=nkeep;
+                //as only one particle per distinct ell value is removed, a group whose remaining members share the same ell
+                //can run out of values to remove while still insignificant, in which case it is removed entirely
+                if (betaave[i]<opt.siglevel) {
+                    for (Int_t j=0;j<numingroup[i];j++) pfof[Partsubset[glist[j]].GetID()]=0;
+                    numingroup[i]=-1;
+                }
             }
             if ((numingroup[i])<opt.MinSize) {
                 for (Int_t j=0;j<numingroup[i];j++) pfof[Partsubset[pglist[i][j]].GetID()]=0;
                 numingroup[i]=-1;
             }
         }
-#ifdef USEOPENMP
-}
-#endif
         if (opt.iverbose) cout<<"Done"<<endl;
         for (i=1;i<=numgroups;i++) if (numingroup[i]==-1) ng--;
         if (ng) ReorderGroupIDs(numgroups, ng, numingroup, pfof, pglist, Partsubset);
@@ -4226,7 +4407,76 @@ private(ii,tid)
             }
         }
 }
-inline void SearchForNewLinks(Int_t nsubset, KDTree *tree, Particle *Partsubset, Int_t *pfof, FOFcompfunc &fofcmp, Double_t *param, Int_t newlinks, Int_t *newlinksIndex, Int_t **nnID, int nthreads) {
+/*!
+    Build a neighbour list of the outliers of the subset, particles with ell (stored in the potential) >= ellthreshold, listing for each
+    the array indices of all outliers within a distance^2 of rmax2, including itself. The list is stored in compressed form,
+    the neighbours of particle index i being nnlist[nnoffset[i]] to nnlist[nnoffset[i+1]-1]. Particles below the threshold have no neighbours.
+    Since comparison functions like \ref FOFStreamwithprob link no particle below the threshold, the list can replace tree searches
+    of passes with linking lengths^2 <= rmax2 and outlier thresholds >= ellthreshold.
+*/
+void BuildOutlierNeighbourList(const Int_t nsubset, KDTree *tree, Particle *Partsubset, Double_t ellthreshold, Double_t rmax2,
+    vector<Int_t> &nnoffset, vector<Int_t> &nnlist)
+{
+    int nthreads=1, nteam=1;
+    vector<Int_t> nthreadlist;
+    nnoffset.resize(nsubset+1);
+#ifdef USEOPENMP
+    if (nsubset>ompsearchnum) nthreads=omp_get_max_threads();
+#endif
+    vector<vector<Int_t>> threadlist(nthreads);
+    nthreadlist.resize(nthreads+1);
+    //each thread searches a contiguous block of particles, so lists can be concatenated in thread order
+#ifdef USEOPENMP
+#pragma omp parallel default(shared) num_threads(nthreads)
+{
+#endif
+    int tid=0;
+#ifdef USEOPENMP
+    tid=omp_get_thread_num();
+    //the team can be smaller than requested, so the blocks are set by the number of threads actually running
+    #pragma omp single
+    nteam=omp_get_num_threads();
+#endif
+    Int_t istart=(nsubset/nteam)*tid+min((Int_t)tid,nsubset%nteam);
+    Int_t iend=istart+nsubset/nteam+(tid<nsubset%nteam);
+    vector<Int_t> tagged;
+    for (auto i=istart;i<iend;i++) {
+        nnoffset[i]=threadlist[tid].size();
+        if (Partsubset[i].GetPotential()<ellthreshold) continue;
+        tagged=tree->SearchBallPosTagged(i,rmax2);
+        for (auto &j:tagged) if (Partsubset[j].GetPotential()>=ellthreshold) threadlist[tid].push_back(j);
+    }
+#ifdef USEOPENMP
+}
+#endif
+    nthreadlist[0]=0;
+    for (auto j=0;j<nteam;j++) nthreadlist[j+1]=nthreadlist[j]+threadlist[j].size();
+    nnlist.resize(nthreadlist[nteam]);
+    nnoffset[nsubset]=nthreadlist[nteam];
+    for (auto j=0;j<nteam;j++) {
+        Int_t istart=(nsubset/nteam)*j+min((Int_t)j,nsubset%nteam);
+        Int_t iend=istart+nsubset/nteam+(j<nsubset%nteam);
+        for (auto i=istart;i<iend;i++) nnoffset[i]+=nthreadlist[j];
+        copy(threadlist[j].begin(),threadlist[j].end(),nnlist.begin()+nthreadlist[j]);
+        vector<Int_t>().swap(threadlist[j]);
+    }
+}
+
+///Mark the neighbours of target in a neighbour list meeting the criterion given by the comparison function in the same manner as KDTree::SearchCriterion
+inline void SearchCriterionNeighbourList(Int_t target, FOFcompfunc &fofcmp, Double_t *param, Int_t iGroup, Particle *Partsubset, Int_t *nnID,
+    Int_t *nnoffset, Int_t *nnlist)
+{
+    Int_t id;
+    for (auto j=nnoffset[target];j<nnoffset[target+1];j++) {
+        id=Partsubset[nnlist[j]].GetID();
+        if (nnID[id]==0||nnID[id]>iGroup) {
+            if (fofcmp(Partsubset[target],Partsubset[nnlist[j]],param)) nnID[id]=iGroup;
+        }
+    }
+}
+
+inline void SearchForNewLinks(Int_t nsubset, KDTree *tree, Particle *Partsubset, Int_t *pfof, FOFcompfunc &fofcmp, Double_t *param, Int_t newlinks, Int_t *newlinksIndex, Int_t **nnID, int nthreads,
+    Int_t *nnoffset, Int_t *nnlist) {
     Int_t i,ii;
     int tid;
 #ifdef USEOPENMP
@@ -4238,7 +4488,8 @@ private(ii,tid)
 #pragma omp for schedule(dynamic,1) nowait
         for (ii=0;ii<newlinks;ii++) {
             tid=omp_get_thread_num();
-            tree->SearchCriterion(newlinksIndex[ii], fofcmp,param, pfof[Partsubset[newlinksIndex[ii]].GetID()], &nnID[0][tid*nsubset]);
+            if (nnoffset!=NULL) SearchCriterionNeighbourList(newlinksIndex[ii], fofcmp, param, pfof[Partsubset[newlinksIndex[ii]].GetID()], Partsubset, &nnID[0][tid*nsubset], nnoffset, nnlist);
+            else tree->SearchCriterion(newlinksIndex[ii], fofcmp,param, pfof[Partsubset[newlinksIndex[ii]].GetID()], &nnID[0][tid*nsubset]);
         }
 }
 #pragma omp parallel default(shared) \
@@ -4260,7 +4511,8 @@ private(ii,tid)
         {
             tid=0;
             for (ii=0;ii<newlinks;ii++) {
-                tree->SearchCriterion(newlinksIndex[ii], fofcmp,param, pfof[Partsubset[newlinksIndex[ii]].GetID()], nnID[tid]);
+                if (nnoffset!=NULL) SearchCriterionNeighbourList(newlinksIndex[ii], fofcmp, param, pfof[Partsubset[newlinksIndex[ii]].GetID()], Partsubset, nnID[tid], nnoffset, nnlist);
+                else tree->SearchCriterion(newlinksIndex[ii], fofcmp,param, pfof[Partsubset[newlinksIndex[ii]].GetID()], nnID[tid]);
             }
         }
 }
@@ -0,0 +1,194 @@
+/*! \file spacefillingcurve.cxx
+ *  \brief this file contains routines that reorder particles along a space filling curve
+
+    Particles are assigned a Morton (Z-order) or Hilbert key based on their position in a grid of 2^21 cells per
+    dimension and sorted with a least significant digit radix sort. The resulting order is kept as the layout of the
+    particle array so that spatially close particles, and hence particles in the same group, are close in memory.
+    The input order is stored as a permutation for stages that must read or write data in input order.
+ */
+
+#include "stf.h"
+
+/// \name Space filling curve routines
+//@{
+
+///number of bits per dimension used by the space filling curve keys
+#define SFCBITS 21
+
+///spread the lower 21 bits of a value so that there are two zero bits between each bit
+inline unsigned long long SFCSpreadBits(unsigned long long x)
+{
+    x &= 0x1fffffULL;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+unsigned long long SFCMortonKey(unsigned int ix, unsigned int iy, unsigned int iz)
+{
+    return (SFCSpreadBits(ix) << 2) | (SFCSpreadBits(iy) << 1) | SFCSpreadBits(iz);
+}
+
+///Hilbert key using Skilling's transform of the axes to the transpose of the Hilbert index (AIP Conf. Proc. 707, 381, 2004)
+unsigned long long SFCHilbertKey(unsigned int ix, unsigned int iy, unsigned int iz)
+{
+    unsigned int X[3] = {ix, iy, iz}, M = 1u << (SFCBITS-1), P, Q, t;
+    //inverse undo
+    for (Q = M; Q > 1; Q >>= 1) {
+        P = Q - 1;
+        for (auto i=0;i<3;i++) {
+            if (X[i] & Q) X[0] ^= P;
+            else {
+                t = (X[0] ^ X[i]) & P;
+                X[0] ^= t;
+                X[i] ^= t;
+            }
+        }
+    }
+    //gray encode
+    for (auto i=1;i<3;i++) X[i] ^= X[i-1];
+    t = 0;
+    for (Q = M; Q > 1; Q >>= 1) if (X[2] & Q) t ^= Q - 1;
+    for (auto i=0;i<3;i++) X[i] ^= t;
+    return SFCMortonKey(X[0], X[1], X[2]);
+}
+
+/*!
+    Stable least significant digit radix sort of keys, permuting index alongside.
+    Each pass builds per thread histograms of a block of the keys, converts these to offsets with a prefix sum ordered
+    by digit then thread and scatters the keys. Only the passes needed to cover the largest key are performed.
+*/
+void SFCRadixSort(vector<unsigned long long> &key, vector<Int_t> &index)
+{
+    const int nbits = 8, nbuckets = 1 << nbits;
+    const unsigned long long mask = nbuckets - 1;
+    Int_t n = key.size();
+    int nthreads = 1;
+    unsigned long long maxkey = 0;
+    vector<unsigned long long> keytmp(n);
+    vector<Int_t> indextmp(n);
+
+    for (Int_t i=0;i<n;i++) maxkey = max(maxkey, key[i]);
+#ifdef USEOPENMP
+    if (n > ompsortsize) nthreads = omp_get_max_threads();
+#endif
+    vector<Int_t> offset(nthreads*nbuckets);
+    for (int shift=0; shift<64 && (maxkey >> shift) > 0; shift += nbits) {
+        for (auto &x:offset) x = 0;
+#ifdef USEOPENMP
+#pragma omp parallel default(shared) num_threads(nthreads)
+{
+#endif
+        int tid = 0, nteam = 1;
+#ifdef USEOPENMP
+        //the team can be smaller than requested, so the blocks are set by the number of threads actually running
+        tid = omp_get_thread_num();
+        nteam = omp_get_num_threads();
+#endif
+        Int_t istart = (n/nteam)*tid + min((Int_t)tid, n%nteam);
+        Int_t iend = istart + n/nteam + (tid < n%nteam);
+        Int_t *toffset = &offset[tid*nbuckets];
+        for (Int_t i=istart;i<iend;i++) toffset[(key[i] >> shift) & mask]++;
+#ifdef USEOPENMP
+#pragma omp barrier
+#pragma omp single
+#endif
+        {
+        Int_t noffset = 0, ncount;
+        for (auto b=0;b<nbuckets;b++) {
+            for (auto j=0;j<nteam;j++) {
+                ncount = offset[j*nbuckets+b];
+                offset[j*nbuckets+b] = noffset;
+                noffset += ncount;
+            }
+        }
+        }
+        for (Int_t i=istart;i<iend;i++) {
+            Int_t pos = toffset[(key[i] >> shift) & mask]++;
+            keytmp[pos] = key[i];
+            indextmp[pos] = index[i];
+        }
+#ifdef USEOPENMP
+}
+#endif
+        key.swap(keytmp);
+        index.swap(indextmp);
+    }
+}
+
+/*!
+    Reorder particles along a space filling curve of type opt.iSFCorder (see \ref SFCTYPES).
+    The grid covers the periodic box if opt.p>0 and the bounding box of the particles otherwise.
+    On return, particle ids are set to their new index and inputorder[i] stores the input index of particle i.
+*/
+void SFCReorderParticles(Options &opt, const Int_t nbodies, Particle *Part, vector<Int_t> &inputorder)
+{
+    if (opt.iSFCorder == SFCNONE || nbodies == 0) return;
+    double time1 = MyGetTime();
+    Double_t xmin[3], xmax[3], width = 0, scale;
+    const unsigned int ncellmax = (1u << SFCBITS) - 1;
+    vector<unsigned long long> key(nbodies);
+    vector<Int_t> index(nbodies);
+    vector<char> iswapped(nbodies, 0);
+#ifndef USEMPI
+    int ThisTask=0,NProcs=1;
+#endif
+
+    if (opt.p > 0) {
+        for (auto k=0;k<3;k++) {xmin[k] = 0; xmax[k] = opt.p;}
+    }
+    else {
+        for (auto k=0;k<3;k++) xmin[k] = xmax[k] = Part[0].GetPosition(k);
+        for (Int_t i=1;i<nbodies;i++) {
+            for (auto k=0;k<3;k++) {
+                xmin[k] = min(xmin[k], Part[i].GetPosition(k));
+                xmax[k] = max(xmax[k], Part[i].GetPosition(k));
+            }
+        }
+    }
+    for (auto k=0;k<3;k++) width = max(width, xmax[k]-xmin[k]);
+    if (width <= 0) width = 1.0;
+    scale = (ncellmax + 1.0)/width;
+
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nbodies > ompsortsize)
+#endif
+    for (Int_t i=0;i<nbodies;i++) {
+        unsigned int ix[3];
+        Double_t x;
+        for (auto k=0;k<3;k++) {
+            x = Part[i].GetPosition(k);
+            if (opt.p > 0) x -= opt.p*floor(x/opt.p);
+            x = (x-xmin[k])*scale;
+            if (x < 0) x = 0;
+            ix[k] = (x >= ncellmax) ? ncellmax : (unsigned int)x;
+        }
+        if (opt.iSFCorder == SFCHILBERT) key[i] = SFCHilbertKey(ix[0], ix[1], ix[2]);
+        else key[i] = SFCMortonKey(ix[0], ix[1], ix[2]);
+        index[i] = i;
+    }
+    SFCRadixSort(key, index);
+    vector<unsigned long long>().swap(key);
+
+    //apply the permutation in place by following its cycles, so particle i receives input particle index[i]
+    for (Int_t i=0;i<nbodies;i++) {
+        if (iswapped[i]) continue;
+        Particle ptemp = Part[i];
+        Int_t j = i, k;
+        while (true) {
+            iswapped[j] = 1;
+            k = index[j];
+            if (k == i) {Part[j] = ptemp; break;}
+            Part[j] = Part[k];
+            j = k;
+        }
+    }
+    for (Int_t i=0;i<nbodies;i++) Part[i].SetID(i);
+    inputorder.swap(index);
+    if (opt.iverbose) cout<<ThisTask<<" reordered "<<nbodies<<" particles along a "<<(opt.iSFCorder == SFCHILBERT ? "Hilbert" : "Morton")<<" curve in "<<MyGetTime()-time1<<endl;
+}
+
+//@}
@@ -375,8 +375,8 @@ private(i,j,k,Pval,cmref)
             Pval=&Part[j+noffset[i]];
             for (k=0;k<3;k++) Pval->SetPosition(k, Pval->GetPosition(k) - cmref[k]);
         }
-        //sort by radius (here use gsl_heapsort as no need to allocate more memory
-        gsl_heapsort(&Part[noffset[i]], numingroup[i], sizeof(Particle), RadCompare);
+        //sort by radius, sorting a compact array of radii and moving each particle once
+        SortParticlesByRadius(numingroup[i], &Part[noffset[i]]);
     }
 #ifdef USEOPENMP
 }
@@ -2318,7 +2318,7 @@ private(i,j,k,Pval,ri,rcmv,ri2,r2,cmx,cmy,cmz,EncMass,Ninside,icmv,cmold,x,y,z,v
             }
         }
         //sort by radius
-        gsl_heapsort(&Part[noffset[i]], numingroup[i], sizeof(Particle), RadCompare);
+        SortParticlesByRadius(numingroup[i], &Part[noffset[i]]);
         pdata[i].gsize=Part[noffset[i]+numingroup[i]-1].Radius();
         pdata[i].gRhalfmass=Part[noffset[i]+(numingroup[i]/2)].Radius();
         //then get cmvel if extra output is desired as will need angular momentum
@@ -2434,7 +2434,7 @@ private(j,Pval,x,y,z,massval)
                 Pval->SetPosition(k,(*Pval).GetPosition(k)-pdata[i].gcm[k]);
             }
         }
-        qsort(&Part[noffset[i]], numingroup[i], sizeof(Particle), RadCompare);
+        SortParticlesByRadius(numingroup[i], &Part[noffset[i]]);
         pdata[i].gsize=Part[noffset[i]+numingroup[i]-1].Radius();
         pdata[i].gRhalfmass=Part[noffset[i]+(numingroup[i]/2)].Radius();
         //then get cmvel if extra output is desired as will need angular momentum
@@ -3620,102 +3620,47 @@ private(i,weight)
     I=I*mtot;
 }
 
-///calculate the phase-space dispersion tensor
-void CalcPhaseSigmaTensor(const Int_t n, Particle *p, GMatrix &eigenvalues, GMatrix& eigenvec, GMatrix &I, int itype)
+///calculate the phase-space dispersion tensor and its eigenvalues and eigenvectors
+void CalcPhaseSigmaTensor(const Int_t n, Particle *p, PhaseVector &eigenvalues, PhaseMatrix &eigenvec, PhaseMatrix &I, int itype)
 {
     CalcPhaseSigmaTensor(n, p,  I, itype);
-    I.Eigenvalvec(eigenvalues, eigenvec);
+    I.SymEigen(eigenvalues, eigenvec);
 }
 
-void CalcPhaseSigmaTensor(const Int_t n, Particle *p, GMatrix &I, int itype) {
-    Double_t det,weight;
-    Double_t Ixx,Iyy,Izz,Ixy,Ixz,Iyz;
-    Double_t Ivxvx,Ivyvy,Ivzvz,Ivxvy,Ivxvz,Ivyvz;
-    Double_t Ixvx,Iyvx,Izvx,Ixvy,Iyvy,Izvy,Ixvz,Iyvz,Izvz;
-    I=GMatrix(6,6);
-    Int_t i;
-    Ixx=Iyy=Izz=Ixy=Ixz=Iyz=0.;
-    Ivxvx=Ivyvy=Ivzvz=Ivxvy=Ivxvz=Ivyvz=0.;
-    Ixvx=Iyvx=Izvx=Ixvy=Iyvy=Izvy=Ixvz=Iyvz=Izvz=0;
+///calculate the phase-space dispersion tensor, accumulating the upper triangle per thread
+void CalcPhaseSigmaTensor(const Int_t n, Particle *p, PhaseMatrix &I, int itype) {
     Double_t mtot=0;
+    I=PhaseMatrix(0.);
 #ifdef USEOPENMP
-    if (n>=ompunbindnum) {
-#pragma omp parallel default(shared) \
-private(i,weight)
+#pragma omp parallel default(shared) if (n>=ompunbindnum)
 {
-#pragma omp for schedule(dynamic) reduction(+:Ixx,Iyy,Izz,Ixy,Ixz,Iyz,Ivxvx,Ivyvy,Ivzvz,Ivxvy,Ivxvz,Ivyvz,Ixvx,Iyvx,Izvx,Ixvy,Iyvy,Izvy,Ixvz,Iyvz,Izvz,mtot)
-    for (i = 0; i < n; i++)
+#endif
+    PhaseMatrix Ilocal(0.);
+    Double_t x[6], weight, mlocal=0;
+#ifdef USEOPENMP
+#pragma omp for schedule(static) nowait
+#endif
+    for (Int_t i = 0; i < n; i++)
     {
         if (itype==-1) weight=p[i].GetMass();
         else if (p[i].GetType()==itype) weight=p[i].GetMass();
         else weight=0.;
-        Ixx+=(p[i].X()*p[i].X())*weight;
-        Iyy+=(p[i].Y()*p[i].Y())*weight;
-        Izz+=(p[i].Z()*p[i].Z())*weight;
-        Ixy+=(p[i].X()*p[i].Y())*weight;
-        Ixz+=(p[i].X()*p[i].Z())*weight;
-        Iyz+=(p[i].Y()*p[i].Z())*weight;
-        Ivxvx+=(p[i].Vx()*p[i].Vx())*weight;
-        Ivyvy+=(p[i].Vy()*p[i].Vy())*weight;
-        Ivzvz+=(p[i].Vz()*p[i].Vz())*weight;
-        Ivxvy+=(p[i].Vx()*p[i].Vy())*weight;
-        Ivxvz+=(p[i].Vx()*p[i].Vz())*weight;
-        Ivyvz+=(p[i].Vy()*p[i].Vz())*weight;
-
-        Ixvx+=(p[i].X()*p[i].Vx())*weight;
-        Iyvx+=(p[i].Y()*p[i].Vx())*weight;
-        Izvx+=(p[i].Z()*p[i].Vx())*weight;
-        Ixvy+=(p[i].X()*p[i].Vy())*weight;
-        Iyvy+=(p[i].Y()*p[i].Vy())*weight;
-        Izvy+=(p[i].Z()*p[i].Vy())*weight;
-        Ixvz+=(p[i].X()*p[i].Vz())*weight;
-        Iyvz+=(p[i].Y()*p[i].Vz())*weight;
-        Izvz+=(p[i].Z()*p[i].Vz())*weight;
-
-        mtot+=weight;
-    }
-}
-    I(0,0)=Ixx;I(1,1)=Iyy;I(2,2)=Izz;
-    I(0,1)=I(1,0)=Ixy;
-    I(0,2)=I(2,0)=Ixz;
-    I(1,2)=I(2,1)=Iyz;
-
-    I(3,3)=Ivxvx;I(4,4)=Ivyvy;I(5,5)=Ivzvz;
-    I(3,4)=I(4,3)=Ivxvy;
-    I(3,5)=I(5,3)=Ivxvz;
-    I(4,5)=I(5,4)=Ivyvz;
-
-    I(0,3)=I(3,0)=Ixvx;
-    I(1,3)=I(3,1)=Iyvx;
-    I(2,3)=I(3,2)=Izvx;
-    I(0,4)=I(4,0)=Ixvy;
-    I(1,4)=I(4,1)=Iyvy;
-    I(2,4)=I(4,2)=Izvy;
-    I(0,5)=I(5,0)=Ixvz;
-    I(1,5)=I(5,1)=Iyvz;
-    I(2,5)=I(5,2)=Izvz;
-
+        for (int j = 0; j < 6; j++) x[j]=p[i].GetPhase(j);
+        for (int j = 0; j < 6; j++) for (int k = j; k < 6; k++) Ilocal(j, k) += x[j]*x[k]*weight;
+        mlocal+=weight;
     }
-    else {
+#ifdef USEOPENMP
+#pragma omp critical (calcphasesigmatensor)
 #endif
-    for (i = 0; i < n; i++)
     {
-        if (itype==-1) weight=p[i].GetMass();
-        else if (p[i].GetType()==itype) weight=p[i].GetMass();
-        else weight=0.;
-        for (int j = 0; j < 6; j++)
-        {
-            for (int k = 0; k < 6; k++)
-            {
-                I(j, k) += (p[i].GetPhase(j) *p[i].GetPhase(k))*weight;
-            }
-        }
-        mtot+=weight;
+    I+=Ilocal;
+    mtot+=mlocal;
     }
 #ifdef USEOPENMP
-    }
+}
 #endif
-    I=I*(1.0/mtot);
+    for (int j = 1; j < 6; j++) for (int k = 0; k < j; k++) I(j, k) = I(k, j);
+    I*=(1.0/mtot);
 }
 
 ///calculate the weighted reduced inertia tensor assuming particles are the same mass
@@ -3871,57 +3816,39 @@ private(i,j,temp)
 #endif
 }
 
-///calculate the phase-space dispersion tensor
-GMatrix CalcPhaseCM(const Int_t n, Particle *p, int itype)
+///calculate the phase-space center of mass
+PhaseVector CalcPhaseCM(const Int_t n, Particle *p, int itype)
 {
-    Double_t det,weight;
-    Double_t cmx,cmy,cmz,cmvx,cmvy,cmvz;
-    GMatrix cm(6,1);
-    Int_t i;
-    cmx=cmy=cmz=cmvx=cmvy=cmvz=0;
+    PhaseVector cm(0.);
     Double_t mtot=0;
 #ifdef USEOPENMP
-    if (n>=ompunbindnum) {
-#pragma omp parallel default(shared) \
-private(i,weight)
+#pragma omp parallel default(shared) if (n>=ompunbindnum)
 {
-#pragma omp for schedule(dynamic) reduction(+:cmx,cmy,cmz,cmvx,cmvy,cmvz,mtot)
-    for (i = 0; i < n; i++)
+#endif
+    PhaseVector cmlocal(0.);
+    Double_t weight, mlocal=0;
+#ifdef USEOPENMP
+#pragma omp for schedule(static) nowait
+#endif
+    for (Int_t i = 0; i < n; i++)
     {
         if (itype==-1) weight=p[i].GetMass();
         else if (p[i].GetType()==itype) weight=p[i].GetMass();
         else weight=0.;
-        cmx+=p[i].X()*weight;
-        cmy+=p[i].Y()*weight;
-        cmz+=p[i].Z()*weight;
-        cmvx+=p[i].Vx()*weight;
-        cmvy+=p[i].Vy()*weight;
-        cmvz+=p[i].Vz()*weight;
-
-        mtot+=weight;
-    }
-}
-    cm(0,0)=cmx;
-    cm(1,0)=cmy;
-    cm(2,0)=cmz;
-    cm(3,0)=cmvx;
-    cm(4,0)=cmvy;
-    cm(5,0)=cmvz;
+        for (int j = 0; j < 6; j++) cmlocal[j] += p[i].GetPhase(j)*weight;
+        mlocal+=weight;
     }
-    else {
+#ifdef USEOPENMP
+#pragma omp critical (calcphasecm)
 #endif
-    for (i = 0; i < n; i++)
     {
-        if (itype==-1) weight=p[i].GetMass();
-        else if (p[i].GetType()==itype) weight=p[i].GetMass();
-        else weight=0.;
-        for (int j = 0; j < 6; j++) cm(j, 0) += p[i].GetPhase(j)*weight;
-        mtot+=weight;
+    cm+=cmlocal;
+    mtot+=mlocal;
     }
 #ifdef USEOPENMP
-    }
+}
 #endif
-    cm=cm*(1.0/mtot);
+    cm*=(1.0/mtot);
     return cm;
 }
 
@@ -4214,96 +4141,37 @@ void GetBindingEnergy(Options &opt, const Int_t nbodies, Particle *Part, Int_t n
     Int_t imostbound,iunbound;
     Double_t Efracval_gas,Efracval_star;
     Double_t mw2=opt.MassValue*opt.MassValue;
-    Double_t potmin,menc;
+    Double_t potmin;
     Int_t npot,ipotmin;
     Coordinate cmpotmin;
     vector<Int_t> npartspertype(NPARTTYPES);
     Int_t n_gas, n_star, n_interloper, n_bh, n_dm;
 
-    //used to temporarily store pids. Needed for large groups as the tree code used to calculate potential overwrites the id of particles so that once
-    //finished it puts the particles back into the input order. Therefore store id values in PID  value (which can be over written)
-    //also if wish to use the deepest potential as a reference, then used to store original order
-    Int_t *storepid;
-
     double time2 = MyGetTime();
 
     if (opt.uinfo.icalculatepotential) {
-    //if approximative calculations, run all calculations in parallel
-    //as halos take less time individually.
-    if (opt.uinfo.iapproxpot) {
-        //run all pot calculations in parallel as using fast approximate potential
-#ifdef USEOPENMP
-#pragma omp parallel default(shared)  \
-private(i,j,k,storepid)
-{
-    #pragma omp for schedule(dynamic) nowait
-#endif
-        for (i=1;i<=ngroup;i++) {
-            if (numingroup[i]<=POTPPCALCNUM) PotentialPP(opt,numingroup[i],&Part[noffset[i]]);
+    //all groups are scheduled by cost, small groups using PP and large groups a tree, which is parallelised internally
+    GroupTasksByCost(ngroup, numingroup, potompcalcnum, GroupPotentialCost,
+        [&](Int_t ig) {
+            //used to temporarily store pids. Needed for large groups as the tree code used to calculate potential overwrites the id of particles so that once
+            //finished it puts the particles back into the input order. Therefore store id values in PID  value (which can be over written)
+            Int_t *storepid;
+            if (numingroup[ig]<=potppcalcnum) PotentialPP(opt,numingroup[ig],&Part[noffset[ig]]);
             else {
-                storepid=new Int_t[numingroup[i]];
-                for (j=0;j<numingroup[i];j++) {
-                    storepid[j]=Part[noffset[i]+j].GetPID();
-                    Part[noffset[i]+j].SetPID(Part[noffset[i]+j].GetID());
+                storepid=new Int_t[numingroup[ig]];
+                for (auto j=0;j<numingroup[ig];j++) {
+                    storepid[j]=Part[noffset[ig]+j].GetPID();
+                    Part[noffset[ig]+j].SetPID(Part[noffset[ig]+j].GetID());
                 }
                 //calculate potential
-                Potential(opt,numingroup[i],&Part[noffset[i]]);
-                for (j=0;j<numingroup[i];j++) {
-                    Part[noffset[i]+j].SetID(Part[noffset[i]+j].GetPID());
-                    Part[noffset[i]+j].SetPID(storepid[j]);
+                Potential(opt,numingroup[ig],&Part[noffset[ig]]);
+                for (auto j=0;j<numingroup[ig];j++) {
+                    Part[noffset[ig]+j].SetID(Part[noffset[ig]+j].GetPID());
+                    Part[noffset[ig]+j].SetPID(storepid[j]);
                 }
                 delete[] storepid;
             }
-        }
-#ifdef USEOPENMP
-}
-#endif
-    }
-    else {
-    //small groups with PP calculations of potential.
-#ifdef USEOPENMP
-#pragma omp parallel default(shared)  \
-private(i,j,k,storepid)
-{
-    #pragma omp for schedule(dynamic) nowait
-#endif
-    for (i=1;i<=ngroup;i++) if (numingroup[i]<POTOMPCALCNUM) {
-        if (numingroup[i]<=POTPPCALCNUM) PotentialPP(opt,numingroup[i],&Part[noffset[i]]);
-        else {
-            storepid=new Int_t[numingroup[i]];
-            for (j=0;j<numingroup[i];j++) {
-                storepid[j]=Part[noffset[i]+j].GetPID();
-                Part[noffset[i]+j].SetPID(Part[noffset[i]+j].GetID());
-            }
-            //calculate potential
-            Potential(opt,numingroup[i],&Part[noffset[i]]);
-            for (j=0;j<numingroup[i];j++) {
-                Part[noffset[i]+j].SetID(Part[noffset[i]+j].GetPID());
-                Part[noffset[i]+j].SetPID(storepid[j]);
-            }
-            delete[] storepid;
-        }
-    }
-#ifdef USEOPENMP
-}
-#endif
-        //loop for large groups with tree calculation
-        for (i=1;i<=ngroup;i++) if (numingroup[i]>=POTOMPCALCNUM) {
-            storepid=new Int_t[numingroup[i]];
-            for (j=0;j<numingroup[i];j++) {
-                storepid[j]=Part[noffset[i]+j].GetPID();
-                Part[noffset[i]+j].SetPID(Part[noffset[i]+j].GetID());
-            }
-            //calculate potential
-            Potential(opt,numingroup[i],&Part[noffset[i]]);
-            for (j=0;j<numingroup[i];j++) {
-                Part[noffset[i]+j].SetID(Part[noffset[i]+j].GetPID());
-                Part[noffset[i]+j].SetPID(storepid[j]);
-            }
-            delete[] storepid;
-        }
-    }
-
+        });
     }//end of if calculate potential
 #ifdef SWIFTINTERFACE
     else {
@@ -4317,7 +4185,7 @@ private(i,j,k,storepid)
     if (opt.uinfo.cmvelreftype==POTREF) {
 #ifdef USEOPENMP
 #pragma omp parallel default(shared)  \
-private(i,j,k,r2,v2,poti,Ti,pot,Eval,npot,storepid,menc,potmin,ipotmin,cmpotmin)
+private(i,j,k,r2,v2,poti,Ti,pot,Eval,npot,potmin,ipotmin,cmpotmin)
 {
     #pragma omp for schedule(dynamic) nowait
 #endif
@@ -4340,21 +4208,9 @@ private(i,j,k,r2,v2,poti,Ti,pot,Eval,npot,storepid,menc,potmin,ipotmin,cmpotmin)
                 pdata[i].gvelminpot[k]=Part[ipotmin+noffset[i]].GetVelocity(k);
             }
             for (k=0;k<3;k++) cmpotmin[k]=Part[ipotmin+noffset[i]].GetPosition(k);
-            for (j=0;j<numingroup[i];j++) {
-                for (k=0;k<3;k++) Part[j+noffset[i]].SetPosition(k,Part[j+noffset[i]].GetPosition(k)-cmpotmin[k]);
-            }
-            gsl_heapsort(&Part[noffset[i]],numingroup[i],sizeof(Particle),RadCompare);
-            //now determine kinetic frame
-            pdata[i].gcmvel[0]=pdata[i].gcmvel[1]=pdata[i].gcmvel[2]=menc=0.;
-            for (j=0;j<npot;j++) {
-                for (k=0;k<3;k++) pdata[i].gcmvel[k]+=Part[j+noffset[i]].GetVelocity(k)*Part[j+noffset[i]].GetMass();
-                menc+=Part[j+noffset[i]].GetMass();
-            }
-            pdata[i].gcmvel*=1.0/menc;
-            for (j=0;j<numingroup[i];j++)
-            {
-                for (k=0;k<3;k++) Part[j+noffset[i]].SetPosition(k,Part[j+noffset[i]].GetPosition(k)+cmpotmin[k]);
-            }
+            //now determine kinetic frame from the particles closest to the minimum, selected without sorting the particles
+            npot=min(npot,numingroup[i]);
+            pdata[i].gcmvel=CentralCMVel(numingroup[i], &Part[noffset[i]], cmpotmin, npot);
         }
 #ifdef USEOPENMP
 }
@@ -4388,11 +4244,10 @@ private(i,j,k,potmin,ipotmin)
 #endif
     }
 
-    //if using POTREF, most computations involve sorts, so parallize over groups
     if (opt.uinfo.cmvelreftype==POTREF) {
 #ifdef USEOPENMP
 #pragma omp parallel default(shared)  \
-private(i,j,k,r2,v2,poti,Ti,pot,Eval,npot,storepid,menc,potmin,ipotmin,cmpotmin)
+private(i,j,k,r2,v2,poti,Ti,pot,Eval,npot,potmin,ipotmin,cmpotmin)
 {
     #pragma omp for schedule(dynamic) nowait
 #endif
@@ -4416,20 +4271,9 @@ private(i,j,k,r2,v2,poti,Ti,pot,Eval,npot,storepid,menc,potmin,ipotmin,cmpotmin)
                 pdata[i].gvelminpot[k]=Part[ipotmin+noffset[i]].GetVelocity(k);
             }
             for (k=0;k<3;k++) cmpotmin[k]=Part[ipotmin+noffset[i]].GetPosition(k);
-            for (j=0;j<numingroup[i];j++) {
-                for (k=0;k<3;k++) Part[j+noffset[i]].SetPosition(k,Part[j+noffset[i]].GetPosition(k)-cmpotmin[k]);
-            }
-            gsl_heapsort(&Part[noffset[i]],numingroup[i],sizeof(Particle),RadCompare);
-            //now determine kinetic frame
-            pdata[i].gcmvel[0]=pdata[i].gcmvel[1]=pdata[i].gcmvel[2]=menc=0.;
-            for (j=0;j<npot;j++) {
-                for (k=0;k<3;k++) pdata[i].gcmvel[k]+=Part[j+noffset[i]].GetVelocity(k)*Part[j+noffset[i]].GetMass();
-                menc+=Part[j+noffset[i]].GetMass();
-            }
-            for (j=0;j<3;j++) {pdata[i].gcmvel[j]/=menc;}
-            for (j=0;j<numingroup[i];j++) {
-                for (k=0;k<3;k++) Part[j+noffset[i]].SetPosition(k,Part[j+noffset[i]].GetPosition(k)+cmpotmin[k]);
-            }
+            //now determine kinetic frame from the particles closest to the minimum, selected without sorting the particles
+            npot=min(npot,numingroup[i]);
+            pdata[i].gcmvel=CentralCMVel(numingroup[i], &Part[noffset[i]], cmpotmin, npot);
         }
 #ifdef USEOPENMP
 }
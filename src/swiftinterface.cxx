@@ -26,6 +26,8 @@ inline int ConfigCheckSwift(Options &opt, Swift::siminfo &s)
 #ifndef USEMPI
     int ThisTask=0;
 #endif
+    //set before any check can return so that all tasks take part in sharing calibrated values
+    SetOpenMPThresholds(opt);
     if (opt.iBaryonSearch && !(opt.partsearchtype==PSTALL || opt.partsearchtype==PSTDARK)) {
         if (ThisTask==0) cerr<<"Conflict in config file: both gas/star/etc particle type search AND the separate baryonic (gas,star,etc) search flag are on. Check config\n";
         return SWIFTCONFIGOPTCONFLICT;
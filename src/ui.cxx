@@ -80,6 +80,52 @@ void GetArgs(int argc, char *argv[], Options &opt)
     ConfigCheck(opt);
 }
 
+/*!
+    Set the OpenMP thresholds (see \ref OMPLIMS) and the PP potential calculation limit from the config options.
+    If Options.iompcalibrate, thresholds not set in the config are first calibrated for this machine and number of threads
+    (see \ref CalibrateOpenMPThresholds). With MPI, the calibration is run by task 0 only, as running it on all tasks at once would
+    have tasks on a node competing for cores, and the values broadcast. Called by \ref ConfigCheck and, for the library
+    interface, ConfigCheckSwift.
+*/
+void SetOpenMPThresholds(Options &opt)
+{
+#ifndef USEMPI
+    int ThisTask =0;
+#endif
+#ifdef USEOPENMP
+    if (opt.iompcalibrate) {
+        Int_t values[8];
+        if (ThisTask==0) {
+            CalibrateOpenMPThresholds(opt);
+            values[0]=ompsubsearchnum;values[1]=ompsearchnum;values[2]=ompunbindnum;values[3]=ompperiodnum;
+            values[4]=omppropnum;values[5]=ompsortsize;values[6]=potompcalcnum;values[7]=ompfofsearchnum;
+        }
+#ifdef USEMPI
+        MPI_Bcast(values, 8, MPI_Int_t, 0, MPI_COMM_WORLD);
+#endif
+        ompsubsearchnum=values[0];ompsearchnum=values[1];ompunbindnum=values[2];ompperiodnum=values[3];
+        omppropnum=values[4];ompsortsize=values[5];potompcalcnum=values[6];ompfofsearchnum=values[7];
+    }
+#endif
+    if (opt.ompsplitsubsearchnumset>=0) ompsplitsubsearchnum=opt.ompsplitsubsearchnumset;
+    if (opt.ompsubsearchnumset>=0) ompsubsearchnum=opt.ompsubsearchnumset;
+    if (opt.ompsearchnumset>=0) ompsearchnum=opt.ompsearchnumset;
+    if (opt.ompunbindnumset>=0) ompunbindnum=opt.ompunbindnumset;
+    if (opt.ompperiodnumset>=0) ompperiodnum=opt.ompperiodnumset;
+    if (opt.omppropnumset>=0) omppropnum=opt.omppropnumset;
+    if (opt.ompfofsearchnumset>=0) ompfofsearchnum=opt.ompfofsearchnumset;
+    if (opt.ompsortsizeset>=0) ompsortsize=opt.ompsortsizeset;
+    if (opt.potompcalcnumset>=0) potompcalcnum=opt.potompcalcnumset;
+    if (opt.potppcalcnumset>=0) potppcalcnum=opt.potppcalcnumset;
+#ifdef USEOPENMP
+    if (ThisTask==0 && (opt.iverbose>=1 || opt.iompcalibrate)) {
+        cout<<"OpenMP thresholds: split subsearch "<<ompsplitsubsearchnum<<" subsearch "<<ompsubsearchnum<<" search "<<ompsearchnum;
+        cout<<" unbind "<<ompunbindnum<<" period "<<ompperiodnum<<" property "<<omppropnum<<" fof search "<<ompfofsearchnum;
+        cout<<" sort "<<ompsortsize<<" potential "<<potompcalcnum<<endl;
+    }
+#endif
+}
+
 ///Outputs the usage to stdout
 void usage(void)
 {
@@ -148,6 +194,8 @@ void usage(void)
     \arg <b> \e Nsearch_velocity </b> number of velocity neighbours used to calculate velocity density, adjust \ref Options.Nvel (suggested value is 32) \n
     \arg <b> \e Nsearch_physical </b> number of physical neighbours searched for Nv to calculate velocity density  \ref Options.Nsearch (suggested value is 256) \n
     \arg <b> \e Cell_fraction </b> fraction of a halo contained in a subvolume used to characterize the background  \ref Options.Ncellfac \n
+    \arg <b> \e Incremental_background </b> 1/0 flag indicating whether the background of a substructure is derived from the grid of its parent when it is well resolved \ref Options.iincrementalbg \n
+    \arg <b> \e Incremental_background_min_cells </b> minimum number of parent cells containing enough particles of the substructure for the parent grid to be used \ref Options.incrementalbgmincells \n
     \arg <b> \e Grid_type </b> integer describing type of grid used to decompose volume for substructure search  \ref Options.gridtype (see \ref GRIDTYPES) \n
         - \b 1 \e standard physical shannon entropy, balanced KD tree volume decomposition into cells
         - \b 2 \e phase phase-space shannon entropy, balanced KD tree volume decomposition into cells
@@ -182,6 +230,10 @@ void usage(void)
         - \b 5 \e standard 3D FOF based algorithm
         - \b 4 \e standard 3D FOF based algorithm <b> FOLLOWED </b> by 6D FOF search using the velocity scale defined by the largest halo on <b> ONLY </b> particles in 3DFOF groups
         - \b 3 \e standard 3D FOF based algorithm <b> FOLLOWED </b> by 6D FOF search using the velocity scale for each 3DFOF group
+    \arg <b> \e FoF_grid_search </b> 1/0 flag indicating whether the 3D FOF search of all particles uses a cell-linked-list grid rather than the tree \ref Options.iFOFgrid \n
+    \arg <b> \e FoF_specialised_criteria </b> 1/0 flag indicating whether substructure FOF searches use inlined stream and 6d criteria \ref Options.iFOFspecialised \n
+    \arg <b> \e Particle_spatial_ordering </b> 0/1/2 space filling curve, none, Morton or Hilbert, along which particles are ordered after loading \ref Options.iSFCorder \n
+    \arg <b> \e FoF_warm_start_input </b> base name of the group array file (<b> \e Write_group_array_file </b>) of a previous snapshot used to seed the 3D FOF search \ref Options.warmstartname \n
     \arg <b> \e Minimum_halo_size </b> Allows field objects (or so-called halos) to require a different minimum size (typically would be <= \ref Options.MinSize. Default is -1 which sets it to \ref Options.MinSize) \ref Options.HaloMinSize \n
     \arg <b> \e Halo_linking_length_factor </b> allows one to use different physical linking lengths between field objects and substructures.  (Typically for 3DFOF searches of dark matter haloes, set to value such that this times \ref Options.ellphys = 0.2 the interparticle spacing when examining cosmological simulations ) \ref Options.ellhalophysfac \n
     \arg <b> \e Halo_velocity_linking_length_factor </b> allows one to use different velocity linking lengths between field objects and substructures when using 6D FOF searches.  (Since in such cases the general idea is to use the local velocity dispersion to define a scale, \f$ \geq5 \f$ times this value seems to correctly scale searches) \ref Options.ellhalovelfac \n
@@ -222,6 +274,17 @@ void usage(void)
     \arg <b> \e Unbinding_type </b> Set the unbinding criteria, either just remove particles deemeed "unbound", that is those with \f$ \alpha T+W>0\f$, choosing \ref UPART. Or with \ref USYSANDPART
     removes "unbound" particles till system also has a true bound fraction > \ref UnbindInfo.minEfrac.
     \arg <b> \e Softening_length </b> Set the (simple plummer) gravitational softening length. \ref UnbindInfo.eps
+    \arg <b> \e Approximate_potential_calculation_relative_error </b> If >0, the number of particles subsampled in the approximate potential calculation is increased for each group
+    until the rms relative error of the potential of probe particles is below this value, starting from the minimum number of particles. \ref UnbindInfo.approxpotrelerr
+    \arg <b> \e Approximate_potential_calculation_num_probe </b> Number of probe particles used to estimate the error of the approximate potential. \ref UnbindInfo.approxpotnumprobe
+    \arg <b> \e Potential_calculation_method </b> Method used to calculate the potential of large groups, 0 for a Barnes-Hut monopole tree walk, 1 for a dual tree fast multipole method and 2 for a Barnes-Hut walk per leaf shared by its particles. \ref UnbindInfo.potmethod
+    \arg <b> \e FMM_expansion_order </b> Order of multipole expansion, 1 for monopole and 2 for quadrupole. \ref UnbindInfo.fmmorder
+    \arg <b> \e FMM_opening_angle </b> Opening angle of the fast multipole method. \ref UnbindInfo.FMMThetaOpen
+    \arg <b> \e Potential_precision </b> Working precision of the direct sums in the potential calculation, 0 for double, 1 for single precision accumulated in double and 2 to also report the deviation from double precision. \ref UnbindInfo.potprecision
+    \arg <b> \e Use_input_potential </b> Use the gravitational potential stored in HDF5 inputs to unbind groups rather than calculating it. \ref UnbindInfo.iinputpotential
+    \arg <b> \e Input_potential_correction </b> Correction used to remove the external potential from input potentials, 0 for none, 1 for a constant and 2 for a constant plus gradient. \ref UnbindInfo.inputpotcorrection
+    \arg <b> \e Input_potential_num_sample </b> Number of group members at which the self-potential is calculated to fit the external potential. \ref UnbindInfo.inputpotnumsample
+    \arg <b> \e Input_potential_unit_conversion </b> Factor converting the specific potential in the input to velocity units squared. \ref UnbindInfo.inputpotconversion
 
     \section cosmoconfig Units & Cosmology
     \subsection unitconfig Units
@@ -291,6 +354,13 @@ void usage(void)
     \arg <b> \e MPI_particle_total_buf_size </b> Total memory size in bytes used to store particles in temporary buffer such that
     particles are sent to non-reading mpi processes in one communication round in chunks of size buffer_size/NProcs/sizeof(Particle). \ref Options.mpiparticlebufsize \n
 
+    \section ompconfigs OpenMP specific options
+    \arg <b> \e OMP_calibrate_thresholds </b> 1/0 flag to calibrate the OpenMP thresholds that are not set explicitly with short benchmarks at start up \ref Options.iompcalibrate \n
+    \arg <b> \e OMP_split_subsearch_min_num, OMP_subsearch_min_num, OMP_search_min_num, OMP_unbind_min_num, OMP_period_min_num, OMP_property_min_num,
+    OMP_fof_search_min_num, OMP_sort_min_num, OMP_potential_min_num </b> minimum number of particles for which the corresponding loops are run with OpenMP, see \ref OMPLIMS.
+    Values < 0 use the default (or calibrated) value. \ref Options.ompsubsearchnumset \n
+    \arg <b> \e Potential_PP_max_num </b> maximum number of particles for which the potential is calculated with a direct PP calculation rather than a tree. \ref Options.potppcalcnumset \n
+
     */
 
 inline void ConfigMessage(char *c) {
@@ -681,6 +751,16 @@ void GetParamFile(Options &opt)
                         opt.foftype = atoi(vbuff);
                     else if (strcmp(tbuff, "FoF_Field_search_type")==0)
                         opt.fofbgtype = atoi(vbuff);
+                    else if (strcmp(tbuff, "FoF_grid_search")==0)
+                        opt.iFOFgrid = atoi(vbuff);
+                    else if (strcmp(tbuff, "FoF_specialised_criteria")==0)
+                        opt.iFOFspecialised = atoi(vbuff);
+                    else if (strcmp(tbuff, "Particle_spatial_ordering")==0)
+                        opt.iSFCorder = atoi(vbuff);
+                    else if (strcmp(tbuff, "FoF_warm_start_input")==0) {
+                        opt.warmstartname=new char[1024];
+                        strcpy(opt.warmstartname,vbuff);
+                    }
                     else if (strcmp(tbuff, "Search_for_substructure")==0)
                         opt.iSubSearch = atoi(vbuff);
                     else if (strcmp(tbuff, "Keep_FOF")==0)
@@ -703,6 +783,10 @@ void GetParamFile(Options &opt)
                         opt.iLocalVelDenApproxCalcFlag = atoi(vbuff);
                     else if (strcmp(tbuff, "Cell_fraction")==0)
                         opt.Ncellfac = atof(vbuff);
+                    else if (strcmp(tbuff, "Incremental_background")==0)
+                        opt.iincrementalbg = atoi(vbuff);
+                    else if (strcmp(tbuff, "Incremental_background_min_cells")==0)
+                        opt.incrementalbgmincells = atoi(vbuff);
                     else if (strcmp(tbuff, "Grid_type")==0)
                         opt.gridtype = atoi(vbuff);
                     else if (strcmp(tbuff, "Nsearch_velocity")==0)
@@ -886,6 +970,26 @@ void GetParamFile(Options &opt)
                         opt.uinfo.approxpotminnum = atoi(vbuff);
                     else if (strcmp(tbuff, "Approximate_potential_calculation_method")==0)
                         opt.uinfo.approxpotmethod = atoi(vbuff);
+                    else if (strcmp(tbuff, "Approximate_potential_calculation_relative_error")==0)
+                        opt.uinfo.approxpotrelerr = atof(vbuff);
+                    else if (strcmp(tbuff, "Approximate_potential_calculation_num_probe")==0)
+                        opt.uinfo.approxpotnumprobe = atoi(vbuff);
+                    else if (strcmp(tbuff, "Potential_calculation_method")==0)
+                        opt.uinfo.potmethod = atoi(vbuff);
+                    else if (strcmp(tbuff, "FMM_expansion_order")==0)
+                        opt.uinfo.fmmorder = atoi(vbuff);
+                    else if (strcmp(tbuff, "FMM_opening_angle")==0)
+                        opt.uinfo.FMMThetaOpen = atof(vbuff);
+                    else if (strcmp(tbuff, "Potential_precision")==0)
+                        opt.uinfo.potprecision = atoi(vbuff);
+                    else if (strcmp(tbuff, "Use_input_potential")==0)
+                        opt.uinfo.iinputpotential = atoi(vbuff);
+                    else if (strcmp(tbuff, "Input_potential_correction")==0)
+                        opt.uinfo.inputpotcorrection = atoi(vbuff);
+                    else if (strcmp(tbuff, "Input_potential_num_sample")==0)
+                        opt.uinfo.inputpotnumsample = atol(vbuff);
+                    else if (strcmp(tbuff, "Input_potential_unit_conversion")==0)
+                        opt.uinfo.inputpotconversion = atof(vbuff);
 
                     //property related
                     else if (strcmp(tbuff, "Reference_frame_for_properties")==0)
@@ -999,6 +1103,28 @@ void GetParamFile(Options &opt)
                         opt.iopenmpfof = atoi(vbuff);
                     else if (strcmp(tbuff, "OMP_fof_region_size")==0)
                         opt.openmpfofsize = atoi(vbuff);
+                    else if (strcmp(tbuff, "OMP_calibrate_thresholds")==0)
+                        opt.iompcalibrate = atoi(vbuff);
+                    else if (strcmp(tbuff, "OMP_split_subsearch_min_num")==0)
+                        opt.ompsplitsubsearchnumset = atol(vbuff);
+                    else if (strcmp(tbuff, "OMP_subsearch_min_num")==0)
+                        opt.ompsubsearchnumset = atol(vbuff);
+                    else if (strcmp(tbuff, "OMP_search_min_num")==0)
+                        opt.ompsearchnumset = atol(vbuff);
+                    else if (strcmp(tbuff, "OMP_unbind_min_num")==0)
+                        opt.ompunbindnumset = atol(vbuff);
+                    else if (strcmp(tbuff, "OMP_period_min_num")==0)
+                        opt.ompperiodnumset = atol(vbuff);
+                    else if (strcmp(tbuff, "OMP_property_min_num")==0)
+                        opt.omppropnumset = atol(vbuff);
+                    else if (strcmp(tbuff, "OMP_fof_search_min_num")==0)
+                        opt.ompfofsearchnumset = atol(vbuff);
+                    else if (strcmp(tbuff, "OMP_sort_min_num")==0)
+                        opt.ompsortsizeset = atol(vbuff);
+                    else if (strcmp(tbuff, "OMP_potential_min_num")==0)
+                        opt.potompcalcnumset = atol(vbuff);
+                    else if (strcmp(tbuff, "Potential_PP_max_num")==0)
+                        opt.potppcalcnumset = atol(vbuff);
                     else if (strcmp(tbuff, "Gas_internal_property_names")==0) {
                         pos=0;
                         dataline=string(vbuff);
@@ -1729,6 +1855,7 @@ void ConfigCheck(Options &opt)
 #ifndef USEMPI
     int ThisTask =0;
 #endif
+    SetOpenMPThresholds(opt);
     //if code is on the fly, no point in checking fname
     // input type, number of input files, etc
     if (opt.iontheflyfinding == false) {
@@ -1856,8 +1983,44 @@ void ConfigCheck(Options &opt)
     }
 #endif
 
+    if (opt.iSFCorder < SFCNONE || opt.iSFCorder > SFCHILBERT){
+        errormessage("Invalid particle spatial ordering, must be 0 (none), 1 (Morton) or 2 (Hilbert)");
+        ConfigExit();
+    }
+#ifdef USEMPI
+    if (opt.iSFCorder != SFCNONE){
+        errormessage("WARNING: Particle spatial ordering is not used with MPI as particles are already ordered by domain. Ignoring.");
+        opt.iSFCorder = SFCNONE;
+    }
+    if (opt.warmstartname != NULL){
+        errormessage("WARNING: Warm starting the FOF search is not implemented with MPI. Ignoring.");
+        delete[] opt.warmstartname;
+        opt.warmstartname = NULL;
+    }
+#endif
+    if (opt.warmstartname != NULL && opt.partsearchtype==PSTALL && opt.iBaryonSearch>1){
+        errormessage("WARNING: Warm starting the FOF search is not compatible with only dark matter generating links. Ignoring.");
+        delete[] opt.warmstartname;
+        opt.warmstartname = NULL;
+    }
+
+    if (opt.iincrementalbg && opt.incrementalbgmincells <= MAXNGRID){
+        errormessage("WARNING: Incremental background needs more cells than used to interpolate the background, resetting to minimum of 7");
+        opt.incrementalbgmincells = MAXNGRID+1;
+    }
+#ifdef SCALING
+    if (opt.iincrementalbg){
+        errormessage("WARNING: Incremental background is not compatible with rescaling velocities when building the grid. Ignoring.");
+        opt.iincrementalbg = 0;
+    }
+#endif
+
 #ifdef USEOPENMP
-    if (opt.iopenmpfof == 1 && opt.openmpfofsize < ompfofsearchnum){
+    if (opt.iopenmpfof < OMPFOFNONE || opt.iopenmpfof > OMPFOFUNIONFIND){
+        errormessage("Invalid OpenMP FOF type, must be 0 (none), 1 (domains) or 2 (union-find)");
+        ConfigExit();
+    }
+    if (opt.iopenmpfof == OMPFOFDOMAIN && opt.openmpfofsize < ompfofsearchnum){
         errormessage("WARNING: OpenMP FOF search region is small, resetting to minimum of ");
         opt.openmpfofsize = ompfofsearchnum;
     }
@@ -2024,6 +2187,50 @@ void ConfigCheck(Options &opt)
             errormessage("In approximate potential but using invalid method for sampling particles. Use 0 for Tree and 1 for Rand. Check config.");
             ConfigExit();
         }
+        if (opt.uinfo.approxpotrelerr <0) {
+            errormessage("In approximate potential but relative error <0. Use 0 for a fixed fraction of particles. Check config.");
+            ConfigExit();
+        }
+        if (opt.uinfo.approxpotrelerr >0 && opt.uinfo.approxpotnumprobe <1) {
+            errormessage("In approximate potential with error control but number of probe particles <1. Check config.");
+            ConfigExit();
+        }
+    }
+    if (opt.uinfo.potmethod < POTMETHODTREE || opt.uinfo.potmethod > POTMETHODTREEGROUP) {
+        errormessage("Invalid potential calculation method. Use 0 for Tree, 1 for FMM and 2 for Tree with group walks. Check config.");
+        ConfigExit();
+    }
+    if (opt.uinfo.potmethod == POTMETHODFMM) {
+        if (opt.uinfo.fmmorder < 1 || opt.uinfo.fmmorder > 2) {
+            errormessage("FMM expansion order must be 1 (monopole) or 2 (quadrupole). Check config.");
+            ConfigExit();
+        }
+        if (opt.uinfo.FMMThetaOpen <= 0 || opt.uinfo.FMMThetaOpen >= 1) {
+            errormessage("FMM opening angle must be in (0,1). Check config.");
+            ConfigExit();
+        }
+    }
+    if (opt.uinfo.potprecision < POTPRECDOUBLE || opt.uinfo.potprecision > POTPRECVALIDATE) {
+        errormessage("Invalid potential precision. Use 0 for double, 1 for mixed and 2 for mixed validated against double. Check config.");
+        ConfigExit();
+    }
+    if (opt.uinfo.iinputpotential) {
+        if (opt.inputtype != IOHDF) {
+            errormessage("Input potentials can only be read from HDF5 inputs. Check config.");
+            ConfigExit();
+        }
+        if (opt.uinfo.inputpotcorrection < POTINPUTCORRNONE || opt.uinfo.inputpotcorrection > POTINPUTCORRLINEAR) {
+            errormessage("Invalid input potential correction. Use 0 for none, 1 for constant and 2 for constant plus gradient. Check config.");
+            ConfigExit();
+        }
+        if (opt.uinfo.inputpotcorrection != POTINPUTCORRNONE && opt.uinfo.inputpotnumsample < 4) {
+            errormessage("Input potential correction requires at least 4 sample particles. Check config.");
+            ConfigExit();
+        }
+        if (opt.uinfo.inputpotconversion == 0) {
+            errormessage("Input potential unit conversion is zero. Check config.");
+            ConfigExit();
+        }
     }
 
     set<string> uniqueval;
@@ -2272,6 +2479,10 @@ ConfigInfo::ConfigInfo(Options &opt){
     AddEntry("Particle_search_type", opt.partsearchtype);
     AddEntry("FoF_search_type", opt.foftype);
     AddEntry("FoF_Field_search_type", opt.fofbgtype);
+    AddEntry("FoF_grid_search", opt.iFOFgrid);
+    AddEntry("FoF_specialised_criteria", opt.iFOFspecialised);
+    AddEntry("Particle_spatial_ordering", opt.iSFCorder);
+    if (opt.warmstartname!=NULL) AddEntry("FoF_warm_start_input", string(opt.warmstartname));
     AddEntry("Search_for_substructure", opt.iSubSearch);
     AddEntry("Keep_FOF", opt.iKeepFOF);
     AddEntry("Iterative_searchflag", opt.iiterflag);
@@ -2284,6 +2495,8 @@ ConfigInfo::ConfigInfo(Options &opt){
     //local field parameters
     AddEntry("Local_velocity_density_approximate_calculation", opt.iLocalVelDenApproxCalcFlag);
     AddEntry("Cell_fraction", opt.Ncellfac);
+    AddEntry("Incremental_background", opt.iincrementalbg);
+    AddEntry("Incremental_background_min_cells", opt.incrementalbgmincells);
     AddEntry("Grid_type", opt.gridtype);
     AddEntry("Nsearch_velocity", opt.Nvel);
     AddEntry("Nsearch_physical", opt.Nsearch);
@@ -2393,6 +2606,16 @@ ConfigInfo::ConfigInfo(Options &opt){
     AddEntry("Approximate_potential_calculation_particle_number_fraction", opt.uinfo.approxpotnumfrac);
     AddEntry("Approximate_potential_calculation_min_particle", opt.uinfo.approxpotminnum);
     AddEntry("Approximate_potential_calculation_method", opt.uinfo.approxpotmethod);
+    AddEntry("Approximate_potential_calculation_relative_error", opt.uinfo.approxpotrelerr);
+    AddEntry("Approximate_potential_calculation_num_probe", opt.uinfo.approxpotnumprobe);
+    AddEntry("Potential_calculation_method", opt.uinfo.potmethod);
+    AddEntry("FMM_expansion_order", opt.uinfo.fmmorder);
+    AddEntry("FMM_opening_angle", opt.uinfo.FMMThetaOpen);
+    AddEntry("Potential_precision", opt.uinfo.potprecision);
+    AddEntry("Use_input_potential", opt.uinfo.iinputpotential);
+    AddEntry("Input_potential_correction", opt.uinfo.inputpotcorrection);
+    AddEntry("Input_potential_num_sample", opt.uinfo.inputpotnumsample);
+    AddEntry("Input_potential_unit_conversion", opt.uinfo.inputpotconversion);
 
     //property related
     AddEntry("Inclusive_halo_masses", opt.iInclusiveHalo);
@@ -2540,6 +2763,22 @@ ConfigInfo::ConfigInfo(Options &opt){
     AddEntry("Snapshot_value",opt.snapshotvalue);
     AddEntry("Memory_log",opt.memuse_log);
 
+    //openmp related
+    AddEntry("OMP_run_fof", opt.iopenmpfof);
+    AddEntry("OMP_fof_region_size", opt.openmpfofsize);
+    AddEntry("OMP_calibrate_thresholds", opt.iompcalibrate);
+    //thresholds as set in the config, so that default or calibrated values (< 0) are again determined on a rerun
+    AddEntry("OMP_split_subsearch_min_num", opt.ompsplitsubsearchnumset);
+    AddEntry("OMP_subsearch_min_num", opt.ompsubsearchnumset);
+    AddEntry("OMP_search_min_num", opt.ompsearchnumset);
+    AddEntry("OMP_unbind_min_num", opt.ompunbindnumset);
+    AddEntry("OMP_period_min_num", opt.ompperiodnumset);
+    AddEntry("OMP_property_min_num", opt.omppropnumset);
+    AddEntry("OMP_fof_search_min_num", opt.ompfofsearchnumset);
+    AddEntry("OMP_sort_min_num", opt.ompsortsizeset);
+    AddEntry("OMP_potential_min_num", opt.potompcalcnumset);
+    AddEntry("Potential_PP_max_num", opt.potppcalcnumset);
+
     //io related
     AddEntry("Cosmological_input",opt.icosmologicalin);
     AddEntry("Input_chunk_size",opt.inputbufsize);
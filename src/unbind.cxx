@@ -1,7 +1,7 @@
 /*! \file unbind.cxx
  *  \brief this file contains routines to check if groups are self-bound and if not unbind them as requried
 
-    \todo Need to improve the gravity calculation (ie: for tree potential use something other than just monopole and also apply corrections if necessary).
+    \todo Need to improve the gravity calculation (ie: apply corrections if necessary).
     \todo Need to clean up unbind proceedure, ensure its mpi compatible and can be combined with a pglist output easily
  */
 
@@ -43,6 +43,107 @@ inline void MarkCell(Node *np, Int_t *marktreecell, Int_t *markleafcell, Int_t &
     }
 }
 
+///subroutine that marks a cell for all particles in a leaf, enclosed in a sphere of radius rleaf about xleaf, in a tree-walk.
+///A cell is only used as a monopole if it would be for any point in the sphere
+inline void MarkCellGroup(Node *np, Int_t *marktreecell, Int_t *markleafcell, Int_t &ntreecell, Int_t &nleafcell, const Int_t bsize, Double_t *cR2max, Coordinate *cm, Coordinate &xleaf, Double_t rleaf){
+    Int_t nid=np->GetID();
+    Double_t r2, r;
+    r2=0;
+    for (int k=0;k<3;k++)r2+=(cm[nid][k]-xleaf[k])*(cm[nid][k]-xleaf[k]);
+    //distance from the cells cm to the closest point of the leaf
+    r=sqrt(r2)-rleaf;
+    if (r<=0 || r*r<cR2max[nid]) {
+        if (np->GetCount()>bsize){
+            MarkCellGroup(((SplitNode*)np)->GetLeft(),marktreecell,markleafcell,ntreecell,nleafcell,bsize,cR2max,cm,xleaf,rleaf);
+            MarkCellGroup(((SplitNode*)np)->GetRight(),marktreecell,markleafcell,ntreecell,nleafcell,bsize,cR2max,cm,xleaf,rleaf);
+        }
+        else markleafcell[nleafcell++]=nid;
+    }
+    else marktreecell[ntreecell++]=nid;
+}
+
+//@}
+
+///\name Direct summation potential kernels
+//@{
+/*!
+    Direct summation of the potential of n particles with packed positions x,y,z and masses m, adding
+    -sum_{l!=i} m_l/sqrt(r_il^2+eps2) to phi[i]. Each pair is calculated once and added to both particles,
+    processing the pairs one tile of \ref POTPPTILE particles at a time.
+    Pairs are calculated in the working precision T, with positions relative to the group (see \ref POTPRECDOUBLE),
+    and at most POTPPTILE terms are summed in T before being accumulated in double precision in phi.
+*/
+template<typename T> void PotentialPPKernel(const Int_t n, const T *x, const T *y, const T *z, const T *m,
+    Double_t *phi, const Double_t eps2)
+{
+    const T teps2=eps2;
+    T phitile[POTPPTILE];
+    for (Int_t jb=0;jb<n;jb+=POTPPTILE) {
+        Int_t je=min(jb+(Int_t)POTPPTILE,n);
+        T *pt=phitile-jb;
+        for (Int_t j=jb;j<je;j++) pt[j]=0;
+        //all pairs i<j with j in the tile
+        for (Int_t i=0;i<je-1;i++) {
+            T xi=x[i], yi=y[i], zi=z[i], mi=m[i], sum=0;
+#ifdef USEOPENMP
+#pragma omp simd reduction(+:sum)
+#endif
+            for (Int_t j=max(jb,i+1);j<je;j++) {
+                T dx=x[j]-xi, dy=y[j]-yi, dz=z[j]-zi;
+                T rinv=T(1)/sqrt(dx*dx+dy*dy+dz*dz+teps2);
+                sum+=m[j]*rinv;
+                pt[j]-=mi*rinv;
+            }
+            phi[i]-=sum;
+            if ((i+1)%POTPPTILE==0) for (Int_t j=jb;j<je;j++) {phi[j]+=pt[j];pt[j]=0;}
+        }
+        for (Int_t j=jb;j<je;j++) phi[j]+=pt[j];
+    }
+}
+
+/*!
+    Direct summation of the potential of ns packed source particles at nt packed target particles, adding
+    -sum_l m_l/sqrt(r_il^2+eps2) to phi[i]. Target i has index tstart+i and sources with the same index, sindex[l], are skipped.
+    As in \ref PotentialPPKernel, each tile of sources is summed in the working precision T and accumulated in phi.
+*/
+template<typename T> void PotentialPPSourceKernel(const Int_t nt, const T *tx, const T *ty, const T *tz, const Int_t tstart,
+    const Int_t ns, const T *sx, const T *sy, const T *sz, const T *sm, const Int_t *sindex,
+    Double_t *phi, const Double_t eps2)
+{
+    const T teps2=eps2;
+    for (Int_t lb=0;lb<ns;lb+=POTPPTILE) {
+        Int_t le=min(lb+(Int_t)POTPPTILE,ns);
+        for (Int_t i=0;i<nt;i++) {
+            T xi=tx[i], yi=ty[i], zi=tz[i], sum=0;
+            Int_t ii=tstart+i;
+#ifdef USEOPENMP
+#pragma omp simd reduction(+:sum)
+#endif
+            for (Int_t l=lb;l<le;l++) {
+                T dx=sx[l]-xi, dy=sy[l]-yi, dz=sz[l]-zi;
+                T r2=dx*dx+dy*dy+dz*dz+teps2;
+                sum+=(sindex[l]!=ii)?sm[l]/sqrt(r2):T(0);
+            }
+            phi[i]-=sum;
+        }
+    }
+}
+template void PotentialPPKernel<double>(const Int_t, const double *, const double *, const double *, const double *, Double_t *, const Double_t);
+template void PotentialPPKernel<float>(const Int_t, const float *, const float *, const float *, const float *, Double_t *, const Double_t);
+template void PotentialPPSourceKernel<double>(const Int_t, const double *, const double *, const double *, const Int_t,
+    const Int_t, const double *, const double *, const double *, const double *, const Int_t *, Double_t *, const Double_t);
+template void PotentialPPSourceKernel<float>(const Int_t, const float *, const float *, const float *, const Int_t,
+    const Int_t, const float *, const float *, const float *, const float *, const Int_t *, Double_t *, const Double_t);
+
+///Mean position of n particles, used as the origin of positions packed in the working precision of the potential calculation
+Coordinate PotentialReferencePosition(const Int_t n, Particle *P)
+{
+    Coordinate xref(0.);
+    if (n==0) return xref;
+    for (Int_t j=0;j<n;j++) for (auto k=0;k<3;k++) xref[k]+=P[j].GetPosition(k);
+    xref*=(1.0/(Double_t)n);
+    return xref;
+}
 //@}
 
 //@{
@@ -134,72 +235,124 @@ inline void UpdateCMForUnboundParticles(Options &opt,
     }
 }
 
-/// Update the potential if necessary for small groups
+/*!
+    Potential of the nEplus unbound particles of a group at all nig particles of the group, added to dphi, calculated by
+    direct summation in working precision T. Targets are processed in blocks of \ref POTPPTILE so that large groups can run in parallel.
+*/
+template<typename T> void UnboundPotentialPPT(Options &opt, Int_t nig, Particle *groupPart, Int_t nEplus, Int_t *nEplusid,
+    Double_t *dphi, bool runomp)
+{
+    Double_t eps2=opt.uinfo.eps*opt.uinfo.eps;
+    Coordinate xref=PotentialReferencePosition(nig, groupPart);
+    //packed target positions, then source positions and masses
+    vector<T> packed(3*nig+4*nEplus);
+    T *tx=packed.data(), *ty=tx+nig, *tz=ty+nig;
+    T *sx=tz+nig, *sy=sx+nEplus, *sz=sy+nEplus, *sm=sz+nEplus;
+    for (auto j=0;j<nig;j++) {
+        tx[j]=groupPart[j].GetPosition(0)-xref[0];ty[j]=groupPart[j].GetPosition(1)-xref[1];tz[j]=groupPart[j].GetPosition(2)-xref[2];
+    }
+    for (auto k=0;k<nEplus;k++) {
+        sx[k]=tx[nEplusid[k]];sy[k]=ty[nEplusid[k]];sz[k]=tz[nEplusid[k]];
+        sm[k]=groupPart[nEplusid[k]].GetMass();
+    }
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(dynamic) if (runomp)
+#endif
+    for (Int_t jb=0;jb<nig;jb+=POTPPTILE) {
+        Int_t nt=min((Int_t)POTPPTILE,nig-jb);
+        PotentialPPSourceKernel(nt, &tx[jb], &ty[jb], &tz[jb], jb, nEplus, sx, sy, sz, sm, nEplusid, &dphi[jb], eps2);
+    }
+}
+
+/// Update the potential if necessary for small groups, removing the contribution of the unbound particles from all others
 inline void UpdatePotentialForUnboundParticlesPP(Options &opt,
     Int_t &nig, Particle *groupPart,
     Int_t &nEplus, Int_t *&nEplusid, int *&Eplusflag)
 {
     //if keeping background then do nothing
     if (opt.uinfo.bgpot!=0) return;
-    Double_t r2, pot, poti, eps2=opt.uinfo.eps*opt.uinfo.eps,mv2=opt.MassValue*opt.MassValue;
-    for (auto k=0;k<nEplus;k++) {
-        for (auto j=0;j<nig;j++) {
-            if (j!=nEplusid[k]) {
-                r2=0.;for (auto n=0;n<3;n++) r2+=pow(groupPart[nEplusid[k]].GetPosition(n)-groupPart[j].GetPosition(n),2.0);
-                r2+=eps2;
-                r2=1.0/sqrt(r2);
-                poti=groupPart[j].GetPotential()+opt.G*(groupPart[nEplusid[k]].GetMass()*groupPart[j].GetMass())*r2;
+    Double_t mv2=opt.MassValue*opt.MassValue;
+    vector<Double_t> dphi(nig,0.);
+    if (opt.uinfo.potprecision==POTPRECDOUBLE) UnboundPotentialPPT<double>(opt, nig, groupPart, nEplus, nEplusid, dphi.data(), false);
+    else UnboundPotentialPPT<float>(opt, nig, groupPart, nEplus, nEplusid, dphi.data(), false);
+    for (auto j=0;j<nig;j++) {
+        Double_t dpot=-opt.G*groupPart[j].GetMass()*dphi[j];
 #ifdef NOMASS
-                poti*=mv2;
+        dpot*=mv2;
 #endif
-                groupPart[j].SetPotential(poti);
-            }
-        }
+        groupPart[j].SetPotential(groupPart[j].GetPotential()+dpot);
     }
 }
 
-/// Update the potential if necessary for large groups
+/*!
+    Update the potential if necessary for large groups, removing the contribution of all unbound particles in one pass over the group.
+    Up to \ref UNBINDSOURCETREENUM unbound particles are summed directly. Otherwise they are placed in a tree and their potential at each
+    particle is calculated with a tree walk using quadrupole moments, which scales as nig*log(nEplus). If a large fraction of the group
+    is removed, the potential is simply recalculated.
+*/
 inline void UpdatePotentialForUnboundParticles(Options &opt,
     Int_t &nig, Particle *groupPart,
     Int_t &nEplus, Int_t *&nEplusid, int *&Eplusflag)
 {
-    int iunbindsizeflag;
-    Double_t r2, pot, poti, eps2=opt.uinfo.eps*opt.uinfo.eps,mv2=opt.MassValue*opt.MassValue;
+    Double_t eps2=opt.uinfo.eps*opt.uinfo.eps,mv2=opt.MassValue*opt.MassValue;
+    Double_t theta2=opt.uinfo.TreeThetaOpen*opt.uinfo.TreeThetaOpen;
+    bool runomp=false;
 
     if (opt.uinfo.bgpot!=0) return;
-    //if ignore the background then adjust the potential energy of the particles
-    //for large groups with many particles removed more computationally effective to simply
-    //recalculate the potential energy after removing particles
-    //for smaller number of particles removed, simply remove the contribution of this particle
-    //from all others. The change in efficiency occurs at roughly nEplus>~log(numingroup[i]) particles.
-    //we set the limit at 2*log(numingroup[i]) to account for overhead in producing tree and calculating new potential
-    iunbindsizeflag=(nEplus<2.0*log((double)nig));
-    if (iunbindsizeflag==0) Potential(opt, nig, groupPart);
-    else {
-        for (auto k=0;k<nEplus;k++) {
+    //if a large fraction of the group is removed, the source tree costs about as much as recalculating the potential
+    if (nEplus>=0.25*nig) {
+        Potential(opt, nig, groupPart);
+        return;
+    }
 #ifdef USEOPENMP
-#pragma omp parallel default(shared)  \
-private(r2,poti)
-{
-#pragma omp for schedule(dynamic) nowait
-#endif
-            for (auto j=0;j<nig;j++) {
-                if (j!=nEplusid[k]) {
-                    r2=0.;for (auto n=0;n<3;n++) r2+=pow(groupPart[nEplusid[k]].GetPosition(n)-groupPart[j].GetPosition(n),2.0);
-                    r2+=eps2;
-                    r2=1.0/sqrt(r2);
-                    poti=groupPart[j].GetPotential()+opt.G*(groupPart[nEplusid[k]].GetMass()*groupPart[j].GetMass())*r2;
+    runomp = (nig > ompunbindnum);
+#endif
+    vector<Double_t> dphi(nig, 0.);
+    //few unbound particles are summed directly in the working precision
+    if (nEplus<=UNBINDSOURCETREENUM) {
+        if (opt.uinfo.potprecision==POTPRECDOUBLE) UnboundPotentialPPT<double>(opt, nig, groupPart, nEplus, nEplusid, dphi.data(), runomp);
+        else UnboundPotentialPPT<float>(opt, nig, groupPart, nEplus, nEplusid, dphi.data(), runomp);
+        for (Int_t j=0;j<nig;j++) {
+            Double_t dpot=-opt.G*groupPart[j].GetMass()*dphi[j];
 #ifdef NOMASS
-                    poti*=mv2;
+            dpot*=mv2;
 #endif
-                    groupPart[j].SetPotential(poti);
-                }
-            }
+            groupPart[j].SetPotential(groupPart[j].GetPotential()+dpot);
+        }
+        return;
+    }
+    //packed source positions, masses and indices in tree order
+    vector<Double_t> sx(nEplus), sy(nEplus), sz(nEplus), sm(nEplus);
+    vector<Int_t> sindex(nEplus);
+    FMMCell *cells=NULL;
+    Particle *sourcePart=new Particle[nEplus];
+    Int_t ncell;
+    for (auto k=0;k<nEplus;k++) {
+        CopyParticleCoreData(sourcePart[k], groupPart[nEplusid[k]]);
+        sourcePart[k].SetID(nEplusid[k]);
+    }
+    KDTree *tree=new KDTree(sourcePart, nEplus, opt.uinfo.BucketSize, tree->TPHYS, tree->KEPAN, 100, 0, 0, 0, NULL, NULL, runomp);
+    for (auto k=0;k<nEplus;k++) {
+        sx[k]=sourcePart[k].GetPosition(0);sy[k]=sourcePart[k].GetPosition(1);sz[k]=sourcePart[k].GetPosition(2);
+        sm[k]=sourcePart[k].GetMass();sindex[k]=sourcePart[k].GetID();
+    }
+    cells=FMMBuildCells(tree, opt.uinfo.BucketSize, sx.data(), sy.data(), sz.data(), sm.data(), ncell, runomp);
+    delete tree;
+    delete[] sourcePart;
 #ifdef USEOPENMP
-}
+#pragma omp parallel for default(shared) schedule(dynamic,256) if (runomp)
 #endif
-        }
+    for (Int_t j=0;j<nig;j++) {
+        Double_t x[3];
+        for (auto k=0;k<3;k++) x[k]=groupPart[j].GetPosition(k);
+        dphi[j]=FMMPotentialAt(cells, 0, x, j, sx.data(), sy.data(), sz.data(), sm.data(), sindex.data(), theta2, eps2, 2);
+        Double_t dpot=-opt.G*groupPart[j].GetMass()*dphi[j];
+#ifdef NOMASS
+        dpot*=mv2;
+#endif
+        groupPart[j].SetPotential(groupPart[j].GetPotential()+dpot);
     }
+    delete[] cells;
 }
 
 inline void RemoveGroup(Options &opt, Int_t &ning, Int_t *&pfof, Particle *&groupPart, int &iunbindflag)
@@ -260,20 +413,89 @@ inline void GetBoundFractionAndMaxE(Options &opt,
     }
 }
 
+/*!
+    Iteratively unbind group i, whose potential and kinetic reference frame have been calculated, returning the number
+    of times the group was altered. Groups of at least \ref ompunbindnum particles update the potential with
+    \ref UpdatePotentialForUnboundParticles, smaller groups by direct summation.
+*/
+int UnbindGroup(Options &opt, Int_t i, Int_t &ning, Particle *groupPart, Int_t *&pglist, Int_t *&pfof,
+    Double_t &gmass, Coordinate &cmvel)
+{
+    int iunbindflag=0, unbindloops=0;
+    bool sortflag, unbindcheck, ilarge=(ning>=ompunbindnum);
+    Int_t oldnumingroup=ning, maxunbindsize, nEplus, nunbound;
+    Int_t *nEplusid;
+    int *Eplusflag;
+    Double_t Efrac, maxE;
+
+    GetBoundFractionAndMaxE(opt, ning, groupPart, cmvel, Efrac, maxE, nunbound);
+    //if amount unbound is very large, just remove group entirely
+    if (nunbound>=opt.uinfo.maxunboundfracforiterativeunbind*ning) {
+        for (auto j=0;j<ning;j++) pfof[pglist[j]]=0;
+        ning=0;
+        return 1;
+    }
+    //determine if any particle  number of particle with positive energy upto opt.uinfo.maxunbindfrac*numingroup+1
+    maxunbindsize=(Int_t)(opt.uinfo.maxunbindfrac*nunbound+1);
+    nEplusid=new Int_t[ning];
+    Eplusflag=new int[ning];
+    //check if bound;
+    unbindcheck = CheckGroupForBoundness(opt,Efrac,maxE,ning);
+    FillUnboundArrays(opt, maxunbindsize, ning, groupPart, Efrac, nEplusid, Eplusflag, nEplus, unbindcheck);
+    while(unbindcheck)
+    {
+        iunbindflag++;
+        unbindloops++;
+        UpdateCMForUnboundParticles(opt, gmass, cmvel, ning, groupPart, nEplus, nEplusid, Eplusflag);
+        if (ilarge) UpdatePotentialForUnboundParticles(opt, ning, groupPart, nEplus, nEplusid, Eplusflag);
+        else UpdatePotentialForUnboundParticlesPP(opt, ning, groupPart, nEplus, nEplusid, Eplusflag);
+        //remove particles with positive energy
+        RemoveUnboundParticles(i, pfof, ning, pglist, groupPart, nEplus, nEplusid, Eplusflag);
+        //if number of particles remove with positive energy is near to the number allowed to be removed
+        //must recalculate kinetic energies and check if maxE>0
+        //otherwise, end unbinding.
+        if (nEplus<opt.uinfo.maxallowedunboundfrac*ning) {
+            unbindcheck=false;
+        }
+        else {
+            sortflag=false;
+            if ((oldnumingroup-ning)>opt.uinfo.maxallowedunboundfrac*oldnumingroup) {
+                oldnumingroup=ning;
+                sortflag=true;
+            }
+            //recalculate kinetic energies since cmvel has changed
+            GetBoundFractionAndMaxE(opt, ning, groupPart, cmvel, Efrac, maxE, nunbound, sortflag);
+            maxunbindsize=(Int_t)(opt.uinfo.maxunbindfrac*nunbound+1);
+            unbindcheck = CheckGroupForBoundness(opt,Efrac,maxE,ning);
+            FillUnboundArrays(opt, maxunbindsize, ning, groupPart, Efrac, nEplusid, Eplusflag, nEplus, unbindcheck);
+        }
+    }
+    //if group too small remove entirely
+    AdjustPGListForUnbinding(unbindloops,ning,pglist,groupPart);
+    RemoveGroup(opt, ning, pfof, groupPart, iunbindflag);
+    delete[] nEplusid;
+    delete[] Eplusflag;
+    return iunbindflag;
+}
+
 //@}
 
 ///\name Remove unbound particles from a candidate group
 //@{
 /*!
     Interface for unbinding proceedure. Unbinding routine requires several arrays, such as numingroup, pglist,gPart,ids, etc
-    This arrays may have been constructed prior to the unbinding call and so can be passed to the routine
-    if this is called it uses Particle array then deletes it.
+    This arrays may have been constructed prior to the unbinding call and so can be passed to the routine.
+    Otherwise they are built with a parallel counting sort on group id from memory that is released in one step.
+    Group members are gathered into a single packed array with \ref BuildPackedPartList, which is unbound and then freed,
+    with the results returned in pfof and pglist. The particle array is never reordered or altered.
 */
 int CheckUnboundGroups(Options opt, const Int_t nbodies, Particle *Part, Int_t &ngroup, Int_t *&pfof, Int_t *numingroup, Int_t **pglist, int ireorder, Int_t *groupflag)
 {
     bool ningflag=false, pglistflag=false;
     int iflag;
     Int_t ng=ngroup;
+    Particle **gPart, *packedPart;
+    MemoryArena arena;
     Double_t time1=MyGetTime();
 #ifndef USEMPI
     int ThisTask=0,NProcs=1;
@@ -285,67 +507,40 @@ int CheckUnboundGroups(Options opt, const Int_t nbodies, Particle *Part, Int_t &
     if (numingroup==NULL) ningflag=true;
     if (pglist==NULL) pglistflag=true;
     //if array was not created outside, build now
-    if (ningflag) numingroup=BuildNumInGroup(nbodies, ngroup, pfof);
-    if (pglistflag) pglist=BuildPGList(nbodies, ngroup, numingroup, pfof);
-    //unbind can either copy information into new arrays and not worry about order or reseting anything
-    //OR save memory at the cost of a few more computations (specifically sorts).
-    //Build particle array containing only particles in groups;
-#ifdef SAVEMEM
-    Int_t *storeval1=new Int_t[nbodies];
-    Int_t *storeval2=new Int_t[nbodies];
-    Int_t *noffset=new Int_t[ngroup+1];
-    Double_t *storeden=new Double_t[nbodies];
-    for (Int_t i=0;i<nbodies;i++) {storeval1[i]=Part[i].GetPID();storeval2[i]=Part[i].GetID();storeden[i]=Part[i].GetDensity();Part[i].SetPID(i);Part[i].SetID(pfof[i]+nbodies*(pfof[i]==0));}
-    qsort(Part,nbodies,sizeof(Particle),IDCompare);
-    noffset[0]=noffset[1]=0;
-    for (Int_t i=2;i<=ngroup;i++) noffset[i]=noffset[i-1]+numingroup[i-1];
-#else
-    Particle **gPart=BuildPartList(ngroup, numingroup, pglist, Part);
+    if (ningflag) numingroup=BuildNumInGroup(nbodies, ngroup, pfof, arena);
+    if (pglistflag) pglist=BuildPGList(nbodies, ngroup, numingroup, pfof, arena);
+    //build packed particle array containing only particles in groups
+    packedPart=BuildPackedPartList(ngroup, numingroup, pglist, Part, gPart);
+    //potentials read from the input are looked up by particle id before ids are replaced by the index in Part,
+    //and are only used for groups too large for a direct calculation
+    vector<int> inputpotflag;
+    if (opt.uinfo.iinputpotential) {
+        Int_t ninputpot=0;
+        inputpotflag.resize(ngroup+1,0);
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+:ninputpot) if (ngroup>1)
+#endif
+        for (Int_t i=1;i<=ngroup;i++) {
+            if (numingroup[i]<=potppcalcnum) continue;
+            inputpotflag[i]=GetInputPotentials(opt, numingroup[i], gPart[i]);
+            ninputpot+=inputpotflag[i];
+        }
+        if (opt.iverbose) cout<<ThisTask<<" using input potentials for "<<ninputpot<<" groups"<<endl;
+    }
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(dynamic) if (ngroup>1)
+#endif
     for (Int_t i=1;i<=ngroup;i++) {
         for (Int_t j=0;j<numingroup[i];j++) {
             gPart[i][j].SetID(j);
             gPart[i][j].SetPID(pglist[i][j]);
         }
     }
-#endif
-
-#ifdef SAVEMEM
-    iflag=Unbind(opt, Part, ngroup, numingroup,noffset,pfof);
-    //if keeping track of a flag, set flag to 0 if group no longer present
-    if (groupflag!=NULL) {
-        for (Int_t i=0;i<=ng;i++) if (numingroup[i]==0) groupflag[i]=0;
-        //and reorder it if reordering group ids
-        if (ireorder) ReorderGroupIDsAndArraybyValue(const Int_t numgroups, const Int_t newnumgroups, Int_t *numingroup, Int_t *pfof, Int_t **pglist, Int_t *value, Int_t *gdata)
-    }
-    //reset order
-    qsort(Part,nbodies,sizeof(Particle),PIDCompare);
-    for (Int_t i=0;i<nbodies;i++) {Part[i].SetPID(storeval1[i]);Part[i].SetID(storeval2[i]);Part[i].SetDensity(storeden[i]);}
-    //and alter pglist
-    for (Int_t i=0;i<=ng;i++) numingroup[i]=0;
-    for (Int_t i=0;i<nbodies;i++) if (pfof[i]>0) pglist[pfof[i]][numingroup[pfof[i]]++]=i;
-    if (ireorder==1 && iflag&&ngroup>0) {
-        if (groupflag!=NULL) {
-            //allocate memory to store the group value which is a combination of the groupflag value and numingroup
-            Double_t *groupvalue=new Double_t[ng+1];
-            for (Int_t i=0;i<=ng;i++) {
-                if (numingroup[i]==0) {groupvalue[i]=groupflag[i]=0;}
-                else {
-                    if (groupflag[i]==1) groupvalue[i]=numingroup[i];
-                    else groupvalue[i]=1.0/(Double_t)numingroup[i];
-                }
-            }
-            //and reorder it if reordering group ids
-            if (ireorder) ReorderGroupIDsAndArraybyValue(ng,ngroup,numingroup,pfof,pglist,groupvalue,groupflag);
-            delete[] groupvalue;
-        }
-        else ReorderGroupIDs(ng,ngroup,numingroup,pfof,pglist);
-    }
-    delete[] noffset;
-#else
 
     //if groupflags are provided then explicitly reorder here if required, otherwise internal reordering within unbind.
-    if (groupflag!=NULL) iflag = Unbind(opt, gPart, ngroup, numingroup,pfof,pglist,0);
-    else iflag = Unbind(opt, gPart, ngroup, numingroup,pfof,pglist,ireorder);
+    int *inputpotflagptr=(inputpotflag.size()>0)?inputpotflag.data():NULL;
+    if (groupflag!=NULL) iflag = Unbind(opt, gPart, ngroup, numingroup,pfof,pglist,0,inputpotflagptr);
+    else iflag = Unbind(opt, gPart, ngroup, numingroup,pfof,pglist,ireorder,inputpotflagptr);
 
     //if keeping track of a flag, set flag to 0 if group no longer present
     if (ireorder==1 && iflag&&ngroup>0) {
@@ -369,123 +564,345 @@ int CheckUnboundGroups(Options opt, const Int_t nbodies, Particle *Part, Int_t &
             ReorderGroupIDs(ng,ngroup,numingroup,pfof,pglist);
         }
     }
-    for (Int_t i=1;i<=ng;i++) delete[] gPart[i];delete[] gPart;
-#endif
-    if (pglistflag) {for (Int_t i=1;i<=ng;i++) delete[] pglist[i];delete[] pglist;}
-    if (ningflag) delete[] numingroup;
+    delete[] gPart;
+    delete[] packedPart;
+    //numingroup and pglist, if built here, are freed with the arena
 
     if (opt.iverbose) cout<<ThisTask<<" Done. Number of groups remaining "<<ngroup<<" in"<<MyGetTime()-time1<<endl;
 
     return iflag;
 }
 
-///Calculate potential of groups
-inline void CalculatePotentials(Options &opt, Particle **gPart, Int_t &numgroups, Int_t *numingroup)
+///\name Cost ordered scheduling of groups
+//@{
+/*!
+    Estimated cost of calculating the potential of a group of n particles. Direct summation scales as n^2 up to
+    \ref potppcalcnum, beyond which the tree scales as n log n, normalised so that the estimate is continuous at potppcalcnum.
+*/
+double GroupPotentialCost(Int_t n)
 {
-    int maxnthreads,nthreads=1;
-
-#ifndef USEMPI
-    int ThisTask=0,NProcs=1;
-#endif
+    if (n<=potppcalcnum) return (double)n*(double)n;
+    return (double)n*log((double)n)*(double)potppcalcnum/log((double)max(potppcalcnum,(Int_t)2));
+}
 
-    if (!opt.uinfo.icalculatepotential) return;
+///Estimated cost of unbinding a group of n particles, dominated by the sorts by energy, ~n log n
+double GroupUnbindCost(Int_t n)
+{
+    return (double)n*log((double)n+1.0);
+}
 
-    //for parallel environment store maximum number of threads
-    nthreads=1;
+/*!
+    Apply groupwork(i) to all groups with numingroup[i]>0 in order of decreasing estimated cost, groupcost(numingroup[i]).
+    With OpenMP each group is a task, so the most expensive groups start first and idle threads pick up the remaining
+    groups as they finish. As in \ref SearchSubSubLevelTasks, groups with at least minompnum particles run the parallel
+    regions within groupwork with a number of threads proportional to their share of the total cost, rather than being
+    processed one at a time with all threads after the small groups are done.
+    As there, the nested threads come from a pool of spare threads left free by the outer team, so the total number of
+    threads never exceeds omp_get_max_threads(). The pool holds at most half the threads, so the small groups still use
+    at least half of the threads when a single group dominates the cost.
+    groupwork must only alter data belonging to group i.
+*/
+void GroupTasksByCost(Int_t numgroups, Int_t *numingroup, Int_t minompnum,
+    const function<double(Int_t)> &groupcost, const function<void(Int_t)> &groupwork)
+{
+    double totalcost=0;
+    vector<double> cost(numgroups+1,0.);
+    vector<Int_t> taskorder;
+    taskorder.reserve(numgroups);
+    for (Int_t i=1;i<=numgroups;i++) if (numingroup[i]>0) {
+        cost[i]=groupcost(numingroup[i]);
+        totalcost+=cost[i];
+        taskorder.push_back(i);
+    }
+    sort(taskorder.begin(), taskorder.end(), [&cost](Int_t a, Int_t b){return cost[a] > cost[b];});
 #ifdef USEOPENMP
-#pragma omp parallel
-    {
-    if (omp_get_thread_num()==0) maxnthreads=nthreads=omp_get_num_threads();
+    int nthreads=omp_get_max_threads(), maxactivelevels=omp_get_max_active_levels();
+    if (nthreads>1 && taskorder.size()>1) {
+        //threads wanted by large groups, the extra threads coming from a pool the outer team leaves free
+        int nspare=0, nsparefree;
+        vector<int> ntaskthreads(numgroups+1,1);
+        for (auto &i:taskorder) {
+            if (numingroup[i]<minompnum) continue;
+            ntaskthreads[i]=max(1,(int)round(nthreads*cost[i]/totalcost));
+            nspare=max(nspare,ntaskthreads[i]-1);
+        }
+        //at most half the threads are held back, so that a dominant group does not leave the many small groups to a few threads
+        nspare=min(nspare,nthreads/2);
+        nsparefree=nspare;
+        //allow the parallel regions of large groups to use more than one thread
+        omp_set_max_active_levels(max(maxactivelevels, 2));
+        #pragma omp parallel default(shared) num_threads(nthreads-nspare)
+        #pragma omp single
+        {
+            for (size_t itask=0;itask<taskorder.size();itask++) {
+                Int_t i=taskorder[itask];
+                #pragma omp task default(shared) firstprivate(i)
+                {
+                    int nextra=0;
+                    if (ntaskthreads[i]>1) {
+                        #pragma omp critical (grouptasksthreads)
+                        {
+                        nextra=min(ntaskthreads[i]-1,nsparefree);
+                        nsparefree-=nextra;
+                        }
+                    }
+                    omp_set_num_threads(1+nextra);
+                    groupwork(i);
+                    if (nextra>0) {
+                        #pragma omp critical (grouptasksthreads)
+                        nsparefree+=nextra;
+                    }
+                }
+            }
+        }
+        omp_set_max_active_levels(maxactivelevels);
+        return;
     }
 #endif
+    for (auto &i:taskorder) groupwork(i);
+}
+//@}
 
-    //for each group calculate potential
-    //if group is small calculate potentials using PP
-    //here openmp is over groups since each group is small
-#ifdef USEOPENMP
-#pragma omp parallel default(shared)
+///\name Potentials read from the input
+//@{
+/*!
+    Store the potentials read from the input (see \ref UnbindInfo.iinputpotential) in \ref inputpotentials, sorted by particle id,
+    so that they are available once the potential field of the particles has been used for other purposes.
+    Particles without an input potential are flagged by NaN values and are not stored.
+*/
+void StoreInputPotentials(Options &opt, const Int_t nbodies, Particle *Part, const Int_t nbaryons, Particle *Pbaryons)
 {
-    #pragma omp for schedule(dynamic,1) nowait
+    if (!opt.uinfo.iinputpotential) return;
+#ifndef USEMPI
+    int ThisTask=0;
 #endif
-    for (auto i=1;i<=numgroups;i++)
-    {
-        if (numingroup[i]<=POTPPCALCNUM) {
-            if (numingroup[i]<0) continue;
-            PotentialPP(opt, numingroup[i], gPart[i]);
-        }
+    Int_t nmissing=0;
+    vector<input_potential>().swap(inputpotentials);
+    inputpotentials.reserve(nbodies+nbaryons);
+    auto storepot = [&](Particle &p) {
+        if (std::isfinite(p.GetPotential())) inputpotentials.push_back({(long long)p.GetPID(), p.GetPotential()*opt.uinfo.inputpotconversion});
+        else nmissing++;
+    };
+    for (Int_t i=0;i<nbodies;i++) storepot(Part[i]);
+    //baryons may be stored at the end of the particle array rather than separately
+    if (Pbaryons!=NULL && (Pbaryons<Part || Pbaryons>=Part+nbodies)) for (Int_t i=0;i<nbaryons;i++) storepot(Pbaryons[i]);
+    sort(inputpotentials.begin(), inputpotentials.end(), [](const input_potential &a, const input_potential &b){return a.pid<b.pid;});
+    if (opt.iverbose) cout<<ThisTask<<" stored "<<inputpotentials.size()<<" input potentials, "<<nmissing<<" particles have none"<<endl;
+}
+
+/*!
+    Set the potential of the n particles to the specific potential read from the input, looked up by particle id (PID).
+    Returns false if any particle has no input potential, in which case the potentials must be calculated.
+*/
+bool GetInputPotentials(Options &opt, const Int_t n, Particle *P)
+{
+    input_potential val;
+    vector<input_potential>::iterator it;
+    if (inputpotentials.size()==0) return false;
+    for (Int_t j=0;j<n;j++) {
+        val.pid=P[j].GetPID();
+        it=lower_bound(inputpotentials.begin(), inputpotentials.end(), val,
+            [](const input_potential &a, const input_potential &b){return a.pid<b.pid;});
+        if (it==inputpotentials.end() || it->pid!=val.pid) return false;
+        P[j].SetPotential(it->pot);
     }
-#ifdef USEOPENMP
+    return true;
 }
+
+/*!
+    Convert the specific input potentials of a group of n particles, set by \ref GetInputPotentials, to the potential energy used
+    in unbinding. The input potential includes the contribution of all particles in the simulation, including the periodic
+    images and the mean background, so it is the self-potential of the group plus an external potential.
+    The self-potential is calculated directly at \ref UnbindInfo.inputpotnumsample members spread through the group and
+    the external potential is fit at these members as a constant or a constant plus a gradient (see \ref POTINPUTCORRNONE),
+    which is subtracted from all members.
+*/
+void GroupPotentialFromInput(Options &opt, const Int_t n, Particle *P)
+{
+    Double_t eps2=opt.uinfo.eps*opt.uinfo.eps, mval=1.0;
+    Int_t nsample=min(opt.uinfo.inputpotnumsample, n);
+    Coordinate xc(0.);
+    FixedVector<4> ext(0.);
+    bool igradient=false;
+#ifdef NOMASS
+    mval=opt.MassValue;
 #endif
-    //reset number of threads to maximum number
+    if (opt.uinfo.inputpotcorrection!=POTINPUTCORRNONE && nsample>0) {
+        //packed positions and masses of the group, as in \ref PotentialPP
+        vector<Double_t> packed(4*n);
+        vector<Int_t> sindex(n);
+        Double_t *x=packed.data(), *y=x+n, *z=y+n, *m=z+n;
+        vector<Double_t> extsample(nsample);
+        Double_t mtot=0;
+        for (Int_t j=0;j<n;j++) {
+            x[j]=P[j].GetPosition(0);y[j]=P[j].GetPosition(1);z[j]=P[j].GetPosition(2);
+            m[j]=P[j].GetMass();
+            sindex[j]=j;
+            for (auto k=0;k<3;k++) xc[k]+=P[j].GetPosition(k)*m[j];
+            mtot+=m[j];
+        }
+        xc*=(1.0/mtot);
+        //external potential at members evenly spaced in the group list
 #ifdef USEOPENMP
-#pragma omp master
-    {
-        omp_set_num_threads(maxnthreads);
-    }
-    nthreads=maxnthreads;
+#pragma omp parallel for schedule(dynamic) if (n>=potompcalcnum)
 #endif
-    for (auto i=1;i<=numgroups;i++)
-    {
-        if (numingroup[i]<0) continue;
-        if (numingroup[i]>POTPPCALCNUM) {
-            Potential(opt, numingroup[i], gPart[i]);
+        for (Int_t s=0;s<nsample;s++) {
+            Int_t j=(Int_t)(s*(Double_t)n/(Double_t)nsample);
+            Double_t phi=0;
+            PotentialPPSourceKernel(1, &x[j], &y[j], &z[j], j, n, x, y, z, m, sindex.data(), &phi, eps2);
+            extsample[s]=P[j].GetPotential()-opt.G*mval*phi;
+        }
+        if (opt.uinfo.inputpotcorrection==POTINPUTCORRLINEAR && nsample>=4) {
+            //least squares fit of ext = a + b.(x-xc)
+            FixedMatrix<4> a(0.);
+            FixedVector<4> u, b(0.);
+            for (Int_t s=0;s<nsample;s++) {
+                Int_t j=(Int_t)(s*(Double_t)n/(Double_t)nsample);
+                u[0]=1.0;
+                for (auto k=0;k<3;k++) u[k+1]=P[j].GetPosition(k)-xc[k];
+                a.AddOuter(u, 1.0);
+                b+=u*extsample[s];
+            }
+            if (a.Det()>1e-12*a(0,0)*a(1,1)*a(2,2)*a(3,3)) {
+                ext=a.Inverse()*b;
+                igradient=true;
+            }
         }
+        //constant fit if requested or if the samples do not constrain a gradient
+        if (!igradient) {
+            for (Int_t s=0;s<nsample;s++) ext[0]+=extsample[s];
+            ext[0]/=(Double_t)nsample;
+        }
+    }
+    for (Int_t j=0;j<n;j++) {
+        Double_t pot=P[j].GetPotential()-ext[0];
+        for (auto k=0;k<3;k++) pot-=ext[k+1]*(P[j].GetPosition(k)-xc[k]);
+        P[j].SetPotential(pot*P[j].GetMass()*mval);
     }
 }
+//@}
 
-///Calculate potential of groups, assumes particle list is ordered by group
-///and accessed by numingroup and noffset;
-inline void CalculatePotentials(Options &opt, Particle *gPart, Int_t &numgroups, Int_t *numingroup, Int_t *noffset)
+///\name Potential of groups
+//@{
+///Potential of a group, by direct summation for small groups and with a tree otherwise
+inline void GroupPotential(Options &opt, Int_t n, Particle *P)
 {
-    int maxnthreads,nthreads=1;
-#ifndef USEMPI
-    int ThisTask=0,NProcs=1;
-#endif
-    if (!opt.uinfo.icalculatepotential) return;
+    if (n<=potppcalcnum) PotentialPP(opt, n, P);
+    else Potential(opt, n, P);
+}
 
-    //for parallel environment store maximum number of threads
-    nthreads=1;
-#ifdef USEOPENMP
-#pragma omp parallel
-    {
-    if (omp_get_thread_num()==0) maxnthreads=nthreads=omp_get_num_threads();
+///Fraction of the n particles that are bound, \f$ \alpha T+W<0 \f$, in the centre of mass frame
+Double_t GroupBoundFraction(Options &opt, Int_t n, Particle *P)
+{
+    Coordinate cmvel(0.);
+    Double_t mtot=0, mass, v2, Ti;
+    Int_t nbound=0;
+    for (Int_t j=0;j<n;j++) {
+        for (auto k=0;k<3;k++) cmvel[k]+=P[j].GetVelocity(k)*P[j].GetMass();
+        mtot+=P[j].GetMass();
     }
+    cmvel*=(1.0/mtot);
+    for (Int_t j=0;j<n;j++) {
+        mass=P[j].GetMass();
+#ifdef NOMASS
+        mass=opt.MassValue;
 #endif
-
-    //for each group calculate potential
-    //if group is small calculate potentials using PP
-    //here openmp is over groups since each group is small
-#ifdef USEOPENMP
-#pragma omp parallel default(shared)
-{
-    #pragma omp for schedule(dynamic,1) nowait
+        v2=0;for (auto k=0;k<3;k++) v2+=pow(P[j].GetVelocity(k)-cmvel[k],2.0);
+        Ti=0.5*mass*v2;
+#ifdef GASON
+        Ti+=mass*P[j].GetU();
 #endif
-    for (auto i=1;i<=numgroups;i++)
-    {
-        if (numingroup[i]<=POTPPCALCNUM) {
-            if (numingroup[i]<0) continue;
-            PotentialPP(opt, numingroup[i], &gPart[noffset[i]]);
-        }
+        nbound+=(opt.uinfo.Eratio*Ti+P[j].GetPotential()<0);
     }
-#ifdef USEOPENMP
+    return nbound/(Double_t)n;
 }
+
+/*!
+    Potential of a group in the working precision of \ref POTPRECVALIDATE, which is left in the particles, also calculated in
+    double precision to return the largest relative difference in the potential of a particle, dpot, and the difference
+    in the initial bound fraction of the group, dfrac.
+*/
+void ValidateGroupPotential(Options &opt, Int_t n, Particle *P, Double_t &dpot, Double_t &dfrac)
+{
+    Options optdouble=opt;
+    vector<Double_t> potdouble(n);
+    Double_t fracdouble;
+    optdouble.uinfo.potprecision=POTPRECDOUBLE;
+    GroupPotential(optdouble, n, P);
+    for (Int_t j=0;j<n;j++) potdouble[j]=P[j].GetPotential();
+    fracdouble=GroupBoundFraction(opt, n, P);
+    GroupPotential(opt, n, P);
+    dpot=0;
+    for (Int_t j=0;j<n;j++) if (potdouble[j]!=0) dpot=max(dpot,fabs(P[j].GetPotential()/potdouble[j]-1.0));
+    dfrac=fabs(GroupBoundFraction(opt, n, P)-fracdouble);
+}
+
+///Report the largest differences between the working and double precision potentials of groups found by \ref ValidateGroupPotential
+void ReportPotentialValidation(Int_t numgroups, vector<Double_t> &dpot, vector<Double_t> &dfrac)
+{
+#ifndef USEMPI
+    int ThisTask=0;
 #endif
-    //reset number of threads to maximum number
-#ifdef USEOPENMP
-#pragma omp master
-    {
-        omp_set_num_threads(maxnthreads);
-    }
-    nthreads=maxnthreads;
-#endif
-    for (auto i=1;i<=numgroups;i++)
-    {
-        if (numingroup[i]<0) continue;
-        if (numingroup[i]>POTPPCALCNUM) {
-            Potential(opt, numingroup[i], &gPart[noffset[i]]);
-        }
+    if (numgroups==0) return;
+    Double_t dpotmax=*max_element(dpot.begin(), dpot.end()), dfracmax=*max_element(dfrac.begin(), dfrac.end());
+    cout<<ThisTask<<" mixed precision potential of "<<numgroups<<" groups, max relative potential difference "<<dpotmax;
+    cout<<" and max bound fraction difference "<<dfracmax<<" relative to double precision"<<endl;
+}
+
+/*!
+    Calculate potential of groups, scheduled by cost with \ref GroupTasksByCost.
+    Groups flagged in inputpotflag have their potential derived from the input potential, see \ref GroupPotentialFromInput.
+*/
+inline void CalculatePotentials(Options &opt, Particle **gPart, Int_t &numgroups, Int_t *numingroup, int *inputpotflag=NULL)
+{
+    if (!opt.uinfo.icalculatepotential) return;
+    vector<Double_t> dpot, dfrac;
+    if (opt.uinfo.potprecision==POTPRECVALIDATE) {dpot.resize(numgroups+1,0.);dfrac.resize(numgroups+1,0.);}
+    //small groups use PP, larger groups a tree, which is parallelised internally
+    GroupTasksByCost(numgroups, numingroup, potompcalcnum, GroupPotentialCost,
+        [&](Int_t i) {
+            if (inputpotflag!=NULL && inputpotflag[i]) GroupPotentialFromInput(opt, numingroup[i], gPart[i]);
+            else if (opt.uinfo.potprecision==POTPRECVALIDATE) ValidateGroupPotential(opt, numingroup[i], gPart[i], dpot[i], dfrac[i]);
+            else GroupPotential(opt, numingroup[i], gPart[i]);
+        });
+    if (opt.uinfo.potprecision==POTPRECVALIDATE) ReportPotentialValidation(numgroups, dpot, dfrac);
+}
+
+///Calculate potential of groups, assumes particle list is ordered by group
+///and accessed by numingroup and noffset;
+inline void CalculatePotentials(Options &opt, Particle *gPart, Int_t &numgroups, Int_t *numingroup, Int_t *noffset)
+{
+    if (!opt.uinfo.icalculatepotential) return;
+    vector<Double_t> dpot, dfrac;
+    if (opt.uinfo.potprecision==POTPRECVALIDATE) {dpot.resize(numgroups+1,0.);dfrac.resize(numgroups+1,0.);}
+    GroupTasksByCost(numgroups, numingroup, potompcalcnum, GroupPotentialCost,
+        [&](Int_t i) {
+            if (opt.uinfo.potprecision==POTPRECVALIDATE) ValidateGroupPotential(opt, numingroup[i], &gPart[noffset[i]], dpot[i], dfrac[i]);
+            else GroupPotential(opt, numingroup[i], &gPart[noffset[i]]);
+        });
+    if (opt.uinfo.potprecision==POTPRECVALIDATE) ReportPotentialValidation(numgroups, dpot, dfrac);
+}
+//@}
+
+/*!
+    Centre of mass velocity of the npot particles closest to centre. These are found by selecting on a compact array of
+    radii with \ref SelectSmallestKeys, so the particles of the group are not sorted or moved.
+*/
+Coordinate CentralCMVel(Int_t n, Particle *P, const Coordinate &centre, Int_t npot)
+{
+    vector<particle_key_index> keys;
+    Coordinate cmvel(0.);
+    Double_t menc=0;
+    Int_t index;
+    ParticleRadialKeys(n, P, centre, keys);
+    SelectSmallestKeys(keys, npot);
+    for (auto j=0;j<npot;j++) {
+        index=keys[j].index;
+        for (auto k=0;k<3;k++) cmvel[k]+=P[index].GetVelocity(k)*P[index].GetMass();
+        menc+=P[index].GetMass();
     }
+    cmvel*=(1.0/menc);
+    return cmvel;
 }
 
 ///loop over groups and get velocity frame
@@ -493,10 +910,9 @@ inline void CalculateBindingReferenceFrame(Options &opt,
     Particle **gPart, Int_t &numgroups, Int_t *numingroup,
     Double_t *&gmass, Coordinate *&cmvel)
 {
-    Double_t potmin,menc;
+    Double_t potmin;
     Int_t npot,ipotmin;
     Coordinate potpos;
-    Int_t *storeval;
 
     //if using standard frame, then using CMVEL of the entire structure
     if (opt.uinfo.fracpotref==1.0) {
@@ -522,55 +938,34 @@ inline void CalculateBindingReferenceFrame(Options &opt,
         if (opt.uinfo.cmvelreftype==CMVELREF) {
 #ifdef USEOPENMP
 #pragma omp parallel default(shared)  \
-private(npot,menc,potpos,storeval)
+private(npot,potpos)
 {
 #pragma omp for schedule(dynamic,1) nowait
 #endif
             for (auto i=1;i<=numgroups;i++)
             {
                 if (numingroup[i]<0) continue;
-                for (auto k=0;k<3;k++) potpos[k]=cmvel[i][k]=0;
+                for (auto k=0;k<3;k++) potpos[k]=0;
                 for (auto j=0;j<numingroup[i];j++) {
                     gmass[i]+=gPart[i][j].GetMass();
                     for (auto k=0;k<3;k++) potpos[k]+=gPart[i][j].GetPosition(k)*gPart[i][j].GetMass();
                 }
                 potpos*=(1.0/gmass[i]);
-                //now sort by radius, first store original position in array
-                storeval=new Int_t[numingroup[i]];
-                for (auto j=0;j<numingroup[i];j++) {
-                    for (auto k=0;k<3;k++) gPart[i][j].SetPosition(k,gPart[i][j].GetPosition(k)-potpos[k]);
-                    storeval[i] = gPart[i][j].GetID();
-                    gPart[i][j].SetID(j);
-                }
-                //sort by radius
-                gsl_heapsort(gPart[i],numingroup[i],sizeof(Particle),RadCompare);
                 //use central regions to define centre of mass velocity
                 //determine how many particles to use
                 npot=max(opt.uinfo.Npotref,Int_t(opt.uinfo.fracpotref*numingroup[i]));
                 npot=min(npot,numingroup[i]);
-                cmvel[i][0]=cmvel[i][1]=cmvel[i][2]=menc=0.;
-                for (auto j=0;j<npot;j++) {
-                    for (auto k=0;k<3;k++) cmvel[i][k]+=gPart[i][j].GetVelocity(k)*gPart[i][j].GetMass();
-                    menc+=gPart[i][j].GetMass();
-                }
-                for (auto j=0;j<3;j++) {cmvel[i][j]/=menc;}
-                gsl_heapsort(gPart[i],numingroup[i],sizeof(Particle),IDCompare);
-                for (auto j=0;j<numingroup[i];j++) {
-                    gPart[i][j].SetID(storeval[j]);
-                    for (auto k=0;k<3;k++) gPart[i][j].SetPosition(k,gPart[i][j].GetPosition(k)+potpos[k]);
-                }
-                delete[] storeval;
+                cmvel[i]=CentralCMVel(numingroup[i], gPart[i], potpos, npot);
             }
 #ifdef USEOPENMP
 }
 #endif
         }
         //if using potential then must identify minimum potential.
-        //Note that  most computations involve sorts, so parallize over groups
         else if (opt.uinfo.cmvelreftype==POTREF) {
 #ifdef USEOPENMP
 #pragma omp parallel default(shared)  \
-private(npot,menc,potmin,ipotmin,potpos,storeval)
+private(npot,potmin,ipotmin,potpos)
 {
 #pragma omp for schedule(dynamic,1) nowait
 #endif
@@ -579,28 +974,12 @@ private(npot,menc,potmin,ipotmin,potpos,storeval)
                 //determine how many particles to use
                 npot=max(opt.uinfo.Npotref,Int_t(opt.uinfo.fracpotref*numingroup[i]));
                 npot=min(npot,numingroup[i]);
-
-                storeval=new Int_t[numingroup[i]];
-                for (auto j=0;j<numingroup[i];j++) {storeval[j]=gPart[i][j].GetID();gPart[i][j].SetID(j);}
                 //determine position of minimum potential and by radius around this position
                 potmin=gPart[i][0].GetPotential();ipotmin=0;
                 for (auto j=1;j<numingroup[i];j++) if (gPart[i][j].GetPotential()<potmin) {potmin=gPart[i][j].GetPotential();ipotmin=j;}
                 for (auto k=0;k<3;k++) potpos[k]=gPart[i][ipotmin].GetPosition(k);
-
-                for (auto j=0;j<numingroup[i];j++) {
-                    for (auto k=0;k<3;k++) gPart[i][j].SetPosition(k,gPart[i][j].GetPosition(k)-potpos[k]);
-                }
-                gsl_heapsort(gPart[i],numingroup[i],sizeof(Particle),RadCompare);
                 //now determine kinetic frame
-                cmvel[i][0]=cmvel[i][1]=cmvel[i][2]=menc=0.;
-                for (auto j=0;j<npot;j++) {
-                    for (auto k=0;k<3;k++) cmvel[i][k]+=gPart[i][j].GetVelocity(k)*gPart[i][j].GetMass();
-                    menc+=gPart[i][j].GetMass();
-                }
-                for (auto j=0;j<3;j++) {cmvel[i][j]/=menc;}
-                gsl_heapsort(gPart[i],numingroup[i],sizeof(Particle),IDCompare);
-                for (auto j=0;j<numingroup[i];j++) gPart[i][j].SetID(storeval[j]);
-                delete[] storeval;
+                cmvel[i]=CentralCMVel(numingroup[i], gPart[i], potpos, npot);
             }
 #ifdef USEOPENMP
 }
@@ -614,10 +993,9 @@ inline void CalculateBindingReferenceFrame(Options &opt,
     Particle *gPart, Int_t &numgroups, Int_t *numingroup, Int_t *noffset,
     Double_t *&gmass, Coordinate *&cmvel)
 {
-    Double_t potmin,menc;
+    Double_t potmin;
     Int_t npot,ipotmin;
     Coordinate potpos;
-    Int_t *storeval;
     //if using standard frame, then using CMVEL of the entire structure
     if (opt.uinfo.fracpotref==1.0) {
 #ifdef USEOPENMP
@@ -642,55 +1020,34 @@ inline void CalculateBindingReferenceFrame(Options &opt,
         if (opt.uinfo.cmvelreftype==CMVELREF) {
 #ifdef USEOPENMP
 #pragma omp parallel default(shared)  \
-private(npot,menc,potpos,storeval)
+private(npot,potpos)
 {
 #pragma omp for schedule(dynamic,1) nowait
 #endif
             for (auto i=1;i<=numgroups;i++)
             {
                 if (numingroup[i]<0) continue;
-                for (auto k=0;k<3;k++) potpos[k]=cmvel[i][k]=0;
+                for (auto k=0;k<3;k++) potpos[k]=0;
                 for (auto j=0;j<numingroup[i];j++) {
                     gmass[i]+=gPart[noffset[i]+j].GetMass();
                     for (auto k=0;k<3;k++) potpos[k]+=gPart[noffset[i]+j].GetPosition(k)*gPart[noffset[i]+j].GetMass();
                 }
                 potpos*=(1.0/gmass[i]);
-                //now sort by radius, first store original position in array
-                storeval=new Int_t[numingroup[i]];
-                for (auto j=0;j<numingroup[i];j++) {
-                    for (auto k=0;k<3;k++) gPart[noffset[i]+j].SetPosition(k,gPart[noffset[i]+j].GetPosition(k)-potpos[k]);
-                    storeval[i] = gPart[noffset[i]+j].GetID();
-                    gPart[noffset[i]+j].SetID(j);
-                }
-                //sort by radius
-                gsl_heapsort(&gPart[noffset[i]],numingroup[i],sizeof(Particle),RadCompare);
                 //use central regions to define centre of mass velocity
                 //determine how many particles to use
                 npot=max(opt.uinfo.Npotref,Int_t(opt.uinfo.fracpotref*numingroup[i]));
                 npot=min(npot,numingroup[i]);
-                cmvel[i][0]=cmvel[i][1]=cmvel[i][2]=menc=0.;
-                for (auto j=0;j<npot;j++) {
-                    for (auto k=0;k<3;k++) cmvel[i][k]+=gPart[noffset[i]+j].GetVelocity(k)*gPart[noffset[i]+j].GetMass();
-                    menc+=gPart[noffset[i]+j].GetMass();
-                }
-                for (auto j=0;j<3;j++) {cmvel[i][j]/=menc;}
-                gsl_heapsort(&gPart[noffset[i]],numingroup[i],sizeof(Particle),IDCompare);
-                for (auto j=0;j<numingroup[i];j++) {
-                    gPart[noffset[i]+j].SetID(storeval[j]);
-                    for (auto k=0;k<3;k++) gPart[noffset[i]+j].SetPosition(k,gPart[noffset[i]+j].GetPosition(k)+potpos[k]);
-                }
-                delete[] storeval;
+                cmvel[i]=CentralCMVel(numingroup[i], &gPart[noffset[i]], potpos, npot);
             }
 #ifdef USEOPENMP
 }
 #endif
         }
         //if using potential then must identify minimum potential.
-        //Note that  most computations involve sorts, so parallize over groups
         else if (opt.uinfo.cmvelreftype==POTREF) {
 #ifdef USEOPENMP
 #pragma omp parallel default(shared)  \
-private(npot,menc,potmin,ipotmin,potpos,storeval)
+private(npot,potmin,ipotmin,potpos)
 {
 #pragma omp for schedule(dynamic,1) nowait
 #endif
@@ -699,28 +1056,12 @@ private(npot,menc,potmin,ipotmin,potpos,storeval)
                 //determine how many particles to use
                 npot=max(opt.uinfo.Npotref,Int_t(opt.uinfo.fracpotref*numingroup[i]));
                 npot=min(npot,numingroup[i]);
-
-                storeval=new Int_t[numingroup[i]];
-                for (auto j=0;j<numingroup[i];j++) {storeval[j]=gPart[noffset[i]+j].GetID();gPart[noffset[i]+j].SetID(j);}
                 //determine position of minimum potential and by radius around this position
                 potmin=gPart[noffset[i]+0].GetPotential();ipotmin=0;
                 for (auto j=1;j<numingroup[i];j++) if (gPart[noffset[i]+j].GetPotential()<potmin) {potmin=gPart[noffset[i]+j].GetPotential();ipotmin=j;}
                 for (auto k=0;k<3;k++) potpos[k]=gPart[noffset[i]+ipotmin].GetPosition(k);
-
-                for (auto j=0;j<numingroup[i];j++) {
-                    for (auto k=0;k<3;k++) gPart[noffset[i]+j].SetPosition(k,gPart[noffset[i]+j].GetPosition(k)-potpos[k]);
-                }
-                gsl_heapsort(&gPart[noffset[i]],numingroup[i],sizeof(Particle),RadCompare);
                 //now determine kinetic frame
-                cmvel[i][0]=cmvel[i][1]=cmvel[i][2]=menc=0.;
-                for (auto j=0;j<npot;j++) {
-                    for (auto k=0;k<3;k++) cmvel[i][k]+=gPart[noffset[i]+j].GetVelocity(k)*gPart[noffset[i]+j].GetMass();
-                    menc+=gPart[noffset[i]+j].GetMass();
-                }
-                for (auto j=0;j<3;j++) {cmvel[i][j]/=menc;}
-                gsl_heapsort(&gPart[noffset[i]],numingroup[i],sizeof(Particle),IDCompare);
-                for (auto j=0;j<numingroup[i];j++) gPart[noffset[i]+j].SetID(storeval[j]);
-                delete[] storeval;
+                cmvel[i]=CentralCMVel(numingroup[i], &gPart[noffset[i]], potpos, npot);
             }
 #ifdef USEOPENMP
 }
@@ -741,26 +1082,20 @@ private(npot,menc,potmin,ipotmin,potpos,storeval)
     NOTE that for groups where the tree-potential was calculated, at the moment, the subtracted energy corresponds to the PP calculation which can lead to decrepancies. However, unless one is
     worried about the exact details of when an object is self-bound, this is not an issue. \n
 
+    Both the potential calculation and the unbinding of all groups are scheduled together in order of decreasing cost, see \ref GroupTasksByCost. \n
+
+    Groups flagged in inputpotflag already store the potentials read from the input, see \ref GetInputPotentials, which are
+    corrected rather than recalculated. \n
+
     Finally, this routines assumes that the pglist passed to the routine is for a gPart array that was build in id order from pfof and a local particle array.
 */
-int Unbind(Options &opt, Particle **gPart, Int_t &numgroups, Int_t *numingroup, Int_t *pfof, Int_t **pglist, int ireorder)
+int Unbind(Options &opt, Particle **gPart, Int_t &numgroups, Int_t *numingroup, Int_t *pfof, Int_t **pglist, int ireorder, int *inputpotflag)
 {
     //flag which is changed if any groups are altered as groups may need to be reordered.
     int iunbindflag=0;
-    //flag used to determine what style of update to the potential is done for larger groups as
-    //if the amount of particles removed is large enough for large groups, it is more efficient to
-    //recalculate the entire potential using a Tree code than it is removing the contribution of each removed particle from
-    //all other particles
-    int maxnthreads,nthreads=1,l,n;
-    Int_t i,j,k,ng=numgroups, oldnumingroup;
-    int unbindloops;
-    bool sortflag;
-    Double_t maxE,v2,r2,poti,Ti,eps2=opt.uinfo.eps*opt.uinfo.eps,mv2=opt.MassValue*opt.MassValue,Efrac, pot;
-    Int_t nEplus,maxunbindsize, nEfrac, nunbound;
-    Int_t *nEplusid;
-    int *Eplusflag;
-    bool unbindcheck;
-
+    Int_t i,j,ng=numgroups;
+    //number of times each group is altered, accumulated per group as groups are processed concurrently
+    int *groupunbindflag;
     Double_t *gmass;
     Coordinate *cmvel;
 
@@ -778,7 +1113,7 @@ int Unbind(Options &opt, Particle **gPart, Int_t &numgroups, Int_t *numingroup,
         cmvel[i]=Coordinate(0.);
         gmass[i]=0.;
         if (opt.uinfo.icalculatepotential) {
-            for (j=0;j<numingroup[i];j++) gPart[i][j].SetPotential(0);
+            if (inputpotflag==NULL || inputpotflag[i]==0) for (j=0;j<numingroup[i];j++) gPart[i][j].SetPotential(0);
         }
         #ifdef SWIFTINTERFACE
         else {
@@ -788,133 +1123,22 @@ int Unbind(Options &opt, Particle **gPart, Int_t &numgroups, Int_t *numingroup,
     }
 
     //if calculate potential
-    CalculatePotentials(opt, gPart, numgroups, numingroup);
+    CalculatePotentials(opt, gPart, numgroups, numingroup, inputpotflag);
 
     //Now set the kinetic reference frame
     CalculateBindingReferenceFrame(opt, gPart, numgroups, numingroup, gmass, cmvel);
 
-    //now go through groups and begin unbinding by finding least bound particle
-    //again for small groups multithread over groups
-    //larger groups thread over particles in a group
-    //for large groups, paralleize over particle, for small groups parallelize over groups
+    //now go through groups and begin unbinding by finding least bound particle, with all groups scheduled
+    //by cost so that large groups, which are parallelised internally, run alongside the small ones.
     //here energy data is stored in density
-#ifdef USEOPENMP
-#pragma omp parallel default(shared)  \
-private(i,j,k,n,maxE,maxunbindsize,nEplus,nEplusid,Eplusflag,v2,Ti,unbindcheck,Efrac,nEfrac,nunbound,r2,poti,unbindloops,sortflag,oldnumingroup)
-{
-    #pragma omp for schedule(dynamic) nowait reduction(+:iunbindflag)
-#endif
-    for (i=1;i<=numgroups;i++) if (numingroup[i]<ompunbindnum && numingroup[i]>0)
-    {
-        unbindloops=0;
-        oldnumingroup = numingroup[i];
-        GetBoundFractionAndMaxE(opt, numingroup[i], gPart[i], cmvel[i], Efrac, maxE,nunbound);
-        if (nunbound>=opt.uinfo.maxunboundfracforiterativeunbind*numingroup[i]) {
-            for (j=0;j<numingroup[i];j++) pfof[pglist[i][j]]=0;
-            numingroup[i]=0;
-            iunbindflag++;
-        }
-        else {
-            //determine if any particle  number of particle with positive energy upto opt.uinfo.maxunbindfrac*numingroup+1
-            maxunbindsize=(Int_t)(opt.uinfo.maxunbindfrac*nunbound+1);
-            Eplusflag=new int[numingroup[i]];
-            nEplusid=new Int_t[numingroup[i]];
-            unbindcheck = CheckGroupForBoundness(opt,Efrac,maxE,numingroup[i]);
-            FillUnboundArrays(opt, maxunbindsize, numingroup[i], gPart[i], Efrac, nEplusid, Eplusflag, nEplus, unbindcheck);
-            while(unbindcheck)
-            {
-                iunbindflag++;
-                unbindloops++;
-                UpdateCMForUnboundParticles(opt, gmass[i], cmvel[i],
-                    numingroup[i], gPart[i], nEplus, nEplusid, Eplusflag);
-                UpdatePotentialForUnboundParticlesPP(opt, numingroup[i], gPart[i],
-                    nEplus, nEplusid, Eplusflag);
-                //remove particles with positive energy
-                RemoveUnboundParticles(i, pfof, numingroup[i], pglist[i], gPart[i], nEplus, nEplusid, Eplusflag);
-                //if number of particles remove with positive energy is near to the number allowed to be removed
-                //must recalculate kinetic energies and check if maxE>0
-                //otherwise, end unbinding.
-                if (nEplus<opt.uinfo.maxallowedunboundfrac*numingroup[i]) {
-                    unbindcheck=false;
-                }
-                else {
-                    sortflag=false;
-                    if ((oldnumingroup-numingroup[i])>opt.uinfo.maxallowedunboundfrac*oldnumingroup) {
-                        oldnumingroup=numingroup[i];
-                        sortflag=true;
-                    }
-                    //recalculate kinetic energies since cmvel has changed
-                    GetBoundFractionAndMaxE(opt, numingroup[i], gPart[i], cmvel[i], Efrac, maxE,nunbound, sortflag);
-                    maxunbindsize=(Int_t)(opt.uinfo.maxunbindfrac*nunbound+1);
-                    unbindcheck = CheckGroupForBoundness(opt,Efrac,maxE,numingroup[i]);
-                    FillUnboundArrays(opt, maxunbindsize, numingroup[i], gPart[i], Efrac, nEplusid, Eplusflag, nEplus, unbindcheck);
-                }
-            }
-            //if group too small remove entirely
-            AdjustPGListForUnbinding(unbindloops,numingroup[i],pglist[i],gPart[i]);
-            RemoveGroup(opt, numingroup[i], pfof, gPart[i], iunbindflag);
-            delete[] nEplusid;
-            delete[] Eplusflag;
-        }
-    }
-#ifdef USEOPENMP
-}
-#endif
-    for (i=1;i<=numgroups;i++) if (numingroup[i]>=ompunbindnum)
-    {
-        unbindloops=0;
-        oldnumingroup = numingroup[i];
-        GetBoundFractionAndMaxE(opt, numingroup[i], gPart[i], cmvel[i], Efrac, maxE, nunbound);
-        //if amount unbound is very large, just remove group entirely
-        if (nunbound>=opt.uinfo.maxunboundfracforiterativeunbind*numingroup[i]) {
-            for (j=0;j<numingroup[i];j++) pfof[pglist[i][j]]=0;
-            numingroup[i]=0;
-            iunbindflag++;
-        }
-        else {
-            //determine if any particle  number of particle with positive energy upto opt.uinfo.maxunbindfrac*numingroup+1
-            maxunbindsize=(Int_t)(opt.uinfo.maxunbindfrac*nunbound+1);
-            nEplusid=new Int_t[numingroup[i]];
-            Eplusflag=new int[numingroup[i]];
-            //check if bound;
-            unbindcheck = CheckGroupForBoundness(opt,Efrac,maxE,numingroup[i]);
-            FillUnboundArrays(opt, maxunbindsize, numingroup[i], gPart[i], Efrac, nEplusid, Eplusflag, nEplus, unbindcheck);
-            while(unbindcheck)
-            {
-                iunbindflag+=1;
-                unbindloops++;
-                UpdateCMForUnboundParticles(opt, gmass[i], cmvel[i],
-                    numingroup[i], gPart[i], nEplus, nEplusid, Eplusflag);
-                UpdatePotentialForUnboundParticles(opt, numingroup[i], gPart[i],
-                    nEplus, nEplusid, Eplusflag);
-                RemoveUnboundParticles(i, pfof, numingroup[i], pglist[i], gPart[i], nEplus, nEplusid, Eplusflag);
-                //if number of particles remove with positive energy is near to the number allowed to be removed
-                //must recalculate kinetic energies and check if maxE>0
-                //otherwise, end unbinding.
-                if (nEplus<opt.uinfo.maxallowedunboundfrac*numingroup[i]) {
-                    unbindcheck=false;
-                    continue;
-                }
-                else{
-                    sortflag=false;
-                    if ((oldnumingroup-numingroup[i])>opt.uinfo.maxallowedunboundfrac*oldnumingroup) {
-                        oldnumingroup=numingroup[i];
-                        sortflag=true;
-                    }
-                    //recalculate kinetic energies since cmvel has changed
-                    GetBoundFractionAndMaxE(opt, numingroup[i], gPart[i], cmvel[i], Efrac, maxE, nunbound,sortflag);
-                    //determine if any particle  number of particle with positive energy upto opt.uinfo.maxunbindfrac*numingroup+1
-                    maxunbindsize=(Int_t)(opt.uinfo.maxunbindfrac*nunbound+1);
-                    unbindcheck = CheckGroupForBoundness(opt,Efrac,maxE,numingroup[i]);
-                    FillUnboundArrays(opt, maxunbindsize, numingroup[i], gPart[i], Efrac, nEplusid, Eplusflag, nEplus, unbindcheck);
-                }
-            }
-            AdjustPGListForUnbinding(unbindloops,numingroup[i],pglist[i],gPart[i]);
-            RemoveGroup(opt, numingroup[i], pfof, gPart[i], iunbindflag);
-            delete[] nEplusid;
-            delete[] Eplusflag;
-        }
-    }
+    groupunbindflag=new int[numgroups+1];
+    for (i=0;i<=numgroups;i++) groupunbindflag[i]=0;
+    GroupTasksByCost(numgroups, numingroup, ompunbindnum, GroupUnbindCost,
+        [&](Int_t ig) {
+            groupunbindflag[ig]=UnbindGroup(opt, ig, numingroup[ig], gPart[ig], pglist[ig], pfof, gmass[ig], cmvel[ig]);
+        });
+    for (i=1;i<=numgroups;i++) iunbindflag+=groupunbindflag[i];
+    delete[] groupunbindflag;
 
     for (i=1;i<=numgroups;i++) if (numingroup[i]==0) ng--;
     if (ireorder==1 && iunbindflag&&ng>0) ReorderGroupIDs(numgroups,ng,numingroup,pfof,pglist);
@@ -926,8 +1150,9 @@ private(i,j,k,n,maxE,maxunbindsize,nEplus,nEplusid,Eplusflag,v2,Ti,unbindcheck,E
     else return 0;
 }
 
-/// Calculates the gravitational potential using a kd-tree and monopole expansion
-///\todo need ewald correction for periodic systems and also use more than monopole.
+/// Calculates the gravitational potential using a kd-tree and either a monopole expansion, walking the tree for each particle or each leaf,
+/// or a fast multipole method, see \ref POTMETHODTREE
+///\todo need ewald correction for periodic systems.
 void Potential(Options &opt, Int_t nbodies, Particle *Part, Double_t *potV)
 {
     Potential(opt, nbodies, Part);
@@ -936,148 +1161,74 @@ void Potential(Options &opt, Int_t nbodies, Particle *Part, Double_t *potV)
 
 void Potential(Options &opt, Int_t nbodies, Particle *Part)
 {
-    Int_t oldnbodies;
-    KDTree *tree;
+    Int_t oldnbodies, nsub=0;
+    KDTree *tree, *leaftree;
     Particle *part;
+    vector<leaf_node_info> leafnodes;
     bool runomp = false;
     int nsearch;
-    double mr;
-    int bsize = opt.uinfo.BucketSize;
+    double mr, err;
+    int bsize;
 
     ///\todo need to get nomass stuff working
 
-    //if approximate potential calculated, subsample partile distribution
+    //if approximate potential calculated, subsample partile distribution. If the error is controlled, the subsample is
+    //enlarged until the error estimated at probe particles is small enough or the full distribution is used, starting
+    //from the minimum number of particles rather than the fixed fraction
     oldnbodies = nbodies;
-    ParticleSubSample(opt, oldnbodies, Part, nbodies, part, mr);
-    if (part != Part) bsize = ceil(bsize*opt.uinfo.approxpotnumfrac);
-
-    //build tree and calculate a tree based potential
-    tree = new KDTree(part, nbodies, bsize, tree->TPHYS, tree->KEPAN,
-        100, 0, 0, 0, NULL, NULL, runomp);
-    if (part != Part) tree->OverWriteInputOrder();
-    PotentialTree(opt, nbodies, part, tree);
-    //and assign potentials back if running approximate potential calculation
-    //i.e., particle pointer does not point to original particle pointer
-    if (part != Part) {
-        nsearch = min(4,(int)ceil(mr+1));
-        PotentialInterpolate(opt, oldnbodies, Part, part, tree, mr, nsearch);
+    if (opt.uinfo.approxpotrelerr > 0) nsub = opt.uinfo.approxpotminnum;
+    while (true) {
+        ParticleSubSample(opt, oldnbodies, Part, nbodies, part, mr, nsub, &leaftree, &leafnodes);
+        //if subsampled by leaves, the potential of each particle is found from the field of the other leaves at its leaf
+        if (leaftree != NULL) PotentialLeafInterpolate(opt, oldnbodies, Part, nbodies, part, leafnodes);
+        else {
+            bsize = opt.uinfo.BucketSize;
+            if (part != Part) bsize = ceil(bsize/mr);
+            //build tree and calculate a tree based potential
+            tree = new KDTree(part, nbodies, bsize, tree->TPHYS, tree->KEPAN,
+                100, 0, 0, 0, NULL, NULL, runomp);
+            if (part != Part) tree->OverWriteInputOrder();
+            if (opt.uinfo.potmethod == POTMETHODFMM) PotentialFMM(opt, nbodies, part, tree);
+            else PotentialTree(opt, nbodies, part, tree);
+            //and assign potentials back if running approximate potential calculation
+            //i.e., particle pointer does not point to original particle pointer
+            if (part != Part) {
+                nsearch = min(4,(int)ceil(mr+1));
+                PotentialInterpolate(opt, oldnbodies, Part, part, tree, mr, nsearch);
+            }
+            delete tree;
+        }
+        if (part == Part) break;
+
+        err = 0;
+        if (opt.uinfo.approxpotrelerr > 0) err = ApproxPotentialError(opt, oldnbodies, Part, opt.uinfo.approxpotnumprobe);
+        //particles are in leaf order while the leaf tree exists so it is only deleted once potentials have been assigned
+        if (leaftree != NULL) delete leaftree;
+        delete[] part;
+        if (err <= opt.uinfo.approxpotrelerr) break;
+        //the error decreases at most in proportion to the number of leaves, so enlarge the subsample at least as much as the error must drop
+        nsub = nbodies*min(8.0, max(2.0, pow(err/opt.uinfo.approxpotrelerr, 2.0)));
     }
-    delete tree;
-
-    //if iterating then run again but new shuffled indices
-    //to better sample low potential regions
-    // if (opt.uinfo.approxpotiterate > 0 && part != Part && nbodies<0.5*oldnbodies) {
-    //     int numloops = 0;
-    //     vector<indexpot> potindex(oldnbodies);
-    //     double newpotsum, oldpotsum, deltapot, oldminpot, newminpot, deltaminpot;
-    //     double oldsubpotsum, newsubpotsum;
-    //     // double deltapot2;
-    //     oldpotsum = 0;
-    //     oldminpot = newminpot = 0;
-    //     for (auto i=0;i<oldnbodies;i++) {
-    //         potindex[i].potval = Part[i].GetPotential();
-    //         potindex[i].index = i;
-    //         oldpotsum += potindex[i].potval;
-    //         if (potindex[i].potval<oldminpot) oldminpot = potindex[i].potval;
-    //     }
-    //     oldsubpotsum = 0; for (auto i=0;i<nbodies;i++) oldsubpotsum += part[i].GetPotential();
-    //
-    //     cout<<oldnbodies<<" "<<nbodies<<" beginning iteration "<<oldpotsum<<endl;
-    //     do {
-    //         //sort indices by pot value
-    //         sort(potindex.begin(), potindex.end(), [](indexpot &a, indexpot &b){
-    //         return a.potval < b.potval;
-    //         });
-    //         //take random sample of the region around the min potential
-    //         random_shuffle(potindex.begin(), potindex.begin()+oldnbodies/2);
-    //         for (auto i=0;i<nbodies/2;i++) {
-    //             Int_t index = potindex[i].index;
-    //             part[i] = Part[index];
-    //             part[i].SetMass(part[i].GetMass()*mr);
-    //         }
-    //         //and outer region
-    //         random_shuffle(potindex.begin()+oldnbodies/2, potindex.end());
-    //         for (auto i=nbodies/2;i<nbodies;i++) {
-    //             Int_t index = potindex[i+oldnbodies/2].index;
-    //             part[i] = Part[index];
-    //             part[i].SetMass(part[i].GetMass()*mr);
-    //         }
-    //
-    //         //build tree and calculate a tree based potential
-    //         tree = new KDTree(part, nbodies, bsize, tree->TPHYS, tree->KEPAN,
-    //             100, 0, 0, 0, NULL, NULL, runomp);
-    //         tree->OverWriteInputOrder();
-    //         PotentialTree(opt, nbodies, part, tree);
-    //         PotentialInterpolate(opt, oldnbodies, Part, part, tree, mr, nsearch);
-    //         delete tree;
-    //
-    //         // for (auto i=0;i<nbodies/2;i++) {
-    //         //     Int_t index = potindex[i].index;
-    //         //     part[i] = Part[index];
-    //         //     part[i].SetMass(part[i].GetMass());
-    //         // }
-    //         // //and outer region
-    //         // random_shuffle(potindex.begin()+nbodies/2, potindex.end());
-    //         // for (auto i=nbodies/2;i<nbodies;i++) {
-    //         //     Int_t index = potindex[i].index;
-    //         //     part[i] = Part[index];
-    //         //     part[i].SetMass(part[i].GetMass()*mr);
-    //         // }
-    //         //
-    //         // //build tree and calculate a tree based potential
-    //         // tree = new KDTree(part, nbodies, bsize, tree->TPHYS, tree->KEPAN,
-    //         //     100, 0, 0, 0, NULL, NULL, runomp);
-    //         // tree->OverWriteInputOrder();
-    //         // PotentialTree(opt, nbodies, part, tree);
-    //         // Particle *pblah = &Part[nbodies/2];
-    //         // PotentialInterpolate(opt, oldnbodies-nbodies/2, pblah, part, tree, mr, nsearch);
-    //         // pblah = NULL;
-    //         // delete tree;
-    //         // for (auto i=0;i<nbodies/2;i++) {
-    //         //     Int_t index = potindex[i].index;
-    //         //     Part[index].SetPotential(potindex[i].potval);
-    //         // }
-    //         //
-    //         // newsubpotsum = 0; for (auto i=0;i<nbodies;i++) newsubpotsum += part[i].GetPotential();
-    //         // cout<<oldnbodies<<" "<<nbodies<<" sub pot "<<oldsubpotsum<<" "<<newsubpotsum<<endl;
-    //
-    //         newpotsum = 0;
-    //         newminpot = 0;
-    //         for (auto i=0;i<oldnbodies;i++) {
-    //             potindex[i].potval = Part[i].GetPotential();
-    //             potindex[i].index = i;
-    //             newpotsum += potindex[i].potval;
-    //             if (potindex[i].potval<newminpot) newminpot = potindex[i].potval;
-    //         }
-    //         deltapot = (oldpotsum-newpotsum)/newpotsum;
-    //         deltapot = sqrt(deltapot*deltapot);
-    //         deltaminpot = (oldminpot-newminpot)/newminpot;
-    //         deltaminpot = sqrt(deltaminpot*deltaminpot);
-    //         numloops++;
-    //         // deltapot2 = (potfull-newpotsum)/potfull;
-    //         // deltapot2 = sqrt(deltapot2*deltapot2);
-    //         //
-    //         cout<<oldnbodies<<" "<<nbodies<<" Iterating "<<oldpotsum<<" "<<newpotsum<<" "<<deltapot<<" "<<numloops<<" "<<deltaminpot<<endl;
-    //         oldpotsum = newpotsum;
-    //         oldminpot = newminpot;
-    //     } while((deltapot>opt.uinfo.approxpotrelerr || deltaminpot>opt.uinfo.approxpotrelerr) && numloops<opt.uinfo.approxpotiterate);
-    // }
-
-    //free up memory
-    if (part != Part) delete[] part;
-    else part = NULL;
 }
 
+/*!
+    Subsample the particle distribution if calculating an approximate potential, either with the centres of mass of the leaves of a
+    tree (\ref POTAPPROXMETHODTREE) or randomly. The number of particles is set by \ref UnbindInfo.approxpotnumfrac unless nsub>0.
+    If leaftree is passed and leaves are used, the tree is returned rather than deleted, so particles stay in leaf order,
+    along with the leaves in leafnodes. Leaf i is subsampled particle i, which stores i in its PID.
+*/
 void ParticleSubSample(Options &opt, const Int_t nbodies, Particle *&Part,
-    Int_t &newnbodies, Particle *&newpart, double &mr)
+    Int_t &newnbodies, Particle *&newpart, double &mr, Int_t nsub, KDTree **leaftree, vector<leaf_node_info> *leafnodesout)
 {
     //if approximate potential calculated, subsample partile distribution
     newnbodies = nbodies;
     newpart = Part;
     mr = 1.0;
+    if (leaftree != NULL) *leaftree = NULL;
     if (opt.uinfo.iapproxpot) {
         if (newnbodies > opt.uinfo.approxpotminnum) {
-            newnbodies = max((Int_t)(opt.uinfo.approxpotnumfrac*nbodies), (Int_t)opt.uinfo.approxpotminnum);
+            if (nsub <= 0) nsub = opt.uinfo.approxpotnumfrac*nbodies;
+            newnbodies = max(nsub, (Int_t)opt.uinfo.approxpotminnum);
         }
         if (newnbodies < 0.5*nbodies) {
             if (opt.uinfo.approxpotmethod == POTAPPROXMETHODTREE) {
@@ -1117,9 +1268,14 @@ void ParticleSubSample(Options &opt, const Int_t nbodies, Particle *&Part,
                     }
                     for (auto k=0;k<3;k++) newpart[i].SetPosition(k, leafnodes[i].cm[k]/mass);
                     newpart[i].SetMass(mass);
+                    newpart[i].SetPID(i);
+                }
+                if (leaftree != NULL && leafnodesout != NULL) {
+                    *leaftree = tree;
+                    leafnodesout->swap(leafnodes);
                 }
+                else delete tree;
                 leafnodes.clear();
-                delete tree;
             }
             else if (opt.uinfo.approxpotmethod == POTAPPROXMETHODRAND) {
                 //randomly sample particle distribution
@@ -1130,7 +1286,7 @@ void ParticleSubSample(Options &opt, const Int_t nbodies, Particle *&Part,
                 random_shuffle(indices.begin(), indices.end());
                 for (auto i=0;i<newnbodies;i++) {
                     Int_t index = indices[i];
-                    newpart[i] = Part[index];
+                    CopyParticleCoreData(newpart[i], Part[index]);
                     newpart[i].SetMass(newpart[i].GetMass()*mr);
                 }
                 indices.clear();
@@ -1140,12 +1296,13 @@ void ParticleSubSample(Options &opt, const Int_t nbodies, Particle *&Part,
     }
 }
 
-void PotentialTree(Options &opt, Int_t nbodies, Particle *&Part, KDTree* &tree)
+///tree potential in working precision T, see \ref PotentialTree
+template<typename T> void PotentialTreeT(Options &opt, Int_t nbodies, Particle *&Part, KDTree* &tree)
 {
     Int_t ntreecell, nleafcell;
-    Double_t r2, eps2=opt.uinfo.eps*opt.uinfo.eps, mv2=opt.MassValue*opt.MassValue;
+    Double_t eps2=opt.uinfo.eps*opt.uinfo.eps, mv2=opt.MassValue*opt.MassValue;
     int bsize = opt.uinfo.BucketSize;
-    int maxnthreads, nthreads;
+    int maxnthreads,nthreads=1;
     //for tree code potential calculation
     Int_t ncell;
     Int_t *start,*end;
@@ -1156,7 +1313,7 @@ void PotentialTree(Options &opt, Int_t nbodies, Particle *&Part, KDTree* &tree)
     Int_t **marktreecell,**markleafcell;
     bool runomp = false;
 #ifdef USEOPENMP
-    runomp = (nbodies > POTOMPCALCNUM);
+    runomp = (nbodies > potompcalcnum);
     #pragma omp parallel
         {
         if (omp_get_thread_num()==0) maxnthreads=nthreads=omp_get_num_threads();
@@ -1219,49 +1376,121 @@ void PotentialTree(Options &opt, Int_t nbodies, Particle *&Part, KDTree* &tree)
 }
 #endif
 
-    //then for each cell find all other cells that contain Particles within a cells gRmax and mark those
-    //and mark all cells for which one does not have to unfold
-    //for marked cells calculate pp, for every other cell just use the CM of the cell to calculate the potential.
+    //packed particle positions and masses in tree order for the direct sums, positions relative to the centre of the tree
+    Coordinate xref=PotentialReferencePosition(nbodies, Part);
+    vector<T> px(nbodies), py(nbodies), pz(nbodies), pm(nbodies);
+    vector<Int_t> pindex(nbodies);
 #ifdef USEOPENMP
-#pragma omp parallel default(shared)  \
-private(ntreecell,nleafcell,r2) if (runomp)
-{
-    #pragma omp for schedule(static)
+#pragma omp parallel for default(shared) schedule(static) if (runomp)
 #endif
     for (auto j=0;j<nbodies;j++) {
+        px[j]=Part[j].GetPosition(0)-xref[0];py[j]=Part[j].GetPosition(1)-xref[1];pz[j]=Part[j].GetPosition(2)-xref[2];
+        pm[j]=Part[j].GetMass();
+        pindex[j]=j;
+    }
+
+    //walk the tree once per leaf and use the resulting cells for all particles in the leaf
+    if (opt.uinfo.potmethod == POTMETHODTREEGROUP) {
+        vector<Int_t> leaflist;
+        for (auto j=0;j<ncell;j++) if (nodelist[j]->GetCount()<=bsize) leaflist.push_back(j);
+#ifdef USEOPENMP
+#pragma omp parallel default(shared) private(ntreecell,nleafcell) if (runomp)
+{
+#endif
         int tid;
 #ifdef USEOPENMP
         tid=omp_get_thread_num();
 #else
         tid=0;
 #endif
-        npomp[tid]=tree->GetRoot();
-        Part[j].SetPotential(0.);
-        ntreecell=nleafcell=0;
-        Coordinate xpos(Part[j].GetPosition());
-        MarkCell(npomp[tid],marktreecell[tid], markleafcell[tid],ntreecell,nleafcell,r2val[tid],bsize, cR2max, cellcm, cmtot, xpos, eps2);
-        for (auto k=0;k<ntreecell;k++) {
-          Part[j].SetPotential(Part[j].GetPotential()-Part[j].GetMass()*r2val[tid][k]);
-        }
-        for (auto k=0;k<nleafcell;k++) {
-            for (auto l=start[markleafcell[tid][k]];l<end[markleafcell[tid][k]];l++) {
-                if (j!=l) {
-                    r2=0.;
-                    for (auto n=0;n<3;n++) r2+=pow(Part[j].GetPosition(n)-Part[l].GetPosition(n),(Double_t)2.0);
-                    r2+=eps2;
-                    r2=1.0/sqrt(r2);
-                    Part[j].SetPotential(Part[j].GetPotential()-(Part[j].GetMass()*Part[l].GetMass())*r2);
+        //sources packed so the sums vectorize: particles in leaves that are opened in the working precision and
+        //cells treated as point masses in double precision, as their large masses dominate the far field
+        vector<T> sx, sy, sz, sm;
+        vector<Double_t> cx, cy, cz, cm, tx(bsize), ty(bsize), tz(bsize);
+        vector<Double_t> phi(bsize);
+        vector<Int_t> sid, cid;
+#ifdef USEOPENMP
+        #pragma omp for schedule(dynamic)
+#endif
+        for (auto i=0;i<(Int_t)leaflist.size();i++) {
+            Int_t ileaf=leaflist[i], nsource=0;
+            ntreecell=nleafcell=0;
+            MarkCellGroup(tree->GetRoot(),marktreecell[tid],markleafcell[tid],ntreecell,nleafcell,bsize,cR2max,cellcm,cellcm[ileaf],cBmax[ileaf]);
+            cx.resize(ntreecell);cy.resize(ntreecell);cz.resize(ntreecell);cm.resize(ntreecell);cid.assign(ntreecell,-1);
+            for (auto k=0;k<ntreecell;k++) {
+                Int_t icell=marktreecell[tid][k];
+                cx[k]=cellcm[icell][0]-xref[0];cy[k]=cellcm[icell][1]-xref[1];cz[k]=cellcm[icell][2]-xref[2];
+                cm[k]=cmtot[icell];
+            }
+            for (auto k=0;k<nleafcell;k++) nsource+=end[markleafcell[tid][k]]-start[markleafcell[tid][k]];
+            sx.resize(nsource);sy.resize(nsource);sz.resize(nsource);sm.resize(nsource);sid.resize(nsource);
+            nsource=0;
+            for (auto k=0;k<nleafcell;k++) {
+                for (auto l=start[markleafcell[tid][k]];l<end[markleafcell[tid][k]];l++) {
+                    sx[nsource]=px[l];sy[nsource]=py[l];sz[nsource]=pz[l];
+                    sm[nsource]=pm[l];sid[nsource]=l;
+                    nsource++;
                 }
             }
-        }
-        Part[j].SetPotential(Part[j].GetPotential()*opt.G);
+            Int_t nleaf=end[ileaf]-start[ileaf];
+            for (auto j=0;j<nleaf;j++) {
+                phi[j]=0;
+                tx[j]=Part[start[ileaf]+j].GetPosition(0)-xref[0];
+                ty[j]=Part[start[ileaf]+j].GetPosition(1)-xref[1];
+                tz[j]=Part[start[ileaf]+j].GetPosition(2)-xref[2];
+            }
+            PotentialPPSourceKernel(nleaf, tx.data(), ty.data(), tz.data(), start[ileaf],
+                ntreecell, cx.data(), cy.data(), cz.data(), cm.data(), cid.data(), phi.data(), eps2);
+            PotentialPPSourceKernel(nleaf, &px[start[ileaf]], &py[start[ileaf]], &pz[start[ileaf]], start[ileaf],
+                nsource, sx.data(), sy.data(), sz.data(), sm.data(), sid.data(), phi.data(), eps2);
+            for (auto j=start[ileaf];j<end[ileaf];j++) {
+                Part[j].SetPotential(opt.G*Part[j].GetMass()*phi[j-start[ileaf]]);
 #ifdef NOMASS
-        Part[j].SetPotential(Part[j].GetPotential()*mv2);
+                Part[j].SetPotential(Part[j].GetPotential()*mv2);
+#endif
+            }
+        }
+#ifdef USEOPENMP
+}
 #endif
     }
+    else {
+        //then for each cell find all other cells that contain Particles within a cells gRmax and mark those
+        //and mark all cells for which one does not have to unfold
+        //for marked cells calculate pp, for every other cell just use the CM of the cell to calculate the potential.
+#ifdef USEOPENMP
+#pragma omp parallel default(shared)  \
+private(ntreecell,nleafcell) if (runomp)
+{
+        #pragma omp for schedule(static)
+#endif
+        for (auto j=0;j<nbodies;j++) {
+            int tid;
+            Double_t phi=0;
+#ifdef USEOPENMP
+            tid=omp_get_thread_num();
+#else
+            tid=0;
+#endif
+            npomp[tid]=tree->GetRoot();
+            ntreecell=nleafcell=0;
+            Coordinate xpos(Part[j].GetPosition());
+            MarkCell(npomp[tid],marktreecell[tid], markleafcell[tid],ntreecell,nleafcell,r2val[tid],bsize, cR2max, cellcm, cmtot, xpos, eps2);
+            for (auto k=0;k<ntreecell;k++) phi-=r2val[tid][k];
+            for (auto k=0;k<nleafcell;k++) {
+                Int_t l=start[markleafcell[tid][k]];
+                PotentialPPSourceKernel(1, &px[j], &py[j], &pz[j], j,
+                    end[markleafcell[tid][k]]-l, &px[l], &py[l], &pz[l], &pm[l], &pindex[l], &phi, eps2);
+            }
+            Part[j].SetPotential(opt.G*Part[j].GetMass()*phi);
+#ifdef NOMASS
+            Part[j].SetPotential(Part[j].GetPotential()*mv2);
+#endif
+        }
 #ifdef USEOPENMP
 }
 #endif
+    }
 
     delete[] start;
     delete[] end;
@@ -1277,13 +1506,449 @@ private(ntreecell,nleafcell,r2) if (runomp)
     delete[] npomp;
 }
 
+///tree potential using cell monopoles, with the direct sums over particles in the working precision set by \ref UnbindInfo.potprecision
+///and the cell monopole terms always in double precision
+void PotentialTree(Options &opt, Int_t nbodies, Particle *&Part, KDTree* &tree)
+{
+    if (opt.uinfo.potprecision==POTPRECDOUBLE) PotentialTreeT<double>(opt, nbodies, Part, tree);
+    else PotentialTreeT<float>(opt, nbodies, Part, tree);
+}
+
+///\name Fast multipole potential routines
+//@{
+
+///add the local expansion about the centre of mass of cell a due to the multipole expansion of the well separated cell b
+inline void FMMCellCell(FMMCell &a, const FMMCell &b, const Double_t eps2, const int order)
+{
+    Double_t r[3], r2, inv, inv2, inv3, inv5, inv7, qr[3], rqr, trq, g;
+    for (auto k=0;k<3;k++) r[k]=a.cm[k]-b.cm[k];
+    r2=r[0]*r[0]+r[1]*r[1]+r[2]*r[2]+eps2;
+    inv=1.0/sqrt(r2);inv2=inv*inv;inv3=inv*inv2;inv5=inv3*inv2;
+    //monopole
+    a.L0-=b.mass*inv;
+    for (auto k=0;k<3;k++) a.L1[k]+=b.mass*r[k]*inv3;
+    if (order<2) return;
+    a.L2[0]-=b.mass*(3.0*r[0]*r[0]*inv5-inv3);
+    a.L2[1]-=b.mass*3.0*r[0]*r[1]*inv5;
+    a.L2[2]-=b.mass*3.0*r[0]*r[2]*inv5;
+    a.L2[3]-=b.mass*(3.0*r[1]*r[1]*inv5-inv3);
+    a.L2[4]-=b.mass*3.0*r[1]*r[2]*inv5;
+    a.L2[5]-=b.mass*(3.0*r[2]*r[2]*inv5-inv3);
+    //quadrupole contribution to the potential and its gradient, 3/2 rQr/r^5 - 1/2 trQ/r^3
+    qr[0]=b.quad[0]*r[0]+b.quad[1]*r[1]+b.quad[2]*r[2];
+    qr[1]=b.quad[1]*r[0]+b.quad[3]*r[1]+b.quad[4]*r[2];
+    qr[2]=b.quad[2]*r[0]+b.quad[4]*r[1]+b.quad[5]*r[2];
+    rqr=r[0]*qr[0]+r[1]*qr[1]+r[2]*qr[2];
+    trq=b.quad[0]+b.quad[3]+b.quad[5];
+    inv7=inv5*inv2;
+    a.L0-=1.5*rqr*inv5-0.5*trq*inv3;
+    g=-7.5*rqr*inv7+1.5*trq*inv5;
+    for (auto k=0;k<3;k++) a.L1[k]-=3.0*qr[k]*inv5+g*r[k];
+}
+
+///add the direct potential of the particles in cell b to the particles in cell a, excluding self interactions
+inline void FMMParticleParticle(const FMMCell &a, const FMMCell &b,
+    const Double_t *px, const Double_t *py, const Double_t *pz, const Double_t *pm, Double_t *pot, const Double_t eps2)
+{
+    for (Int_t i=a.start;i<a.end;i++) {
+        Double_t sum=0, xi=px[i], yi=py[i], zi=pz[i];
+#ifdef USEOPENMP
+#pragma omp simd reduction(+:sum)
+#endif
+        for (Int_t l=b.start;l<b.end;l++) {
+            Double_t dx=px[l]-xi, dy=py[l]-yi, dz=pz[l]-zi;
+            Double_t r2=dx*dx+dy*dy+dz*dz+eps2;
+            sum+=(l!=i)?pm[l]/sqrt(r2):0;
+        }
+        pot[i]-=sum;
+    }
+}
+
+/*!
+    Dual tree walk accumulating the potential in sink cell a due to source cell b. Well separated pairs, (rmax_a+rmax_b) < theta r,
+    interact through the multipole expansion of b, pairs of leaves directly and otherwise the larger cell is opened.
+    Only the local expansions of a and its descendants and the potentials of particles in a are updated, so walks with
+    disjoint sink cells can run concurrently.
+*/
+void FMMInteract(FMMCell *cells, const Int_t a, const Int_t b,
+    const Double_t *px, const Double_t *py, const Double_t *pz, const Double_t *pm, Double_t *pot,
+    const Double_t theta2, const Double_t eps2, const int order)
+{
+    FMMCell &ca=cells[a];
+    const FMMCell &cb=cells[b];
+    if (a==b) {
+        if (ca.left==-1) {FMMParticleParticle(ca,ca,px,py,pz,pm,pot,eps2);return;}
+        FMMInteract(cells,ca.left,ca.left,px,py,pz,pm,pot,theta2,eps2,order);
+        FMMInteract(cells,ca.left,ca.right,px,py,pz,pm,pot,theta2,eps2,order);
+        FMMInteract(cells,ca.right,ca.left,px,py,pz,pm,pot,theta2,eps2,order);
+        FMMInteract(cells,ca.right,ca.right,px,py,pz,pm,pot,theta2,eps2,order);
+        return;
+    }
+    Double_t r2=0, rsum=ca.rmax+cb.rmax;
+    for (auto k=0;k<3;k++) r2+=(ca.cm[k]-cb.cm[k])*(ca.cm[k]-cb.cm[k]);
+    if (rsum*rsum<theta2*r2) FMMCellCell(ca,cb,eps2,order);
+    else if (ca.left==-1 && cb.left==-1) FMMParticleParticle(ca,cb,px,py,pz,pm,pot,eps2);
+    else if (cb.left==-1 || (ca.left!=-1 && ca.rmax>=cb.rmax)) {
+        FMMInteract(cells,ca.left,b,px,py,pz,pm,pot,theta2,eps2,order);
+        FMMInteract(cells,ca.right,b,px,py,pz,pm,pot,theta2,eps2,order);
+    }
+    else {
+        FMMInteract(cells,a,cb.left,px,py,pz,pm,pot,theta2,eps2,order);
+        FMMInteract(cells,a,cb.right,px,py,pz,pm,pot,theta2,eps2,order);
+    }
+}
+
+///shift the local expansion of cell a to its descendants and evaluate it at the particles of leaf cells
+void FMMEvaluateLocal(FMMCell *cells, const Int_t a,
+    const Double_t *px, const Double_t *py, const Double_t *pz, Double_t *pot)
+{
+    FMMCell &ca=cells[a];
+    Double_t d[3], l2d[3];
+    if (ca.left==-1) {
+        for (Int_t i=ca.start;i<ca.end;i++) {
+            d[0]=px[i]-ca.cm[0];d[1]=py[i]-ca.cm[1];d[2]=pz[i]-ca.cm[2];
+            l2d[0]=ca.L2[0]*d[0]+ca.L2[1]*d[1]+ca.L2[2]*d[2];
+            l2d[1]=ca.L2[1]*d[0]+ca.L2[3]*d[1]+ca.L2[4]*d[2];
+            l2d[2]=ca.L2[2]*d[0]+ca.L2[4]*d[1]+ca.L2[5]*d[2];
+            pot[i]+=ca.L0;
+            for (auto k=0;k<3;k++) pot[i]+=(ca.L1[k]+0.5*l2d[k])*d[k];
+        }
+        return;
+    }
+    for (auto c : {ca.left, ca.right}) {
+        FMMCell &cc=cells[c];
+        for (auto k=0;k<3;k++) d[k]=cc.cm[k]-ca.cm[k];
+        l2d[0]=ca.L2[0]*d[0]+ca.L2[1]*d[1]+ca.L2[2]*d[2];
+        l2d[1]=ca.L2[1]*d[0]+ca.L2[3]*d[1]+ca.L2[4]*d[2];
+        l2d[2]=ca.L2[2]*d[0]+ca.L2[4]*d[1]+ca.L2[5]*d[2];
+        cc.L0+=ca.L0;
+        for (auto k=0;k<3;k++) {
+            cc.L0+=(ca.L1[k]+0.5*l2d[k])*d[k];
+            cc.L1[k]+=ca.L1[k]+l2d[k];
+        }
+        for (auto k=0;k<6;k++) cc.L2[k]+=ca.L2[k];
+        FMMEvaluateLocal(cells,c,px,py,pz,pot);
+    }
+}
+
+///collect the largest cells containing at most nmax particles, which are processed independently
+void FMMSinkCells(FMMCell *cells, const Int_t a, const Int_t nmax, vector<Int_t> &sinks)
+{
+    if (cells[a].left==-1 || cells[a].end-cells[a].start<=nmax) {sinks.push_back(a);return;}
+    FMMSinkCells(cells,cells[a].left,nmax,sinks);
+    FMMSinkCells(cells,cells[a].right,nmax,sinks);
+}
+
+/*!
+    Build the cells of a tree, with the particle data in tree order packed in px,py,pz,pm, and calculate their multipole moments.
+    Returns an array of ncell cells in depth first order, so cell 0 is the root.
+*/
+FMMCell *FMMBuildCells(KDTree *tree, const int bsize, const Double_t *px, const Double_t *py, const Double_t *pz, const Double_t *pm,
+    Int_t &ncell, bool runomp)
+{
+    Node **nodelist;
+    FMMCell *cells;
+    ncell=tree->GetNumNodes();
+    nodelist=new Node*[ncell];
+    ncell=0;
+    GetNodeList(tree->GetRoot(),ncell,nodelist,bsize);
+    ncell++;
+    cells=new FMMCell[ncell];
+
+    //leaf moments from particles, the node list is in depth first order so children always follow their parent
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (runomp)
+#endif
+    for (Int_t j=0;j<ncell;j++) {
+        FMMCell &c=cells[j];
+        c.start=nodelist[j]->GetStart();
+        c.end=nodelist[j]->GetEnd();
+        c.L0=0;
+        for (auto k=0;k<3;k++) c.L1[k]=0;
+        for (auto k=0;k<6;k++) c.L2[k]=c.quad[k]=0;
+        if (nodelist[j]->GetCount()>bsize) {
+            c.left=((SplitNode*)nodelist[j])->GetLeft()->GetID();
+            c.right=((SplitNode*)nodelist[j])->GetRight()->GetID();
+            continue;
+        }
+        c.left=c.right=-1;
+        Double_t d[3], r2max=0;
+        c.mass=c.cm[0]=c.cm[1]=c.cm[2]=0;
+        for (Int_t i=c.start;i<c.end;i++) {
+            c.mass+=pm[i];
+            c.cm[0]+=pm[i]*px[i];c.cm[1]+=pm[i]*py[i];c.cm[2]+=pm[i]*pz[i];
+        }
+        for (auto k=0;k<3;k++) c.cm[k]/=c.mass;
+        for (Int_t i=c.start;i<c.end;i++) {
+            d[0]=px[i]-c.cm[0];d[1]=py[i]-c.cm[1];d[2]=pz[i]-c.cm[2];
+            r2max=max(r2max,d[0]*d[0]+d[1]*d[1]+d[2]*d[2]);
+            c.quad[0]+=pm[i]*d[0]*d[0];c.quad[1]+=pm[i]*d[0]*d[1];c.quad[2]+=pm[i]*d[0]*d[2];
+            c.quad[3]+=pm[i]*d[1]*d[1];c.quad[4]+=pm[i]*d[1]*d[2];c.quad[5]+=pm[i]*d[2]*d[2];
+        }
+        c.rmax=sqrt(r2max);
+    }
+    delete[] nodelist;
+    //moments of parents from their children
+    for (Int_t j=ncell-1;j>=0;j--) {
+        FMMCell &c=cells[j];
+        if (c.left==-1) continue;
+        const FMMCell &cl=cells[c.left], &cr=cells[c.right];
+        Double_t dl[3], dr[3];
+        c.mass=cl.mass+cr.mass;
+        for (auto k=0;k<3;k++) c.cm[k]=(cl.mass*cl.cm[k]+cr.mass*cr.cm[k])/c.mass;
+        for (auto k=0;k<3;k++) {dl[k]=cl.cm[k]-c.cm[k];dr[k]=cr.cm[k]-c.cm[k];}
+        c.rmax=max(sqrt(dl[0]*dl[0]+dl[1]*dl[1]+dl[2]*dl[2])+cl.rmax,sqrt(dr[0]*dr[0]+dr[1]*dr[1]+dr[2]*dr[2])+cr.rmax);
+        for (auto k=0,n=0;k<3;k++) for (auto l=k;l<3;l++,n++)
+            c.quad[n]=cl.quad[n]+cr.quad[n]+cl.mass*dl[k]*dl[l]+cr.mass*dr[k]*dr[l];
+    }
+    return cells;
+}
+
+///potential at x due to the source cells below cell a, using the multipole expansion of cells with rmax^2 < theta2*r^2 and direct sums
+///over the sources (packed in tree order) of other leaves, skipping sources with sindex equal to index
+Double_t FMMPotentialAt(const FMMCell *cells, const Int_t a, const Double_t *x, const Int_t index,
+    const Double_t *sx, const Double_t *sy, const Double_t *sz, const Double_t *sm, const Int_t *sindex,
+    const Double_t theta2, const Double_t eps2, const int order)
+{
+    Double_t phi=0, r[3], r2, inv, inv2, inv3, qr[3];
+    //each level of the binary tree adds at most one cell to the stack, cells beyond its size go to spill, which only
+    //allocates memory for very deep (unbalanced) trees
+    Int_t stack[FMMWALKSTACKSIZE], nstack=1, icell;
+    vector<Int_t> spill;
+    stack[0]=a;
+    while (nstack>0 || spill.size()>0) {
+        if (spill.size()>0) {icell=spill.back(); spill.pop_back();}
+        else icell=stack[--nstack];
+        const FMMCell &c=cells[icell];
+        for (auto k=0;k<3;k++) r[k]=x[k]-c.cm[k];
+        r2=r[0]*r[0]+r[1]*r[1]+r[2]*r[2];
+        if (c.rmax*c.rmax<theta2*r2) {
+            r2+=eps2;
+            inv=1.0/sqrt(r2);
+            phi-=c.mass*inv;
+            if (order<2) continue;
+            inv2=inv*inv;inv3=inv*inv2;
+            qr[0]=c.quad[0]*r[0]+c.quad[1]*r[1]+c.quad[2]*r[2];
+            qr[1]=c.quad[1]*r[0]+c.quad[3]*r[1]+c.quad[4]*r[2];
+            qr[2]=c.quad[2]*r[0]+c.quad[4]*r[1]+c.quad[5]*r[2];
+            phi-=1.5*(r[0]*qr[0]+r[1]*qr[1]+r[2]*qr[2])*inv3*inv2-0.5*(c.quad[0]+c.quad[3]+c.quad[5])*inv3;
+        }
+        else if (c.left==-1) {
+            PotentialPPSourceKernel(1, &x[0], &x[1], &x[2], index,
+                c.end-c.start, &sx[c.start], &sy[c.start], &sz[c.start], &sm[c.start], &sindex[c.start], &phi, eps2);
+        }
+        else {
+            if (nstack+2<=FMMWALKSTACKSIZE) {stack[nstack++]=c.left; stack[nstack++]=c.right;}
+            else {spill.push_back(c.left); spill.push_back(c.right);}
+        }
+    }
+    return phi;
+}
+
+///potential and its gradient at x as in \ref FMMPotentialAt, with the gradient of cells that are not opened taken from their monopole
+Double_t FMMPotentialGradAt(const FMMCell *cells, const Int_t a, const Double_t *x, const Int_t index,
+    const Double_t *sx, const Double_t *sy, const Double_t *sz, const Double_t *sm, const Int_t *sindex,
+    const Double_t theta2, const Double_t eps2, Double_t *grad)
+{
+    Double_t phi=0, r[3], r2, inv, inv2, inv3, qr[3];
+    Int_t stack[FMMWALKSTACKSIZE], nstack=1, icell;
+    vector<Int_t> spill;
+    grad[0]=grad[1]=grad[2]=0;
+    stack[0]=a;
+    while (nstack>0 || spill.size()>0) {
+        if (spill.size()>0) {icell=spill.back(); spill.pop_back();}
+        else icell=stack[--nstack];
+        const FMMCell &c=cells[icell];
+        for (auto k=0;k<3;k++) r[k]=x[k]-c.cm[k];
+        r2=r[0]*r[0]+r[1]*r[1]+r[2]*r[2];
+        if (c.rmax*c.rmax<theta2*r2) {
+            r2+=eps2;
+            inv=1.0/sqrt(r2);
+            inv2=inv*inv;inv3=inv*inv2;
+            phi-=c.mass*inv;
+            for (auto k=0;k<3;k++) grad[k]+=c.mass*r[k]*inv3;
+            qr[0]=c.quad[0]*r[0]+c.quad[1]*r[1]+c.quad[2]*r[2];
+            qr[1]=c.quad[1]*r[0]+c.quad[3]*r[1]+c.quad[4]*r[2];
+            qr[2]=c.quad[2]*r[0]+c.quad[4]*r[1]+c.quad[5]*r[2];
+            phi-=1.5*(r[0]*qr[0]+r[1]*qr[1]+r[2]*qr[2])*inv3*inv2-0.5*(c.quad[0]+c.quad[3]+c.quad[5])*inv3;
+        }
+        else if (c.left==-1) {
+            for (Int_t l=c.start;l<c.end;l++) {
+                if (sindex[l]==index) continue;
+                r[0]=x[0]-sx[l];r[1]=x[1]-sy[l];r[2]=x[2]-sz[l];
+                inv=1.0/sqrt(r[0]*r[0]+r[1]*r[1]+r[2]*r[2]+eps2);
+                inv3=inv*inv*inv;
+                phi-=sm[l]*inv;
+                for (auto k=0;k<3;k++) grad[k]+=sm[l]*r[k]*inv3;
+            }
+        }
+        else {
+            if (nstack+2<=FMMWALKSTACKSIZE) {stack[nstack++]=c.left; stack[nstack++]=c.right;}
+            else {spill.push_back(c.left); spill.push_back(c.right);}
+        }
+    }
+    return phi;
+}
+
+/*!
+    Calculates the potential using a dual tree walk fast multipole method (see Dehnen 2002, J. Comp. Phys., 179, 27).
+    Cells store multipole moments up to quadrupole order (or just the monopole if opt.uinfo.fmmorder==1) and well separated
+    cell pairs interact once through a local Taylor expansion of the potential about the sink cell's centre of mass, which is
+    then shifted down the tree to the particles. Pairs of leaf cells that are not well separated interact directly.
+    The tree is split into sink cells that are walked independently, so threads never update the same cell or particle.
+*/
+void PotentialFMM(Options &opt, Int_t nbodies, Particle *&Part, KDTree* &tree)
+{
+    Double_t eps2=opt.uinfo.eps*opt.uinfo.eps, mv2=opt.MassValue*opt.MassValue;
+    Double_t theta2=opt.uinfo.FMMThetaOpen*opt.uinfo.FMMThetaOpen;
+    int bsize = opt.uinfo.BucketSize, order = opt.uinfo.fmmorder;
+    int nthreads = 1;
+    Int_t ncell;
+    FMMCell *cells;
+    vector<Int_t> sinks;
+    bool runomp = false;
+#ifdef USEOPENMP
+    runomp = (nbodies > potompcalcnum);
+    if (runomp) nthreads = omp_get_max_threads();
+#endif
+
+    //particle data in tree order, stored as separate arrays so that direct sums vectorize
+    vector<Double_t> px(nbodies), py(nbodies), pz(nbodies), pm(nbodies), pot(nbodies,0.);
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (runomp)
+#endif
+    for (Int_t i=0;i<nbodies;i++) {
+        px[i]=Part[i].GetPosition(0);py[i]=Part[i].GetPosition(1);pz[i]=Part[i].GetPosition(2);
+        pm[i]=Part[i].GetMass();
+    }
+
+    cells=FMMBuildCells(tree,bsize,px.data(),py.data(),pz.data(),pm.data(),ncell,runomp);
+
+    //walk independent sink cells, several per thread to balance the load
+    FMMSinkCells(cells,0,max((Int_t)bsize,nbodies/(8*nthreads)),sinks);
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(dynamic) if (runomp)
+#endif
+    for (Int_t j=0;j<(Int_t)sinks.size();j++) {
+        FMMInteract(cells,sinks[j],0,px.data(),py.data(),pz.data(),pm.data(),pot.data(),theta2,eps2,order);
+        FMMEvaluateLocal(cells,sinks[j],px.data(),py.data(),pz.data(),pot.data());
+    }
+    delete[] cells;
+
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (runomp)
+#endif
+    for (Int_t i=0;i<nbodies;i++) {
+        Part[i].SetPotential(opt.G*pm[i]*pot[i]);
+#ifdef NOMASS
+        Part[i].SetPotential(Part[i].GetPotential()*mv2);
+#endif
+    }
+}
+//@}
+
+/*!
+    Assign potentials to particles subsampled by leaf (see \ref ParticleSubSample). The potential and its gradient due to the other
+    leaves, treated as particles at their centres of mass leafpart, are calculated at the centre of mass of each leaf with a tree walk
+    and expanded to first order about it, to which the potential of the other particles of the leaf is added by direct summation.
+    Particles must be in the leaf order of the tree used to subsample them.
+*/
+void PotentialLeafInterpolate(Options &opt, const Int_t nbodies, Particle *Part, const Int_t nleaf, Particle *leafpart,
+    vector<leaf_node_info> &leafnodes)
+{
+    Double_t eps2=opt.uinfo.eps*opt.uinfo.eps, mv2=opt.MassValue*opt.MassValue;
+    Double_t theta2=opt.uinfo.TreeThetaOpen*opt.uinfo.TreeThetaOpen;
+    bool runomp = (nbodies > potompcalcnum);
+    //leaf centres of mass packed in tree order, with their leaf in sindex
+    vector<Double_t> sx(nleaf), sy(nleaf), sz(nleaf), sm(nleaf);
+    vector<Int_t> sindex(nleaf);
+    FMMCell *cells;
+    Int_t ncell;
+    KDTree *tree = new KDTree(leafpart, nleaf, opt.uinfo.BucketSize, tree->TPHYS, tree->KEPAN, 100, 0, 0, 0, NULL, NULL, runomp);
+    for (Int_t k=0;k<nleaf;k++) {
+        sx[k]=leafpart[k].GetPosition(0);sy[k]=leafpart[k].GetPosition(1);sz[k]=leafpart[k].GetPosition(2);
+        sm[k]=leafpart[k].GetMass();sindex[k]=leafpart[k].GetPID();
+    }
+    cells=FMMBuildCells(tree, opt.uinfo.BucketSize, sx.data(), sy.data(), sz.data(), sm.data(), ncell, runomp);
+    delete tree;
+#ifdef USEOPENMP
+#pragma omp parallel default(shared) if (runomp)
+{
+#endif
+    vector<Double_t> packed, phi;
+#ifdef USEOPENMP
+#pragma omp for schedule(dynamic)
+#endif
+    for (Int_t k=0;k<nleaf;k++)
+    {
+        Int_t ileaf=sindex[k], istart=leafnodes[ileaf].istart, n=leafnodes[ileaf].iend-leafnodes[ileaf].istart;
+        Double_t cm[3]={sx[k],sy[k],sz[k]}, grad[3], phicm;
+        phicm=FMMPotentialGradAt(cells, 0, cm, ileaf, sx.data(), sy.data(), sz.data(), sm.data(), sindex.data(), theta2, eps2, grad);
+        packed.resize(4*n);
+        phi.assign(n,0.);
+        Double_t *x=packed.data(), *y=x+n, *z=y+n, *m=z+n;
+        for (Int_t j=0;j<n;j++) {
+            x[j]=Part[istart+j].GetPosition(0);y[j]=Part[istart+j].GetPosition(1);z[j]=Part[istart+j].GetPosition(2);
+            m[j]=Part[istart+j].GetMass();
+        }
+        PotentialPPKernel(n, x, y, z, m, phi.data(), eps2);
+        for (Int_t j=0;j<n;j++) {
+            phi[j]+=phicm+grad[0]*(x[j]-cm[0])+grad[1]*(y[j]-cm[1])+grad[2]*(z[j]-cm[2]);
+            Part[istart+j].SetPotential(opt.G*m[j]*phi[j]);
+#ifdef NOMASS
+            Part[istart+j].SetPotential(Part[istart+j].GetPotential()*mv2);
+#endif
+        }
+    }
+#ifdef USEOPENMP
+}
+#endif
+    delete[] cells;
+}
+
+/*!
+    Estimate the error of an approximate potential from the rms relative difference between the potential of nprobe particles,
+    spread evenly through the particle array, and their exact potential by direct summation.
+*/
+Double_t ApproxPotentialError(Options &opt, const Int_t nbodies, Particle *Part, Int_t nprobe)
+{
+    Double_t eps2=opt.uinfo.eps*opt.uinfo.eps, mv2=opt.MassValue*opt.MassValue, err2=0;
+    Coordinate xref=PotentialReferencePosition(nbodies, Part);
+    vector<Double_t> packed(4*nbodies);
+    vector<Int_t> index(nbodies);
+    Double_t *x=packed.data(), *y=x+nbodies, *z=y+nbodies, *m=z+nbodies;
+    bool runomp = (nbodies > potompcalcnum);
+    for (Int_t j=0;j<nbodies;j++) {
+        x[j]=Part[j].GetPosition(0)-xref[0];y[j]=Part[j].GetPosition(1)-xref[1];z[j]=Part[j].GetPosition(2)-xref[2];
+        m[j]=Part[j].GetMass();
+        index[j]=j;
+    }
+    nprobe=min(nprobe,nbodies);
+    if (nprobe<=0) return 0;
+    Int_t stride=nbodies/nprobe;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) reduction(+:err2) if (runomp)
+#endif
+    for (Int_t l=0;l<nprobe;l++) {
+        Int_t i=l*stride;
+        Double_t phi=0, potexact;
+        PotentialPPSourceKernel(1, &x[i], &y[i], &z[i], i, nbodies, x, y, z, m, index.data(), &phi, eps2);
+        potexact=opt.G*m[i]*phi;
+#ifdef NOMASS
+        potexact*=mv2;
+#endif
+        if (potexact!=0) err2+=pow(Part[i].GetPotential()/potexact-1.0,2.0);
+    }
+    return sqrt(err2/(Double_t)nprobe);
+}
+
 void PotentialInterpolate(Options &opt, const Int_t nbodies, Particle *&Part, Particle *&interpolatepart, KDTree *&tree, double massratio, int nsearch)
 {
     bool runomp = false;
     vector<Int_t> nn;
     vector<Double_t> dist2;
     Double_t pot, wsum, w;
-    runomp = (nbodies > POTOMPCALCNUM);
+    runomp = (nbodies > potompcalcnum);
 #ifdef USEOPENMP
 #pragma omp parallel default(shared) private(nn, dist2, wsum, pot) \
 if (runomp)
@@ -1320,21 +1985,29 @@ if (runomp)
 }
 
 
-void PotentialPP(Options &opt, Int_t nbodies, Particle *Part)
+///direct summation potential in working precision T, see \ref PotentialPP
+template<typename T> void PotentialPPT(Options &opt, Int_t nbodies, Particle *Part)
 {
-    Double_t r2, pot, poti, eps2=opt.uinfo.eps*opt.uinfo.eps, mv2=opt.MassValue*opt.MassValue;
-    for (auto j=0;j<nbodies;j++) Part[j].SetPotential(0.);
+    Double_t eps2=opt.uinfo.eps*opt.uinfo.eps, mv2=opt.MassValue*opt.MassValue;
+    Coordinate xref=PotentialReferencePosition(nbodies, Part);
+    //packed positions and masses, potentials
+    vector<T> packed(4*nbodies);
+    vector<Double_t> phi(nbodies,0.);
+    T *x=packed.data(), *y=x+nbodies, *z=y+nbodies, *m=z+nbodies;
     for (auto j=0;j<nbodies;j++) {
-        for (auto k=j+1;k<nbodies;k++) {
-            r2=0.;for (auto n=0;n<3;n++) r2+=pow(Part[j].GetPosition(n)-Part[k].GetPosition(n),2.0);
-            r2+=eps2;
-            r2=1.0/sqrt(r2);
-            pot=-opt.G*(Part[j].GetMass()*Part[k].GetMass())*r2;
-            poti=Part[j].GetPotential()+pot;Part[j].SetPotential(poti);
-            poti=Part[k].GetPotential()+pot;Part[k].SetPotential(poti);
-        }
+        x[j]=Part[j].GetPosition(0)-xref[0];y[j]=Part[j].GetPosition(1)-xref[1];z[j]=Part[j].GetPosition(2)-xref[2];
+        m[j]=Part[j].GetMass();
     }
+    PotentialPPKernel(nbodies, x, y, z, m, phi.data(), eps2);
+    for (auto j=0;j<nbodies;j++) Part[j].SetPotential(opt.G*Part[j].GetMass()*phi[j]);
     #ifdef NOMASS
     for (auto j=0;j<nbodies;j++) Part[j].SetPotential(Part[j].GetPotential()*mv2);
     #endif
 }
+
+///direct summation potential, in the working precision set by \ref UnbindInfo.potprecision
+void PotentialPP(Options &opt, Int_t nbodies, Particle *Part)
+{
+    if (opt.uinfo.potprecision==POTPRECDOUBLE) PotentialPPT<double>(opt, nbodies, Part);
+    else PotentialPPT<float>(opt, nbodies, Part);
+}
@@ -93,9 +93,18 @@ void GetMemUsage(Options &opt, string funcname, bool printreport){
         float bytestoGB;
         bytestoGB = 1.0/(1024.0*1024.*1024.);
         // bytestoGB = 1.0;
+        //usage can be sampled from concurrent substructure search tasks, so update the running statistics one at a time
+#ifdef USEOPENMP
+        #pragma omp critical (memusage)
+#endif
+        {
         if (opt.memuse_peak < peak) opt.memuse_peak = peak;
         opt.memuse_nsamples++;
         opt.memuse_ave += size;
+        memuse["Peak"] = opt.memuse_peak*bytestoGB;
+        memuse["Average"] = opt.memuse_ave/(float)opt.memuse_nsamples*bytestoGB;
+        if (opt.memuse_arenapeak > 0) memuse["Arena_peak"] = opt.memuse_arenapeak*bytestoGB;
+        }
         memuse["Size"] = size*bytestoGB;
         memuse["Resident"] = resident*bytestoGB;
         memuse["Shared"] = shared*bytestoGB;
@@ -103,8 +112,6 @@ void GetMemUsage(Options &opt, string funcname, bool printreport){
         memuse["Library"] = library*bytestoGB;
         memuse["Data"] = data*bytestoGB;
         memuse["Dirty"] = dirty*bytestoGB;
-        memuse["Peak"] = opt.memuse_peak*bytestoGB;
-        memuse["Average"] = opt.memuse_ave/(float)opt.memuse_nsamples*bytestoGB;
 
         for (map<string,float>::iterator it=memuse.begin(); it!=memuse.end(); ++it) {
             memreport += it->first + string(" = ") + to_string(it->second) + string(" GB, ");
@@ -113,10 +120,18 @@ void GetMemUsage(Options &opt, string funcname, bool printreport){
     else{
         memreport+= string(" unable to open or scane system file storing memory use");
     }
-    // sprintf(buffer,"%s.memlog.%d",opt.outname,ThisTask);
-    // Fmem.open(buffer,ios::app);
-    // Fmem<<memreport<<endl;
-    // Fmem.close();
+    if (opt.memuse_log) {
+        sprintf(buffer,"%s.memlog.%d",opt.outname,ThisTask);
+        //one append at a time so that reports from concurrent tasks do not interleave
+#ifdef USEOPENMP
+        #pragma omp critical (memusage)
+#endif
+        {
+        Fmem.open(buffer,ios::app);
+        Fmem<<memreport<<endl;
+        Fmem.close();
+        }
+    }
     if (printreport) cout<<memreport<<endl;
 }
 
@@ -219,6 +234,92 @@ double MyGetTime(){
 #endif
 }
 
+/*!
+    Copy the phase-space and core information of a particle without cloning its hydro, star, black hole and extra dark matter
+    properties, which are not used by the searches. The particle is byte copied and the copied pointers to the properties are
+    released, as is done for particles received through MPI. The destination must not own any properties.
+*/
+void CopyParticleCoreData(Particle &dst, Particle &src)
+{
+    memcpy((void*)&dst, (void*)&src, sizeof(Particle));
+#ifdef GASON
+    dst.NullHydroProperties();
+#endif
+#ifdef STARON
+    dst.NullStarProperties();
+#endif
+#ifdef BHON
+    dst.NullBHProperties();
+#endif
+#ifdef EXTRADMON
+    dst.NullExtraDMProperties();
+#endif
+}
+
+///gather particles src[index[i]] into dst using \ref CopyParticleCoreData
+void GatherParticlesCoreData(const Int_t n, Particle *dst, Particle *src, const Int_t *index)
+{
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (n > omppropnum)
+#endif
+    for (Int_t i=0;i<n;i++) CopyParticleCoreData(dst[i], src[index[i]]);
+}
+
+/*!
+    Fill keys with the squared distance of particles from centre and their index. Selections and sorts of particles by radius
+    then act on this compact array rather than on the particles, which can be large when they carry hydro or star properties.
+*/
+void ParticleRadialKeys(const Int_t n, Particle *P, const Coordinate &centre, vector<particle_key_index> &keys)
+{
+    Double_t dx;
+    keys.resize(n);
+    for (Int_t i=0;i<n;i++) {
+        keys[i].key=0;
+        for (auto k=0;k<3;k++) {dx=P[i].GetPosition(k)-centre[k];keys[i].key+=dx*dx;}
+        keys[i].index=i;
+    }
+}
+
+///partially order keys so that the first nsel have the smallest keys, in no particular order
+void SelectSmallestKeys(vector<particle_key_index> &keys, Int_t nsel)
+{
+    if (nsel<=0 || nsel>=(Int_t)keys.size()) return;
+    nth_element(keys.begin(), keys.begin()+nsel, keys.end(),
+        [](const particle_key_index &a, const particle_key_index &b){return a.key<b.key;});
+}
+
+/*!
+    Sort keys and move the particles into the same order. The permutation is applied by following its cycles, so each
+    particle is moved once. As in gsl_heapsort, particles are moved as bytes so any properties they own move with them.
+*/
+void SortParticlesByKeys(const Int_t n, Particle *P, vector<particle_key_index> &keys)
+{
+    unsigned char ptemp[sizeof(Particle)];
+    Int_t j, k;
+    sort(keys.begin(), keys.end(), [](const particle_key_index &a, const particle_key_index &b){return a.key<b.key;});
+    //index of keys is set to -1 once particle has been placed
+    for (Int_t i=0;i<n;i++) {
+        if (keys[i].index<0 || keys[i].index==i) continue;
+        memcpy((void*)ptemp, (void*)&P[i], sizeof(Particle));
+        j=i;
+        while (true) {
+            k=keys[j].index;
+            keys[j].index=-1;
+            if (k==i) {memcpy((void*)&P[j], (void*)ptemp, sizeof(Particle)); break;}
+            memcpy((void*)&P[j], (void*)&P[k], sizeof(Particle));
+            j=k;
+        }
+    }
+}
+
+///sort particles by their distance from the origin, equivalent to sorting with RadCompare
+void SortParticlesByRadius(const Int_t n, Particle *P)
+{
+    vector<particle_key_index> keys;
+    ParticleRadialKeys(n, P, Coordinate(0.), keys);
+    SortParticlesByKeys(n, P, keys);
+}
+
 #ifdef NOMASS
 void VR_NOMASS(){};
 #endif